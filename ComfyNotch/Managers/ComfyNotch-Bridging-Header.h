@@ -5,4 +5,13 @@
 #include "BrightnessManager.h"
 #include "MessageMeta.h"
 #include "MessageHashMap.h"
+#include "MessagesContext.h"
+#include "MessagesMetrics.h"
 #include "Messages.h"
+#include "ChatDBWatcher.h"
+#include "AttributedBodyDecoder.h"
+#include "MessagesCursor.h"
+#include "MessagesWorker.h"
+#include "ContactIndex.h"
+#include "MessagesEventRing.h"
+#include "RecentHandles.h"
@@ -0,0 +1,409 @@
+//
+//  AttributedBodyDecoder.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 7/31/25.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include "AttributedBodyDecoder.h"
+
+/// `attributedBody` is an NSArchiver "typedstream": a header, then groups of
+/// (type encoding string, values...) where every object is its class chain
+/// followed by more groups and an END tag. Type strings and class names go in
+/// a shared string table, objects and classes in an object table, and later
+/// uses of either are written as a one byte back reference.
+
+#define TS_TAG_INT16        0x81
+#define TS_TAG_INT32        0x82
+#define TS_TAG_FLOAT        0x83
+#define TS_TAG_NEW          0x84
+#define TS_TAG_NIL          0x85
+#define TS_TAG_END          0x86
+#define TS_TAG_REFERENCE    0x92
+
+#define TS_MAX_SHARED       256
+#define TS_MAX_OBJECTS      512
+#define TS_MAX_DEPTH        32
+
+/// Flags kept per object table entry
+enum {
+    TS_CLASS_STRING     = 1 << 0,   // NSString or a subclass
+    TS_CLASS_URL        = 1 << 1,   // NSURL
+    TS_CLASS_ATTRIBUTED = 1 << 2,   // NSAttributedString or a subclass
+    TS_IS_CLASS     = 1 << 7,   // the entry is a class, not an instance
+};
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} SharedString;
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t pos;
+
+    SharedString shared[TS_MAX_SHARED];
+    int shared_count;
+    uint64_t embedded[TS_MAX_SHARED / 64];  // shared strings already given an object slot
+
+    uint8_t objects[TS_MAX_OBJECTS];
+    int object_count;
+
+    int depth;
+    int url_depth;
+    uint8_t root_flags;             // class of the archive's top level object
+    int64_t run_units;              // UTF-16 units the attributed string's runs cover
+    AttributedBodyText *out;
+} TypedStreamReader;
+
+static bool read_byte(TypedStreamReader *r, uint8_t *byte) {
+    if (r->pos >= r->length) return false;
+    *byte = r->data[r->pos++];
+    return true;
+}
+
+static bool peek_byte(TypedStreamReader *r, uint8_t *byte) {
+    if (r->pos >= r->length) return false;
+    *byte = r->data[r->pos];
+    return true;
+}
+
+/// Integers are one signed byte, or a tag followed by 2 / 4 little endian bytes
+static bool read_int_after(TypedStreamReader *r, uint8_t first, int64_t *value) {
+    const uint8_t *p = r->data + r->pos;
+
+    switch (first) {
+        case TS_TAG_INT16:
+            if (r->length - r->pos < 2) return false;
+            *value = (int16_t)(p[0] | p[1] << 8);
+            r->pos += 2;
+            return true;
+        case TS_TAG_INT32:
+            if (r->length - r->pos < 4) return false;
+            *value = (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                               (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+            r->pos += 4;
+            return true;
+        case TS_TAG_FLOAT:
+        case TS_TAG_NEW:
+        case TS_TAG_NIL:
+        case TS_TAG_END:
+            return false;
+        default:
+            *value = (int8_t)first;
+            return true;
+    }
+}
+
+static bool read_int(TypedStreamReader *r, int64_t *value) {
+    uint8_t first;
+    return read_byte(r, &first) && read_int_after(r, first, value);
+}
+
+/// A byte count that has to fit in what is left of the blob
+static bool read_length(TypedStreamReader *r, size_t *length) {
+    int64_t value;
+    if (!read_int(r, &value) || value < 0 || (uint64_t)value > r->length - r->pos) return false;
+    *length = (size_t)value;
+    return true;
+}
+
+/// Back references are written as (index + TS_TAG_REFERENCE)
+static bool read_reference_after(TypedStreamReader *r, uint8_t first, int count, int *index) {
+    int64_t value;
+    if (first >= TS_TAG_REFERENCE) {
+        value = first - TS_TAG_REFERENCE;
+    } else if (first == TS_TAG_INT16 || first == TS_TAG_INT32) {
+        if (!read_int_after(r, first, &value)) return false;
+        value -= TS_TAG_REFERENCE;
+    } else {
+        return false;
+    }
+    if (value < 0 || value >= count) return false;
+    *index = (int)value;
+    return true;
+}
+
+static int push_object(TypedStreamReader *r, uint8_t flags) {
+    if (r->object_count >= TS_MAX_OBJECTS) return -1;
+    r->objects[r->object_count] = flags;
+    return r->object_count++;
+}
+
+/// Reads a new or referenced shared string, `*index` is -1 for nil.
+/// Embedded C strings also take an object slot the first time they appear.
+static bool read_shared(TypedStreamReader *r, bool embedded, int *index) {
+    uint8_t tag;
+    if (!read_byte(r, &tag)) return false;
+
+    if (tag == TS_TAG_NIL) {
+        *index = -1;
+        return true;
+    }
+
+    if (tag == TS_TAG_NEW) {
+        size_t length;
+        if (!read_length(r, &length) || r->shared_count >= TS_MAX_SHARED) return false;
+
+        *index = r->shared_count++;
+        r->shared[*index] = (SharedString){ .offset = (uint32_t)r->pos, .length = (uint32_t)length };
+        r->pos += length;
+    } else if (!read_reference_after(r, tag, r->shared_count, index)) {
+        return false;
+    }
+
+    if (embedded && !(r->embedded[*index / 64] & (1ULL << (*index % 64)))) {
+        r->embedded[*index / 64] |= 1ULL << (*index % 64);
+        if (push_object(r, 0) < 0) return false;
+    }
+    return true;
+}
+
+static bool shared_equals(TypedStreamReader *r, int index, const char *string) {
+    size_t length = strlen(string);
+    return r->shared[index].length == length &&
+           memcmp(r->data + r->shared[index].offset, string, length) == 0;
+}
+
+static uint8_t class_flags_for_name(TypedStreamReader *r, int name) {
+    if (shared_equals(r, name, "NSString") || shared_equals(r, name, "NSMutableString"))
+        return TS_CLASS_STRING;
+    if (shared_equals(r, name, "NSURL"))
+        return TS_CLASS_URL;
+    if (shared_equals(r, name, "NSAttributedString") || shared_equals(r, name, "NSMutableAttributedString"))
+        return TS_CLASS_ATTRIBUTED;
+    return 0;
+}
+
+/// A class is its name, version and superclass, the chain ends in nil.
+/// `*flags` collects what the whole chain is a kind of.
+static bool read_class(TypedStreamReader *r, uint8_t *flags) {
+    uint8_t tag;
+    if (!read_byte(r, &tag)) return false;
+
+    if (tag == TS_TAG_NIL) {
+        *flags = 0;
+        return true;
+    }
+
+    if (tag != TS_TAG_NEW) {
+        int index;
+        if (!read_reference_after(r, tag, r->object_count, &index)) return false;
+        if (!(r->objects[index] & TS_IS_CLASS)) return false;
+        *flags = r->objects[index] & ~TS_IS_CLASS;
+        return true;
+    }
+
+    int name;
+    int64_t version;
+    if (!read_shared(r, false, &name) || name < 0) return false;
+    if (!read_int(r, &version)) return false;
+
+    int slot = push_object(r, TS_IS_CLASS);
+    if (slot < 0 || ++r->depth > TS_MAX_DEPTH) return false;
+
+    uint8_t parent;
+    bool ok = read_class(r, &parent);
+    r->depth--;
+    if (!ok) return false;
+
+    r->objects[slot] |= class_flags_for_name(r, name) | parent;
+    *flags = r->objects[slot] & ~TS_IS_CLASS;
+    return true;
+}
+
+static bool read_object(TypedStreamReader *r);
+
+/// The first NSString is the message itself, the first one inside an NSURL is its link
+static void found_string(TypedStreamReader *r, size_t offset, size_t length) {
+    AttributedBodyText *out = r->out;
+
+    if (r->url_depth > 0) {
+        if (out->has_link) return;
+        out->has_link = true;
+        out->link_offset = offset;
+        out->link_length = length;
+    } else if (!out->has_text) {
+        out->has_text = true;
+        out->text_offset = offset;
+        out->text_length = length;
+    }
+}
+
+static bool read_value(TypedStreamReader *r, char type, uint8_t owner) {
+    uint8_t tag;
+    int64_t value;
+    int index;
+
+    switch (type) {
+        case '@':
+            return read_object(r);
+        case '#':
+            return read_class(r, &tag);
+        case ':':
+        case '%':
+            return read_shared(r, false, &index);
+        case '*':
+            if (!read_byte(r, &tag)) return false;
+            if (tag == TS_TAG_NIL) return true;
+            return tag == TS_TAG_NEW && read_shared(r, true, &index);
+        case '+': {
+            size_t length;
+            if (!read_length(r, &length)) return false;
+            if (owner & TS_CLASS_STRING) found_string(r, r->pos, length);
+            r->pos += length;
+            return true;
+        }
+        case 'f':
+        case 'd':
+            if (!peek_byte(r, &tag)) return false;
+            if (tag == TS_TAG_FLOAT) {
+                size_t size = type == 'f' ? 4 : 8;
+                if (r->length - r->pos < size + 1) return false;
+                r->pos += size + 1;
+                return true;
+            }
+            return read_int(r, &value);
+        case 'c': case 'C': case 's': case 'S': case 'i': case 'I':
+        case 'l': case 'L': case 'q': case 'Q': case 'B':
+            return read_int(r, &value);
+        case 'v':
+            return true;
+        default:
+            /// Arrays and structs never show up in message bodies
+            return false;
+    }
+}
+
+/// One type encoding followed by a value for each of its characters
+static bool read_group(TypedStreamReader *r, uint8_t owner) {
+    int type;
+    if (!read_shared(r, false, &type) || type < 0) return false;
+    
+    /// An attributed string's runs are (attributes number, length in UTF-16 units)
+    if ((owner & TS_CLASS_ATTRIBUTED) && shared_equals(r, type, "iI")) {
+        int64_t number, units;
+        if (!read_int(r, &number) || !read_int(r, &units) || units <= 0) return false;
+        r->run_units += units;
+        return true;
+    }
+
+    SharedString encoding = r->shared[type];
+    for (uint32_t i = 0; i < encoding.length; i++) {
+        if (!read_value(r, (char)r->data[encoding.offset + i], owner)) return false;
+    }
+    return true;
+}
+
+static bool read_object(TypedStreamReader *r) {
+    uint8_t tag;
+    if (!read_byte(r, &tag)) return false;
+
+    if (tag == TS_TAG_NIL) return true;
+    if (tag != TS_TAG_NEW) {
+        int index;
+        return read_reference_after(r, tag, r->object_count, &index);
+    }
+
+    /// The instance takes its slot before its class does
+    int slot = push_object(r, 0);
+    uint8_t flags;
+    if (slot < 0 || !read_class(r, &flags)) return false;
+    r->objects[slot] = flags;
+    if (r->depth == 0) r->root_flags = flags;
+
+    if (++r->depth > TS_MAX_DEPTH) return false;
+    if (flags & TS_CLASS_URL) r->url_depth++;
+
+    bool ok = true;
+    for (;;) {
+        if (!peek_byte(r, &tag)) {
+            ok = false;
+            break;
+        }
+        if (tag == TS_TAG_END) {
+            r->pos++;
+            break;
+        }
+        if (!read_group(r, flags)) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (flags & TS_CLASS_URL) r->url_depth--;
+    r->depth--;
+    return ok;
+}
+
+/// Version byte, "streamtyped" and the system version
+static bool read_header(TypedStreamReader *r) {
+    uint8_t version;
+    size_t length;
+    int64_t system_version;
+
+    if (!read_byte(r, &version) || (version != 3 && version != 4)) return false;
+    if (!read_length(r, &length) || length != 11) return false;
+    if (memcmp(r->data + r->pos, "streamtyped", 11) != 0) return false;
+    r->pos += 11;
+    return read_int(r, &system_version);
+}
+
+/// UTF-16 units of `length` bytes of UTF-8, false if they are not valid UTF-8
+static bool utf16_length(const uint8_t *text, size_t length, int64_t *units) {
+    *units = 0;
+    for (size_t i = 0; i < length; ) {
+        uint8_t lead = text[i];
+        size_t size = lead < 0x80 ? 1 : (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 :
+                      (lead & 0xF8) == 0xF0 ? 4 : 0;
+        if (size == 0 || size > length - i) return false;
+        
+        uint32_t code = size == 1 ? lead : lead & (0x7F >> size);
+        for (size_t k = 1; k < size; k++) {
+            if ((text[i + k] & 0xC0) != 0x80) return false;
+            code = code << 6 | (text[i + k] & 0x3F);
+        }
+        /// Overlong forms, surrogates and anything past U+10FFFF
+        static const uint32_t smallest[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (code < smallest[size] || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF) return false;
+        
+        *units += size == 4 ? 2 : 1;
+        i += size;
+    }
+    return true;
+}
+
+bool attributed_body_decode(const void *blob, size_t length, AttributedBodyText *out) {
+    if (!out) return false;
+    memset(out, 0, sizeof(*out));
+    if (!blob || length == 0 || length > UINT32_MAX) return false;
+
+    TypedStreamReader reader;
+    reader.data = blob;
+    reader.length = length;
+    reader.pos = 0;
+    reader.shared_count = 0;
+    memset(reader.embedded, 0, sizeof(reader.embedded));
+    reader.object_count = 0;
+    reader.depth = 0;
+    reader.url_depth = 0;
+    reader.root_flags = 0;
+    reader.run_units = 0;
+    reader.out = out;
+
+    /// The whole attributed string has to parse, runs and attributes included,
+    /// and its runs have to cover the text exactly. Anything less could be a
+    /// misread, and the caller has a slower decoder that would get it right.
+    int64_t units;
+    bool ok = read_header(&reader) &&
+              read_group(&reader, 0) &&
+              (reader.root_flags & TS_CLASS_ATTRIBUTED) &&
+              out->has_text &&
+              utf16_length(reader.data + out->text_offset, out->text_length, &units) &&
+              units == reader.run_units;
+    if (!ok) memset(out, 0, sizeof(*out));
+    return ok;
+}
@@ -0,0 +1,35 @@
+//
+//  AttributedBodyDecoder.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 7/31/25.
+//
+
+#ifndef AttributedBodyDecoder_h
+#define AttributedBodyDecoder_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Where the visible text of an `attributedBody` blob lives. Everything is an
+/// offset / length into the blob that was decoded, nothing is copied, so the
+/// caller slices its own buffer while it still has it.
+typedef struct {
+    bool has_text;
+    size_t text_offset;
+    size_t text_length;     // UTF-8 bytes of the NSString
+
+    bool has_link;
+    size_t link_offset;
+    size_t link_length;     // UTF-8 bytes of the first NSURL's string
+} AttributedBodyText;
+
+/// Reads a `streamtyped` (NSArchiver) archive in one linear pass and finds the
+/// attributed string's text plus the first link attribute. Uses no heap, the
+/// shared string / object tables live on the stack.
+/// Returns false if the blob is not a typedstream holding an attributed
+/// string, does not parse to the end of it, or its attribute runs do not
+/// cover the text exactly, so a misread is never taken for the message.
+bool attributed_body_decode(const void *blob, size_t length, AttributedBodyText *out);
+
+#endif /* AttributedBodyDecoder_h */
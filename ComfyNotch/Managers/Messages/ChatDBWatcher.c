@@ -0,0 +1,469 @@
+//
+//  ChatDBWatcher.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 7/30/25.
+//
+
+#include <sqlite3.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ChatDBWatcher.h"
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <libgen.h>
+#elif defined(__APPLE__)
+#include <sys/event.h>
+#endif
+
+/// SQLite appends the WAL frames before it publishes the new header in -shm,
+/// and -shm writes go through mmap so they never raise a file event. If the
+/// version has not moved yet we look again a few times, backing off, before
+/// going back to sleep.
+static const int settle_intervals_ms[] = { 2, 5, 10, 25, 50 };
+#define SETTLE_RETRIES ((int)(sizeof(settle_intervals_ms) / sizeof(settle_intervals_ms[0])))
+
+/// How often the stat backend looks at the files
+#define POLL_INTERVAL_MS    50
+
+struct ChatDBWatcher {
+    pthread_t thread;
+    int wake_pipe[2];
+
+    sqlite3 *db;                    // only ever runs PRAGMA data_version
+    int64_t data_version;
+
+    const ChatDBWatcherBackend *backend;
+    void *backend_state;
+
+    ChatDBWatcherCallback callback;
+    void *userdata;
+
+    _Atomic uint64_t file_events;
+    _Atomic uint64_t version_checks;
+    _Atomic uint64_t callbacks;
+};
+
+static int64_t read_data_version(sqlite3 *db) {
+    sqlite3_stmt *stmt = NULL;
+    int64_t version = -1;
+
+    /// Not worth caching, this only runs after the kernel said a file changed
+    if (sqlite3_prepare_v2(db, "PRAGMA data_version;", -1, &stmt, NULL) != SQLITE_OK)
+        return -1;
+
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        version = sqlite3_column_int64(stmt, 0);
+
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+/// Returns true and calls back if the database moved on since the last check
+static bool check_for_change(ChatDBWatcher *watcher) {
+    atomic_fetch_add_explicit(&watcher->version_checks, 1, memory_order_relaxed);
+
+    int64_t version = read_data_version(watcher->db);
+    if (version < 0 || version == watcher->data_version) return false;
+
+    watcher->data_version = version;
+    atomic_fetch_add_explicit(&watcher->callbacks, 1, memory_order_relaxed);
+    watcher->callback(watcher->userdata);
+    return true;
+}
+
+static void *watcher_thread(void *arg) {
+    ChatDBWatcher *watcher = arg;
+    int settle = 0;
+
+    for (;;) {
+        int timeout = settle > 0 ? settle_intervals_ms[SETTLE_RETRIES - settle] : -1;
+        ChatDBWaitResult result = watcher->backend->wait(watcher->backend_state,
+                                                         watcher->wake_pipe[0],
+                                                         timeout);
+
+        if (result == CHATDB_WAIT_WOKEN || result == CHATDB_WAIT_ERROR) break;
+
+        if (result == CHATDB_WAIT_CHANGED) {
+            atomic_fetch_add_explicit(&watcher->file_events, 1, memory_order_relaxed);
+            settle = SETTLE_RETRIES;
+        } else {
+            settle--;
+        }
+
+        if (check_for_change(watcher)) settle = 0;
+    }
+
+    return NULL;
+}
+
+ChatDBWatcher *chatdb_watcher_start(const char *db_path,
+                                    const ChatDBWatcherBackend *backend,
+                                    ChatDBWatcherCallback callback,
+                                    void *userdata) {
+    if (!db_path || !callback) return NULL;
+    if (!backend) backend = chatdb_watcher_default_backend();
+
+    ChatDBWatcher *watcher = calloc(1, sizeof(ChatDBWatcher));
+    if (!watcher) return NULL;
+
+    watcher->backend = backend;
+    watcher->callback = callback;
+    watcher->userdata = userdata;
+    watcher->wake_pipe[0] = watcher->wake_pipe[1] = -1;
+
+    if (sqlite3_open_v2(db_path, &watcher->db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+        goto fail;
+
+    watcher->data_version = read_data_version(watcher->db);
+    if (watcher->data_version < 0) goto fail;
+
+    if (pipe(watcher->wake_pipe) != 0) goto fail;
+
+    watcher->backend_state = backend->open(db_path);
+    if (!watcher->backend_state) goto fail;
+
+    if (pthread_create(&watcher->thread, NULL, watcher_thread, watcher) != 0) {
+        backend->close(watcher->backend_state);
+        goto fail;
+    }
+
+    return watcher;
+
+fail:
+    if (watcher->wake_pipe[0] >= 0) close(watcher->wake_pipe[0]);
+    if (watcher->wake_pipe[1] >= 0) close(watcher->wake_pipe[1]);
+    sqlite3_close(watcher->db);
+    free(watcher);
+    return NULL;
+}
+
+void chatdb_watcher_stop(ChatDBWatcher *watcher) {
+    if (!watcher) return;
+
+    char byte = 1;
+    while (write(watcher->wake_pipe[1], &byte, 1) < 0 && errno == EINTR) {}
+    pthread_join(watcher->thread, NULL);
+
+    watcher->backend->close(watcher->backend_state);
+    close(watcher->wake_pipe[0]);
+    close(watcher->wake_pipe[1]);
+    sqlite3_close(watcher->db);
+    free(watcher);
+}
+
+ChatDBWatcherStats chatdb_watcher_stats(ChatDBWatcher *watcher) {
+    ChatDBWatcherStats stats = { 0 };
+    if (!watcher) return stats;
+
+    stats.file_events = atomic_load_explicit(&watcher->file_events, memory_order_relaxed);
+    stats.version_checks = atomic_load_explicit(&watcher->version_checks, memory_order_relaxed);
+    stats.callbacks = atomic_load_explicit(&watcher->callbacks, memory_order_relaxed);
+    return stats;
+}
+
+// MARK: - Poll Backend
+
+typedef struct {
+    char db_path[1024];
+    char wal_path[1024];
+    struct stat last_db;
+    struct stat last_wal;
+} PollState;
+
+static void stat_or_zero(const char *path, struct stat *st) {
+    if (stat(path, st) != 0) memset(st, 0, sizeof(*st));
+}
+
+static bool stat_changed(const struct stat *a, const struct stat *b) {
+#if defined(__APPLE__)
+    if (a->st_mtimespec.tv_sec != b->st_mtimespec.tv_sec ||
+        a->st_mtimespec.tv_nsec != b->st_mtimespec.tv_nsec) return true;
+#else
+    if (a->st_mtim.tv_sec != b->st_mtim.tv_sec ||
+        a->st_mtim.tv_nsec != b->st_mtim.tv_nsec) return true;
+#endif
+    return a->st_size != b->st_size || a->st_ino != b->st_ino;
+}
+
+static void *poll_open(const char *db_path) {
+    PollState *state = calloc(1, sizeof(PollState));
+    if (!state) return NULL;
+
+    snprintf(state->db_path, sizeof(state->db_path), "%s", db_path);
+    snprintf(state->wal_path, sizeof(state->wal_path), "%s-wal", db_path);
+    stat_or_zero(state->db_path, &state->last_db);
+    stat_or_zero(state->wal_path, &state->last_wal);
+    return state;
+}
+
+static ChatDBWaitResult poll_wait(void *arg, int wake_fd, int timeout_ms) {
+    PollState *state = arg;
+    int waited = 0;
+
+    for (;;) {
+        int interval = POLL_INTERVAL_MS;
+        if (timeout_ms >= 0 && timeout_ms - waited < interval) interval = timeout_ms - waited;
+
+        struct pollfd pfd = { .fd = wake_fd, .events = POLLIN };
+        int rc = poll(&pfd, 1, interval);
+        if (rc < 0 && errno != EINTR) return CHATDB_WAIT_ERROR;
+        if (rc > 0) return CHATDB_WAIT_WOKEN;
+        waited += interval;
+
+        struct stat db, wal;
+        stat_or_zero(state->db_path, &db);
+        stat_or_zero(state->wal_path, &wal);
+
+        bool changed = stat_changed(&db, &state->last_db) || stat_changed(&wal, &state->last_wal);
+        state->last_db = db;
+        state->last_wal = wal;
+
+        if (changed) return CHATDB_WAIT_CHANGED;
+        if (timeout_ms >= 0 && waited >= timeout_ms) return CHATDB_WAIT_TIMEOUT;
+    }
+}
+
+static void poll_close(void *state) {
+    free(state);
+}
+
+static const ChatDBWatcherBackend poll_backend = {
+    .name  = "poll",
+    .open  = poll_open,
+    .wait  = poll_wait,
+    .close = poll_close,
+};
+
+const ChatDBWatcherBackend *chatdb_watcher_poll_backend(void) {
+    return &poll_backend;
+}
+
+#if defined(__linux__)
+
+// MARK: - inotify Backend
+
+typedef struct {
+    int fd;
+    char db_name[256];
+    char wal_name[256 + 4];
+} InotifyState;
+
+static void *inotify_open(const char *db_path) {
+    InotifyState *state = calloc(1, sizeof(InotifyState));
+    if (!state) return NULL;
+
+    char dir_copy[1024], name_copy[1024];
+    snprintf(dir_copy, sizeof(dir_copy), "%s", db_path);
+    snprintf(name_copy, sizeof(name_copy), "%s", db_path);
+
+    snprintf(state->db_name, sizeof(state->db_name), "%s", basename(name_copy));
+    snprintf(state->wal_name, sizeof(state->wal_name), "%s-wal", state->db_name);
+
+    state->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state->fd < 0) {
+        free(state);
+        return NULL;
+    }
+
+    /// Watching the folder also catches the -wal file being created or replaced
+    uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO;
+    if (inotify_add_watch(state->fd, dirname(dir_copy), mask) < 0) {
+        close(state->fd);
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+
+static ChatDBWaitResult inotify_wait(void *arg, int wake_fd, int timeout_ms) {
+    InotifyState *state = arg;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        struct pollfd pfds[2] = {
+            { .fd = wake_fd,   .events = POLLIN },
+            { .fd = state->fd, .events = POLLIN },
+        };
+        int rc = poll(pfds, 2, timeout_ms);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            return CHATDB_WAIT_ERROR;
+        }
+        if (rc == 0) return CHATDB_WAIT_TIMEOUT;
+        if (pfds[0].revents & POLLIN) return CHATDB_WAIT_WOKEN;
+
+        bool relevant = false;
+        ssize_t len;
+        while ((len = read(state->fd, buffer, sizeof(buffer))) > 0) {
+            for (char *p = buffer; p < buffer + len; ) {
+                struct inotify_event *event = (struct inotify_event *)p;
+                if (event->len > 0 &&
+                    (strcmp(event->name, state->db_name) == 0 ||
+                     strcmp(event->name, state->wal_name) == 0)) {
+                    relevant = true;
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (relevant) return CHATDB_WAIT_CHANGED;
+    }
+}
+
+static void inotify_close(void *arg) {
+    InotifyState *state = arg;
+    close(state->fd);
+    free(state);
+}
+
+static const ChatDBWatcherBackend native_backend = {
+    .name  = "inotify",
+    .open  = inotify_open,
+    .wait  = inotify_wait,
+    .close = inotify_close,
+};
+
+const ChatDBWatcherBackend *chatdb_watcher_default_backend(void) {
+    return &native_backend;
+}
+
+#elif defined(__APPLE__)
+
+// MARK: - kqueue Backend
+
+typedef struct {
+    int kq;
+    int db_fd;
+    int wal_fd;
+    int dir_fd;
+    char wal_path[1024];
+    int registered_wake_fd;
+} KqueueState;
+
+static const unsigned int vnode_flags = NOTE_WRITE | NOTE_EXTEND | NOTE_DELETE | NOTE_RENAME | NOTE_ATTRIB;
+
+static int watch_path(int kq, const char *path, unsigned int flags) {
+    int fd = open(path, O_EVTONLY);
+    if (fd < 0) return -1;
+
+    struct kevent change;
+    EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, flags, 0, NULL);
+    if (kevent(kq, &change, 1, NULL, 0, NULL) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/// The -wal file comes and goes with checkpoints, so re-attach whenever the folder changes
+static void rewatch_wal(KqueueState *state) {
+    if (state->wal_fd >= 0) close(state->wal_fd);
+    state->wal_fd = watch_path(state->kq, state->wal_path, vnode_flags);
+}
+
+static void *kqueue_open(const char *db_path) {
+    KqueueState *state = calloc(1, sizeof(KqueueState));
+    if (!state) return NULL;
+
+    state->registered_wake_fd = -1;
+    state->kq = kqueue();
+    if (state->kq < 0) {
+        free(state);
+        return NULL;
+    }
+
+    char dir_path[1024];
+    snprintf(dir_path, sizeof(dir_path), "%s", db_path);
+    char *slash = strrchr(dir_path, '/');
+    if (slash) *slash = '\0'; else snprintf(dir_path, sizeof(dir_path), ".");
+
+    snprintf(state->wal_path, sizeof(state->wal_path), "%s-wal", db_path);
+    state->db_fd = watch_path(state->kq, db_path, vnode_flags);
+    state->dir_fd = watch_path(state->kq, dir_path, NOTE_WRITE);
+    state->wal_fd = -1;
+    rewatch_wal(state);
+
+    if (state->db_fd < 0 && state->dir_fd < 0) {
+        close(state->kq);
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+
+static ChatDBWaitResult kqueue_wait(void *arg, int wake_fd, int timeout_ms) {
+    KqueueState *state = arg;
+
+    if (state->registered_wake_fd != wake_fd) {
+        struct kevent change;
+        EV_SET(&change, wake_fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+        if (kevent(state->kq, &change, 1, NULL, 0, NULL) < 0) return CHATDB_WAIT_ERROR;
+        state->registered_wake_fd = wake_fd;
+    }
+
+    struct timespec timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (long)(timeout_ms % 1000) * 1000000L
+    };
+
+    for (;;) {
+        struct kevent events[8];
+        int n = kevent(state->kq, NULL, 0, events, 8, timeout_ms < 0 ? NULL : &timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return CHATDB_WAIT_ERROR;
+        }
+        if (n == 0) return CHATDB_WAIT_TIMEOUT;
+
+        bool changed = false;
+        for (int i = 0; i < n; i++) {
+            int fd = (int)events[i].ident;
+            if (events[i].filter == EVFILT_READ && fd == wake_fd) return CHATDB_WAIT_WOKEN;
+
+            if (fd == state->dir_fd ||
+                (fd == state->wal_fd && (events[i].fflags & (NOTE_DELETE | NOTE_RENAME)))) {
+                rewatch_wal(state);
+            }
+            changed = true;
+        }
+        if (changed) return CHATDB_WAIT_CHANGED;
+    }
+}
+
+static void kqueue_close(void *arg) {
+    KqueueState *state = arg;
+    if (state->db_fd >= 0) close(state->db_fd);
+    if (state->wal_fd >= 0) close(state->wal_fd);
+    if (state->dir_fd >= 0) close(state->dir_fd);
+    close(state->kq);
+    free(state);
+}
+
+static const ChatDBWatcherBackend native_backend = {
+    .name  = "kqueue",
+    .open  = kqueue_open,
+    .wait  = kqueue_wait,
+    .close = kqueue_close,
+};
+
+const ChatDBWatcherBackend *chatdb_watcher_default_backend(void) {
+    return &native_backend;
+}
+
+#else
+
+const ChatDBWatcherBackend *chatdb_watcher_default_backend(void) {
+    return &poll_backend;
+}
+
+#endif
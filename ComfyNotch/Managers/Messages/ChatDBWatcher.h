@@ -0,0 +1,58 @@
+//
+//  ChatDBWatcher.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 7/30/25.
+//
+
+#ifndef ChatDBWatcher_h
+#define ChatDBWatcher_h
+
+#include <stdint.h>
+
+/// Watches chat.db and chat.db-wal on a background thread and calls back only
+/// when `PRAGMA data_version` says another connection really committed.
+/// While nothing changes the thread is blocked in the kernel and runs no SQL.
+typedef struct ChatDBWatcher ChatDBWatcher;
+
+/// Called on the watcher thread, hop to your own queue before touching UI state
+typedef void (*ChatDBWatcherCallback)(void *userdata);
+
+/// Results a backend `wait` can report
+typedef enum {
+    CHATDB_WAIT_ERROR   = -1,
+    CHATDB_WAIT_TIMEOUT = 0,
+    CHATDB_WAIT_CHANGED = 1,
+    CHATDB_WAIT_WOKEN   = 2,
+} ChatDBWaitResult;
+
+/// Pluggable file notification backend
+typedef struct {
+    const char *name;
+    /// Starts watching `db_path` and its -wal file, returns backend state or NULL
+    void *(*open)(const char *db_path);
+    /// Blocks until one of the files changed, `wake_fd` became readable or
+    /// `timeout_ms` elapsed (-1 waits forever)
+    ChatDBWaitResult (*wait)(void *state, int wake_fd, int timeout_ms);
+    void (*close)(void *state);
+} ChatDBWatcherBackend;
+
+typedef struct {
+    uint64_t file_events;       // wakeups caused by the backend
+    uint64_t version_checks;    // PRAGMA data_version round trips
+    uint64_t callbacks;         // times the database really changed
+} ChatDBWatcherStats;
+
+/// inotify on Linux, kqueue on macOS, stat polling anywhere else
+const ChatDBWatcherBackend *chatdb_watcher_default_backend(void);
+/// Portable fallback that stats the files every few milliseconds
+const ChatDBWatcherBackend *chatdb_watcher_poll_backend(void);
+
+ChatDBWatcher *chatdb_watcher_start(const char *db_path,
+                                    const ChatDBWatcherBackend *backend,
+                                    ChatDBWatcherCallback callback,
+                                    void *userdata);
+void chatdb_watcher_stop(ChatDBWatcher *watcher);
+ChatDBWatcherStats chatdb_watcher_stats(ChatDBWatcher *watcher);
+
+#endif /* ChatDBWatcher_h */
@@ -0,0 +1,641 @@
+//
+//  ContactIndex.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "ContactIndex.h"
+#include "MessageHashMap.h"
+
+/// Suffix keys start with this, so they never equal a phone number's key
+#define SUFFIX_MARK '#'
+
+// MARK: - Phone Numbers
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+size_t contact_normalize_phone(const char *value, int default_country, char *out, size_t capacity) {
+    if (!value || !out || capacity == 0) return 0;
+
+    char digits[CONTACT_KEY_MAX];
+    size_t count = 0;
+    bool plus = false, seen = false;
+    for (const char *p = value; *p; p++) {
+        if (is_digit(*p)) {
+            if (count == sizeof(digits)) return 0;
+            digits[count++] = *p;
+            seen = true;
+        } else if (*p == '+' && !seen) {
+            plus = true;
+        }
+    }
+    if (count == 0) return 0;
+
+    const char *number = digits;
+    char country[16] = "";
+    if (plus) {
+        /// Already international
+    } else if (count > 2 && digits[0] == '0' && digits[1] == '0') {
+        /// 00 is the international prefix almost everywhere
+        number += 2;
+        count -= 2;
+        plus = true;
+    } else if (count >= 7 && default_country > 0) {
+        snprintf(country, sizeof(country), "%d", default_country);
+        size_t country_len = strlen(country);
+        if (count > 10 && strncmp(digits, country, country_len) == 0) {
+            /// Country code without the plus, "1 555 123 4567"
+            country[0] = '\0';
+        } else if (digits[0] == '0') {
+            /// Trunk prefix, "07911 123456" is +44 7911 123456
+            number++;
+            count--;
+        } else if (count > 10) {
+            /// Too long to be national, someone else's country code
+            country[0] = '\0';
+        }
+        plus = true;
+    }
+
+    /// Short codes and numbers without a country stay bare digits
+    size_t length = (plus ? 1 : 0) + strlen(country) + count;
+    if (count == 0 || length + 1 > capacity) return 0;
+
+    char *w = out;
+    if (plus) *w++ = '+';
+    for (const char *c = country; *c; c++) *w++ = *c;
+    memcpy(w, number, count);
+    out[length] = '\0';
+    return length;
+}
+
+// MARK: - Emails
+
+#define PUNY_BASE         36
+#define PUNY_TMIN         1
+#define PUNY_TMAX         26
+#define PUNY_SKEW         38
+#define PUNY_DAMP         700
+#define PUNY_INITIAL_BIAS 72
+#define PUNY_INITIAL_N    128
+
+/// Next code point of `s`, 0 at the end, -1 if it is not valid UTF-8
+static int32_t utf8_next(const unsigned char **s, const unsigned char *end) {
+    const unsigned char *p = *s;
+    if (p >= end) return 0;
+
+    uint32_t c = *p++;
+    int more = c < 0x80 ? 0 : (c & 0xE0) == 0xC0 ? 1 : (c & 0xF0) == 0xE0 ? 2 : (c & 0xF8) == 0xF0 ? 3 : -1;
+    if (more < 0 || end - p < more) return -1;
+    if (more > 0) c &= 0x3F >> more;
+    for (int i = 0; i < more; i++, p++) {
+        if ((*p & 0xC0) != 0x80) return -1;
+        c = (c << 6) | (*p & 0x3F);
+    }
+    static const uint32_t smallest[] = { 0, 0x80, 0x800, 0x10000 };
+    if (c < smallest[more] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return -1;
+
+    *s = p;
+    return (int32_t)c;
+}
+
+static uint32_t puny_adapt(uint32_t delta, uint32_t points, bool first) {
+    delta = first ? delta / PUNY_DAMP : delta / 2;
+    delta += delta / points;
+
+    uint32_t k = 0;
+    while (delta > ((PUNY_BASE - PUNY_TMIN) * PUNY_TMAX) / 2) {
+        delta /= PUNY_BASE - PUNY_TMIN;
+        k += PUNY_BASE;
+    }
+    return k + (PUNY_BASE - PUNY_TMIN + 1) * delta / (delta + PUNY_SKEW);
+}
+
+static char puny_digit(uint32_t d) {
+    return (char)(d < 26 ? 'a' + d : '0' + (d - 26));
+}
+
+/// RFC 3492 for one label. Appends to `out` at `*length`, false if it does not fit.
+static bool punycode_label(const uint32_t *points, size_t count, char *out, size_t capacity, size_t *length) {
+    size_t w = *length;
+    #define PUT(c) do { if (w + 1 >= capacity) return false; out[w++] = (c); } while (0)
+
+    PUT('x'); PUT('n'); PUT('-'); PUT('-');
+    size_t basic = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (points[i] < 0x80) {
+            PUT((char)points[i]);
+            basic++;
+        }
+    }
+    if (basic > 0) PUT('-');
+
+    uint32_t n = PUNY_INITIAL_N, delta = 0, bias = PUNY_INITIAL_BIAS;
+    for (size_t handled = basic; handled < count; ) {
+        uint32_t m = UINT32_MAX;
+        for (size_t i = 0; i < count; i++) {
+            if (points[i] >= n && points[i] < m) m = points[i];
+        }
+        if ((uint64_t)(m - n) * (handled + 1) + delta > UINT32_MAX) return false;
+        delta += (m - n) * (uint32_t)(handled + 1);
+        n = m;
+
+        for (size_t i = 0; i < count; i++) {
+            if (points[i] < n) delta++;
+            if (points[i] != n) continue;
+
+            uint32_t q = delta;
+            for (uint32_t k = PUNY_BASE;; k += PUNY_BASE) {
+                uint32_t t = k <= bias ? PUNY_TMIN : k >= bias + PUNY_TMAX ? PUNY_TMAX : k - bias;
+                if (q < t) break;
+                PUT(puny_digit(t + (q - t) % (PUNY_BASE - t)));
+                q = (q - t) / (PUNY_BASE - t);
+            }
+            PUT(puny_digit(q));
+            bias = puny_adapt(delta, (uint32_t)(handled + 1), handled == basic);
+            delta = 0;
+            handled++;
+        }
+        delta++;
+        n++;
+    }
+    #undef PUT
+
+    *length = w;
+    return true;
+}
+
+/// Appends the lowercased domain to `out`, labels with non-ASCII punycoded
+static bool normalize_domain(const char *domain, size_t domain_len, char *out, size_t capacity, size_t *length) {
+    const char *end = domain + domain_len;
+    for (const char *label = domain; label <= end; ) {
+        const char *dot = memchr(label, '.', (size_t)(end - label));
+        if (!dot) dot = end;
+
+        bool ascii = true;
+        for (const char *p = label; p < dot; p++) ascii &= (unsigned char)*p < 0x80;
+
+        if (ascii) {
+            if (*length + (size_t)(dot - label) + 1 >= capacity) return false;
+            for (const char *p = label; p < dot; p++) {
+                out[(*length)++] = (*p >= 'A' && *p <= 'Z') ? (char)(*p + 32) : *p;
+            }
+        } else {
+            uint32_t points[CONTACT_KEY_MAX];
+            size_t count = 0;
+            const unsigned char *p = (const unsigned char *)label;
+            while (p < (const unsigned char *)dot) {
+                int32_t c = utf8_next(&p, (const unsigned char *)dot);
+                if (c <= 0 || count == CONTACT_KEY_MAX) return false;
+                /// Full case folding needs Unicode tables, ASCII is what shows up
+                points[count++] = (c >= 'A' && c <= 'Z') ? (uint32_t)c + 32 : (uint32_t)c;
+            }
+            if (!punycode_label(points, count, out, capacity, length)) return false;
+        }
+
+        if (dot == end) break;
+        if (*length + 2 >= capacity) return false;
+        out[(*length)++] = '.';
+        label = dot + 1;
+    }
+    return true;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+size_t contact_normalize_email(const char *value, char *out, size_t capacity) {
+    if (!value || !out || capacity == 0) return 0;
+
+    const char *start = value, *end = value + strlen(value);
+    while (start < end && is_space(*start)) start++;
+    while (end > start && is_space(end[-1])) end--;
+    if (end - start >= 7 && strncasecmp(start, "mailto:", 7) == 0) start += 7;
+
+    const char *at = memchr(start, '@', (size_t)(end - start));
+    if (!at || at == start || at + 1 >= end || memchr(at + 1, '@', (size_t)(end - at - 1))) return 0;
+
+    size_t length = 0;
+    size_t local_len = (size_t)(at - start);
+    if (local_len + 2 >= capacity) return 0;
+    for (size_t i = 0; i < local_len; i++) {
+        char c = start[i];
+        out[length++] = (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+    }
+    out[length++] = '@';
+
+    if (!normalize_domain(at + 1, (size_t)(end - at - 1), out, capacity, &length)) return 0;
+    out[length] = '\0';
+    return length;
+}
+
+size_t contact_normalize(const char *value, int default_country, char *out, size_t capacity, ContactKeyKind *kind) {
+    size_t length = 0;
+    ContactKeyKind found = CONTACT_KEY_NONE;
+
+    if (value && strchr(value, '@')) {
+        length = contact_normalize_email(value, out, capacity);
+        if (length) found = CONTACT_KEY_EMAIL;
+    } else {
+        length = contact_normalize_phone(value, default_country, out, capacity);
+        if (length) found = CONTACT_KEY_PHONE;
+    }
+    if (kind) *kind = found;
+    return length;
+}
+
+/// "#" and the last `digits` digits of a normalized phone key, 0 if it is shorter
+static size_t suffix_key(const char *key, size_t length, size_t digits, char *out) {
+    if (key[0] == '+') {
+        key++;
+        length--;
+    }
+    if (length < digits) return 0;
+    out[0] = SUFFIX_MARK;
+    memcpy(out + 1, key + length - digits, digits);
+    out[digits + 1] = '\0';
+    return digits + 1;
+}
+
+// MARK: - Building
+
+typedef struct {
+    uint64_t hash;
+    uint32_t key_offset;
+    uint32_t key_len;
+    int32_t contact;
+    uint32_t order : 31;    // insertion order, so the first contact wins ties
+    uint32_t suffix : 1;
+} KeyEntry;
+
+typedef struct {
+    uint32_t name_offset;
+    uint32_t image_offset;
+    uint32_t image_len;
+} ContactEntry;
+
+/// Grow-only byte buffer
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Blob;
+
+static bool blob_append(Blob *blob, const void *bytes, size_t length, uint32_t *offset) {
+    if (blob->size + length > UINT32_MAX) return false;
+    if (blob->size + length > blob->capacity) {
+        size_t capacity = blob->capacity ? blob->capacity : 4096;
+        while (capacity < blob->size + length) capacity *= 2;
+        char *data = realloc(blob->data, capacity);
+        if (!data) return false;
+        blob->data = data;
+        blob->capacity = capacity;
+    }
+    if (length) memcpy(blob->data + blob->size, bytes, length);
+    *offset = (uint32_t)blob->size;
+    blob->size += length;
+    return true;
+}
+
+struct ContactIndexBuilder {
+    int default_country;
+    KeyEntry *keys;
+    size_t key_count;
+    size_t key_capacity;
+    ContactEntry *contacts;
+    size_t contact_count;
+    size_t contact_capacity;
+    Blob strings;           // keys and names, NUL terminated
+    Blob images;
+    bool failed;
+};
+
+struct ContactIndex {
+    /// Sorted, looked up by binary search. Hashes sit apart from the rest so
+    /// the search only walks 8 bytes per step.
+    uint64_t *hashes;
+    KeyEntry *keys;
+    size_t key_count;
+    ContactEntry *contacts;
+    size_t contact_count;
+    char *strings;
+    char *images;
+    int default_country;
+};
+
+ContactIndexBuilder *contact_index_builder_create(int default_country) {
+    ContactIndexBuilder *builder = calloc(1, sizeof(ContactIndexBuilder));
+    if (builder) builder->default_country = default_country;
+    return builder;
+}
+
+static void builder_free(ContactIndexBuilder *builder) {
+    free(builder->keys);
+    free(builder->contacts);
+    free(builder->strings.data);
+    free(builder->images.data);
+    free(builder);
+}
+
+int32_t contact_index_builder_add_contact(ContactIndexBuilder *builder, const char *name,
+                                          const void *image, size_t image_len) {
+    if (!builder || builder->failed || builder->contact_count >= INT32_MAX) return -1;
+
+    if (builder->contact_count == builder->contact_capacity) {
+        size_t capacity = builder->contact_capacity ? builder->contact_capacity * 2 : 64;
+        ContactEntry *contacts = realloc(builder->contacts, capacity * sizeof(ContactEntry));
+        if (!contacts) return -1;
+        builder->contacts = contacts;
+        builder->contact_capacity = capacity;
+    }
+
+    ContactEntry entry = { 0 };
+    if (!name) name = "";
+    if (!blob_append(&builder->strings, name, strlen(name) + 1, &entry.name_offset)) return -1;
+    if (image && image_len > 0) {
+        if (image_len > UINT32_MAX || !blob_append(&builder->images, image, image_len, &entry.image_offset)) {
+            return -1;
+        }
+        entry.image_len = (uint32_t)image_len;
+    }
+
+    builder->contacts[builder->contact_count] = entry;
+    return (int32_t)builder->contact_count++;
+}
+
+static bool builder_add_key(ContactIndexBuilder *builder, int32_t contact, const char *key, size_t length, bool suffix) {
+    if (builder->key_count == builder->key_capacity) {
+        size_t capacity = builder->key_capacity ? builder->key_capacity * 2 : 256;
+        KeyEntry *keys = realloc(builder->keys, capacity * sizeof(KeyEntry));
+        if (!keys) return false;
+        builder->keys = keys;
+        builder->key_capacity = capacity;
+    }
+
+    KeyEntry entry = {
+        .hash = message_hashmap_hash(key, length),
+        .key_len = (uint32_t)length,
+        .contact = contact,
+        .order = (uint32_t)builder->key_count,
+        .suffix = suffix,
+    };
+    if (!blob_append(&builder->strings, key, length + 1, &entry.key_offset)) return false;
+    builder->keys[builder->key_count++] = entry;
+    return true;
+}
+
+bool contact_index_builder_add_value(ContactIndexBuilder *builder, int32_t contact, const char *value) {
+    if (!builder || builder->failed || contact < 0 || (size_t)contact >= builder->contact_count) return false;
+    if (builder->key_count + 3 > INT32_MAX) return false;
+
+    char key[CONTACT_KEY_MAX];
+    ContactKeyKind kind;
+    size_t length = contact_normalize(value, builder->default_country, key, sizeof(key), &kind);
+    if (length == 0) return false;
+
+    bool ok = builder_add_key(builder, contact, key, length, false);
+    if (ok && kind == CONTACT_KEY_PHONE) {
+        char suffix[16];
+        size_t suffix_len;
+        if ((suffix_len = suffix_key(key, length, 10, suffix))) ok &= builder_add_key(builder, contact, suffix, suffix_len, true);
+        if ((suffix_len = suffix_key(key, length, 7, suffix))) ok &= builder_add_key(builder, contact, suffix, suffix_len, true);
+    }
+    /// A half added value would leave its suffixes pointing the wrong way
+    if (!ok) builder->failed = true;
+    return ok;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    const KeyEntry *x = a, *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static bool same_key(const char *strings, const KeyEntry *a, const KeyEntry *b) {
+    return a->key_len == b->key_len && memcmp(strings + a->key_offset, strings + b->key_offset, a->key_len) == 0;
+}
+
+ContactIndex *contact_index_builder_finish(ContactIndexBuilder *builder) {
+    if (!builder) return NULL;
+    if (builder->failed) {
+        builder_free(builder);
+        return NULL;
+    }
+
+    /// By hash, then in the order added. Keys sharing a hash are next to each
+    /// other, and a run of them is almost always one key.
+    qsort(builder->keys, builder->key_count, sizeof(KeyEntry), compare_keys);
+
+    /// One entry per key. An exact key keeps the contact that added it first,
+    /// a suffix key shared by two contacts says nothing and goes.
+    const char *strings = builder->strings.data;
+    KeyEntry *keys = builder->keys;
+    size_t kept = 0;
+    for (size_t run = 0; run < builder->key_count; ) {
+        size_t run_end = run + 1;
+        while (run_end < builder->key_count && keys[run_end].hash == keys[run].hash) run_end++;
+
+        size_t run_kept = kept;
+        for (size_t i = run; i < run_end; i++) {
+            KeyEntry *first = NULL;
+            for (size_t j = run_kept; j < kept; j++) {
+                if (same_key(strings, &keys[j], &keys[i])) first = &keys[j];
+            }
+            if (!first) {
+                keys[kept++] = keys[i];
+            } else if (first->contact != keys[i].contact && first->suffix) {
+                first->contact = -1;
+            }
+        }
+        /// Drop the ambiguous suffixes marked above
+        size_t w = run_kept;
+        for (size_t j = run_kept; j < kept; j++) {
+            if (keys[j].contact >= 0) keys[w++] = keys[j];
+        }
+        kept = w;
+        run = run_end;
+    }
+
+    ContactIndex *index = calloc(1, sizeof(ContactIndex));
+    uint64_t *hashes = malloc((kept ? kept : 1) * sizeof(uint64_t));
+    if (!index || !hashes) {
+        free(index);
+        free(hashes);
+        builder_free(builder);
+        return NULL;
+    }
+    for (size_t i = 0; i < kept; i++) hashes[i] = builder->keys[i].hash;
+
+    index->hashes = hashes;
+    index->keys = builder->keys;
+    index->key_count = kept;
+    index->contacts = builder->contacts;
+    index->contact_count = builder->contact_count;
+    index->strings = builder->strings.data;
+    index->images = builder->images.data;
+    index->default_country = builder->default_country;
+    free(builder);
+    return index;
+}
+
+void contact_index_free(ContactIndex *index) {
+    if (!index) return;
+    free(index->hashes);
+    free(index->keys);
+    free(index->contacts);
+    free(index->strings);
+    free(index->images);
+    free(index);
+}
+
+size_t contact_index_contacts(const ContactIndex *index) {
+    return index ? index->contact_count : 0;
+}
+
+size_t contact_index_keys(const ContactIndex *index) {
+    return index ? index->key_count : 0;
+}
+
+// MARK: - Lookups
+
+static int32_t find_key(const ContactIndex *index, const char *key, size_t length) {
+    uint64_t hash = message_hashmap_hash(key, length);
+
+    size_t low = 0, high = index->key_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->hashes[mid] < hash) low = mid + 1;
+        else high = mid;
+    }
+    for (size_t i = low; i < index->key_count && index->hashes[i] == hash; i++) {
+        const KeyEntry *entry = &index->keys[i];
+        if (entry->key_len == length && memcmp(index->strings + entry->key_offset, key, length) == 0) {
+            return entry->contact;
+        }
+    }
+    return -1;
+}
+
+int32_t contact_index_lookup(const ContactIndex *index, const char *handle_id) {
+    if (!index || !handle_id) return -1;
+
+    char key[CONTACT_KEY_MAX];
+    ContactKeyKind kind;
+    size_t length = contact_normalize(handle_id, index->default_country, key, sizeof(key), &kind);
+    if (length == 0) return -1;
+
+    int32_t contact = find_key(index, key, length);
+    if (contact >= 0 || kind != CONTACT_KEY_PHONE) return contact;
+
+    char suffix[16];
+    size_t suffix_len;
+    if ((suffix_len = suffix_key(key, length, 10, suffix)) && (contact = find_key(index, suffix, suffix_len)) >= 0) {
+        return contact;
+    }
+    if ((suffix_len = suffix_key(key, length, 7, suffix))) return find_key(index, suffix, suffix_len);
+    return -1;
+}
+
+size_t contact_index_resolve(const ContactIndex *index, const char *const *handle_ids,
+                             size_t count, int32_t *out) {
+    if (!handle_ids || !out) return 0;
+
+    size_t matched = 0;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = contact_index_lookup(index, handle_ids[i]);
+        matched += out[i] >= 0;
+    }
+    return matched;
+}
+
+const char *contact_index_name(const ContactIndex *index, int32_t contact) {
+    if (!index || contact < 0 || (size_t)contact >= index->contact_count) return NULL;
+    return index->strings + index->contacts[contact].name_offset;
+}
+
+const void *contact_index_image(const ContactIndex *index, int32_t contact, size_t *length) {
+    if (length) *length = 0;
+    if (!index || contact < 0 || (size_t)contact >= index->contact_count) return NULL;
+
+    const ContactEntry *entry = &index->contacts[contact];
+    if (entry->image_len == 0) return NULL;
+    if (length) *length = entry->image_len;
+    return index->images + entry->image_offset;
+}
+
+// MARK: - Directory
+
+/// Readers count themselves in the slot of the epoch they saw. A swap flips the
+/// epoch and waits for the old slot to empty, twice, since a reader can see an
+/// epoch, stall, and only count itself after the next flip.
+struct ContactDirectory {
+    _Atomic(ContactIndex *) current;
+    atomic_uint_fast64_t epoch;
+    atomic_uint_fast64_t readers[2];
+    pthread_mutex_t swap_lock;
+};
+
+ContactDirectory *contact_directory_create(void) {
+    ContactDirectory *directory = calloc(1, sizeof(ContactDirectory));
+    if (!directory) return NULL;
+
+    atomic_init(&directory->current, NULL);
+    atomic_init(&directory->epoch, 0);
+    atomic_init(&directory->readers[0], 0);
+    atomic_init(&directory->readers[1], 0);
+    pthread_mutex_init(&directory->swap_lock, NULL);
+    return directory;
+}
+
+void contact_directory_destroy(ContactDirectory *directory) {
+    if (!directory) return;
+    contact_index_free(atomic_load(&directory->current));
+    pthread_mutex_destroy(&directory->swap_lock);
+    free(directory);
+}
+
+ContactDirectoryRead contact_directory_acquire(ContactDirectory *directory) {
+    ContactDirectoryRead read = { NULL, 0 };
+    if (!directory) return read;
+
+    read.slot = (uint32_t)(atomic_load(&directory->epoch) & 1);
+    atomic_fetch_add(&directory->readers[read.slot], 1);
+    read.index = atomic_load(&directory->current);
+    return read;
+}
+
+void contact_directory_release(ContactDirectory *directory, ContactDirectoryRead read) {
+    if (!directory) return;
+    atomic_fetch_sub(&directory->readers[read.slot & 1], 1);
+}
+
+static void wait_for_readers(ContactDirectory *directory) {
+    uint64_t old = atomic_fetch_add(&directory->epoch, 1);
+    while (atomic_load(&directory->readers[old & 1]) != 0) sched_yield();
+}
+
+void contact_directory_swap(ContactDirectory *directory, ContactIndex *index) {
+    if (!directory) {
+        contact_index_free(index);
+        return;
+    }
+
+    pthread_mutex_lock(&directory->swap_lock);
+    ContactIndex *old = atomic_exchange(&directory->current, index);
+    wait_for_readers(directory);
+    wait_for_readers(directory);
+    pthread_mutex_unlock(&directory->swap_lock);
+
+    contact_index_free(old);
+}
@@ -0,0 +1,96 @@
+//
+//  ContactIndex.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#ifndef ContactIndex_h
+#define ContactIndex_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Longest normalized key, an email is at most 254 bytes before punycode
+#define CONTACT_KEY_MAX 512
+
+typedef enum {
+    CONTACT_KEY_NONE = 0,
+    CONTACT_KEY_PHONE,
+    CONTACT_KEY_EMAIL,
+} ContactKeyKind;
+
+// MARK: - Normalizing
+
+/// "+15551234567" style: digits only, with the country code. Numbers saved
+/// without one get `default_country` (a calling code, 1 for NANP, 0 for
+/// none), a leading trunk 0 is dropped for it. Short codes stay bare digits.
+/// Returns the key length, 0 if there are no digits or it does not fit.
+size_t contact_normalize_phone(const char *value, int default_country, char *out, size_t capacity);
+/// Trimmed, "mailto:" dropped, ASCII lowercased, and a domain with non-ASCII
+/// labels punycoded ("xn--"). Returns 0 unless it is local@domain.
+size_t contact_normalize_email(const char *value, char *out, size_t capacity);
+/// Either of the above, an '@' makes it an email
+size_t contact_normalize(const char *value, int default_country, char *out, size_t capacity, ContactKeyKind *kind);
+
+// MARK: - Index
+
+/// Every phone number and email of every contact, normalized, in one sorted
+/// array of hashes next to one blob of keys. Immutable once built, so any
+/// number of threads can look up in it without locking.
+///
+/// Phone numbers also get their last 10 and last 7 digits as keys, for
+/// handles and contacts that disagree about the country code. Those only
+/// match when no exact key does, and are left out when two contacts share one.
+typedef struct ContactIndex ContactIndex;
+typedef struct ContactIndexBuilder ContactIndexBuilder;
+
+ContactIndexBuilder *contact_index_builder_create(int default_country);
+/// Returns the new contact's number, -1 if out of memory. `image` is copied.
+int32_t contact_index_builder_add_contact(ContactIndexBuilder *builder, const char *name,
+                                          const void *image, size_t image_len);
+/// A phone number or email of `contact`, false if it normalizes to nothing
+bool contact_index_builder_add_value(ContactIndexBuilder *builder, int32_t contact, const char *value);
+/// Sorts the keys into a new index, then frees the builder either way
+ContactIndex *contact_index_builder_finish(ContactIndexBuilder *builder);
+
+void contact_index_free(ContactIndex *index);
+
+size_t contact_index_contacts(const ContactIndex *index);
+size_t contact_index_keys(const ContactIndex *index);
+
+/// The contact `handle_id` (a chat.db handle.id) belongs to, -1 if none
+int32_t contact_index_lookup(const ContactIndex *index, const char *handle_id);
+/// Looks up `count` handle ids into `out`, returns how many matched
+size_t contact_index_resolve(const ContactIndex *index, const char *const *handle_ids,
+                             size_t count, int32_t *out);
+
+const char *contact_index_name(const ContactIndex *index, int32_t contact);
+/// NULL if the contact has no image
+const void *contact_index_image(const ContactIndex *index, int32_t contact, size_t *length);
+
+// MARK: - Directory
+
+/// Where the current index is published. Readers never block, a rebuilt
+/// index is swapped in and the old one freed once no reader still has it.
+typedef struct ContactDirectory ContactDirectory;
+
+/// What `contact_directory_acquire` handed out, give it back to release.
+/// `index` is NULL until the first swap.
+typedef struct {
+    const ContactIndex *index;
+    uint32_t slot;
+} ContactDirectoryRead;
+
+ContactDirectory *contact_directory_create(void);
+/// Frees the current index too, nobody may be reading
+void contact_directory_destroy(ContactDirectory *directory);
+
+ContactDirectoryRead contact_directory_acquire(ContactDirectory *directory);
+void contact_directory_release(ContactDirectory *directory, ContactDirectoryRead read);
+/// Publishes `index` (owned by the directory from now on), then waits for the
+/// readers of the one it replaces and frees that. Swaps take turns.
+void contact_directory_swap(ContactDirectory *directory, ContactIndex *index);
+
+#endif /* ContactIndex_h */
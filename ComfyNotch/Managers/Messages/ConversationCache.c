@@ -0,0 +1,344 @@
+//
+//  ConversationCache.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/2/25.
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ConversationCache.h"
+#include "Int64Table.h"
+
+/// Starting size of the handle table, doubles at half full
+#define CONVERSATION_TABLE_SIZE 64
+
+typedef struct CachedConversation {
+    int64_t handle_id;
+
+    /// `per_handle` slots, the newest message sits at `head` and older ones
+    /// walk backwards from there
+    ConversationCacheMessage *ring;
+    int head;
+    int count;
+    bool complete;
+    size_t bytes;
+
+    struct CachedConversation *newer;   // towards the most recently used end
+    struct CachedConversation *older;
+} CachedConversation;
+
+struct ConversationCache {
+    pthread_mutex_t lock;
+    size_t budget;
+    int per_handle;
+
+    /// handle_id -> its CachedConversation
+    Int64Table table;
+
+    CachedConversation *most_recent;
+    CachedConversation *least_recent;
+
+    ConversationCacheStats stats;
+};
+
+// MARK: - Handle Table
+
+static CachedConversation *table_get(ConversationCache *cache, int64_t handle_id) {
+    Int64TableSlot *slot = int64_table_find(&cache->table, handle_id);
+    return slot ? slot->pointer : NULL;
+}
+
+static bool table_put(ConversationCache *cache, CachedConversation *conversation) {
+    Int64TableSlot *slot = int64_table_insert(&cache->table, conversation->handle_id, NULL);
+    if (!slot) return false;
+    slot->pointer = conversation;
+    return true;
+}
+
+static void table_remove(ConversationCache *cache, int64_t handle_id) {
+    Int64TableSlot *slot = int64_table_find(&cache->table, handle_id);
+    if (slot) int64_table_remove(&cache->table, slot);
+}
+
+// MARK: - LRU List
+
+static void lru_unlink(ConversationCache *cache, CachedConversation *conversation) {
+    if (conversation->newer) conversation->newer->older = conversation->older;
+    else cache->most_recent = conversation->older;
+
+    if (conversation->older) conversation->older->newer = conversation->newer;
+    else cache->least_recent = conversation->newer;
+
+    conversation->newer = conversation->older = NULL;
+}
+
+static void lru_push_front(ConversationCache *cache, CachedConversation *conversation) {
+    conversation->older = cache->most_recent;
+    conversation->newer = NULL;
+    if (cache->most_recent) cache->most_recent->newer = conversation;
+    cache->most_recent = conversation;
+    if (!cache->least_recent) cache->least_recent = conversation;
+}
+
+static void lru_touch(ConversationCache *cache, CachedConversation *conversation) {
+    if (cache->most_recent == conversation) return;
+    lru_unlink(cache, conversation);
+    lru_push_front(cache, conversation);
+}
+
+// MARK: - Conversations
+
+static size_t conversation_overhead(ConversationCache *cache) {
+    return sizeof(CachedConversation) + (size_t)cache->per_handle * sizeof(ConversationCacheMessage);
+}
+
+static ConversationCacheMessage *slot_at(ConversationCache *cache, CachedConversation *conversation, int age) {
+    int index = (conversation->head - age + cache->per_handle) % cache->per_handle;
+    return &conversation->ring[index];
+}
+
+static void release_slot(ConversationCache *cache, CachedConversation *conversation,
+                         ConversationCacheMessage *slot) {
+    size_t bytes = slot->text ? slot->text_length + 1 : 0;
+    conversation->bytes -= bytes;
+    cache->stats.bytes -= bytes;
+    free((char *)slot->text);
+    memset(slot, 0, sizeof(*slot));
+}
+
+/// Copies `message` into `slot`, the text gets its own NUL terminated buffer
+static bool store_slot(ConversationCache *cache, CachedConversation *conversation,
+                       ConversationCacheMessage *slot, const ConversationCacheMessage *message) {
+    char *text = malloc(message->text_length + 1);
+    if (!text) return false;
+    if (message->text_length) memcpy(text, message->text, message->text_length);
+    text[message->text_length] = '\0';
+
+    *slot = *message;
+    slot->text = text;
+    conversation->bytes += message->text_length + 1;
+    cache->stats.bytes += message->text_length + 1;
+    return true;
+}
+
+static void drop_conversation(ConversationCache *cache, CachedConversation *conversation) {
+    for (int age = 0; age < conversation->count; age++) {
+        release_slot(cache, conversation, slot_at(cache, conversation, age));
+    }
+
+    table_remove(cache, conversation->handle_id);
+    lru_unlink(cache, conversation);
+    cache->stats.bytes -= conversation_overhead(cache);
+    cache->stats.conversations--;
+
+    free(conversation->ring);
+    free(conversation);
+}
+
+/// Evicts from the least recently used end until the budget holds again
+static void enforce_budget(ConversationCache *cache) {
+    while (cache->stats.bytes > cache->budget && cache->least_recent) {
+        drop_conversation(cache, cache->least_recent);
+        cache->stats.evictions++;
+    }
+}
+
+static CachedConversation *create_conversation(ConversationCache *cache, int64_t handle_id) {
+    CachedConversation *conversation = calloc(1, sizeof(CachedConversation));
+    if (!conversation) return NULL;
+
+    conversation->handle_id = handle_id;
+    conversation->ring = calloc((size_t)cache->per_handle, sizeof(ConversationCacheMessage));
+    if (!conversation->ring || !table_put(cache, conversation)) {
+        free(conversation->ring);
+        free(conversation);
+        return NULL;
+    }
+
+    conversation->head = cache->per_handle - 1;
+    lru_push_front(cache, conversation);
+    cache->stats.bytes += conversation_overhead(cache);
+    cache->stats.conversations++;
+    return conversation;
+}
+
+/// Adds `message` as the newest, pushing the oldest out once the ring is full
+static bool push_front(ConversationCache *cache, CachedConversation *conversation,
+                       const ConversationCacheMessage *message) {
+    int next = (conversation->head + 1) % cache->per_handle;
+    ConversationCacheMessage *slot = &conversation->ring[next];
+
+    if (conversation->count == cache->per_handle) {
+        release_slot(cache, conversation, slot);
+        conversation->count--;
+        conversation->complete = false;
+    }
+    if (!store_slot(cache, conversation, slot, message)) return false;
+
+    conversation->head = next;
+    conversation->count++;
+    return true;
+}
+
+/// (date, ROWID) order, the same key the cursor pages on
+static bool is_newer(const ConversationCacheMessage *a, const ConversationCacheMessage *b) {
+    return a->date > b->date || (a->date == b->date && a->rowid > b->rowid);
+}
+
+// MARK: - Public API
+
+ConversationCache *conversation_cache_create(size_t budget_bytes, int per_handle) {
+    if (per_handle <= 0) return NULL;
+
+    ConversationCache *cache = calloc(1, sizeof(ConversationCache));
+    if (!cache) return NULL;
+
+    if (!int64_table_init(&cache->table, CONVERSATION_TABLE_SIZE)) {
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->budget = budget_bytes;
+    cache->per_handle = per_handle;
+    return cache;
+}
+
+void conversation_cache_destroy(ConversationCache *cache) {
+    if (!cache) return;
+
+    while (cache->least_recent) drop_conversation(cache, cache->least_recent);
+    int64_table_free(&cache->table);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+bool conversation_cache_fill(ConversationCache *cache, int64_t handle_id,
+                             const ConversationCacheMessage *messages, int count, bool complete) {
+    if (!cache || count < 0 || (count > 0 && !messages)) return false;
+
+    pthread_mutex_lock(&cache->lock);
+
+    CachedConversation *existing = table_get(cache, handle_id);
+    if (existing) drop_conversation(cache, existing);
+
+    CachedConversation *conversation = create_conversation(cache, handle_id);
+    bool ok = conversation != NULL;
+
+    /// Keep only the newest `per_handle`, oldest goes in first
+    int keep = count < cache->per_handle ? count : cache->per_handle;
+    for (int i = keep - 1; ok && i >= 0; i--) {
+        ok = push_front(cache, conversation, &messages[i]);
+    }
+
+    if (ok) {
+        conversation->complete = complete && keep == count;
+        enforce_budget(cache);
+        ok = table_get(cache, handle_id) == conversation;
+    } else if (conversation) {
+        drop_conversation(cache, conversation);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return ok;
+}
+
+bool conversation_cache_push(ConversationCache *cache, int64_t handle_id,
+                             const ConversationCacheMessage *message) {
+    if (!cache || !message) return false;
+
+    pthread_mutex_lock(&cache->lock);
+
+    CachedConversation *conversation = table_get(cache, handle_id);
+    if (!conversation) {
+        pthread_mutex_unlock(&cache->lock);
+        return false;
+    }
+
+    bool ok;
+    if (conversation->count == 0 || is_newer(message, slot_at(cache, conversation, 0))) {
+        ok = push_front(cache, conversation, message);
+        if (ok) {
+            cache->stats.pushes++;
+            enforce_budget(cache);
+            ok = table_get(cache, handle_id) == conversation;
+        } else {
+            drop_conversation(cache, conversation);
+            cache->stats.invalidations++;
+        }
+    } else {
+        /// Usually a row the page that filled the ring already had
+        ok = false;
+        for (int age = 0; age < conversation->count; age++) {
+            if (slot_at(cache, conversation, age)->rowid == message->rowid) {
+                ok = true;
+                break;
+            }
+        }
+        if (!ok) {
+            drop_conversation(cache, conversation);
+            cache->stats.invalidations++;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return ok;
+}
+
+bool conversation_cache_contains(ConversationCache *cache, int64_t handle_id) {
+    if (!cache) return false;
+
+    pthread_mutex_lock(&cache->lock);
+    bool found = table_get(cache, handle_id) != NULL;
+    pthread_mutex_unlock(&cache->lock);
+    return found;
+}
+
+void conversation_cache_invalidate(ConversationCache *cache, int64_t handle_id) {
+    if (!cache) return;
+
+    pthread_mutex_lock(&cache->lock);
+    CachedConversation *conversation = table_get(cache, handle_id);
+    if (conversation) {
+        drop_conversation(cache, conversation);
+        cache->stats.invalidations++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int conversation_cache_visit(ConversationCache *cache, int64_t handle_id, int limit,
+                             ConversationCacheVisitor visit, void *userdata) {
+    if (!cache || !visit || limit <= 0) return -1;
+
+    pthread_mutex_lock(&cache->lock);
+
+    CachedConversation *conversation = table_get(cache, handle_id);
+    if (!conversation || (conversation->count < limit && !conversation->complete)) {
+        cache->stats.misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return -1;
+    }
+
+    cache->stats.hits++;
+    lru_touch(cache, conversation);
+
+    int count = conversation->count < limit ? conversation->count : limit;
+    for (int age = 0; age < count; age++) {
+        visit(slot_at(cache, conversation, age), userdata);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return count;
+}
+
+ConversationCacheStats conversation_cache_stats(ConversationCache *cache) {
+    ConversationCacheStats stats = { 0 };
+    if (!cache) return stats;
+
+    pthread_mutex_lock(&cache->lock);
+    stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+    return stats;
+}
@@ -0,0 +1,75 @@
+//
+//  ConversationCache.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/2/25.
+//
+
+#ifndef ConversationCache_h
+#define ConversationCache_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Default budget for the cache a MessagesContext owns
+#define CONVERSATION_CACHE_DEFAULT_BUDGET       (4u << 20)
+#define CONVERSATION_CACHE_DEFAULT_PER_HANDLE   64
+
+/// A message whose body is already decoded to plain UTF-8
+typedef struct {
+    int64_t rowid;
+    int64_t date;
+    bool is_from_me;
+    bool is_read;
+    bool has_attachments;
+    const char *text;       // not NUL terminated on the way in, the cache keeps its own copy
+    size_t text_length;
+} ConversationCacheMessage;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t pushes;            // deltas applied to a cached conversation
+    uint64_t evictions;         // conversations dropped to stay under budget
+    uint64_t invalidations;     // conversations dropped because a delta did not fit
+    size_t bytes;
+    size_t conversations;
+} ConversationCacheStats;
+
+/// Keeps the newest `per_handle` messages of recently opened conversations in
+/// a ring per handle. Conversations are evicted least recently used first once
+/// the whole cache goes over `budget_bytes`. Thread-safe.
+typedef struct ConversationCache ConversationCache;
+
+typedef void (*ConversationCacheVisitor)(const ConversationCacheMessage *message, void *userdata);
+
+ConversationCache *conversation_cache_create(size_t budget_bytes, int per_handle);
+void conversation_cache_destroy(ConversationCache *cache);
+
+/// Replaces what is cached for `handle_id` with `messages`, newest first.
+/// `complete` says these are all the messages the conversation has.
+/// Returns false if the conversation did not fit.
+bool conversation_cache_fill(ConversationCache *cache, int64_t handle_id,
+                             const ConversationCacheMessage *messages, int count, bool complete);
+
+/// O(1) when `message` is the newest of its conversation, which is the case for
+/// new rows. Does nothing if the handle is not cached. A row older than the
+/// ring's head that is not already in it drops the conversation instead.
+/// Returns true if the message is now in the cache.
+bool conversation_cache_push(ConversationCache *cache, int64_t handle_id,
+                             const ConversationCacheMessage *message);
+
+bool conversation_cache_contains(ConversationCache *cache, int64_t handle_id);
+void conversation_cache_invalidate(ConversationCache *cache, int64_t handle_id);
+
+/// Calls `visit` for up to `limit` messages of `handle_id`, newest first, with
+/// the cache locked, and marks the conversation most recently used.
+/// Returns how many were visited, or -1 on a miss: the handle is not cached,
+/// or fewer than `limit` are cached and that is not the whole conversation.
+int conversation_cache_visit(ConversationCache *cache, int64_t handle_id, int limit,
+                             ConversationCacheVisitor visit, void *userdata);
+
+ConversationCacheStats conversation_cache_stats(ConversationCache *cache);
+
+#endif /* ConversationCache_h */
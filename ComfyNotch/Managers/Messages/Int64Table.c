@@ -0,0 +1,105 @@
+//
+//  Int64Table.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#include <stdlib.h>
+#include "Int64Table.h"
+
+#define MIN_CAPACITY 16
+
+static inline size_t slot_of(int64_t key, size_t capacity) {
+    /// splitmix64 finalizer, ROWIDs are sequential and would cluster otherwise
+    uint64_t x = (uint64_t)key;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (size_t)x & (capacity - 1);
+}
+
+bool int64_table_init(Int64Table *table, size_t capacity) {
+    size_t size = MIN_CAPACITY;
+    while (size < capacity) size <<= 1;
+
+    table->slots = malloc(size * sizeof(Int64TableSlot));
+    if (!table->slots) return false;
+    for (size_t i = 0; i < size; i++) table->slots[i].key = INT64_TABLE_EMPTY;
+    table->capacity = size;
+    table->count = 0;
+    return true;
+}
+
+void int64_table_free(Int64Table *table) {
+    if (!table) return;
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = table->count = 0;
+}
+
+Int64TableSlot *int64_table_find(const Int64Table *table, int64_t key) {
+    if (key == INT64_TABLE_EMPTY) return NULL;
+
+    size_t mask = table->capacity - 1;
+    for (size_t i = slot_of(key, table->capacity);; i = (i + 1) & mask) {
+        Int64TableSlot *slot = &table->slots[i];
+        if (slot->key == key) return slot;
+        if (slot->key == INT64_TABLE_EMPTY) return NULL;
+    }
+}
+
+static bool grow(Int64Table *table) {
+    Int64Table grown;
+    if (!int64_table_init(&grown, table->capacity * 2)) return false;
+
+    size_t mask = grown.capacity - 1;
+    for (size_t i = 0; i < table->capacity; i++) {
+        Int64TableSlot *old = &table->slots[i];
+        if (old->key == INT64_TABLE_EMPTY) continue;
+        size_t j = slot_of(old->key, grown.capacity);
+        while (grown.slots[j].key != INT64_TABLE_EMPTY) j = (j + 1) & mask;
+        grown.slots[j] = *old;
+    }
+    grown.count = table->count;
+
+    free(table->slots);
+    *table = grown;
+    return true;
+}
+
+Int64TableSlot *int64_table_insert(Int64Table *table, int64_t key, bool *inserted) {
+    if (key == INT64_TABLE_EMPTY) return NULL;
+    if ((table->count + 1) * 2 > table->capacity && !grow(table)) return NULL;
+
+    size_t mask = table->capacity - 1;
+    size_t i = slot_of(key, table->capacity);
+    while (table->slots[i].key != INT64_TABLE_EMPTY) {
+        if (table->slots[i].key == key) {
+            if (inserted) *inserted = false;
+            return &table->slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    table->slots[i] = (Int64TableSlot){ .key = key };
+    table->count++;
+    if (inserted) *inserted = true;
+    return &table->slots[i];
+}
+
+void int64_table_remove(Int64Table *table, Int64TableSlot *slot) {
+    size_t mask = table->capacity - 1;
+    size_t hole = (size_t)(slot - table->slots);
+    for (size_t i = (hole + 1) & mask; table->slots[i].key != INT64_TABLE_EMPTY; i = (i + 1) & mask) {
+        size_t home = slot_of(table->slots[i].key, table->capacity);
+        /// Moves back unless its home lies cyclically in (hole, i]
+        bool stays = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+        if (stays) continue;
+        table->slots[hole] = table->slots[i];
+        hole = i;
+    }
+    table->slots[hole].key = INT64_TABLE_EMPTY;
+    table->count--;
+}
@@ -0,0 +1,56 @@
+//
+//  Int64Table.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+//  Only included by the C files in this folder.
+//
+
+#ifndef Int64Table_h
+#define Int64Table_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// No ROWID or handle_id is ever this, chat.db keys start at 0
+#define INT64_TABLE_EMPTY INT64_MIN
+
+/// One slot, `key == INT64_TABLE_EMPTY` marks it empty
+typedef struct {
+    int64_t key;
+    union {
+        int64_t value;
+        void *pointer;
+    };
+    uint32_t stamp;     // free for the owner, moves with the slot
+} Int64TableSlot;
+
+/// Linear probing on int64 keys with a power of two capacity, doubled before
+/// it gets more than half full. Removing shifts the probe run back instead of
+/// leaving tombstones, so lookups never slow down with churn.
+///
+/// Slot pointers are only good until the next insert or remove.
+typedef struct {
+    Int64TableSlot *slots;
+    size_t capacity;
+    size_t count;
+} Int64Table;
+
+/// `capacity` is rounded up to a power of two, 16 at least
+bool int64_table_init(Int64Table *table, size_t capacity);
+void int64_table_free(Int64Table *table);
+
+/// NULL if `key` is not in, never allocates
+Int64TableSlot *int64_table_find(const Int64Table *table, int64_t key);
+
+/// The slot for `key`, a new one with `value` 0 if it was not there yet.
+/// NULL only if growing failed or `key` is INT64_TABLE_EMPTY. Never grows
+/// while `count` stays under half of `capacity`.
+Int64TableSlot *int64_table_insert(Int64Table *table, int64_t key, bool *inserted);
+
+/// `slot` must come from this table
+void int64_table_remove(Int64Table *table, Int64TableSlot *slot);
+
+#endif /* Int64Table_h */
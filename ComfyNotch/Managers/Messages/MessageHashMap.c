@@ -5,95 +5,343 @@
 //  Created by Aryan Rogye on 7/7/25.
 //
 
-#include "stdio.h"
 #include "stdlib.h"
 #include "string.h"
 #include "MessageHashMap.h"
 
-/// This is the buckets where we store our hash map entries.
-static HashNode *buckets[HASHMAP_SIZE] = { 0 };
+/// Keys are bump allocated out of blocks this big (bigger keys get their own block)
+#define ARENA_BLOCK_SIZE (64 * 1024)
 
-int getSizeOfBucketsStored(void) {
-    int count = 0;
-    for (int i = 0; i < HASHMAP_SIZE; i++) {
-        HashNode *node = buckets[i];
-        while (node != NULL) {
-            count++;
-            node = node->next;
-        }
+struct HashArenaBlock {
+    HashArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+// MARK: - Hashing
+/// wyhash style: 8 bytes at a time folded through a 64x64 -> 128 bit multiply
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read_tail(const unsigned char *p, size_t len) {
+    uint64_t v = 0;
+    memcpy(&v, p, len);
+    return v;
+}
+
+static uint64_t hash_key(const char *key, size_t len) {
+    static const uint64_t P0 = 0xa0761d6478bd642full;
+    static const uint64_t P1 = 0xe7037ed1a0b428dbull;
+    static const uint64_t P2 = 0x8ebc6af09c88c6e3ull;
+    
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t seed = P0 ^ len;
+    size_t remaining = len;
+    
+    while (remaining >= 16) {
+        seed = hash_mix(read64(p) ^ P1, read64(p + 8) ^ seed);
+        p += 16;
+        remaining -= 16;
     }
     
-    return count;
+    uint64_t a = 0, b = 0;
+    if (remaining > 8) {
+        a = read64(p);
+        b = read_tail(p + 8, remaining - 8);
+    } else {
+        a = read_tail(p, remaining);
+    }
+    
+    uint64_t hash = hash_mix(P1 ^ len, hash_mix(a ^ P1, b ^ seed) ^ P2);
+    return hash ? hash : 1; // 0 is reserved for empty slots
+}
+
+uint64_t message_hashmap_hash(const char *key, size_t len) {
+    return hash_key(key, len);
 }
 
-// MARK: - Function to get the hash index for a given key
-int getHashIndex(const char *key) {
-    unsigned long hash = 5381;
-    int c;
+// MARK: - Arena
+static const char *arena_copy(MessageHashMap *map, const char *key, size_t len) {
+    HashArenaBlock *block = map->arena;
+    size_t needed = len + 1;
     
-    while ((c = *key++)) {
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    if (!block || block->size - block->used < needed) {
+        size_t size = needed > ARENA_BLOCK_SIZE ? needed : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(HashArenaBlock) + size);
+        if (!block) return NULL;
+        block->next = map->arena;
+        block->used = 0;
+        block->size = size;
+        map->arena = block;
     }
     
-    return hash % HASHMAP_SIZE;
-}
-
-// MARK: - Function to put a key -value pair into the hash map
-// NOTE: no hasmap should be replaced, so we must make sure that we handle collisions properly.
-void hashmap_put(const char *key, MessageMeta value) {
-    /// first we get the hashIndex for the key
-    int index = getHashIndex(key);
-    
-    /// See If we get the key something already exists in the hash map
-    HashNode *node = buckets[index];
-    while (node != NULL) {
-        if (strcmp(node->key, key) == 0) {
-            if (node->value.date == value.date) {
-                printf("🟡 Duplicate message insert skipped for key: %s\n", key);
-                return;
-            }
-            if (node->value.date != value.date) {
-                node->value = value;
-            }
-            return;
-        }
-        node = node->next;
+    char *copy = block->data + block->used;
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+    block->used += needed;
+    return copy;
+}
+
+// MARK: - Table
+void message_hashmap_init(MessageHashMap *map, size_t initial_capacity) {
+    size_t capacity = 16;
+    while (capacity < initial_capacity) capacity <<= 1;
+    
+    map->slots = calloc(capacity, sizeof(HashSlot));
+    map->capacity = map->slots ? capacity : 0;
+    map->count = 0;
+    map->arena = NULL;
+}
+
+static HashSlot *find_slot(HashSlot *slots, size_t capacity, uint64_t hash,
+                           const char *key, size_t len) {
+    size_t mask = capacity - 1;
+    size_t index = (size_t)hash & mask;
+    
+    for (;;) {
+        HashSlot *slot = &slots[index];
+        if (slot->hash == 0) return slot;
+        if (slot->hash == hash && slot->key_len == len && memcmp(slot->key, key, len) == 0)
+            return slot;
+        index = (index + 1) & mask;
+    }
+}
+
+static int grow(MessageHashMap *map) {
+    size_t capacity = map->capacity ? map->capacity * 2 : HASHMAP_SIZE;
+    HashSlot *slots = calloc(capacity, sizeof(HashSlot));
+    if (!slots) return -1;
+    
+    /// Keys stay where they are in the arena, only the slots move
+    for (size_t i = 0; i < map->capacity; i++) {
+        HashSlot *old = &map->slots[i];
+        if (old->hash == 0) continue;
+        *find_slot(slots, capacity, old->hash, old->key, old->key_len) = *old;
     }
     
-    /// Create a new node for the key-value pair
-    HashNode *newNode = malloc(sizeof(HashNode));
-    newNode->key = strdup(key);
-    newNode->value = value;
-    newNode->next = buckets[index];
-    buckets[index] = newNode;
+    free(map->slots);
+    map->slots = slots;
+    map->capacity = capacity;
+    return 0;
 }
 
-MessageMeta *hashmap_get(const char *key) {
-    int index = getHashIndex(key);
+// MARK: - Function to put a key -value pair into the map
+// NOTE: no entry should be replaced with the same date, an existing key only gets its value updated
+bool message_hashmap_put(MessageHashMap *map, const char *key, MessageMeta value) {
+    if (!key) return false;
     
-    HashNode *node = buckets[index];
+    /// Keep the load under 70% so linear probe runs stay short
+    if ((map->count + 1) * 10 > map->capacity * 7 && grow(map) != 0)
+        return false;
     
-    while(node != NULL) {
-        if (strcmp(node->key, key) == 0) {
-            return &node->value;
-        }
-        node = node->next;
+    size_t len = strlen(key);
+    uint64_t hash = hash_key(key, len);
+    HashSlot *slot = find_slot(map->slots, map->capacity, hash, key, len);
+    
+    if (slot->hash != 0) {
+        if (slot->value.date != value.date) slot->value = value;
+        return true;
     }
+    
+    const char *copy = arena_copy(map, key, len);
+    if (!copy) return false;
+    
+    slot->hash = hash;
+    slot->key = copy;
+    slot->key_len = (uint32_t)len;
+    slot->value = value;
+    map->count++;
+    return true;
+}
+
+MessageMeta *message_hashmap_get(MessageHashMap *map, const char *key) {
+    if (!key || map->capacity == 0) return NULL;
+    
+    size_t len = strlen(key);
+    HashSlot *slot = find_slot(map->slots, map->capacity, hash_key(key, len), key, len);
+    
     /// Not Found
-    return NULL;
-}
-
-void hashmap_free(void) {
-    for (int i = 0; i < HASHMAP_SIZE; i++) {
-        HashNode *node = buckets[i];
-        while (node != NULL) {
-            HashNode *next = node->next;
-            
-            free(node->key);  // strdup'd key
-            free(node);       // node itself
-            
-            node = next;
+    return slot->hash ? &slot->value : NULL;
+}
+
+void message_hashmap_free(MessageHashMap *map) {
+    HashArenaBlock *block = map->arena;
+    while (block != NULL) {
+        HashArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    
+    free(map->slots);
+    map->slots = NULL;
+    map->capacity = 0;
+    map->count = 0;
+    map->arena = NULL;
+}
+
+MessageHashMapStats message_hashmap_stats(const MessageHashMap *map) {
+    MessageHashMapStats stats = {
+        .count = map->count,
+        .capacity = map->capacity,
+        .bytes = map->capacity * sizeof(HashSlot),
+    };
+    
+    size_t mask = map->capacity - 1;
+    size_t probes = 0;
+    for (size_t i = 0; i < map->capacity; i++) {
+        const HashSlot *slot = &map->slots[i];
+        if (slot->hash == 0) continue;
+        /// Distance from the home slot, wrapping around the end of the table
+        size_t probe = ((i - ((size_t)slot->hash & mask)) & mask) + 1;
+        probes += probe;
+        if (probe > stats.max_probe) stats.max_probe = probe;
+    }
+    if (map->count) stats.mean_probe = (double)probes / map->count;
+    
+    for (const HashArenaBlock *block = map->arena; block; block = block->next)
+        stats.bytes += sizeof(HashArenaBlock) + block->size;
+    return stats;
+}
+
+// MARK: - Seen Message Set
+void message_seen_set_init(MessageSeenSet *set) {
+    message_hashmap_init(&set->map, HASHMAP_SIZE);
+    memset(&set->previous, 0, sizeof(set->previous));
+    set->generation_start = 0;
+    set->newest_date = 0;
+    set->window = SEEN_SET_DEFAULT_WINDOW;
+    set->expired = 0;
+    set->has_dates = false;
+    pthread_rwlock_init(&set->lock, NULL);
+}
+
+void message_seen_set_destroy(MessageSeenSet *set) {
+    pthread_rwlock_wrlock(&set->lock);
+    message_hashmap_free(&set->map);
+    message_hashmap_free(&set->previous);
+    pthread_rwlock_unlock(&set->lock);
+    pthread_rwlock_destroy(&set->lock);
+}
+
+/// Checks both generations, call with the lock held either way
+static MessageMeta *seen_set_find(MessageSeenSet *set, const char *key) {
+    MessageMeta *meta = message_hashmap_get(&set->map, key);
+    return meta ? meta : message_hashmap_get(&set->previous, key);
+}
+
+/// The window in the units of `date`: chat.db dates are nanoseconds since
+/// 2001, databases from before High Sierra stored seconds
+static int64_t window_span(int64_t window, int64_t date) {
+    return date > 1000000000000LL ? window * 1000000000LL : window;
+}
+
+/// Starts a new generation once `date` is a window past the current one's start
+static void seen_set_rotate(MessageSeenSet *set, int64_t date) {
+    if (!set->has_dates) {
+        set->generation_start = set->newest_date = date;
+        set->has_dates = true;
+        return;
+    }
+    if (date > set->newest_date) set->newest_date = date;
+    if (set->window <= 0) return;
+    
+    int64_t span = window_span(set->window, date);
+    if (date - set->generation_start < span) return;
+    
+    set->expired += set->previous.count;
+    message_hashmap_free(&set->previous);
+    if (date - set->generation_start >= 2 * span) {
+        /// Quiet for two windows, the current generation is stale too
+        set->expired += set->map.count;
+        message_hashmap_free(&set->map);
+    } else {
+        set->previous = set->map;
+    }
+    message_hashmap_init(&set->map, HASHMAP_SIZE);
+    set->generation_start = date;
+}
+
+bool message_seen_set_get(MessageSeenSet *set, const char *key, MessageMeta *out) {
+    pthread_rwlock_rdlock(&set->lock);
+    MessageMeta *meta = seen_set_find(set, key);
+    if (meta && out) *out = *meta;
+    pthread_rwlock_unlock(&set->lock);
+    return meta != NULL;
+}
+
+bool message_seen_set_insert(MessageSeenSet *set, const char *key, MessageMeta value) {
+    /// Most GUIDs we are asked about are already known, settle those under the shared lock
+    if (message_seen_set_get(set, key, NULL)) return false;
+    
+    pthread_rwlock_wrlock(&set->lock);
+    bool inserted = seen_set_find(set, key) == NULL;
+    if (inserted) {
+        seen_set_rotate(set, value.date);
+        inserted = message_hashmap_put(&set->map, key, value);
+    }
+    pthread_rwlock_unlock(&set->lock);
+    return inserted;
+}
+
+size_t message_seen_set_count(MessageSeenSet *set) {
+    pthread_rwlock_rdlock(&set->lock);
+    size_t count = set->map.count + set->previous.count;
+    pthread_rwlock_unlock(&set->lock);
+    return count;
+}
+
+void message_seen_set_set_window(MessageSeenSet *set, int64_t window) {
+    pthread_rwlock_wrlock(&set->lock);
+    set->window = window > 0 ? window : 0;
+    pthread_rwlock_unlock(&set->lock);
+}
+
+int64_t message_seen_set_cutoff(MessageSeenSet *set) {
+    pthread_rwlock_rdlock(&set->lock);
+    int64_t cutoff = INT64_MIN;
+    if (set->has_dates && set->window > 0)
+        cutoff = set->newest_date - window_span(set->window, set->newest_date);
+    pthread_rwlock_unlock(&set->lock);
+    return cutoff;
+}
+
+uint64_t message_seen_set_expired(MessageSeenSet *set) {
+    pthread_rwlock_rdlock(&set->lock);
+    uint64_t expired = set->expired;
+    pthread_rwlock_unlock(&set->lock);
+    return expired;
+}
+
+void message_seen_set_each(MessageSeenSet *set, MessageSeenSetVisitor visit, void *userdata) {
+    pthread_rwlock_rdlock(&set->lock);
+    const MessageHashMap *generations[] = { &set->map, &set->previous };
+    for (int g = 0; g < 2; g++) {
+        for (size_t i = 0; i < generations[g]->capacity; i++) {
+            const HashSlot *slot = &generations[g]->slots[i];
+            if (slot->hash) visit(slot->key, slot->key_len, slot->value, userdata);
         }
-        buckets[i] = NULL; // clear bucket
     }
+    pthread_rwlock_unlock(&set->lock);
+}
+
+MessageHashMapStats message_seen_set_stats(MessageSeenSet *set) {
+    pthread_rwlock_rdlock(&set->lock);
+    MessageHashMapStats stats = message_hashmap_stats(&set->map);
+    MessageHashMapStats previous = message_hashmap_stats(&set->previous);
+    pthread_rwlock_unlock(&set->lock);
+    
+    /// Probe lengths are the current generation's, it is the one taking inserts
+    stats.count += previous.count;
+    stats.capacity += previous.capacity;
+    stats.bytes += previous.bytes;
+    return stats;
 }
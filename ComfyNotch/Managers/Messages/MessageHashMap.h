@@ -8,19 +8,99 @@
 #ifndef MessageHashMap_h
 #define MessageHashMap_h
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "MessageMeta.h"
 
+/// Starting slot count, the table doubles whenever it gets 70% full
 #define HASHMAP_SIZE 1024
 
-typedef struct HashNode {
-    char *key;
+/// One open addressing slot, `hash == 0` marks it empty
+typedef struct {
+    uint64_t hash;
+    const char *key;        // points into the map's arena
+    uint32_t key_len;
     MessageMeta value;
-    struct HashNode *next;
-} HashNode;
+} HashSlot;
 
-int getSizeOfBucketsStored(void);
-void hashmap_put(const char *key, MessageMeta value);
-MessageMeta *hashmap_get(const char *key);
-void hashmap_free(void);
+typedef struct HashArenaBlock HashArenaBlock;
+
+/// Linear probing table with a power of two capacity. Keys are copied into a
+/// bump arena so inserting never mallocs per key, and freeing is one pass over
+/// the arena blocks.
+typedef struct {
+    HashSlot *slots;
+    size_t capacity;
+    size_t count;
+    HashArenaBlock *arena;
+} MessageHashMap;
+
+/// Never 0, which marks an empty slot. Shared with SeenSnapshot so its file can be probed the same way.
+uint64_t message_hashmap_hash(const char *key, size_t len);
+
+void message_hashmap_init(MessageHashMap *map, size_t initial_capacity);
+/// False if `key` is NULL or growing the table or the arena failed, the map
+/// is left as it was then
+bool message_hashmap_put(MessageHashMap *map, const char *key, MessageMeta value);
+MessageMeta *message_hashmap_get(MessageHashMap *map, const char *key);
+void message_hashmap_free(MessageHashMap *map);
+
+typedef struct {
+    size_t count;
+    size_t capacity;
+    double mean_probe;      // slots looked at to find a key, 1 is perfect
+    size_t max_probe;
+    size_t bytes;           // slots plus key arena
+} MessageHashMapStats;
+
+/// Walks the whole table, meant for diagnostics and not the hot path
+MessageHashMapStats message_hashmap_stats(const MessageHashMap *map);
+
+/// How long a GUID is remembered by default, measured on message dates
+#define SEEN_SET_DEFAULT_WINDOW (7 * 24 * 60 * 60)
+
+/// Thread-safe seen-message set, lookups share a reader lock so any number of
+/// threads can check GUIDs at once while inserts take the writer side.
+/// Values are copied out because a resize can move the slot under a reader.
+///
+/// Memory is bounded by expiring on message date: GUIDs go into the current
+/// generation, and once a message `window` newer than the generation's start
+/// arrives the previous generation is freed whole and the current one takes
+/// its place. Every GUID within `window` of the newest date is kept, older
+/// ones are gone after at most two windows. The ROWID watermark already keeps
+/// old rows from being handed out again, so nothing past the window is needed.
+typedef struct {
+    MessageHashMap map;             // current generation
+    MessageHashMap previous;
+    int64_t generation_start;       // message date the current generation began at
+    int64_t newest_date;
+    int64_t window;                 // seconds, 0 keeps everything
+    uint64_t expired;               // GUIDs dropped with old generations
+    bool has_dates;
+    pthread_rwlock_t lock;
+} MessageSeenSet;
+
+void message_seen_set_init(MessageSeenSet *set);
+void message_seen_set_destroy(MessageSeenSet *set);
+bool message_seen_set_get(MessageSeenSet *set, const char *key, MessageMeta *out);
+/// Returns true if `key` was not in the set yet and now is (check and insert
+/// are one step), false if it already was or could not be added
+bool message_seen_set_insert(MessageSeenSet *set, const char *key, MessageMeta value);
+size_t message_seen_set_count(MessageSeenSet *set);
+
+/// Changes the expiry window (seconds), 0 turns expiry off
+void message_seen_set_set_window(MessageSeenSet *set, int64_t window);
+/// Oldest message date still inside the window, in the same units as the
+/// dates inserted, or INT64_MIN while nothing can have expired yet
+int64_t message_seen_set_cutoff(MessageSeenSet *set);
+/// GUIDs dropped with old generations so far
+uint64_t message_seen_set_expired(MessageSeenSet *set);
+
+typedef void (*MessageSeenSetVisitor)(const char *key, size_t length, MessageMeta value, void *userdata);
+/// Calls `visit` for every entry under the reader lock, don't insert from it
+void message_seen_set_each(MessageSeenSet *set, MessageSeenSetVisitor visit, void *userdata);
+MessageHashMapStats message_seen_set_stats(MessageSeenSet *set);
 
 #endif
@@ -0,0 +1,644 @@
+//
+//  MessageSearch.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/4/25.
+//
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MessageSearch.h"
+
+#define SEARCH_MAGIC        "CNSRCH01"
+#define SEARCH_VERSION      1
+
+/// Postings kept in memory before the file is rewritten with them merged in.
+/// Large enough that the first build over a long history only rewrites a few times.
+#define SEARCH_TAIL_MAX_POSTINGS    (4u << 20)
+
+/// Trigrams of a message read without allocating, longer ones go to the heap
+#define SEARCH_STACK_TRIGRAMS       512
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t db_identity;
+    int64_t watermark;
+    uint64_t doc_count;
+    uint64_t trigram_count;
+    uint64_t postings_size;
+    uint64_t checksum;      // of every field above
+} SearchHeader;
+
+/// One trigram of the file, sorted by trigram. Its postings are `size` bytes
+/// at `offset`: `count` ordinals, each the varint delta from the one before.
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint32_t last;          // last ordinal, where the tail's deltas continue from
+    uint32_t size;
+    uint64_t offset;
+} SearchDirEntry;
+
+/// Ordinals of one trigram not in the file yet, `capacity` 0 marks a free slot
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *ordinals;
+} SearchTailList;
+
+struct MessageSearch {
+    char *path;
+    uint64_t db_identity;
+
+    /// The file, NULL while it has no documents
+    void *map;
+    size_t map_size;
+    const MessageSearchDoc *docs;
+    size_t doc_count;
+    const SearchDirEntry *dir;
+    size_t trigram_count;
+    const uint8_t *postings;
+    size_t postings_size;
+
+    /// Newer documents, their ordinals continue after the file's
+    MessageSearchDoc *tail_docs;
+    size_t tail_doc_count;
+    size_t tail_doc_capacity;
+
+    /// Open addressing on the trigram, power of two sized
+    SearchTailList *lists;
+    size_t list_capacity;
+    size_t list_count;
+    size_t tail_postings;
+
+    int64_t file_watermark;
+    int64_t watermark;
+};
+
+static uint64_t header_checksum(const SearchHeader *header) {
+    /// FNV-1a, only guards against a torn or foreign file
+    const unsigned char *bytes = (const unsigned char *)header;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < offsetof(SearchHeader, checksum); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static inline unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/// Every distinct trigram of `text`, sorted. Returns the count, `*out` is
+/// `stack` unless the text needed more room; free it if it is not.
+static size_t extract_trigrams(const char *text, size_t length, uint32_t *stack, uint32_t **out) {
+    *out = stack;
+    if (length < MESSAGE_SEARCH_MIN_QUERY) return 0;
+
+    size_t count = length - 2;
+    uint32_t *trigrams = stack;
+    if (count > SEARCH_STACK_TRIGRAMS) {
+        trigrams = malloc(count * sizeof(uint32_t));
+        if (!trigrams) return 0;
+        *out = trigrams;
+    }
+
+    const unsigned char *bytes = (const unsigned char *)text;
+    uint32_t trigram = (uint32_t)fold(bytes[0]) << 8 | fold(bytes[1]);
+    for (size_t i = 0; i < count; i++) {
+        trigram = (trigram << 8 | fold(bytes[i + 2])) & 0xFFFFFF;
+        trigrams[i] = trigram;
+    }
+
+    qsort(trigrams, count, sizeof(uint32_t), compare_u32);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (unique == 0 || trigrams[unique - 1] != trigrams[i]) trigrams[unique++] = trigrams[i];
+    }
+    return unique;
+}
+
+// MARK: - Varints
+
+static size_t put_varint(uint8_t *out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/// Appends the ordinals of one file entry to `out`, false if the bytes are bad
+static bool decode_entry(const MessageSearch *search, const SearchDirEntry *entry, uint32_t *out) {
+    if (entry->offset + entry->size > search->postings_size) return false;
+
+    const uint8_t *p = search->postings + entry->offset;
+    const uint8_t *end = p + entry->size;
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < entry->count; i++) {
+        uint32_t delta = 0;
+        for (int shift = 0;; shift += 7) {
+            if (p == end || shift > 28) return false;
+            uint8_t byte = *p++;
+            delta |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        value += delta;
+        out[i] = value;
+    }
+    return true;
+}
+
+// MARK: - Tail
+
+static uint32_t hash_trigram(uint32_t trigram) {
+    /// Multiplying leaves the low bits weak and the table masks them off, so fold the high ones in
+    uint32_t hash = trigram * 2654435761u;
+    return hash ^ (hash >> 16);
+}
+
+static SearchTailList *tail_find(const MessageSearch *search, uint32_t trigram) {
+    if (search->list_capacity == 0) return NULL;
+
+    size_t mask = search->list_capacity - 1;
+    for (size_t i = hash_trigram(trigram) & mask;; i = (i + 1) & mask) {
+        SearchTailList *list = &search->lists[i];
+        if (list->capacity == 0) return NULL;
+        if (list->trigram == trigram) return list;
+    }
+}
+
+static bool tail_grow_table(MessageSearch *search) {
+    size_t capacity = search->list_capacity ? search->list_capacity * 2 : 1024;
+    SearchTailList *lists = calloc(capacity, sizeof(SearchTailList));
+    if (!lists) return false;
+
+    for (size_t i = 0; i < search->list_capacity; i++) {
+        SearchTailList *old = &search->lists[i];
+        if (old->capacity == 0) continue;
+        size_t j = hash_trigram(old->trigram) & (capacity - 1);
+        while (lists[j].capacity != 0) j = (j + 1) & (capacity - 1);
+        lists[j] = *old;
+    }
+
+    free(search->lists);
+    search->lists = lists;
+    search->list_capacity = capacity;
+    return true;
+}
+
+static bool tail_append(MessageSearch *search, uint32_t trigram, uint32_t ordinal) {
+    SearchTailList *list = tail_find(search, trigram);
+    if (!list) {
+        /// Kept under 3/4 full so probes stay short
+        if ((search->list_count + 1) * 4 > search->list_capacity * 3 && !tail_grow_table(search)) {
+            return false;
+        }
+        size_t mask = search->list_capacity - 1;
+        size_t i = hash_trigram(trigram) & mask;
+        while (search->lists[i].capacity != 0) i = (i + 1) & mask;
+
+        list = &search->lists[i];
+        list->ordinals = malloc(4 * sizeof(uint32_t));
+        if (!list->ordinals) return false;
+        list->trigram = trigram;
+        list->count = 0;
+        list->capacity = 4;
+        search->list_count++;
+    } else if (list->count == list->capacity) {
+        uint32_t *grown = realloc(list->ordinals, list->capacity * 2 * sizeof(uint32_t));
+        if (!grown) return false;
+        list->ordinals = grown;
+        list->capacity *= 2;
+    }
+
+    list->ordinals[list->count++] = ordinal;
+    search->tail_postings++;
+    return true;
+}
+
+static void tail_clear(MessageSearch *search) {
+    for (size_t i = 0; i < search->list_capacity; i++) free(search->lists[i].ordinals);
+    free(search->lists);
+    search->lists = NULL;
+    search->list_capacity = 0;
+    search->list_count = 0;
+    search->tail_postings = 0;
+    search->tail_doc_count = 0;
+}
+
+// MARK: - File
+
+static void unmap(MessageSearch *search) {
+    if (search->map) munmap(search->map, search->map_size);
+    search->map = NULL;
+    search->map_size = 0;
+    search->docs = NULL;
+    search->doc_count = 0;
+    search->dir = NULL;
+    search->trigram_count = 0;
+    search->postings = NULL;
+    search->postings_size = 0;
+}
+
+/// Maps the file at `search->path` if it is a valid index of our database
+static bool map_file(MessageSearch *search) {
+    int fd = open(search->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    SearchHeader header;
+    bool valid = fstat(fd, &st) == 0 &&
+                 (size_t)st.st_size >= sizeof(header) &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 memcmp(header.magic, SEARCH_MAGIC, 8) == 0 &&
+                 header.version == SEARCH_VERSION &&
+                 header.checksum == header_checksum(&header) &&
+                 header.db_identity == search->db_identity &&
+                 (uint64_t)st.st_size == sizeof(header) +
+                                         header.doc_count * sizeof(MessageSearchDoc) +
+                                         header.trigram_count * sizeof(SearchDirEntry) +
+                                         header.postings_size;
+    if (!valid) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    unmap(search);
+    const char *base = map;
+    search->map = map;
+    search->map_size = (size_t)st.st_size;
+    search->docs = (const MessageSearchDoc *)(base + sizeof(header));
+    search->doc_count = header.doc_count;
+    search->dir = (const SearchDirEntry *)(base + sizeof(header) + header.doc_count * sizeof(MessageSearchDoc));
+    search->trigram_count = header.trigram_count;
+    search->postings = (const uint8_t *)(search->dir + header.trigram_count);
+    search->postings_size = header.postings_size;
+    search->file_watermark = header.watermark;
+    search->watermark = header.watermark;
+    return true;
+}
+
+static int compare_tail_lists(const void *a, const void *b) {
+    const SearchTailList *x = *(SearchTailList *const *)a, *y = *(SearchTailList *const *)b;
+    return x->trigram < y->trigram ? -1 : x->trigram > y->trigram;
+}
+
+/// Writes the tail ordinals of `list` continuing from `previous`, returns the bytes written
+static bool write_tail_postings(FILE *file, const SearchTailList *list, uint32_t previous, uint32_t *size) {
+    uint8_t buffer[4096];
+    size_t used = 0;
+    *size = 0;
+    for (uint32_t i = 0; i < list->count; i++) {
+        if (used + 5 > sizeof(buffer)) {
+            if (fwrite(buffer, 1, used, file) != used) return false;
+            *size += (uint32_t)used;
+            used = 0;
+        }
+        used += put_varint(buffer + used, list->ordinals[i] - previous);
+        previous = list->ordinals[i];
+    }
+    *size += (uint32_t)used;
+    return fwrite(buffer, 1, used, file) == used;
+}
+
+/// Writes the file and the tail merged into a temp file and renames it over the
+/// index, so a reader never maps a half written file. The tail's ordinals are
+/// all above the file's, so each trigram is the file's bytes followed by the tail's.
+static bool write_merged(MessageSearch *search) {
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", search->path);
+
+    SearchTailList **tail = malloc((search->list_count + 1) * sizeof(SearchTailList *));
+    SearchDirEntry *dir = malloc((search->trigram_count + search->list_count + 1) * sizeof(SearchDirEntry));
+    FILE *file = fopen(tmp_path, "wb");
+    bool ok = tail && dir && file;
+
+    size_t tail_count = 0;
+    for (size_t i = 0; ok && i < search->list_capacity; i++) {
+        if (search->lists[i].capacity != 0) tail[tail_count++] = &search->lists[i];
+    }
+    if (ok) qsort(tail, tail_count, sizeof(SearchTailList *), compare_tail_lists);
+
+    SearchHeader header = { 0 };
+    memcpy(header.magic, SEARCH_MAGIC, 8);
+    header.version = SEARCH_VERSION;
+    header.db_identity = search->db_identity;
+    header.watermark = search->watermark;
+    header.doc_count = search->doc_count + search->tail_doc_count;
+
+    /// Documents, then room for the directory, which is only known once the postings are out
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(search->docs, sizeof(MessageSearchDoc), search->doc_count, file) == search->doc_count &&
+         fwrite(search->tail_docs, sizeof(MessageSearchDoc), search->tail_doc_count, file) == search->tail_doc_count;
+
+    size_t merged_count = 0;
+    {
+        size_t i = 0, j = 0;
+        while (i < search->trigram_count || j < tail_count) {
+            uint32_t a = i < search->trigram_count ? search->dir[i].trigram : UINT32_MAX;
+            uint32_t b = j < tail_count ? tail[j]->trigram : UINT32_MAX;
+            if (a <= b) i++;
+            if (b <= a) j++;
+            merged_count++;
+        }
+    }
+    long postings_start = (long)(sizeof(header) + header.doc_count * sizeof(MessageSearchDoc) +
+                                 merged_count * sizeof(SearchDirEntry));
+    ok = ok && fseek(file, postings_start, SEEK_SET) == 0;
+
+    uint64_t offset = 0;
+    size_t i = 0, j = 0, n = 0;
+    while (ok && (i < search->trigram_count || j < tail_count)) {
+        const SearchDirEntry *old = i < search->trigram_count ? &search->dir[i] : NULL;
+        const SearchTailList *added = j < tail_count ? tail[j] : NULL;
+        if (old && added && old->trigram != added->trigram) {
+            if (old->trigram < added->trigram) added = NULL;
+            else old = NULL;
+        }
+
+        SearchDirEntry *entry = &dir[n++];
+        *entry = (SearchDirEntry){ .trigram = old ? old->trigram : added->trigram, .offset = offset };
+        if (old) {
+            ok = old->offset + old->size <= search->postings_size &&
+                 fwrite(search->postings + old->offset, 1, old->size, file) == old->size;
+            entry->count = old->count;
+            entry->last = old->last;
+            entry->size = old->size;
+            i++;
+        }
+        if (ok && added) {
+            uint32_t size;
+            ok = write_tail_postings(file, added, old ? old->last : 0, &size);
+            entry->count += added->count;
+            entry->last = added->ordinals[added->count - 1];
+            entry->size += size;
+            j++;
+        }
+        offset += entry->size;
+    }
+
+    header.trigram_count = n;
+    header.postings_size = offset;
+    header.checksum = header_checksum(&header);
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fseek(file, (long)(sizeof(header) + header.doc_count * sizeof(MessageSearchDoc)), SEEK_SET) == 0 &&
+         fwrite(dir, sizeof(SearchDirEntry), n, file) == n;
+
+    if (file) ok = fclose(file) == 0 && ok;
+    free(tail);
+    free(dir);
+    if (!ok || rename(tmp_path, search->path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+
+    tail_clear(search);
+    return map_file(search);
+}
+
+// MARK: - API
+
+MessageSearch *message_search_open(const char *path, uint64_t db_identity) {
+    if (!path) return NULL;
+
+    MessageSearch *search = calloc(1, sizeof(MessageSearch));
+    if (!search) return NULL;
+
+    search->path = strdup(path);
+    if (!search->path) {
+        free(search);
+        return NULL;
+    }
+    search->db_identity = db_identity;
+
+    /// A missing or stale file just means an empty index that needs building
+    map_file(search);
+    return search;
+}
+
+void message_search_close(MessageSearch *search) {
+    if (!search) return;
+
+    message_search_flush(search);
+    unmap(search);
+    tail_clear(search);
+    free(search->tail_docs);
+    free(search->path);
+    free(search);
+}
+
+int64_t message_search_watermark(MessageSearch *search) {
+    return search ? search->watermark : 0;
+}
+
+size_t message_search_doc_count(MessageSearch *search) {
+    return search ? search->doc_count + search->tail_doc_count : 0;
+}
+
+bool message_search_flush(MessageSearch *search) {
+    if (!search) return false;
+    if (search->tail_doc_count == 0 && search->watermark == search->file_watermark) return true;
+    return write_merged(search);
+}
+
+void message_search_clear(MessageSearch *search) {
+    if (!search) return;
+
+    unmap(search);
+    tail_clear(search);
+    unlink(search->path);
+    search->file_watermark = search->watermark = 0;
+}
+
+bool message_search_add(MessageSearch *search, const MessageSearchDoc *doc,
+                        const char *text, size_t length) {
+    if (!search || !doc) return false;
+    if (doc->rowid <= search->watermark) return true;
+
+    uint32_t stack[SEARCH_STACK_TRIGRAMS];
+    uint32_t *trigrams;
+    size_t count = extract_trigrams(text, text ? length : 0, stack, &trigrams);
+
+    bool ok = true;
+    if (count > 0) {
+        if (search->tail_doc_count == search->tail_doc_capacity) {
+            size_t capacity = search->tail_doc_capacity ? search->tail_doc_capacity * 2 : 256;
+            MessageSearchDoc *grown = realloc(search->tail_docs, capacity * sizeof(MessageSearchDoc));
+            ok = grown != NULL;
+            if (ok) {
+                search->tail_docs = grown;
+                search->tail_doc_capacity = capacity;
+            }
+        }
+
+        uint32_t ordinal = (uint32_t)(search->doc_count + search->tail_doc_count);
+        for (size_t i = 0; ok && i < count; i++) ok = tail_append(search, trigrams[i], ordinal);
+
+        /// A document half in the tail would never match, so give up on the whole tail
+        if (!ok) {
+            tail_clear(search);
+            search->watermark = search->file_watermark;
+        } else {
+            search->tail_docs[search->tail_doc_count++] = *doc;
+        }
+    }
+    if (trigrams != stack) free(trigrams);
+    if (!ok) return false;
+
+    search->watermark = doc->rowid;
+    if (search->tail_postings >= SEARCH_TAIL_MAX_POSTINGS) return message_search_flush(search);
+    return true;
+}
+
+/// Every ordinal of `trigram`, file then tail. Returns the count, or -1 on a bad file.
+static int64_t collect_ordinals(MessageSearch *search, uint32_t trigram, uint32_t **out) {
+    const SearchDirEntry *entry = NULL;
+    size_t low = 0, high = search->trigram_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (search->dir[mid].trigram < trigram) low = mid + 1;
+        else high = mid;
+    }
+    if (low < search->trigram_count && search->dir[low].trigram == trigram) entry = &search->dir[low];
+    const SearchTailList *list = tail_find(search, trigram);
+
+    size_t file_count = entry ? entry->count : 0;
+    size_t tail_count = list ? list->count : 0;
+    *out = NULL;
+    if (file_count + tail_count == 0) return 0;
+
+    uint32_t *ordinals = malloc((file_count + tail_count) * sizeof(uint32_t));
+    if (!ordinals) return -1;
+    if (entry && !decode_entry(search, entry, ordinals)) {
+        free(ordinals);
+        return -1;
+    }
+    if (list) memcpy(ordinals + file_count, list->ordinals, tail_count * sizeof(uint32_t));
+
+    *out = ordinals;
+    return (int64_t)(file_count + tail_count);
+}
+
+/// Postings length of `trigram` without decoding anything
+static size_t posting_count(MessageSearch *search, uint32_t trigram) {
+    size_t count = 0;
+    size_t low = 0, high = search->trigram_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (search->dir[mid].trigram < trigram) low = mid + 1;
+        else high = mid;
+    }
+    if (low < search->trigram_count && search->dir[low].trigram == trigram) count = search->dir[low].count;
+    const SearchTailList *list = tail_find(search, trigram);
+    return count + (list ? list->count : 0);
+}
+
+typedef struct {
+    uint32_t trigram;
+    size_t count;
+} QueryTrigram;
+
+static int compare_query_trigrams(const void *a, const void *b) {
+    size_t x = ((const QueryTrigram *)a)->count, y = ((const QueryTrigram *)b)->count;
+    return x < y ? -1 : x > y;
+}
+
+int message_search_each(MessageSearch *search, const char *query, size_t length,
+                        MessageSearchVisitor visit, void *userdata) {
+    if (!search || !query || !visit) return -1;
+
+    uint32_t stack[SEARCH_STACK_TRIGRAMS];
+    uint32_t *trigrams;
+    size_t count = extract_trigrams(query, length, stack, &trigrams);
+    if (count == 0) return 0;
+
+    /// Rarest first, so the candidate list starts short and only shrinks
+    QueryTrigram *order = malloc(count * sizeof(QueryTrigram));
+    if (!order) {
+        if (trigrams != stack) free(trigrams);
+        return -1;
+    }
+    bool empty = false;
+    for (size_t i = 0; i < count; i++) {
+        order[i].trigram = trigrams[i];
+        order[i].count = posting_count(search, trigrams[i]);
+        empty = empty || order[i].count == 0;
+    }
+    if (trigrams != stack) free(trigrams);
+    if (empty) {
+        free(order);
+        return 0;
+    }
+    qsort(order, count, sizeof(QueryTrigram), compare_query_trigrams);
+
+    uint32_t *candidates;
+    int64_t candidate_count = collect_ordinals(search, order[0].trigram, &candidates);
+    for (size_t t = 1; candidate_count > 0 && t < count; t++) {
+        uint32_t *other;
+        int64_t other_count = collect_ordinals(search, order[t].trigram, &other);
+        if (other_count < 0) {
+            candidate_count = -1;
+            break;
+        }
+
+        int64_t kept = 0, j = 0;
+        for (int64_t i = 0; i < candidate_count && j < other_count; i++) {
+            while (j < other_count && other[j] < candidates[i]) j++;
+            if (j < other_count && other[j] == candidates[i]) candidates[kept++] = candidates[i];
+        }
+        candidate_count = kept;
+        free(other);
+    }
+    free(order);
+
+    int visited = 0;
+    for (int64_t i = candidate_count - 1; i >= 0; i--) {
+        uint32_t ordinal = candidates[i];
+        const MessageSearchDoc *doc = ordinal < search->doc_count
+            ? &search->docs[ordinal]
+            : &search->tail_docs[ordinal - search->doc_count];
+        visited++;
+        if (!visit(doc, userdata)) break;
+    }
+
+    free(candidates);
+    return candidate_count < 0 ? -1 : visited;
+}
+
+bool message_search_matches(const char *text, size_t length, const char *query, size_t query_length) {
+    if (query_length == 0) return true;
+    if (!text || length < query_length) return false;
+
+    const unsigned char *t = (const unsigned char *)text;
+    const unsigned char *q = (const unsigned char *)query;
+    unsigned char first = fold(q[0]);
+    for (size_t i = 0; i + query_length <= length; i++) {
+        if (fold(t[i]) != first) continue;
+        size_t k = 1;
+        while (k < query_length && fold(t[i + k]) == fold(q[k])) k++;
+        if (k == query_length) return true;
+    }
+    return false;
+}
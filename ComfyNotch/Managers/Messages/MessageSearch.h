@@ -0,0 +1,70 @@
+//
+//  MessageSearch.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/4/25.
+//
+
+#ifndef MessageSearch_h
+#define MessageSearch_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Trigram inverted index over decoded message text, kept in our caches folder
+/// next to the sidecar index. Every message gets an ordinal in ROWID order and
+/// each trigram (three bytes, ASCII folded to lower case) maps to the ordinals
+/// that contain it, delta + varint encoded. The file is memory mapped; newer
+/// messages go into an in-memory tail that is merged into the file when it
+/// grows large, so extending it never re-reads old messages.
+///
+/// Lookups only narrow things down: a message holding every trigram of the
+/// query does not have to hold the query, callers check the text themselves.
+///
+/// Not thread-safe, the MessagesContext that owns one only touches it locked.
+typedef struct {
+    int64_t rowid;
+    int64_t handle_id;
+    int64_t date;
+} MessageSearchDoc;
+
+typedef struct MessageSearch MessageSearch;
+
+/// Shortest query the index can answer, anything shorter has no trigram
+#define MESSAGE_SEARCH_MIN_QUERY 3
+
+/// Maps `path` if it holds an index of the database identified by
+/// `db_identity`, otherwise starts empty (watermark 0) and the caller builds it.
+MessageSearch *message_search_open(const char *path, uint64_t db_identity);
+
+/// Merges anything pending into the file and unmaps it
+void message_search_close(MessageSearch *search);
+
+/// Highest message ROWID the index has seen
+int64_t message_search_watermark(MessageSearch *search);
+size_t message_search_doc_count(MessageSearch *search);
+
+/// Indexes `text` of a row newer than the watermark, anything older is already
+/// in and ignored. Rows without text only move the watermark.
+bool message_search_add(MessageSearch *search, const MessageSearchDoc *doc,
+                        const char *text, size_t length);
+
+/// Writes the in-memory tail into the file now
+bool message_search_flush(MessageSearch *search);
+
+/// Drops everything, for when chat.db was replaced under us
+void message_search_clear(MessageSearch *search);
+
+/// Return false to stop the walk
+typedef bool (*MessageSearchVisitor)(const MessageSearchDoc *doc, void *userdata);
+
+/// Calls `visit` for every message holding all trigrams of `query`, newest
+/// ROWID first. Returns how many were visited, or -1 on error.
+int message_search_each(MessageSearch *search, const char *query, size_t length,
+                        MessageSearchVisitor visit, void *userdata);
+
+/// ASCII case-insensitive substring test, folded the same way as the trigrams
+bool message_search_matches(const char *text, size_t length, const char *query, size_t query_length);
+
+#endif /* MessageSearch_h */
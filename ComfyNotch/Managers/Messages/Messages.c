@@ -14,191 +14,1012 @@
 #include "MessageMeta.h"
 #include "MessageHashMap.h"
 #include "Messages.h"
+#include "MessagesContextInternal.h"
+#include "MessagesReaderPool.h"
+#include "AttributedBodyDecoder.h"
 
-void preload_hashmap(sqlite3 *db, int64_t last_known_time);
 void print_guid(const char *guid, int length);
 
-char *base64_encode(const unsigned char *data, size_t input_length) {
-    static const char encoding_table[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+MessagesBody messages_column_body(sqlite3_stmt *stmt, int text_column, int blob_column) {
+    MessagesBody body = { .kind = MESSAGES_BODY_NONE, .data = NULL, .length = 0 };
     
-    if (input_length == 0) {
-        char *empty = malloc(1);
-        if (empty) empty[0] = '\0';
-        return empty;
+    const unsigned char *text = sqlite3_column_text(stmt, text_column);
+    int textSize = sqlite3_column_bytes(stmt, text_column);
+    if (text && textSize > 0) {
+        body.kind = MESSAGES_BODY_TEXT;
+        body.data = text;
+        body.length = (size_t)textSize;
+        return body;
     }
     
-    size_t output_length = 4 * ((input_length + 2) / 3);
-    char *encoded_data = malloc(output_length + 1);
-    if (!encoded_data) return NULL;
+    /// Modern macOS leaves `text` empty and only fills the typedstream blob
+    const void *blob = sqlite3_column_blob(stmt, blob_column);
+    int blobSize = sqlite3_column_bytes(stmt, blob_column);
+    if (blob && blobSize > 0) {
+        body.kind = MESSAGES_BODY_ATTRIBUTED;
+        body.data = blob;
+        body.length = (size_t)blobSize;
+    }
+    return body;
+}
+
+static bool is_blank(const char *text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] != ' ' && text[i] != '\t' && text[i] != '\n' && text[i] != '\r') return false;
+    }
+    return true;
+}
+
+bool messages_body_text(MessagesBody body, const char **text, size_t *length) {
+    switch (body.kind) {
+        case MESSAGES_BODY_NONE:
+            *text = "";
+            *length = 0;
+            return true;
+        case MESSAGES_BODY_TEXT:
+            *text = body.data;
+            *length = body.length;
+            return true;
+        case MESSAGES_BODY_ATTRIBUTED: {
+            AttributedBodyText decoded;
+            if (!attributed_body_decode(body.data, body.length, &decoded)) return false;
+            
+            /// Same rule as formatAttributedBody, a link only stands in for an empty string
+            const char *base = body.data;
+            *text = base + decoded.text_offset;
+            *length = decoded.text_length;
+            if (decoded.has_link && is_blank(*text, *length)) {
+                *text = base + decoded.link_offset;
+                *length = decoded.link_length;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Steps a MESSAGES_STMT_MESSAGE_BY_ROWID statement, from the context or a pool
+/// reader, onto the newest message of `handle_id` the sidecar index knows of.
+/// Only the index lookups take the context lock. Returns false if there is none.
+static bool step_indexed(MessagesContext *ctx, sqlite3_stmt *stmt, int64_t handle_id) {
+    SidecarIndexEntry entry = { .handle_id = handle_id, .date = INT64_MAX, .rowid = INT64_MAX };
+    for (;;) {
+        messages_context_lock(ctx);
+        bool more = sidecar_index_before(ctx->index, handle_id, entry.date, entry.rowid, &entry);
+        messages_context_unlock(ctx);
+        if (!more) return false;
+        
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, entry.rowid);
+        if (sqlite3_step(stmt) == SQLITE_ROW) return true;
+    }
+}
+
+/// Positions MESSAGES_STMT_MESSAGE_BY_ROWID on the newest message of `handle_id`
+/// found through the sidecar index, skipping rows deleted from chat.db since they
+/// were indexed. Returns NULL if the handle has none, otherwise release the statement.
+/// Call with the context locked and the index caught up.
+static sqlite3_stmt *step_indexed_last_message(MessagesContext *ctx, int64_t handle_id) {
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_MESSAGE_BY_ROWID);
+    if (!stmt)
+        return NULL;
     
-    size_t i = 0, j = 0;
+    if (step_indexed(ctx, stmt, handle_id)) return stmt;
+    
+    messages_context_release(ctx, stmt);
+    return NULL;
+}
+
+/// True when lookups should go through the sidecar index. Call with the context locked.
+static bool use_index(MessagesContext *ctx) {
+    return ctx->index && messages_index_catch_up(ctx);
+}
+
+static bool visit_last_message(MessagesContext *ctx, int64_t handle_id,
+                               MessagesBodyVisitor visit, void *userdata) {
+    messages_context_lock(ctx);
     
-    // Process 3-byte chunks efficiently
-    while (i + 2 < input_length) {
-        uint32_t triple = (data[i] << 16) | (data[i+1] << 8) | data[i+2];
-        encoded_data[j++] = encoding_table[(triple >> 18) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 12) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 6) & 0x3F];
-        encoded_data[j++] = encoding_table[triple & 0x3F];
-        i += 3;
+    sqlite3_stmt *stmt;
+    int body_column;
+    bool found;
+    if (use_index(ctx)) {
+        stmt = step_indexed_last_message(ctx, handle_id);
+        body_column = 1;
+        found = stmt != NULL;
+    } else {
+        stmt = messages_context_statement(ctx, MESSAGES_STMT_LAST_MESSAGE_TEXT);
+        body_column = 0;
+        if (stmt) sqlite3_bind_int64(stmt, 1, handle_id);
+        found = stmt && sqlite3_step(stmt) == SQLITE_ROW;
     }
     
-    // Handle remaining 1-2 bytes with padding
-    if (i < input_length) {
-        uint32_t triple = data[i] << 16;
-        if (i + 1 < input_length) triple |= data[i+1] << 8;
-        
-        encoded_data[j++] = encoding_table[(triple >> 18) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 12) & 0x3F];
-        encoded_data[j++] = (i + 1 < input_length) ? encoding_table[(triple >> 6) & 0x3F] : '=';
-        encoded_data[j++] = '=';
+    if (found) {
+        MessagesBody body = messages_column_body(stmt, body_column, body_column + 1);
+        visit(&body, userdata);
     }
     
-    encoded_data[output_length] = '\0';
-    return encoded_data;
+    messages_context_release(ctx, stmt);
+    messages_context_unlock(ctx);
+    return found;
 }
 
-const char *get_last_message_text(sqlite3 *db, long long handle_id) {
-    // NOTE: not thread-safe, do not call concurrently
-    static char buffer[4096] = {0}; // reuse buffer (not thread-safe)
-    memset(buffer, 0, sizeof(buffer));
+/// Zero copy access to the last message for `handle_id`. `visit` gets a view
+/// straight into SQLite's row buffer which is only valid during the callback.
+/// Returns false if the handle has no message.
+bool visit_last_message_body(MessagesContext *ctx, int64_t handle_id,
+                             MessagesBodyVisitor visit, void *userdata) {
+    if (!ctx || !visit) return false;
     
-    const char *sql =
-    "SELECT text, attributedBody FROM message "
-    "WHERE handle_id = ? ORDER BY date DESC LIMIT 1;";
+    uint64_t start = messages_metrics_now();
+    bool found = visit_last_message(ctx, handle_id, visit, userdata);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_LAST_MESSAGE_BODY, start);
+    return found;
+}
+
+typedef struct {
+    void *buffer;
+    size_t capacity;
+    MessagesBody *out;
+    int64_t length;
+} CopyBodyRequest;
+
+static void copy_body(const MessagesBody *body, void *userdata) {
+    CopyBodyRequest *request = userdata;
     
-    sqlite3_stmt *stmt = NULL;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
-        return NULL;
+    request->length = (int64_t)body->length;
+    if (request->out) {
+        request->out->kind = body->kind;
+        request->out->length = body->length;
+        request->out->data = body->length <= request->capacity ? request->buffer : NULL;
+    }
+    if (body->length > 0 && body->length <= request->capacity)
+        memcpy(request->buffer, body->data, body->length);
+}
+
+/// Copies the last message for `handle_id` into `buffer` as raw bytes, text is
+/// UTF-8 without a terminator and attributedBody is the untouched blob.
+/// Returns the full length; if that is > `capacity` nothing was copied and the
+/// call should be repeated with a bigger buffer. Returns -1 if there is no message.
+int64_t get_last_message_body(MessagesContext *ctx, int64_t handle_id,
+                              void *buffer, size_t capacity, MessagesBody *out) {
+    CopyBodyRequest request = {
+        .buffer = buffer,
+        .capacity = buffer ? capacity : 0,
+        .out = out,
+        .length = -1
+    };
+    if (out) *out = (MessagesBody){ .kind = MESSAGES_BODY_NONE, .data = NULL, .length = 0 };
     
-    sqlite3_bind_int64(stmt, 1, handle_id);
+    visit_last_message_body(ctx, handle_id, copy_body, &request);
+    return request.length;
+}
+
+static int64_t last_talked_to(MessagesContext *ctx, int64_t handle_id) {
+    messages_context_lock(ctx);
     
-    if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const unsigned char *text = sqlite3_column_text(stmt, 0);
-        const void *blob = sqlite3_column_blob(stmt, 1);
-        int blobSize = sqlite3_column_bytes(stmt, 1);
+    int64_t result = -1;
+    sqlite3_stmt *stmt;
+    if (use_index(ctx)) {
+        stmt = step_indexed_last_message(ctx, handle_id);
+        if (stmt)
+            result = sqlite3_column_int64(stmt, 0);
+    } else {
+        stmt = messages_context_statement(ctx, MESSAGES_STMT_LAST_TALKED_TO);
+        if (stmt) {
+            sqlite3_bind_int64(stmt, 1, handle_id);
+            if (sqlite3_step(stmt) == SQLITE_ROW)
+                result = sqlite3_column_int64(stmt, 0);
+        }
+    }
+    
+    messages_context_release(ctx, stmt);
+    messages_context_unlock(ctx);
+    return result;
+}
+
+int64_t get_last_talked_to(MessagesContext *ctx, int64_t handle_id) {
+    
+    //    printf("Fetching last talked to for handle_id: %lld\n", handle_id);
+    
+    if (!ctx)
+        return -1;
+    
+    uint64_t start = messages_metrics_now();
+    int64_t result = last_talked_to(ctx, handle_id);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_LAST_TALKED_TO, start);
+    return result;
+}
+
+/// Builds a JSON array like "[1,2,3]" so the id list can be bound as a single
+/// parameter and expanded with json_each, the SQL text never changes with the count
+static char *ids_to_json(const int64_t *ids, int count) {
+    size_t capacity = (size_t)count * 21 + 3;
+    char *json = malloc(capacity);
+    if (!json) return NULL;
+
+    size_t len = 0;
+    json[len++] = '[';
+    for (int i = 0; i < count; i++) {
+        len += snprintf(json + len, capacity - len, i ? ",%lld" : "%lld", (long long)ids[i]);
+    }
+    json[len++] = ']';
+    json[len] = '\0';
+    return json;
+}
+
+/// Fills `summary` from the current row of `stmt`, whose columns from `date_column`
+/// on are date, text, attributedBody, is_from_me. A NULL date means no message.
+static void fill_summary(MessagesHandleSummary *summary, int64_t handle_id,
+                         sqlite3_stmt *stmt, int date_column) {
+    memset(summary, 0, sizeof(*summary));
+    summary->handle_id = handle_id;
+    summary->date = -1;
+    if (!stmt || sqlite3_column_type(stmt, date_column) == SQLITE_NULL) return;
+    
+    summary->date = sqlite3_column_int64(stmt, date_column);
+    summary->is_from_me = sqlite3_column_int(stmt, date_column + 3) == 1;
+
+    MessagesBody body = messages_column_body(stmt, date_column + 1, date_column + 2);
+    if (body.kind == MESSAGES_BODY_TEXT) {
+        summary->text = strndup(body.data, body.length);
+    } else if (body.kind == MESSAGES_BODY_ATTRIBUTED) {
+        summary->attributed_body = malloc(body.length);
+        if (summary->attributed_body) {
+            memcpy(summary->attributed_body, body.data, body.length);
+            summary->attributed_body_len = (int)body.length;
+        }
+    }
+}
+
+/// One sidecar index search plus one ROWID lookup per handle.
+/// Call with the context locked and the index caught up.
+static int get_indexed_handle_summaries(MessagesContext *ctx,
+                                        const int64_t *handle_ids,
+                                        int handle_count,
+                                        MessagesHandleSummary *out,
+                                        int capacity) {
+    sqlite3_stmt *all = NULL;
+    if (!handle_ids || handle_count <= 0) {
+        all = messages_context_statement(ctx, MESSAGES_STMT_ALL_HANDLES);
+        if (!all)
+            return -1;
+    }
+    
+    int count = 0;
+    for (int i = 0; count < capacity; i++) {
+        int64_t handle_id;
+        if (all) {
+            if (sqlite3_step(all) != SQLITE_ROW) break;
+            handle_id = sqlite3_column_int64(all, 0);
+        } else {
+            if (i >= handle_count) break;
+            handle_id = handle_ids[i];
+        }
         
-        if (text && strlen((const char *)text) > 0) {
-            strncpy(buffer, (const char *)text, sizeof(buffer) - 1);
-        } else if (blob && blobSize > 0) {
-            // Base64-encode attributedBody
-            const char *prefix = "__BASE64__:";
-            strncat(buffer, prefix, sizeof(buffer) - strlen(buffer) - 1);
-            
-            char *encoded = base64_encode((const unsigned char *)blob, blobSize);
-            if (encoded) {
-                strncat(buffer, encoded, sizeof(buffer) - strlen(buffer) - 1);
-                free(encoded);
+        sqlite3_stmt *stmt = step_indexed_last_message(ctx, handle_id);
+        fill_summary(&out[count++], handle_id, stmt, 0);
+        messages_context_release(ctx, stmt);
+    }
+    
+    messages_context_release(ctx, all);
+    return count;
+}
+
+/// Handles per pool task, small enough that a few hundred spread over every reader
+#define SUMMARY_CHUNK 16
+/// `pooled_handle_summaries` left the batch to the context's own connection
+#define NOT_POOLED (-2)
+
+typedef struct {
+    MessagesContext *ctx;
+    const int64_t *handle_ids;
+    int count;
+    bool indexed;
+    MessagesHandleSummary *out;
+    _Atomic bool failed;
+} SummaryBatch;
+
+/// Summarises handles [index * SUMMARY_CHUNK, +SUMMARY_CHUNK) on a pool reader
+static void summarize_chunk(MessagesReader *reader, size_t index, void *userdata) {
+    SummaryBatch *batch = userdata;
+    int first = (int)index * SUMMARY_CHUNK;
+    int count = batch->count - first < SUMMARY_CHUNK ? batch->count - first : SUMMARY_CHUNK;
+    const int64_t *ids = batch->handle_ids + first;
+    MessagesHandleSummary *out = batch->out + first;
+    
+    if (batch->indexed) {
+        sqlite3_stmt *stmt = messages_reader_statement(reader, MESSAGES_STMT_MESSAGE_BY_ROWID);
+        if (!stmt) {
+            atomic_store(&batch->failed, true);
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            bool found = step_indexed(batch->ctx, stmt, ids[i]);
+            fill_summary(&out[i], ids[i], found ? stmt : NULL, 0);
+        }
+        messages_reader_release(reader, stmt);
+        return;
+    }
+    
+    /// The same one-statement batch as the context runs, over this chunk's ids
+    char *json = ids_to_json(ids, count);
+    sqlite3_stmt *stmt = json ? messages_reader_statement(reader, MESSAGES_STMT_HANDLE_SUMMARIES) : NULL;
+    if (!stmt) {
+        free(json);
+        atomic_store(&batch->failed, true);
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, json, -1, SQLITE_TRANSIENT);
+    free(json);
+    
+    /// The LEFT JOIN gives every id exactly one row, in the order given
+    int filled = 0;
+    while (filled < count && sqlite3_step(stmt) == SQLITE_ROW) {
+        fill_summary(&out[filled], sqlite3_column_int64(stmt, 0), stmt, 1);
+        filled++;
+    }
+    if (filled < count) atomic_store(&batch->failed, true);
+    messages_reader_release(reader, stmt);
+}
+
+/// Every ROWID of the handle table, call with the context locked
+static int64_t *all_handle_ids(MessagesContext *ctx, int *count) {
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_ALL_HANDLES);
+    if (!stmt) return NULL;
+    
+    int capacity = 256;
+    int64_t *ids = malloc((size_t)capacity * sizeof(int64_t));
+    *count = 0;
+    while (ids && sqlite3_step(stmt) == SQLITE_ROW) {
+        if (*count == capacity) {
+            int64_t *grown = realloc(ids, (size_t)capacity * 2 * sizeof(int64_t));
+            if (!grown) {
+                free(ids);
+                ids = NULL;
+                break;
             }
+            ids = grown;
+            capacity *= 2;
         }
+        ids[(*count)++] = sqlite3_column_int64(stmt, 0);
     }
     
-    sqlite3_finalize(stmt);
-    return buffer[0] ? buffer : NULL;
+    messages_context_release(ctx, stmt);
+    return ids;
 }
 
-int64_t get_last_talked_to(sqlite3 *db, int64_t handle_id) {
+/// Splits the batch over the reader pool, results land in `out` by position.
+/// Returns NOT_POOLED when there is no pool or too few handles to be worth it.
+static int pooled_handle_summaries(MessagesContext *ctx,
+                                   const int64_t *handle_ids,
+                                   int handle_count,
+                                   MessagesHandleSummary *out,
+                                   int capacity) {
+    messages_context_lock(ctx);
+    MessagesReaderPool *pool = ctx->pool;
+    if (!pool) {
+        messages_context_unlock(ctx);
+        return NOT_POOLED;
+    }
     
-    //    printf("Fetching last talked to for handle_id: %lld\n", handle_id);
-    //    printf("DB: %p\n", db);
+    bool indexed = use_index(ctx);
+    int64_t *all = NULL;
+    if (!handle_ids || handle_count <= 0) {
+        all = all_handle_ids(ctx, &handle_count);
+        if (!all) {
+            messages_context_unlock(ctx);
+            return -1;
+        }
+        handle_ids = all;
+    }
+    messages_context_unlock(ctx);
     
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT date FROM message WHERE handle_id = ? ORDER BY date DESC LIMIT 1;";
+    int count = handle_count < capacity ? handle_count : capacity;
+    if (count < 2 * SUMMARY_CHUNK) {
+        free(all);
+        return NOT_POOLED;
+    }
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    SummaryBatch batch = {
+        .ctx = ctx, .handle_ids = handle_ids, .count = count, .indexed = indexed, .out = out,
+    };
+    atomic_init(&batch.failed, false);
+    memset(out, 0, (size_t)count * sizeof(MessagesHandleSummary));
+    messages_reader_pool_run(pool, (size_t)(count + SUMMARY_CHUNK - 1) / SUMMARY_CHUNK,
+                             summarize_chunk, &batch);
+    free(all);
+    
+    if (atomic_load(&batch.failed)) {
+        free_handle_summaries(out, count);
         return -1;
+    }
+    return count;
+}
+
+static int handle_summaries(MessagesContext *ctx,
+                            const int64_t *handle_ids,
+                            int handle_count,
+                            MessagesHandleSummary *out,
+                            int capacity) {
+    int pooled = pooled_handle_summaries(ctx, handle_ids, handle_count, out, capacity);
+    if (pooled != NOT_POOLED) return pooled;
     
-    sqlite3_bind_int64(stmt, 1, handle_id);
+    messages_context_lock(ctx);
+    if (use_index(ctx)) {
+        int count = get_indexed_handle_summaries(ctx, handle_ids, handle_count, out, capacity);
+        messages_context_unlock(ctx);
+        return count;
+    }
+    messages_context_unlock(ctx);
+
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_HANDLE_SUMMARIES);
+    if (!stmt)
+        return -1;
+
+    char *json = NULL;
+    if (handle_ids && handle_count > 0) {
+        json = ids_to_json(handle_ids, handle_count);
+        if (!json) {
+            messages_context_release(ctx, stmt);
+            return -1;
+        }
+        sqlite3_bind_text(stmt, 1, json, -1, SQLITE_TRANSIENT);
+        free(json);
+    } else {
+        sqlite3_bind_null(stmt, 1);
+    }
+
+    int count = 0;
+    while (count < capacity && sqlite3_step(stmt) == SQLITE_ROW) {
+        fill_summary(&out[count++], sqlite3_column_int64(stmt, 0), stmt, 1);
+    }
+
+    messages_context_release(ctx, stmt);
+    return count;
+}
+
+/// Fetches the last date, text/attributedBody and is_from_me for every handle in one query.
+/// Pass NULL/0 for `handle_ids` to summarise every row in the handle table.
+/// Returns the number of summaries written into `out`, or -1 on error.
+int get_handle_summaries(MessagesContext *ctx,
+                         const int64_t *handle_ids,
+                         int handle_count,
+                         MessagesHandleSummary *out,
+                         int capacity) {
+    if (!ctx || !out || capacity <= 0) return -1;
+
+    uint64_t start = messages_metrics_now();
+    int count = handle_summaries(ctx, handle_ids, handle_count, out, capacity);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_HANDLE_SUMMARIES, start);
+    return count;
+}
+
+void free_handle_summaries(MessagesHandleSummary *summaries, int count) {
+    if (!summaries) return;
+    for (int i = 0; i < count; i++) {
+        free(summaries[i].text);
+        free(summaries[i].attributed_body);
+        summaries[i].text = NULL;
+        summaries[i].attributed_body = NULL;
+        summaries[i].attributed_body_len = 0;
+    }
+}
+
+static char *column_strdup(sqlite3_stmt *stmt, int column) {
+    const unsigned char *text = sqlite3_column_text(stmt, column);
+    return text ? strdup((const char *)text) : NULL;
+}
+
+static int message_attachments(MessagesContext *ctx,
+                               const int64_t *message_ids,
+                               int message_count,
+                               MessagesAttachment *out,
+                               int capacity) {
+    char *json = ids_to_json(message_ids, message_count);
+    if (!json) return -1;
     
-    int64_t result = -1;
-    if (sqlite3_step(stmt) == SQLITE_ROW)
-        result = sqlite3_column_int64(stmt, 0);
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_ATTACHMENTS);
+    if (!stmt) {
+        free(json);
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, json, -1, SQLITE_TRANSIENT);
+    free(json);
     
-    sqlite3_finalize(stmt);
-    return result;
+    int count = 0;
+    while (count < capacity && sqlite3_step(stmt) == SQLITE_ROW) {
+        MessagesAttachment *attachment = &out[count++];
+        
+        attachment->message_id = sqlite3_column_int64(stmt, 0);
+        attachment->attachment_id = sqlite3_column_int64(stmt, 1);
+        attachment->filename = column_strdup(stmt, 2);
+        attachment->mime_type = column_strdup(stmt, 3);
+        attachment->transfer_name = column_strdup(stmt, 4);
+        attachment->total_bytes = sqlite3_column_int64(stmt, 5);
+    }
+    
+    messages_context_release(ctx, stmt);
+    return count;
 }
 
-static bool didLoadHashMap = false;
+/// Fetches every attachment of every message in `message_ids` with one JOIN,
+/// instead of a join lookup plus an attachment lookup per message.
+/// Results are grouped by message in the order the ids were given, attachments
+/// of one message by attachment ROWID. Messages without attachments add nothing.
+/// Returns the number of attachments written into `out` (a full `out` means
+/// there may be more, call again with room for more), or -1 on error.
+int get_message_attachments(MessagesContext *ctx,
+                            const int64_t *message_ids,
+                            int message_count,
+                            MessagesAttachment *out,
+                            int capacity) {
+    if (!ctx || !out || capacity <= 0) return -1;
+    if (!message_ids || message_count <= 0) return 0;
+    
+    uint64_t start = messages_metrics_now();
+    int count = message_attachments(ctx, message_ids, message_count, out, capacity);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_ATTACHMENTS, start);
+    return count;
+}
 
-/// Function will check if the chat db has any changed "chat" from the time then it will check if it is from me/the user or not
-int has_chat_db_changed(sqlite3 *db, int64_t last_known_time) {
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT guid, date, is_from_me FROM message ORDER BY date DESC LIMIT 1;";
+void free_message_attachments(MessagesAttachment *attachments, int count) {
+    if (!attachments) return;
+    for (int i = 0; i < count; i++) {
+        free(attachments[i].filename);
+        free(attachments[i].mime_type);
+        free(attachments[i].transfer_name);
+        attachments[i].filename = NULL;
+        attachments[i].mime_type = NULL;
+        attachments[i].transfer_name = NULL;
+    }
+}
+
+/// Seeds the ROWID high-water mark with the newest row so nothing that already
+/// exists in chat.db is reported as new. MAX(ROWID) is a single b-tree seek.
+/// Call with the context locked.
+static bool seed_watermark(MessagesContext *ctx) {
+    if (ctx->has_watermark) return true;
+    
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_MAX_ROWID);
+    if (!stmt) return false;
+    
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        ctx->rowid_watermark = sqlite3_column_int64(stmt, 0);
+        ctx->has_watermark = true;
+    }
+    
+    messages_context_release(ctx, stmt);
+    return ctx->has_watermark;
+}
+
+/// Keeps an open conversation current without re-reading it. Only handles the
+/// cache already holds pay for decoding the body.
+static void apply_to_conversation_cache(MessagesContext *ctx, sqlite3_stmt *stmt,
+                                        const MessagesDeltaRow *row) {
+    if (!conversation_cache_contains(ctx->conversations, row->handle_id)) return;
+    
+    ConversationCacheMessage message = {
+        .rowid = row->rowid,
+        .date = row->date,
+        .is_from_me = row->is_from_me,
+        .is_read = sqlite3_column_int(stmt, 5) == 1,
+        .has_attachments = sqlite3_column_int(stmt, 6) == 1,
+    };
+    
+    /// Swift can still decode what C can't, it just has to go back to SQLite for it
+    if (!messages_body_text(messages_column_body(stmt, 7, 8), &message.text, &message.text_length)) {
+        conversation_cache_invalidate(ctx->conversations, row->handle_id);
+        return;
+    }
+    conversation_cache_push(ctx->conversations, row->handle_id, &message);
+}
+
+/// Re-reads which received messages up to the watermark are unread, one range
+/// of message_idx_is_read. Rows past it are counted by the delta scan as they
+/// come in. Call with the context locked.
+static bool sweep_unread(MessagesContext *ctx) {
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_UNREAD);
+    if (!stmt) return false;
+    
+    sqlite3_bind_int64(stmt, 1, ctx->rowid_watermark);
+    unread_counters_begin_sweep(ctx->unread);
+    
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        unread_counters_add(ctx->unread, sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1));
+    }
+    /// A failed read keeps the old counts rather than dropping everything it missed
+    bool ok = rc == SQLITE_DONE;
+    if (ok) unread_counters_end_sweep(ctx->unread);
+    
+    messages_context_release(ctx, stmt);
+    return ok;
+}
+
+static int64_t data_version(MessagesContext *ctx) {
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_DATA_VERSION);
+    if (!stmt) return -1;
+    
+    int64_t version = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+    messages_context_release(ctx, stmt);
+    return version;
+}
+
+/// First use only. Call with the context locked.
+static bool seed_unread(MessagesContext *ctx) {
+    if (ctx->unread_seeded) return true;
+    if (!ctx->unread || !seed_watermark(ctx)) return false;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        return 0;
+    /// Read before the sweep, a commit in between only means one extra sweep
+    int64_t version = data_version(ctx);
+    if (!sweep_unread(ctx)) return false;
+    
+    ctx->unread_data_version = version;
+    ctx->unread_seeded = true;
+    return true;
+}
+
+/// Messages marked read (or deleted) leave no new row behind, so once
+/// `data_version` says anything was committed the unread range is swept again.
+/// Only ever touches unread rows, however long the history is.
+static void refresh_unread(MessagesContext *ctx) {
+    messages_context_lock(ctx);
+    if (ctx->unread_seeded) {
+        int64_t version = data_version(ctx);
+        if (version >= 0 && version != ctx->unread_data_version && sweep_unread(ctx)) {
+            ctx->unread_data_version = version;
+        }
+    } else {
+        seed_unread(ctx);
     }
+    messages_context_unlock(ctx);
+}
+
+typedef struct {
+    MessagesUnreadCount *out;
+    int capacity;
+    int count;
+} UnreadCopy;
+
+static void copy_unread(int64_t handle_id, int64_t unread, void *userdata) {
+    UnreadCopy *copy = userdata;
+    if (copy->count < copy->capacity) {
+        copy->out[copy->count] = (MessagesUnreadCount){ .handle_id = handle_id, .unread = unread };
+    }
+    copy->count++;
+}
+
+static int unread_counts(MessagesContext *ctx, MessagesUnreadCount *out, int capacity) {
+    messages_context_lock(ctx);
+    UnreadCopy copy = { .out = out, .capacity = capacity };
+    bool ok = seed_unread(ctx);
+    if (ok) unread_counters_each(ctx->unread, copy_unread, &copy);
+    messages_context_unlock(ctx);
+    return ok ? copy.count : -1;
+}
+
+int get_unread_counts(MessagesContext *ctx, MessagesUnreadCount *out, int capacity) {
+    if (!ctx || capacity < 0 || (!out && capacity > 0)) return -1;
+    
+    uint64_t start = messages_metrics_now();
+    int count = unread_counts(ctx, out, capacity);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_UNREAD_COUNTS, start);
+    return count;
+}
+
+int64_t get_unread_count(MessagesContext *ctx, int64_t handle_id) {
+    if (!ctx) return 0;
+    
+    messages_context_lock(ctx);
+    int64_t unread = seed_unread(ctx) ? unread_counters_get(ctx->unread, handle_id) : 0;
+    messages_context_unlock(ctx);
+    return unread;
+}
+
+/// Throws away what it had for a smaller K, the extra handles were never
+/// tracked. Call with the context locked.
+static bool seed_recent(MessagesContext *ctx, int capacity) {
+    if (ctx->recent && recent_handles_capacity(ctx->recent) >= capacity) return true;
+    /// Rows after the watermark are moved in by the delta scan, moving a
+    /// handle to a date it already has is a no-op
+    if (!seed_watermark(ctx)) return false;
+    
+    RecentHandles *recent = recent_handles_create(capacity);
+    sqlite3_stmt *stmt = recent ? messages_context_statement(ctx, MESSAGES_STMT_RECENT_HANDLES) : NULL;
+    if (!stmt) {
+        recent_handles_destroy(recent);
+        return false;
+    }
+    
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (sqlite3_column_type(stmt, 1) == SQLITE_NULL) continue;
+        recent_handles_update(recent, sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1));
+    }
+    messages_context_release(ctx, stmt);
+    
+    if (rc != SQLITE_DONE) {
+        recent_handles_destroy(recent);
+        return false;
+    }
+    recent_handles_destroy(ctx->recent);
+    ctx->recent = recent;
+    return true;
+}
+
+static int recent_handles(MessagesContext *ctx, RecentHandle *out, int capacity) {
+    messages_context_lock(ctx);
+    int count = seed_recent(ctx, capacity) ? recent_handles_copy(ctx->recent, out, capacity) : -1;
+    messages_context_unlock(ctx);
+    return count;
+}
+
+int get_recent_handles(MessagesContext *ctx, RecentHandle *out, int capacity) {
+    if (!ctx || !out || capacity <= 0) return -1;
+    
+    uint64_t start = messages_metrics_now();
+    int count = recent_handles(ctx, out, capacity);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_RECENT_HANDLES, start);
+    return count;
+}
+
+static int new_messages(MessagesContext *ctx, MessagesDeltaRow *out, int capacity) {
+    /// Held across seeding and the scan so two callers never get the same rows
+    messages_context_lock(ctx);
     
-    /// Only once at start we will preload the hashmap with the last data
-    if (!didLoadHashMap) {
-        preload_hashmap(db, last_known_time);
-        didLoadHashMap = true;
+    bool seeded = seed_watermark(ctx);
+    /// Unread rows are counted up to the watermark before the scan moves it,
+    /// the scan adds the rest
+    if (seeded) seed_unread(ctx);
+    
+    sqlite3_stmt *stmt = seeded
+        ? messages_context_statement(ctx, MESSAGES_STMT_NEW_SINCE)
+        : NULL;
+    if (!stmt) {
+        messages_context_unlock(ctx);
+        return -1;
     }
     
-    int rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) {
-        int guid_len = sqlite3_column_bytes(stmt, 0);
-        char *guidCopy = malloc(guid_len + 1);
-        memcpy(guidCopy, sqlite3_column_text(stmt, 0), guid_len);
-        guidCopy[guid_len] = '\0';
+    sqlite3_bind_int64(stmt, 1, ctx->rowid_watermark);
+    sqlite3_bind_int(stmt, 2, capacity);
+    
+    int count = 0;
+    while (count < capacity && sqlite3_step(stmt) == SQLITE_ROW) {
+        MessagesDeltaRow *row = &out[count++];
         
-        int64_t date = sqlite3_column_int64(stmt, 1);
-        int is_from_me = sqlite3_column_int(stmt, 2);
+        row->rowid = sqlite3_column_int64(stmt, 0);
         
-        /// Create a MessageMeta struct to check against the hashmap
-        MessageMeta meta = {
-            .date = date,
-            .isFromMe = is_from_me
-        };
+        const unsigned char *guid = sqlite3_column_text(stmt, 1);
+        snprintf(row->guid, sizeof(row->guid), "%s", guid ? (const char *)guid : "");
         
-        MessageMeta *existing = hashmap_get(guidCopy);
+        row->handle_id = sqlite3_column_int64(stmt, 2);
+        row->date = sqlite3_column_int64(stmt, 3);
+        row->is_from_me = sqlite3_column_int(stmt, 4) == 1;
         
-        if (existing == NULL) {
-//            print_guid(guidCopy, guid_len);
-            /// NOTE: Uncomment the next lines to see if the message that I sent/recevied is new or not
-//            printf("🟢 New message detected: %s\n", guidCopy);
-//            printf("Date: %lld, From Me: %d\n", date, is_from_me);
-            
-            hashmap_put(guidCopy, meta);
-            free(guidCopy);
-            
-            int result = meta.isFromMe ? 0 : 1;
-            sqlite3_finalize(stmt);
-            return result;
+        ctx->rowid_watermark = row->rowid;
+        if (!row->is_from_me && sqlite3_column_int(stmt, 5) == 0) {
+            unread_counters_add(ctx->unread, row->rowid, row->handle_id);
         }
-        free(guidCopy);
+        /// handle_id 0 is no handle, what you send to a group
+        if (ctx->recent && row->handle_id > 0) {
+            recent_handles_update(ctx->recent, row->handle_id, row->date);
+        }
+        apply_to_conversation_cache(ctx, stmt, row);
     }
     
-    sqlite3_finalize(stmt);
-    return 0;
+    messages_context_release(ctx, stmt);
+    messages_context_unlock(ctx);
+    return count;
 }
 
-void preload_hashmap(sqlite3 *db, int64_t last_known_time) {
+/// Returns every message with a ROWID above the watermark, oldest first, in one
+/// range scan over the rowid b-tree. The watermark advances past the rows returned,
+/// so if more than `capacity` rows are pending the next call picks up the rest.
+/// Returns the number of rows written into `out`, or -1 on error.
+int get_new_messages(MessagesContext *ctx, MessagesDeltaRow *out, int capacity) {
+    if (!ctx || !out || capacity <= 0) return -1;
+    
+    uint64_t start = messages_metrics_now();
+    int count = new_messages(ctx, out, capacity);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_NEW_MESSAGES, start);
+    return count;
+}
+
+int64_t get_messages_watermark(MessagesContext *ctx) {
+    if (!ctx) return -1;
+    
+    messages_context_lock(ctx);
+    int64_t watermark = seed_watermark(ctx) ? ctx->rowid_watermark : -1;
+    messages_context_unlock(ctx);
+    return watermark;
+}
+
+void set_messages_watermark(MessagesContext *ctx, int64_t rowid) {
+    if (!ctx) return;
+    
+    messages_context_lock(ctx);
+    ctx->rowid_watermark = rowid;
+    ctx->has_watermark = true;
+    messages_context_unlock(ctx);
+}
+
+typedef struct {
     sqlite3_stmt *stmt;
-    const char *sql = "SELECT guid, date, is_from_me FROM message WHERE date > ? LIMIT 50;";
+    const char *query;
+    size_t query_length;
+    MessagesSearchHit *out;
+    int capacity;
+    int count;
+} SearchRequest;
+
+/// The index only says every trigram is there, the current text decides
+static bool verify_candidate(const MessageSearchDoc *doc, void *userdata) {
+    SearchRequest *request = userdata;
+    
+    sqlite3_reset(request->stmt);
+    sqlite3_bind_int64(request->stmt, 1, doc->rowid);
+    
+    /// Deleted since it was indexed
+    if (sqlite3_step(request->stmt) != SQLITE_ROW) return true;
+    
+    const char *text;
+    size_t length;
+    if (!messages_body_text(messages_column_body(request->stmt, 1, 2), &text, &length) ||
+        !message_search_matches(text, length, request->query, request->query_length)) {
+        return true;
+    }
+    
+    request->out[request->count++] = (MessagesSearchHit){
+        .rowid = doc->rowid,
+        .handle_id = doc->handle_id,
+        .date = doc->date,
+    };
+    return request->count < request->capacity;
+}
+
+static int compare_hits_newest_first(const void *a, const void *b) {
+    const MessagesSearchHit *x = a, *y = b;
+    if (x->date != y->date) return x->date > y->date ? -1 : 1;
+    return x->rowid > y->rowid ? -1 : x->rowid < y->rowid;
+}
+
+static int search(MessagesContext *ctx, const char *query,
+                  MessagesSearchHit *out, int capacity) {
+    messages_context_lock(ctx);
+    if (!ctx->search || !messages_search_catch_up(ctx)) {
+        messages_context_unlock(ctx);
+        return -1;
+    }
+    
+    SearchRequest request = {
+        .stmt = messages_context_statement(ctx, MESSAGES_STMT_MESSAGE_BY_ROWID),
+        .query = query,
+        .query_length = strlen(query),
+        .out = out,
+        .capacity = capacity,
+    };
+    
+    int visited = request.stmt
+        ? message_search_each(ctx->search, query, request.query_length, verify_candidate, &request)
+        : -1;
+    messages_context_release(ctx, request.stmt);
+    messages_context_unlock(ctx);
+    if (visited < 0) return -1;
+    
+    /// Candidates come in ROWID order, which is almost but not quite date order
+    qsort(out, (size_t)request.count, sizeof(MessagesSearchHit), compare_hits_newest_first);
+    return request.count;
+}
+
+/// Finds up to `capacity` messages containing `query` (ASCII case-insensitive),
+/// newest first, through the trigram index from `messages_context_attach_search`.
+/// Queries shorter than MESSAGE_SEARCH_MIN_QUERY bytes find nothing.
+/// Returns the number of hits written into `out`, or -1 on error or with no index.
+int search_messages(MessagesContext *ctx, const char *query,
+                    MessagesSearchHit *out, int capacity) {
+    if (!ctx || !query || !out || capacity <= 0) return -1;
     
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+    uint64_t start = messages_metrics_now();
+    int count = search(ctx, query, out, capacity);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_SEARCH, start);
+    return count;
+}
+
+/// In the snapshot the last run left behind
+static bool seen_before_restart(MessagesContext *ctx, const char *guid) {
+    messages_context_lock(ctx);
+    /// Everything in it is older than the seen window now, unmap it
+    if (ctx->seen_snapshot &&
+        seen_snapshot_newest_date(ctx->seen_snapshot) < message_seen_set_cutoff(&ctx->seen)) {
+        seen_snapshot_close(ctx->seen_snapshot);
+        ctx->seen_snapshot = NULL;
+    }
+    bool seen = ctx->seen_snapshot && seen_snapshot_get(ctx->seen_snapshot, guid, NULL);
+    messages_context_unlock(ctx);
+    return seen;
+}
+
+static void publish_new_message(MessagesContext *ctx, const MessagesDeltaRow *row) {
+    messages_context_lock(ctx);
+    MessagesEvent event = {
+        .kind = MESSAGES_EVENT_NEW_MESSAGE,
+        .is_from_me = row->is_from_me,
+        .handle_id = row->handle_id,
+        .rowid = row->rowid,
+        .date = row->date,
+        .unread = unread_counters_get(ctx->unread, row->handle_id),
+    };
+    messages_context_publish(ctx, &event);
+    messages_context_unlock(ctx);
+}
+
+/// Publishes every handle past the watermark, only while a ring is attached
+static void publish_new_handles(MessagesContext *ctx) {
+    messages_context_lock(ctx);
+    if (!ctx->events) {
+        messages_context_unlock(ctx);
         return;
     }
     
-    sqlite3_bind_int64(stmt, 1, last_known_time);
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_HANDLES_SINCE);
+    if (stmt) {
+        sqlite3_bind_int64(stmt, 1, ctx->handle_watermark);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            MessagesEvent event = {
+                .kind = MESSAGES_EVENT_HANDLE_ADDED,
+                .handle_id = sqlite3_column_int64(stmt, 0),
+            };
+            messages_context_publish(ctx, &event);
+            ctx->handle_watermark = event.handle_id;
+        }
+        messages_context_release(ctx, stmt);
+    }
+    messages_context_unlock(ctx);
+}
+
+static int count_new_received(MessagesContext *ctx) {
+    MessagesDeltaRow rows[64];
+    int received = 0;
+    int count;
     
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *guid = (const char *)sqlite3_column_text(stmt, 0);
-        int64_t date = sqlite3_column_int64(stmt, 1);
-        int is_from_me = sqlite3_column_int(stmt, 2);
+    do {
+        count = get_new_messages(ctx, rows, 64);
         
-        MessageMeta meta = {
-            .date = date,
-            .isFromMe = is_from_me == 1
-        };
-        
-        hashmap_put(guid, meta); // load into your cache
-    }
+        for (int i = 0; i < count; i++) {
+            /// Create a MessageMeta struct to check against the hashmap
+            MessageMeta meta = {
+                .date = rows[i].date,
+                .isFromMe = rows[i].is_from_me
+            };
+            
+            if (seen_before_restart(ctx, rows[i].guid)) continue;
+            if (!message_seen_set_insert(&ctx->seen, rows[i].guid, meta)) continue;
+            publish_new_message(ctx, &rows[i]);
+            
+            /// NOTE: Uncomment the next lines to see if the message that I sent/recevied is new or not
+//            printf("🟢 New message detected: %s\n", rows[i].guid);
+//            printf("Date: %lld, From Me: %d\n", rows[i].date, rows[i].is_from_me);
+            
+            if (!meta.isFromMe) received++;
+        }
+    } while (count == 64);
+    
+    return received;
+}
+
+/// Function will check if the chat db has any new "chat" since the last call then it will check if it is from me/the user or not
+/// Returns how many new messages were received (not sent by the user)
+/// With an event ring attached, whatever it found also goes out as events,
+/// handles before the messages that use them.
+int has_chat_db_changed(MessagesContext *ctx) {
+    if (!ctx) return 0;
     
-    sqlite3_finalize(stmt);
-//    printf("Size Of Hashmap: %d\n", getSizeOfBucketsStored());
+    uint64_t start = messages_metrics_now();
+    publish_new_handles(ctx);
+    int received = count_new_received(ctx);
+    refresh_unread(ctx);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_HAS_CHANGED, start);
+    return received;
 }
 
 void print_guid(const char *guid, int length) {
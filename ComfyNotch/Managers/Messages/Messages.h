@@ -10,9 +10,114 @@
 
 #include <sqlite3.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "MessagesContext.h"
+#include "RecentHandles.h"
 
-int64_t get_last_talked_to(sqlite3 *db, int64_t handle_id);
-const char *get_last_message_text(sqlite3 *db, long long handle_id);
-int has_chat_db_changed(sqlite3 *db, int64_t last_known_time);
+/// Summary of the most recent message for a single handle.
+/// `text` and `attributed_body` are heap allocated, release them with `free_handle_summaries`
+typedef struct {
+    int64_t handle_id;
+    int64_t date;                   // -1 if the handle has no messages
+    bool is_from_me;
+    char *text;                     // NULL if the text column is empty
+    unsigned char *attributed_body; // raw blob, only filled when text is empty
+    int attributed_body_len;
+} MessagesHandleSummary;
+
+int get_handle_summaries(MessagesContext *ctx,
+                         const int64_t *handle_ids,
+                         int handle_count,
+                         MessagesHandleSummary *out,
+                         int capacity);
+void free_handle_summaries(MessagesHandleSummary *summaries, int count);
+
+/// One attachment of a message. The strings are heap allocated and NULL when
+/// the column is, release them with `free_message_attachments`
+typedef struct {
+    int64_t message_id;
+    int64_t attachment_id;
+    char *filename;
+    char *mime_type;
+    char *transfer_name;
+    int64_t total_bytes;
+} MessagesAttachment;
+
+int get_message_attachments(MessagesContext *ctx,
+                            const int64_t *message_ids,
+                            int message_count,
+                            MessagesAttachment *out,
+                            int capacity);
+void free_message_attachments(MessagesAttachment *attachments, int count);
+
+/// Large enough for every guid format chat.db uses (plain UUIDs and the "p:0/" prefixed ones)
+#define MESSAGES_GUID_MAX 128
+
+/// A message row that appeared after the last ROWID watermark
+typedef struct {
+    int64_t rowid;
+    char guid[MESSAGES_GUID_MAX];
+    int64_t handle_id;
+    int64_t date;
+    bool is_from_me;
+} MessagesDeltaRow;
+
+int get_new_messages(MessagesContext *ctx, MessagesDeltaRow *out, int capacity);
+int64_t get_messages_watermark(MessagesContext *ctx);
+void set_messages_watermark(MessagesContext *ctx, int64_t rowid);
+
+int64_t get_last_talked_to(MessagesContext *ctx, int64_t handle_id);
+
+/// What a message body holds
+typedef enum {
+    MESSAGES_BODY_NONE = 0,
+    MESSAGES_BODY_TEXT,         // UTF-8 from the `text` column, not NUL terminated
+    MESSAGES_BODY_ATTRIBUTED,   // raw `attributedBody` typedstream blob
+} MessagesBodyKind;
+
+typedef struct {
+    MessagesBodyKind kind;
+    const void *data;
+    size_t length;
+} MessagesBody;
+
+typedef void (*MessagesBodyVisitor)(const MessagesBody *body, void *userdata);
+
+bool visit_last_message_body(MessagesContext *ctx, int64_t handle_id,
+                             MessagesBodyVisitor visit, void *userdata);
+int64_t get_last_message_body(MessagesContext *ctx, int64_t handle_id,
+                              void *buffer, size_t capacity, MessagesBody *out);
+int has_chat_db_changed(MessagesContext *ctx);
+
+/// A message whose text holds the search query
+typedef struct {
+    int64_t rowid;
+    int64_t handle_id;
+    int64_t date;
+} MessagesSearchHit;
+
+int search_messages(MessagesContext *ctx, const char *query,
+                    MessagesSearchHit *out, int capacity);
+
+/// Unread received messages of one handle
+typedef struct {
+    int64_t handle_id;
+    int64_t unread;
+} MessagesUnreadCount;
+
+/// Every handle with unread messages, out of memory. Counts are as of the
+/// last `has_chat_db_changed`, the first call seeds them with one scan.
+/// Returns how many handles have unread messages, only `capacity` of them are
+/// written, or -1 on error.
+int get_unread_counts(MessagesContext *ctx, MessagesUnreadCount *out, int capacity);
+int64_t get_unread_count(MessagesContext *ctx, int64_t handle_id);
+
+/// The `capacity` handles with the newest messages, newest first, handles
+/// without any left out. The first call (or one asking for more than before)
+/// seeds them with one query, after that every new row the delta scan sees
+/// moves its handle in O(log K) and nothing is read again.
+/// Returns how many were written, or -1 on error.
+int get_recent_handles(MessagesContext *ctx, RecentHandle *out, int capacity);
 
 #endif /* LastTalkedTo_h */
@@ -0,0 +1,684 @@
+//
+//  MessagesContext.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 7/28/25.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "MessagesContextInternal.h"
+#include "MessagesReaderPool.h"
+
+static const char *statement_sql[MESSAGES_STMT_COUNT] = {
+    [MESSAGES_STMT_MAX_ROWID] =
+    "SELECT IFNULL(MAX(ROWID), 0) FROM message;",
+    
+    /// ROWID is the table key, so this is a range scan straight off the b-tree
+    [MESSAGES_STMT_NEW_SINCE] =
+    "SELECT ROWID, guid, handle_id, date, is_from_me, "
+    "is_read, cache_has_attachments, text, attributedBody FROM message "
+    "WHERE ROWID > ? ORDER BY ROWID LIMIT ?;",
+    
+    [MESSAGES_STMT_LAST_TALKED_TO] =
+    "SELECT date FROM message WHERE handle_id = ? ORDER BY date DESC LIMIT 1;",
+    
+    [MESSAGES_STMT_LAST_MESSAGE_TEXT] =
+    "SELECT text, attributedBody FROM message "
+    "WHERE handle_id = ? ORDER BY date DESC LIMIT 1;",
+    
+    /// One index probe on (handle_id, date) per handle, all inside a single statement
+    [MESSAGES_STMT_HANDLE_SUMMARIES] =
+    "WITH ids(handle_id) AS ("
+    "  SELECT value FROM json_each(?1) "
+    "  UNION ALL SELECT ROWID FROM handle WHERE ?1 IS NULL"
+    ") "
+    "SELECT ids.handle_id, m.date, m.text, m.attributedBody, m.is_from_me "
+    "FROM ids LEFT JOIN message m ON m.ROWID = ("
+    "  SELECT ROWID FROM message WHERE handle_id = ids.handle_id "
+    "  ORDER BY date DESC LIMIT 1"
+    ");",
+    
+    /// One probe on message_attachment_join_idx_message_id per message, rows come
+    /// back in the order the ids were passed so each message's attachments are adjacent
+    [MESSAGES_STMT_ATTACHMENTS] =
+    "SELECT j.message_id, a.ROWID, a.filename, a.mime_type, a.transfer_name, a.total_bytes "
+    "FROM json_each(?1) ids "
+    "JOIN message_attachment_join j ON j.message_id = ids.value "
+    "JOIN attachment a ON a.ROWID = j.attachment_id "
+    "ORDER BY ids.key, j.attachment_id;",
+    
+    /// Keyset paging on (date, ROWID): one seek into message_idx_handle per page,
+    /// the index already ends in ROWID so no sort step either way
+    [MESSAGES_STMT_PAGE_OLDER] =
+    "SELECT ROWID, date, is_from_me, is_read, cache_has_attachments, text, attributedBody "
+    "FROM message WHERE handle_id = ?1 AND (date, ROWID) < (?2, ?3) "
+    "ORDER BY date DESC, ROWID DESC LIMIT ?4;",
+    
+    [MESSAGES_STMT_PAGE_NEWER] =
+    "SELECT ROWID, date, is_from_me, is_read, cache_has_attachments, text, attributedBody "
+    "FROM message WHERE handle_id = ?1 AND (date, ROWID) > (?2, ?3) "
+    "ORDER BY date ASC, ROWID ASC LIMIT ?4;",
+    
+    /// Feeds the sidecar index, a range scan over the rowid b-tree. A negative
+    /// limit reads to the end.
+    [MESSAGES_STMT_INDEX_SINCE] =
+    "SELECT ROWID, handle_id, date FROM message WHERE ROWID > ?1 ORDER BY ROWID LIMIT ?2;",
+    
+    /// Point lookup for a ROWID the sidecar index found
+    [MESSAGES_STMT_MESSAGE_BY_ROWID] =
+    "SELECT date, text, attributedBody, is_from_me FROM message WHERE ROWID = ?;",
+    
+    [MESSAGES_STMT_ALL_HANDLES] =
+    "SELECT ROWID FROM handle ORDER BY ROWID;",
+    
+    /// Feeds the search index, the same range scan with the bodies to decode
+    [MESSAGES_STMT_SEARCH_SINCE] =
+    "SELECT ROWID, handle_id, date, text, attributedBody FROM message WHERE ROWID > ?1 "
+    "ORDER BY ROWID LIMIT ?2;",
+    
+    /// Only the unread received rows, a range of message_idx_is_read
+    [MESSAGES_STMT_UNREAD] =
+    "SELECT ROWID, handle_id FROM message "
+    "WHERE is_read = 0 AND is_from_me = 0 AND ROWID <= ?;",
+    
+    /// Moves whenever another connection commits, reading it costs no I/O
+    [MESSAGES_STMT_DATA_VERSION] =
+    "PRAGMA data_version;",
+    
+    [MESSAGES_STMT_MAX_HANDLE_ROWID] =
+    "SELECT IFNULL(MAX(ROWID), 0) FROM handle;",
+    
+    /// Handles only ever get appended, a range scan over the rowid b-tree
+    [MESSAGES_STMT_HANDLES_SINCE] =
+    "SELECT ROWID FROM handle WHERE ROWID > ? ORDER BY ROWID;",
+    
+    /// One MAX(date) probe into message_idx_handle per handle, handles with
+    /// no messages come back NULL
+    [MESSAGES_STMT_RECENT_HANDLES] =
+    "SELECT h.ROWID, (SELECT MAX(date) FROM message WHERE handle_id = h.ROWID) FROM handle h;",
+};
+
+static const char *statement_names[MESSAGES_STMT_COUNT] = {
+    [MESSAGES_STMT_MAX_ROWID] = "MAX_ROWID",
+    [MESSAGES_STMT_NEW_SINCE] = "NEW_SINCE",
+    [MESSAGES_STMT_LAST_TALKED_TO] = "LAST_TALKED_TO",
+    [MESSAGES_STMT_LAST_MESSAGE_TEXT] = "LAST_MESSAGE_TEXT",
+    [MESSAGES_STMT_HANDLE_SUMMARIES] = "HANDLE_SUMMARIES",
+    [MESSAGES_STMT_ATTACHMENTS] = "ATTACHMENTS",
+    [MESSAGES_STMT_PAGE_OLDER] = "PAGE_OLDER",
+    [MESSAGES_STMT_PAGE_NEWER] = "PAGE_NEWER",
+    [MESSAGES_STMT_INDEX_SINCE] = "INDEX_SINCE",
+    [MESSAGES_STMT_MESSAGE_BY_ROWID] = "MESSAGE_BY_ROWID",
+    [MESSAGES_STMT_ALL_HANDLES] = "ALL_HANDLES",
+    [MESSAGES_STMT_SEARCH_SINCE] = "SEARCH_SINCE",
+    [MESSAGES_STMT_UNREAD] = "UNREAD",
+    [MESSAGES_STMT_DATA_VERSION] = "DATA_VERSION",
+    [MESSAGES_STMT_MAX_HANDLE_ROWID] = "MAX_HANDLE_ROWID",
+    [MESSAGES_STMT_HANDLES_SINCE] = "HANDLES_SINCE",
+    [MESSAGES_STMT_RECENT_HANDLES] = "RECENT_HANDLES",
+};
+
+/// SQLite calls this as a statement finishes (reset or done), on the thread
+/// that ran it, which holds the context lock for any cached statement
+static int profile_statement(unsigned type, void *userdata, void *p, void *x) {
+    MessagesContext *ctx = userdata;
+    if (type != SQLITE_TRACE_PROFILE) return 0;
+    
+    for (int id = 0; id < MESSAGES_STMT_COUNT; id++) {
+        if (ctx->statements[id] == p) {
+            messages_metrics_record_statement(&ctx->metrics, id, p, (uint64_t)*(sqlite3_int64 *)x);
+            break;
+        }
+    }
+    return 0;
+}
+
+MessagesContext *messages_context_open(const char *db_path) {
+    if (!db_path) return NULL;
+    
+    MessagesContext *ctx = calloc(1, sizeof(MessagesContext));
+    if (!ctx) return NULL;
+    
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ctx->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    
+    int rc = sqlite3_open_v2(db_path,
+                             &ctx->db,
+                             SQLITE_OPEN_READONLY | SQLITE_OPEN_FULLMUTEX | SQLITE_OPEN_SHAREDCACHE,
+                             NULL);
+    if (rc != SQLITE_OK) {
+        sqlite3_close(ctx->db);
+        pthread_mutex_destroy(&ctx->lock);
+        free(ctx);
+        return NULL;
+    }
+    
+    struct stat st;
+    if (stat(db_path, &st) == 0) {
+        ctx->db_identity = (uint64_t)st.st_dev << 32 ^ (uint64_t)st.st_ino;
+    }
+    
+    sqlite3_trace_v2(ctx->db, SQLITE_TRACE_PROFILE, profile_statement, ctx);
+    message_seen_set_init(&ctx->seen);
+    ctx->conversations = conversation_cache_create(CONVERSATION_CACHE_DEFAULT_BUDGET,
+                                                   CONVERSATION_CACHE_DEFAULT_PER_HANDLE);
+    ctx->unread = unread_counters_create();
+    return ctx;
+}
+
+void messages_context_close(MessagesContext *ctx) {
+    if (!ctx) return;
+    
+    /// First, its readers look up in the sidecar index under the context lock
+    messages_reader_pool_close(ctx->pool);
+    
+    for (int i = 0; i < MESSAGES_STMT_COUNT; i++) {
+        sqlite3_finalize(ctx->statements[i]);
+        ctx->statements[i] = NULL;
+    }
+    sqlite3_close(ctx->db);
+    message_seen_set_destroy(&ctx->seen);
+    seen_snapshot_close(ctx->seen_snapshot);
+    conversation_cache_destroy(ctx->conversations);
+    unread_counters_destroy(ctx->unread);
+    recent_handles_destroy(ctx->recent);
+    sidecar_index_close(ctx->index);
+    sidecar_index_close(ctx->index_build.index);
+    free(ctx->index_build.entries);
+    message_search_close(ctx->search);
+    messages_event_ring_destroy(ctx->events);
+    /// Merges what an unfinished first build indexed, the next launch resumes from it
+    message_search_close(ctx->search_build);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+sqlite3 *messages_context_db(MessagesContext *ctx) {
+    return ctx ? ctx->db : NULL;
+}
+
+MessagesContextStats messages_context_stats(MessagesContext *ctx) {
+    MessagesContextStats stats = { 0 };
+    if (!ctx) return stats;
+    
+    messages_context_lock(ctx);
+    stats = ctx->stats;
+    messages_context_unlock(ctx);
+    return stats;
+}
+
+bool messages_context_set_cache_budget(MessagesContext *ctx, size_t budget_bytes, int messages_per_handle) {
+    if (!ctx) return false;
+    
+    ConversationCache *cache = conversation_cache_create(budget_bytes, messages_per_handle);
+    if (!cache) return false;
+    
+    /// Under the context lock so no delta scan or page fill is using the old one
+    messages_context_lock(ctx);
+    conversation_cache_destroy(ctx->conversations);
+    ctx->conversations = cache;
+    messages_context_unlock(ctx);
+    return true;
+}
+
+ConversationCacheStats messages_context_cache_stats(MessagesContext *ctx) {
+    ConversationCacheStats stats = { 0 };
+    if (!ctx) return stats;
+    
+    messages_context_lock(ctx);
+    stats = conversation_cache_stats(ctx->conversations);
+    messages_context_unlock(ctx);
+    return stats;
+}
+
+// MARK: - Reader Pool
+
+bool messages_context_attach_pool(MessagesContext *ctx, int readers) {
+    if (!ctx) return false;
+    
+    messages_context_lock(ctx);
+    bool attached = ctx->pool != NULL;
+    messages_context_unlock(ctx);
+    if (attached) return true;
+    
+    const char *path = sqlite3_db_filename(ctx->db, "main");
+    if (!path || !*path) return false;
+    
+    MessagesReaderPool *pool = messages_reader_pool_open(path, readers, &ctx->metrics);
+    if (!pool) return false;
+    
+    messages_context_lock(ctx);
+    if (ctx->pool) {
+        messages_context_unlock(ctx);
+        messages_reader_pool_close(pool);
+        return true;
+    }
+    ctx->pool = pool;
+    messages_context_unlock(ctx);
+    return true;
+}
+
+// MARK: - Events
+
+/// Read state changes once the counts are seeded, the seed itself is no news
+static void publish_unread_change(int64_t rowid, int64_t handle_id, bool unread,
+                                  int64_t handle_unread, void *userdata) {
+    MessagesContext *ctx = userdata;
+    if (!ctx->unread_seeded) return;
+    
+    MessagesEvent event = {
+        .kind = MESSAGES_EVENT_READ_STATE,
+        .is_read = !unread,
+        .handle_id = handle_id,
+        .rowid = rowid,
+        .unread = handle_unread,
+    };
+    messages_context_publish(ctx, &event);
+}
+
+void messages_context_publish(MessagesContext *ctx, const MessagesEvent *event) {
+    if (ctx->events) messages_event_ring_push(ctx->events, event);
+}
+
+bool messages_context_attach_events(MessagesContext *ctx, int capacity) {
+    if (!ctx) return false;
+    
+    messages_context_lock(ctx);
+    if (ctx->events) {
+        messages_context_unlock(ctx);
+        return true;
+    }
+    
+    /// Handles that exist now are not new, only ones added after this are
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_MAX_HANDLE_ROWID);
+    bool seeded = stmt && sqlite3_step(stmt) == SQLITE_ROW;
+    if (seeded) ctx->handle_watermark = sqlite3_column_int64(stmt, 0);
+    if (stmt) messages_context_release(ctx, stmt);
+    
+    MessagesEventRing *ring = seeded ? messages_event_ring_create(capacity) : NULL;
+    if (ring) {
+        ctx->events = ring;
+        unread_counters_observe(ctx->unread, publish_unread_change, ctx);
+    }
+    messages_context_unlock(ctx);
+    return ring != NULL;
+}
+
+MessagesEventRing *messages_context_events(MessagesContext *ctx) {
+    if (!ctx) return NULL;
+    
+    messages_context_lock(ctx);
+    MessagesEventRing *ring = ctx->events;
+    messages_context_unlock(ctx);
+    return ring;
+}
+
+// MARK: - Seen Snapshot
+
+bool messages_context_restore_seen(MessagesContext *ctx, const char *snapshot_path) {
+    if (!ctx || !snapshot_path) return false;
+    
+    SeenSnapshot *snapshot = seen_snapshot_open(snapshot_path, ctx->db_identity);
+    if (!snapshot) return false;
+    
+    messages_context_lock(ctx);
+    
+    int64_t max_rowid = -1;
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_MAX_ROWID);
+    if (stmt && sqlite3_step(stmt) == SQLITE_ROW) max_rowid = sqlite3_column_int64(stmt, 0);
+    messages_context_release(ctx, stmt);
+    
+    /// Rows it counted as handed out are gone, chat.db was replaced since
+    bool ok = max_rowid >= 0 && seen_snapshot_watermark(snapshot) <= max_rowid;
+    if (ok) {
+        seen_snapshot_close(ctx->seen_snapshot);
+        ctx->seen_snapshot = snapshot;
+        ctx->rowid_watermark = seen_snapshot_watermark(snapshot);
+        ctx->has_watermark = true;
+    } else {
+        seen_snapshot_close(snapshot);
+    }
+    
+    messages_context_unlock(ctx);
+    return ok;
+}
+
+typedef struct {
+    SeenSnapshotWriter *writer;
+    int64_t cutoff;
+} SnapshotCopy;
+
+static void add_to_snapshot(const char *key, size_t length, MessageMeta value, void *userdata) {
+    SnapshotCopy *copy = userdata;
+    if (value.date >= copy->cutoff) seen_snapshot_writer_add(copy->writer, key, length, value);
+}
+
+bool messages_context_save_seen(MessagesContext *ctx, const char *snapshot_path) {
+    if (!ctx || !snapshot_path) return false;
+    
+    int64_t watermark = get_messages_watermark(ctx);
+    if (watermark < 0) return false;
+    
+    /// Held so the restored snapshot can't be swapped out while we copy it
+    messages_context_lock(ctx);
+    SeenSnapshotWriter *writer = seen_snapshot_writer_create(message_seen_set_count(&ctx->seen) +
+                                                             seen_snapshot_count(ctx->seen_snapshot));
+    SnapshotCopy copy = { .writer = writer, .cutoff = message_seen_set_cutoff(&ctx->seen) };
+    bool ok = writer != NULL;
+    if (ok) {
+        message_seen_set_each(&ctx->seen, add_to_snapshot, &copy);
+        seen_snapshot_each(ctx->seen_snapshot, add_to_snapshot, &copy);
+        ok = seen_snapshot_writer_finish(writer, snapshot_path, ctx->db_identity, watermark);
+    }
+    messages_context_unlock(ctx);
+    return ok;
+}
+
+void messages_context_set_seen_window(MessagesContext *ctx, int64_t seconds) {
+    if (!ctx) return;
+    message_seen_set_set_window(&ctx->seen, seconds);
+}
+
+// MARK: - Sidecar Index
+
+/// Appends (rowid, handle_id, date) for every row `stmt` returns to `build`
+static bool collect_index_rows(sqlite3_stmt *stmt, MessagesIndexBuild *build, int *rows) {
+    *rows = 0;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (build->count == build->capacity) {
+            size_t capacity = build->capacity ? build->capacity * 2 : 4096;
+            SidecarIndexEntry *grown = realloc(build->entries, capacity * sizeof(SidecarIndexEntry));
+            if (!grown) return false;
+            build->entries = grown;
+            build->capacity = capacity;
+        }
+        
+        SidecarIndexEntry *entry = &build->entries[build->count++];
+        entry->rowid = sqlite3_column_int64(stmt, 0);
+        entry->handle_id = sqlite3_column_int64(stmt, 1);
+        entry->date = sqlite3_column_int64(stmt, 2);
+        build->watermark = entry->rowid;
+        (*rows)++;
+    }
+    return rc == SQLITE_DONE;
+}
+
+/// The first build reads the whole message table, so it gets its own
+/// connection and does not hold the context lock while it runs. Reads at most
+/// `batch` rows past the build's watermark (everything if `batch` <= 0).
+static bool build_index_batch(MessagesIndexBuild *build, const char *db_path, int batch, int *rows) {
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    bool ok = false;
+    
+    if (sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, statement_sql[MESSAGES_STMT_INDEX_SINCE], -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, build->watermark);
+        sqlite3_bind_int(stmt, 2, batch > 0 ? batch : -1);
+        ok = collect_index_rows(stmt, build, rows);
+    }
+    
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return ok;
+}
+
+static void index_build_reset(MessagesIndexBuild *build) {
+    sidecar_index_close(build->index);
+    free(build->entries);
+    memset(build, 0, sizeof(*build));
+}
+
+bool messages_index_catch_up(MessagesContext *ctx) {
+    if (!ctx->index) return false;
+    
+    int64_t max_rowid = -1;
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_MAX_ROWID);
+    if (!stmt) return false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) max_rowid = sqlite3_column_int64(stmt, 0);
+    messages_context_release(ctx, stmt);
+    
+    int64_t watermark = sidecar_index_watermark(ctx->index);
+    if (max_rowid < 0) return false;
+    if (watermark == max_rowid) return true;
+    
+    stmt = messages_context_statement(ctx, MESSAGES_STMT_INDEX_SINCE);
+    if (!stmt) return false;
+    
+    bool ok;
+    if (watermark > max_rowid) {
+        /// Rows we indexed are gone, chat.db was swapped under us, start over
+        MessagesIndexBuild build = { 0 };
+        int rows;
+        sqlite3_bind_int64(stmt, 1, 0);
+        sqlite3_bind_int(stmt, 2, -1);
+        ok = collect_index_rows(stmt, &build, &rows) &&
+             sidecar_index_rebuild(ctx->index, build.entries, build.count, build.watermark);
+        free(build.entries);
+    } else {
+        sqlite3_bind_int64(stmt, 1, watermark);
+        sqlite3_bind_int(stmt, 2, -1);
+        ok = true;
+        int rc;
+        while (ok && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            SidecarIndexEntry entry = {
+                .rowid = sqlite3_column_int64(stmt, 0),
+                .handle_id = sqlite3_column_int64(stmt, 1),
+                .date = sqlite3_column_int64(stmt, 2),
+            };
+            ok = sidecar_index_add(ctx->index, &entry);
+        }
+        ok = ok && rc == SQLITE_DONE;
+    }
+    
+    messages_context_release(ctx, stmt);
+    return ok;
+}
+
+MessagesBuildStatus messages_context_attach_index_step(MessagesContext *ctx, const char *index_path,
+                                                      int batch) {
+    if (!ctx || !index_path) return MESSAGES_BUILD_FAILED;
+    
+    MessagesIndexBuild *build = &ctx->index_build;
+    if (!build->index) {
+        build->index = sidecar_index_open(index_path, ctx->db_identity);
+        if (!build->index) return MESSAGES_BUILD_FAILED;
+    }
+    
+    /// Only a file with nothing in it is built here, one with a watermark just catches up
+    if (sidecar_index_watermark(build->index) == 0) {
+        const char *db_path = sqlite3_db_filename(ctx->db, "main");
+        int rows = 0;
+        if (!db_path || !build_index_batch(build, db_path, batch, &rows)) {
+            index_build_reset(build);
+            return MESSAGES_BUILD_FAILED;
+        }
+        if (batch > 0 && rows == batch) return MESSAGES_BUILD_MORE;
+        
+        if (!sidecar_index_rebuild(build->index, build->entries, build->count, build->watermark)) {
+            index_build_reset(build);
+            return MESSAGES_BUILD_FAILED;
+        }
+    }
+    
+    SidecarIndex *index = build->index;
+    build->index = NULL;
+    index_build_reset(build);
+    
+    messages_context_lock(ctx);
+    sidecar_index_close(ctx->index);
+    ctx->index = index;
+    bool ok = messages_index_catch_up(ctx);
+    if (!ok) {
+        sidecar_index_close(ctx->index);
+        ctx->index = NULL;
+    }
+    messages_context_unlock(ctx);
+    return ok ? MESSAGES_BUILD_DONE : MESSAGES_BUILD_FAILED;
+}
+
+bool messages_context_attach_index(MessagesContext *ctx, const char *index_path) {
+    return messages_context_attach_index_step(ctx, index_path, 0) == MESSAGES_BUILD_DONE;
+}
+
+// MARK: - Search Index
+
+/// Indexes the text of every row `stmt` (MESSAGES_STMT_SEARCH_SINCE) returns.
+/// Bodies C can't decode are skipped, Swift's fallback decoder is not reachable from here.
+static bool index_search_rows(MessageSearch *search, sqlite3_stmt *stmt, int *rows) {
+    bool ok = true;
+    int rc;
+    *rows = 0;
+    while (ok && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        (*rows)++;
+        MessageSearchDoc doc = {
+            .rowid = sqlite3_column_int64(stmt, 0),
+            .handle_id = sqlite3_column_int64(stmt, 1),
+            .date = sqlite3_column_int64(stmt, 2),
+        };
+        const char *text = NULL;
+        size_t length = 0;
+        if (!messages_body_text(messages_column_body(stmt, 3, 4), &text, &length)) length = 0;
+        ok = message_search_add(search, &doc, text, length);
+    }
+    return ok && rc == SQLITE_DONE;
+}
+
+/// Like `build_index_batch`, decodes at most `batch` messages past the
+/// watermark (all of them if `batch` <= 0) on its own connection
+static bool build_search_batch(MessageSearch *search, const char *db_path, int batch, int *rows) {
+    sqlite3 *db = NULL;
+    sqlite3_stmt *stmt = NULL;
+    bool ok = false;
+    
+    if (sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, statement_sql[MESSAGES_STMT_SEARCH_SINCE], -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, message_search_watermark(search));
+        sqlite3_bind_int(stmt, 2, batch > 0 ? batch : -1);
+        ok = index_search_rows(search, stmt, rows);
+    }
+    
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return ok;
+}
+
+bool messages_search_catch_up(MessagesContext *ctx) {
+    if (!ctx->search) return false;
+    
+    int64_t max_rowid = -1;
+    sqlite3_stmt *stmt = messages_context_statement(ctx, MESSAGES_STMT_MAX_ROWID);
+    if (!stmt) return false;
+    if (sqlite3_step(stmt) == SQLITE_ROW) max_rowid = sqlite3_column_int64(stmt, 0);
+    messages_context_release(ctx, stmt);
+    
+    if (max_rowid < 0) return false;
+    if (message_search_watermark(ctx->search) == max_rowid) return true;
+    
+    /// Rows we indexed are gone, chat.db was swapped under us, start over
+    if (message_search_watermark(ctx->search) > max_rowid) message_search_clear(ctx->search);
+    
+    stmt = messages_context_statement(ctx, MESSAGES_STMT_SEARCH_SINCE);
+    if (!stmt) return false;
+    sqlite3_bind_int64(stmt, 1, message_search_watermark(ctx->search));
+    sqlite3_bind_int(stmt, 2, -1);
+    int rows;
+    bool ok = index_search_rows(ctx->search, stmt, &rows);
+    messages_context_release(ctx, stmt);
+    return ok;
+}
+
+MessagesBuildStatus messages_context_attach_search_step(MessagesContext *ctx, const char *index_path,
+                                                       int batch) {
+    if (!ctx || !index_path) return MESSAGES_BUILD_FAILED;
+    
+    if (!ctx->search_build) {
+        ctx->search_build = message_search_open(index_path, ctx->db_identity);
+        if (!ctx->search_build) return MESSAGES_BUILD_FAILED;
+    }
+    
+    /// Resumes from whatever the file already holds, so an interrupted first build picks up where it stopped.
+    /// The tail is only flushed once the batches ran out, it merges itself whenever it grows large.
+    const char *db_path = sqlite3_db_filename(ctx->db, "main");
+    int rows = 0;
+    bool ok = db_path && build_search_batch(ctx->search_build, db_path, batch, &rows);
+    if (ok && batch > 0 && rows == batch) return MESSAGES_BUILD_MORE;
+    
+    MessageSearch *search = ctx->search_build;
+    ctx->search_build = NULL;
+    if (!ok || !message_search_flush(search)) {
+        message_search_close(search);
+        return MESSAGES_BUILD_FAILED;
+    }
+    
+    messages_context_lock(ctx);
+    message_search_close(ctx->search);
+    ctx->search = search;
+    ok = messages_search_catch_up(ctx);
+    if (!ok) {
+        message_search_close(ctx->search);
+        ctx->search = NULL;
+    }
+    messages_context_unlock(ctx);
+    return ok ? MESSAGES_BUILD_DONE : MESSAGES_BUILD_FAILED;
+}
+
+bool messages_context_attach_search(MessagesContext *ctx, const char *index_path) {
+    return messages_context_attach_search_step(ctx, index_path, 0) == MESSAGES_BUILD_DONE;
+}
+
+// MARK: - Locking
+
+void messages_context_lock(MessagesContext *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+}
+
+void messages_context_unlock(MessagesContext *ctx) {
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+sqlite3_stmt *messages_context_statement(MessagesContext *ctx, MessagesStatementID id) {
+    if (!ctx || id < 0 || id >= MESSAGES_STMT_COUNT) return NULL;
+    
+    messages_context_lock(ctx);
+    
+    sqlite3_stmt *stmt = ctx->statements[id];
+    if (stmt) {
+        ctx->stats.prepares_avoided++;
+        return stmt;
+    }
+    
+    /// SQLITE_PREPARE_PERSISTENT tells SQLite this statement will be reused for a long time
+    if (sqlite3_prepare_v3(ctx->db, statement_sql[id], -1,
+                           SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK) {
+        messages_context_unlock(ctx);
+        return NULL;
+    }
+    
+    ctx->stats.prepares++;
+    ctx->statements[id] = stmt;
+    return stmt;
+}
+
+const char *messages_context_statement_sql(MessagesStatementID id) {
+    return id >= 0 && id < MESSAGES_STMT_COUNT ? statement_sql[id] : NULL;
+}
+
+const char *messages_context_statement_name(MessagesStatementID id) {
+    return id >= 0 && id < MESSAGES_STMT_COUNT ? statement_names[id] : NULL;
+}
+
+void messages_context_release(MessagesContext *ctx, sqlite3_stmt *stmt) {
+    if (!stmt) return;
+    
+    /// Reset ends the implicit read transaction so WAL checkpoints are not held back
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    messages_context_unlock(ctx);
+}
@@ -0,0 +1,108 @@
+//
+//  MessagesContext.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 7/28/25.
+//
+
+#ifndef MessagesContext_h
+#define MessagesContext_h
+
+#include <sqlite3.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ConversationCache.h"
+#include "MessagesEventRing.h"
+#include "MessagesMetrics.h"
+
+/// Opaque handle that owns the chat.db connection and every prepared statement
+/// the Messages C layer uses. Statements are compiled once and then reset/rebound,
+/// so the steady state poll never hits the SQL compiler.
+/// Every function taking a context is safe to call from any thread, there is
+/// no static state left in the Messages C layer.
+typedef struct MessagesContext MessagesContext;
+
+typedef struct {
+    uint64_t prepares;          // statements compiled with sqlite3_prepare_v2
+    uint64_t prepares_avoided;  // lookups served from the statement cache
+} MessagesContextStats;
+
+MessagesContext *messages_context_open(const char *db_path);
+void messages_context_close(MessagesContext *ctx);
+
+sqlite3 *messages_context_db(MessagesContext *ctx);
+MessagesContextStats messages_context_stats(MessagesContext *ctx);
+
+/// Resizes the conversation cache, dropping whatever it held. `messages_per_handle`
+/// should be at least the page size reads ask for or every read misses.
+bool messages_context_set_cache_budget(MessagesContext *ctx, size_t budget_bytes, int messages_per_handle);
+ConversationCacheStats messages_context_cache_stats(MessagesContext *ctx);
+
+/// Where a build that runs in bounded steps stands after one
+typedef enum {
+    MESSAGES_BUILD_FAILED = -1,
+    MESSAGES_BUILD_MORE   = 0,  // call the step again
+    MESSAGES_BUILD_DONE   = 1,  // built and attached
+} MessagesBuildStatus;
+
+/// Opens (building it the first time) the sidecar (handle_id, date) index at
+/// `index_path`, somewhere in the app's caches folder. From then on every
+/// "latest message of a handle" lookup is a binary search in it.
+bool messages_context_attach_index(MessagesContext *ctx, const char *index_path);
+
+/// `messages_context_attach_index` a piece at a time: the first build reads at
+/// most `batch` messages per call, outside the context lock, and picks up from
+/// the last ROWID it read. One caller at a time, until it returns DONE or FAILED.
+MessagesBuildStatus messages_context_attach_index_step(MessagesContext *ctx, const char *index_path,
+                                                      int batch);
+
+/// Opens the trigram search index at `index_path`, indexing whatever it is
+/// missing on its own connection first, so the first call over a long history
+/// takes a while. `search_messages` only answers once this succeeded.
+bool messages_context_attach_search(MessagesContext *ctx, const char *index_path);
+
+/// `messages_context_attach_search` a piece at a time, at most `batch`
+/// messages decoded per call. Same rules as `messages_context_attach_index_step`,
+/// and what a cancelled build indexed is kept for the next one.
+MessagesBuildStatus messages_context_attach_search_step(MessagesContext *ctx, const char *index_path,
+                                                       int batch);
+
+/// Opens `readers` more read-only connections to chat.db (0 for one per core),
+/// each on its own thread, and from then on splits handle summaries and page
+/// decoding across them. Calls attaching a second pool do nothing.
+bool messages_context_attach_pool(MessagesContext *ctx, int readers);
+
+/// From then on every poll (`has_chat_db_changed`) also publishes what it
+/// found as typed events into a ring of `capacity`: new messages, read state
+/// changes and new handles. Calls attaching a second ring do nothing.
+bool messages_context_attach_events(MessagesContext *ctx, int capacity);
+/// The ring to drain, NULL until attached. Lives as long as the context, stop
+/// watching its wake fd before closing the context.
+MessagesEventRing *messages_context_events(MessagesContext *ctx);
+
+/// Carries on from the last run: loads the seen GUIDs and ROWID watermark
+/// `messages_context_save_seen` left at `snapshot_path`, so messages that
+/// arrived while the app was closed are reported and nothing already reported
+/// fires again. Cost does not depend on how many GUIDs the file holds.
+/// Call before the first poll. Returns false, and the first poll starts from
+/// the newest row, if there is no usable snapshot for this chat.db.
+bool messages_context_restore_seen(MessagesContext *ctx, const char *snapshot_path);
+
+/// Writes the seen GUIDs (restored ones included) and the watermark, call on the way out.
+/// GUIDs that fell out of the seen window are left behind.
+bool messages_context_save_seen(MessagesContext *ctx, const char *snapshot_path);
+
+/// How long (in seconds of message date) a GUID is remembered, SEEN_SET_DEFAULT_WINDOW
+/// unless changed. 0 remembers everything, memory then grows with every message.
+void messages_context_set_seen_window(MessagesContext *ctx, int64_t seconds);
+
+/// Latency percentiles of every entry point since the last reset, plus what
+/// each statement cost SQLite and how healthy the seen-GUID table is.
+/// `reset` starts the next window, no call recorded in between is lost.
+bool messages_context_metrics(MessagesContext *ctx, MessagesMetricsSnapshot *out, bool reset);
+
+/// The same as one JSON object, written snprintf style: returns the length the
+/// whole document needs, and `buffer` holds as much as fit, NUL terminated.
+size_t messages_context_metrics_json(MessagesContext *ctx, char *buffer, size_t capacity, bool reset);
+
+#endif /* MessagesContext_h */
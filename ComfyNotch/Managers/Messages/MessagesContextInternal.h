@@ -0,0 +1,181 @@
+//
+//  MessagesContextInternal.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 7/28/25.
+//
+//  Only included by the C files in this folder, Swift should never
+//  see the layout of MessagesContext.
+//
+
+#ifndef MessagesContextInternal_h
+#define MessagesContextInternal_h
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "MessagesContext.h"
+#include "MessageHashMap.h"
+#include "Messages.h"
+#include "ConversationCache.h"
+#include "SidecarIndex.h"
+#include "MessageSearch.h"
+#include "SeenSnapshot.h"
+#include "MessagesMetrics.h"
+#include "UnreadCounters.h"
+#include "RecentHandles.h"
+
+/// A first sidecar index build between two `messages_context_attach_index_step` calls
+typedef struct {
+    SidecarIndex *index;
+    SidecarIndexEntry *entries;
+    size_t count;
+    size_t capacity;
+    /// Last ROWID read, the next batch starts after it
+    int64_t watermark;
+} MessagesIndexBuild;
+
+typedef struct MessagesReaderPool MessagesReaderPool;
+
+/// Every statement the context keeps prepared, the SQL lives in MessagesContext.c
+typedef enum {
+    MESSAGES_STMT_MAX_ROWID = 0,
+    MESSAGES_STMT_NEW_SINCE,
+    MESSAGES_STMT_LAST_TALKED_TO,
+    MESSAGES_STMT_LAST_MESSAGE_TEXT,
+    MESSAGES_STMT_HANDLE_SUMMARIES,
+    MESSAGES_STMT_ATTACHMENTS,
+    MESSAGES_STMT_PAGE_OLDER,
+    MESSAGES_STMT_PAGE_NEWER,
+    MESSAGES_STMT_INDEX_SINCE,
+    MESSAGES_STMT_MESSAGE_BY_ROWID,
+    MESSAGES_STMT_ALL_HANDLES,
+    MESSAGES_STMT_SEARCH_SINCE,
+    MESSAGES_STMT_UNREAD,
+    MESSAGES_STMT_DATA_VERSION,
+    MESSAGES_STMT_MAX_HANDLE_ROWID,
+    MESSAGES_STMT_HANDLES_SINCE,
+    MESSAGES_STMT_RECENT_HANDLES,
+    MESSAGES_STMT_COUNT
+} MessagesStatementID;
+
+_Static_assert(MESSAGES_STMT_COUNT <= MESSAGES_METRICS_MAX_STATEMENTS,
+               "grow MESSAGES_METRICS_MAX_STATEMENTS");
+
+/// Latency of one entry point. Recording is a handful of relaxed atomic adds,
+/// no lock, so it is cheap enough to leave on in release builds.
+typedef struct {
+    _Atomic uint64_t buckets[MESSAGES_HISTOGRAM_BUCKETS];
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+} MessagesHistogram;
+
+typedef struct {
+    _Atomic uint64_t executions;
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t vm_steps;
+    _Atomic uint64_t fullscan_steps;
+    _Atomic uint64_t sorts;
+} MessagesStatementCounters;
+
+typedef struct {
+    MessagesHistogram operations[MESSAGES_OP_COUNT];
+    MessagesStatementCounters statements[MESSAGES_STMT_COUNT];
+} MessagesMetrics;
+
+struct MessagesContext {
+    /// Recursive, held while a cached statement is in use and around the watermark
+    pthread_mutex_t lock;
+    
+    sqlite3 *db;
+    sqlite3_stmt *statements[MESSAGES_STMT_COUNT];
+    MessagesContextStats stats;
+    
+    /// Highest message ROWID already handed out by `get_new_messages`
+    int64_t rowid_watermark;
+    bool has_watermark;
+    
+    /// Every GUID `has_chat_db_changed` already reported
+    MessageSeenSet seen;
+    /// What the last run had seen, from `messages_context_restore_seen`, may be NULL
+    SeenSnapshot *seen_snapshot;
+    
+    /// Recent messages of recently opened conversations, kept current from the delta scan
+    ConversationCache *conversations;
+    
+    /// Unread received messages per handle. Seeded once, new rows come from the
+    /// delta scan and reads from a sweep whenever `data_version` moved.
+    UnreadCounters *unread;
+    bool unread_seeded;
+    int64_t unread_data_version;
+    
+    /// The handles with the newest messages, seeded by `get_recent_handles` and
+    /// moved by the delta scan after that. NULL until first asked for.
+    RecentHandles *recent;
+    
+    /// Our own (handle_id, date) index, NULL until `messages_context_attach_index`
+    SidecarIndex *index;
+    /// Only touched by the one caller stepping the build, never under the lock
+    MessagesIndexBuild index_build;
+    /// Trigram index over message text, NULL until `messages_context_attach_search`
+    MessageSearch *search;
+    /// The search index while `messages_context_attach_search_step` fills it, same rules as `index_build`
+    MessageSearch *search_build;
+    /// Read-only connections for batches split across cores, NULL until
+    /// `messages_context_attach_pool`
+    MessagesReaderPool *pool;
+    /// What polls found, for Swift to drain, NULL until `messages_context_attach_events`.
+    /// Only ever pushed to with the context locked, which keeps it single producer.
+    MessagesEventRing *events;
+    /// Highest handle ROWID already published, seeded when the ring is attached
+    int64_t handle_watermark;
+    /// Device and inode of chat.db, an index built for another file is thrown away
+    uint64_t db_identity;
+    
+    /// Per entry point latency and per statement cost, see `messages_context_metrics`
+    MessagesMetrics metrics;
+};
+
+/// Returns the cached statement for `id`, preparing it on first use, with the
+/// context locked. Always pair with `messages_context_release`, which ends the
+/// read transaction and unlocks.
+sqlite3_stmt *messages_context_statement(MessagesContext *ctx, MessagesStatementID id);
+void messages_context_release(MessagesContext *ctx, sqlite3_stmt *stmt);
+
+/// The SQL behind `id`, for tooling that checks query plans
+const char *messages_context_statement_sql(MessagesStatementID id);
+/// Short name of `id` like "NEW_SINCE", for reports
+const char *messages_context_statement_name(MessagesStatementID id);
+
+void messages_context_lock(MessagesContext *ctx);
+void messages_context_unlock(MessagesContext *ctx);
+
+/// Pushes `event` if a ring is attached. Call with the context locked.
+void messages_context_publish(MessagesContext *ctx, const MessagesEvent *event);
+
+/// Adds every message newer than the sidecar index's watermark to it, so a
+/// lookup never misses a row that arrived since. Call with the context locked.
+bool messages_index_catch_up(MessagesContext *ctx);
+
+/// Same for the search index, decoding the text of every new message once
+bool messages_search_catch_up(MessagesContext *ctx);
+
+/// Reads a text / attributedBody column pair of the current row as a view into
+/// SQLite's row buffer, only valid until the statement moves on
+MessagesBody messages_column_body(sqlite3_stmt *stmt, int text_column, int blob_column);
+
+/// What a conversation shows for `body`: the text as is, or the text decoded
+/// out of an attributedBody. `*text` points into `body.data`. Returns false if
+/// the blob could not be decoded in C.
+bool messages_body_text(MessagesBody body, const char **text, size_t *length);
+
+/// Monotonic clock in nanoseconds, the start time for `messages_metrics_record`
+uint64_t messages_metrics_now(void);
+/// Records one call of `op` that started at `start_ns`
+void messages_metrics_record(MessagesMetrics *metrics, MessagesOperation op, uint64_t start_ns);
+/// Records one execution of `stmt` that took `ns`, from SQLite's profile hook
+void messages_metrics_record_statement(MessagesMetrics *metrics, MessagesStatementID id,
+                                       sqlite3_stmt *stmt, uint64_t ns);
+
+#endif /* MessagesContextInternal_h */
@@ -0,0 +1,508 @@
+//
+//  MessagesCursor.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/1/25.
+//
+
+#include <sqlite3.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MessagesCursor.h"
+#include "MessagesContextInternal.h"
+#include "MessagesReaderPool.h"
+
+MessagesCursor messages_cursor_make(int64_t handle_id) {
+    MessagesCursor cursor = { 0 };
+    cursor.handle_id = handle_id;
+    return cursor;
+}
+
+// MARK: - Columns
+
+#define COLUMNS_MIN_ROWS    32
+#define COLUMNS_MIN_BODIES  4096
+
+/// Bytes of one row over every column
+#define COLUMNS_ROW_SIZE (3 * sizeof(int64_t) + 2 * sizeof(uint32_t) + sizeof(uint8_t))
+
+MessagesPageColumns *messages_page_columns_create(void) {
+    return calloc(1, sizeof(MessagesPageColumns));
+}
+
+void messages_page_columns_destroy(MessagesPageColumns *columns) {
+    if (!columns) return;
+    /// Every column lives in the block `rowid` starts
+    free(columns->rowid);
+    free(columns->bodies);
+    free(columns);
+}
+
+/// One block for every column, widest first so each stays aligned
+static bool grow_columns(MessagesPageColumns *columns, int rows) {
+    int capacity = columns->row_capacity ? columns->row_capacity : COLUMNS_MIN_ROWS;
+    while (capacity < rows) capacity *= 2;
+    
+    char *block = malloc((size_t)capacity * COLUMNS_ROW_SIZE);
+    if (!block) return false;
+    
+    MessagesPageColumns grown = *columns;
+    grown.rowid = (int64_t *)block;
+    grown.date = grown.rowid + capacity;
+    grown.handle_id = grown.date + capacity;
+    grown.body_offset = (uint32_t *)(grown.handle_id + capacity);
+    grown.body_length = grown.body_offset + capacity;
+    grown.flags = (uint8_t *)(grown.body_length + capacity);
+    grown.row_capacity = capacity;
+    
+    size_t count = (size_t)columns->count;
+    if (count) {
+        memcpy(grown.rowid, columns->rowid, count * sizeof(int64_t));
+        memcpy(grown.date, columns->date, count * sizeof(int64_t));
+        memcpy(grown.handle_id, columns->handle_id, count * sizeof(int64_t));
+        memcpy(grown.body_offset, columns->body_offset, count * sizeof(uint32_t));
+        memcpy(grown.body_length, columns->body_length, count * sizeof(uint32_t));
+        memcpy(grown.flags, columns->flags, count * sizeof(uint8_t));
+    }
+    free(columns->rowid);
+    *columns = grown;
+    return true;
+}
+
+/// Copies `length` bytes and a NUL onto the end of `bodies`, returns the offset
+static bool append_body(MessagesPageColumns *columns, const void *data, size_t length, uint32_t *offset) {
+    size_t needed = columns->bodies_used + length + 1;
+    if (needed > UINT32_MAX) return false;
+    
+    if (needed > columns->bodies_capacity) {
+        size_t capacity = columns->bodies_capacity ? columns->bodies_capacity : COLUMNS_MIN_BODIES;
+        while (capacity < needed) capacity *= 2;
+        char *bodies = realloc(columns->bodies, capacity);
+        if (!bodies) return false;
+        columns->bodies = bodies;
+        columns->bodies_capacity = capacity;
+    }
+    
+    *offset = (uint32_t)columns->bodies_used;
+    if (length) memcpy(columns->bodies + columns->bodies_used, data, length);
+    columns->bodies[columns->bodies_used + length] = '\0';
+    columns->bodies_used = needed;
+    return true;
+}
+
+// MARK: - Pages
+
+/// One message as the statement or the cache has it, `body` only valid until
+/// either moves on
+typedef struct {
+    int64_t rowid;
+    int64_t date;
+    bool is_from_me;
+    bool is_read;
+    bool has_attachments;
+    MessagesBody body;
+} PageRowView;
+
+/// Where a page goes, row structs or columns, exactly one of the two is set
+typedef struct {
+    MessagesPageRow *rows;
+    MessagesPageColumns *columns;
+    int64_t handle_id;
+    int count;
+} PageOut;
+
+static bool page_out_add(PageOut *out, const PageRowView *view) {
+    if (out->rows) {
+        MessagesPageRow *row = &out->rows[out->count++];
+        memset(row, 0, sizeof(*row));
+        row->rowid = view->rowid;
+        row->date = view->date;
+        row->is_from_me = view->is_from_me;
+        row->is_read = view->is_read;
+        row->has_attachments = view->has_attachments;
+    
+        if (view->body.kind == MESSAGES_BODY_TEXT) {
+            row->text = strndup(view->body.data, view->body.length);
+        } else if (view->body.kind == MESSAGES_BODY_ATTRIBUTED) {
+            row->attributed_body = malloc(view->body.length);
+            if (row->attributed_body) {
+                memcpy(row->attributed_body, view->body.data, view->body.length);
+                row->attributed_body_len = (int)view->body.length;
+            }
+        }
+        return true;
+    }
+    
+    MessagesPageColumns *columns = out->columns;
+    if (columns->count == columns->row_capacity && !grow_columns(columns, columns->count + 1)) return false;
+    
+    int i = columns->count;
+    uint32_t offset = 0;
+    size_t length = view->body.kind == MESSAGES_BODY_NONE ? 0 : view->body.length;
+    if (!append_body(columns, view->body.data, length, &offset)) return false;
+    
+    columns->rowid[i] = view->rowid;
+    columns->date[i] = view->date;
+    columns->handle_id[i] = out->handle_id;
+    columns->body_offset[i] = offset;
+    columns->body_length[i] = (uint32_t)length;
+    columns->flags[i] = (view->is_from_me ? MESSAGES_PAGE_FROM_ME : 0) |
+                        (view->is_read ? MESSAGES_PAGE_READ : 0) |
+                        (view->has_attachments ? MESSAGES_PAGE_HAS_ATTACHMENTS : 0) |
+                        (view->body.kind == MESSAGES_BODY_ATTRIBUTED ? MESSAGES_PAGE_ATTRIBUTED : 0);
+    columns->count++;
+    out->count++;
+    return true;
+}
+
+/// Row `i` of what was written so far
+static PageRowView page_out_row(const PageOut *out, int i) {
+    PageRowView view = { 0 };
+    
+    if (out->rows) {
+        const MessagesPageRow *row = &out->rows[i];
+        view = (PageRowView){
+            .rowid = row->rowid,
+            .date = row->date,
+            .is_from_me = row->is_from_me,
+            .is_read = row->is_read,
+            .has_attachments = row->has_attachments,
+        };
+        if (row->text) {
+            view.body = (MessagesBody){ MESSAGES_BODY_TEXT, row->text, strlen(row->text) };
+        } else if (row->attributed_body) {
+            view.body = (MessagesBody){ MESSAGES_BODY_ATTRIBUTED, row->attributed_body,
+                                        (size_t)row->attributed_body_len };
+        }
+        return view;
+    }
+    
+    const MessagesPageColumns *columns = out->columns;
+    uint8_t flags = columns->flags[i];
+    view = (PageRowView){
+        .rowid = columns->rowid[i],
+        .date = columns->date[i],
+        .is_from_me = flags & MESSAGES_PAGE_FROM_ME,
+        .is_read = flags & MESSAGES_PAGE_READ,
+        .has_attachments = flags & MESSAGES_PAGE_HAS_ATTACHMENTS,
+    };
+    if (columns->body_length[i]) {
+        view.body = (MessagesBody){
+            flags & MESSAGES_PAGE_ATTRIBUTED ? MESSAGES_BODY_ATTRIBUTED : MESSAGES_BODY_TEXT,
+            columns->bodies + columns->body_offset[i],
+            columns->body_length[i],
+        };
+    }
+    return view;
+}
+
+/// Runs one keyset page from (date, rowid), exclusive, in the statement's direction
+static int read_page(MessagesContext *ctx, MessagesStatementID id, int64_t date, int64_t rowid,
+                     PageOut *out, int capacity) {
+    sqlite3_stmt *stmt = messages_context_statement(ctx, id);
+    if (!stmt) return -1;
+    
+    sqlite3_bind_int64(stmt, 1, out->handle_id);
+    sqlite3_bind_int64(stmt, 2, date);
+    sqlite3_bind_int64(stmt, 3, rowid);
+    sqlite3_bind_int(stmt, 4, capacity);
+    
+    bool ok = true;
+    while (ok && out->count < capacity && sqlite3_step(stmt) == SQLITE_ROW) {
+        PageRowView view = {
+            .rowid = sqlite3_column_int64(stmt, 0),
+            .date = sqlite3_column_int64(stmt, 1),
+            .is_from_me = sqlite3_column_int(stmt, 2) == 1,
+            .is_read = sqlite3_column_int(stmt, 3) == 1,
+            .has_attachments = sqlite3_column_int(stmt, 4) == 1,
+            .body = messages_column_body(stmt, 5, 6),
+        };
+        ok = page_out_add(out, &view);
+    }
+    
+    messages_context_release(ctx, stmt);
+    return ok ? out->count : -1;
+}
+
+/// Seeds the conversation cache with the newest page. Only if C could decode
+/// every body, a half decoded conversation would show blanks.
+static void fill_conversation_cache(MessagesContext *ctx, const PageOut *out, bool complete) {
+    int count = out->count;
+    ConversationCacheMessage *messages = calloc(count ? count : 1, sizeof(ConversationCacheMessage));
+    if (!messages) return;
+    
+    bool decoded = true;
+    for (int i = 0; decoded && i < count; i++) {
+        PageRowView row = page_out_row(out, i);
+        messages[i] = (ConversationCacheMessage){
+            .rowid = row.rowid,
+            .date = row.date,
+            .is_from_me = row.is_from_me,
+            .is_read = row.is_read,
+            .has_attachments = row.has_attachments,
+        };
+        decoded = messages_body_text(row.body, &messages[i].text, &messages[i].text_length);
+    }
+    
+    if (decoded) conversation_cache_fill(ctx->conversations, out->handle_id, messages, count, complete);
+    free(messages);
+}
+
+static int older_page(MessagesContext *ctx, MessagesCursor *cursor, PageOut *out, int capacity) {
+    int64_t date = cursor->has_rows ? cursor->oldest_date : INT64_MAX;
+    int64_t rowid = cursor->has_rows ? cursor->oldest_rowid : INT64_MAX;
+    
+    /// A fresh cursor reads the newest page, which also seeds the cache. The
+    /// lock keeps the delta scan from slipping a row in between the two.
+    bool fills = !cursor->has_rows;
+    if (fills) messages_context_lock(ctx);
+    
+    int count = read_page(ctx, MESSAGES_STMT_PAGE_OLDER, date, rowid, out, capacity);
+    if (fills) {
+        if (count >= 0) fill_conversation_cache(ctx, out, count < capacity);
+        messages_context_unlock(ctx);
+    }
+    if (count <= 0) return count;
+    
+    if (!cursor->has_rows) {
+        PageRowView newest = page_out_row(out, 0);
+        cursor->newest_date = newest.date;
+        cursor->newest_rowid = newest.rowid;
+        cursor->has_rows = true;
+    }
+    PageRowView oldest = page_out_row(out, count - 1);
+    cursor->oldest_date = oldest.date;
+    cursor->oldest_rowid = oldest.rowid;
+    return count;
+}
+
+static int newer_page(MessagesContext *ctx, MessagesCursor *cursor, PageOut *out, int capacity) {
+    int64_t date = cursor->has_rows ? cursor->newest_date : INT64_MIN;
+    int64_t rowid = cursor->has_rows ? cursor->newest_rowid : INT64_MIN;
+    
+    int count = read_page(ctx, MESSAGES_STMT_PAGE_NEWER, date, rowid, out, capacity);
+    if (count <= 0) return count;
+    
+    if (!cursor->has_rows) {
+        PageRowView oldest = page_out_row(out, 0);
+        cursor->oldest_date = oldest.date;
+        cursor->oldest_rowid = oldest.rowid;
+        cursor->has_rows = true;
+    }
+    PageRowView newest = page_out_row(out, count - 1);
+    cursor->newest_date = newest.date;
+    cursor->newest_rowid = newest.rowid;
+    return count;
+}
+
+typedef struct {
+    PageOut *out;
+    bool ok;
+} CachedPage;
+
+static void copy_cached_row(const ConversationCacheMessage *message, void *userdata) {
+    CachedPage *page = userdata;
+    PageRowView view = {
+        .rowid = message->rowid,
+        .date = message->date,
+        .is_from_me = message->is_from_me,
+        .is_read = message->is_read,
+        .has_attachments = message->has_attachments,
+        .body = { MESSAGES_BODY_TEXT, message->text, message->text_length },
+    };
+    page->ok = page->ok && page_out_add(page->out, &view);
+}
+
+static int cached_page(MessagesContext *ctx, MessagesCursor *cursor, PageOut *out, int capacity) {
+    CachedPage page = { .out = out, .ok = true };
+    
+    messages_context_lock(ctx);
+    int count = conversation_cache_visit(ctx->conversations, cursor->handle_id, capacity,
+                                         copy_cached_row, &page);
+    messages_context_unlock(ctx);
+    /// Out of room in the columns, a query gets another try
+    if (!page.ok) return -1;
+    if (count <= 0) return count;
+    
+    PageRowView newest = page_out_row(out, 0), oldest = page_out_row(out, count - 1);
+    cursor->newest_date = newest.date;
+    cursor->newest_rowid = newest.rowid;
+    cursor->oldest_date = oldest.date;
+    cursor->oldest_rowid = oldest.rowid;
+    cursor->has_rows = true;
+    return count;
+}
+
+typedef int (*PageReader)(MessagesContext *ctx, MessagesCursor *cursor, PageOut *out, int capacity);
+
+static int run_page(MessagesContext *ctx, MessagesCursor *cursor, PageOut *out, int capacity,
+                    PageReader read, MessagesOperation op) {
+    out->handle_id = cursor->handle_id;
+    if (out->columns) {
+        out->columns->count = 0;
+        out->columns->bodies_used = 0;
+    }
+    
+    uint64_t start = messages_metrics_now();
+    int count = read(ctx, cursor, out, capacity);
+    messages_metrics_record(&ctx->metrics, op, start);
+    return count;
+}
+
+/// The next `capacity` messages older than anything returned so far, newest
+/// first. On a fresh cursor this is the newest page of the conversation.
+int messages_cursor_older(MessagesContext *ctx, MessagesCursor *cursor,
+                          MessagesPageRow *out, int capacity) {
+    if (!ctx || !cursor || !out || capacity <= 0) return -1;
+    
+    PageOut page = { .rows = out };
+    return run_page(ctx, cursor, &page, capacity, older_page, MESSAGES_OP_CURSOR_OLDER);
+}
+
+int messages_cursor_newer(MessagesContext *ctx, MessagesCursor *cursor,
+                          MessagesPageRow *out, int capacity) {
+    if (!ctx || !cursor || !out || capacity <= 0) return -1;
+    
+    PageOut page = { .rows = out };
+    return run_page(ctx, cursor, &page, capacity, newer_page, MESSAGES_OP_CURSOR_NEWER);
+}
+
+int messages_cursor_cached(MessagesContext *ctx, MessagesCursor *cursor,
+                           MessagesPageRow *out, int capacity) {
+    if (!ctx || !cursor || !out || capacity <= 0 || cursor->has_rows) return -1;
+    
+    PageOut page = { .rows = out };
+    return run_page(ctx, cursor, &page, capacity, cached_page, MESSAGES_OP_CURSOR_CACHED);
+}
+
+int messages_cursor_older_columns(MessagesContext *ctx, MessagesCursor *cursor,
+                                  MessagesPageColumns *columns, int capacity) {
+    if (!ctx || !cursor || !columns || capacity <= 0) return -1;
+    
+    PageOut page = { .columns = columns };
+    return run_page(ctx, cursor, &page, capacity, older_page, MESSAGES_OP_CURSOR_OLDER);
+}
+
+int messages_cursor_newer_columns(MessagesContext *ctx, MessagesCursor *cursor,
+                                  MessagesPageColumns *columns, int capacity) {
+    if (!ctx || !cursor || !columns || capacity <= 0) return -1;
+    
+    PageOut page = { .columns = columns };
+    return run_page(ctx, cursor, &page, capacity, newer_page, MESSAGES_OP_CURSOR_NEWER);
+}
+
+int messages_cursor_cached_columns(MessagesContext *ctx, MessagesCursor *cursor,
+                                   MessagesPageColumns *columns, int capacity) {
+    if (!ctx || !cursor || !columns || capacity <= 0 || cursor->has_rows) return -1;
+    
+    PageOut page = { .columns = columns };
+    return run_page(ctx, cursor, &page, capacity, cached_page, MESSAGES_OP_CURSOR_CACHED);
+}
+
+// MARK: - Decoding
+
+/// Rows per pool task, decoding one is a few microseconds
+#define DECODE_CHUNK 8
+
+static bool decode_row(MessagesPageRow *row) {
+    if (row->text || !row->attributed_body) return false;
+    
+    MessagesBody body = { MESSAGES_BODY_ATTRIBUTED, row->attributed_body, (size_t)row->attributed_body_len };
+    const char *text;
+    size_t length;
+    if (!messages_body_text(body, &text, &length)) return false;
+    
+    /// `text` points into the blob, copy it out before the blob goes
+    char *copy = strndup(text, length);
+    if (!copy) return false;
+    free(row->attributed_body);
+    row->attributed_body = NULL;
+    row->attributed_body_len = 0;
+    row->text = copy;
+    return true;
+}
+
+/// Rows write only their own body and flags byte, so chunks never overlap
+static bool decode_column(MessagesPageColumns *columns, int i) {
+    if (!(columns->flags[i] & MESSAGES_PAGE_ATTRIBUTED)) return false;
+    
+    char *blob = columns->bodies + columns->body_offset[i];
+    MessagesBody body = { MESSAGES_BODY_ATTRIBUTED, blob, columns->body_length[i] };
+    const char *text;
+    size_t length;
+    if (!messages_body_text(body, &text, &length)) return false;
+    
+    /// `text` is inside the blob, and the blob already has its NUL after it
+    memmove(blob, text, length);
+    blob[length] = '\0';
+    columns->body_length[i] = (uint32_t)length;
+    columns->flags[i] &= (uint8_t)~MESSAGES_PAGE_ATTRIBUTED;
+    return true;
+}
+
+typedef struct {
+    MessagesPageRow *rows;
+    MessagesPageColumns *columns;
+    int count;
+    _Atomic int decoded;
+} DecodeBatch;
+
+static void decode_chunk(MessagesReader *reader, size_t index, void *userdata) {
+    (void)reader;
+    DecodeBatch *batch = userdata;
+    int first = (int)index * DECODE_CHUNK;
+    int last = first + DECODE_CHUNK < batch->count ? first + DECODE_CHUNK : batch->count;
+    
+    int decoded = 0;
+    for (int i = first; i < last; i++) {
+        decoded += batch->rows ? decode_row(&batch->rows[i]) : decode_column(batch->columns, i);
+    }
+    atomic_fetch_add(&batch->decoded, decoded);
+}
+
+static int decode_page(MessagesContext *ctx, DecodeBatch *batch) {
+    messages_context_lock(ctx);
+    MessagesReaderPool *pool = ctx->pool;
+    messages_context_unlock(ctx);
+    
+    atomic_init(&batch->decoded, 0);
+    size_t chunks = (size_t)(batch->count + DECODE_CHUNK - 1) / DECODE_CHUNK;
+    
+    if (pool && chunks > 1) {
+        messages_reader_pool_run(pool, chunks, decode_chunk, batch);
+    } else {
+        for (size_t i = 0; i < chunks; i++) decode_chunk(NULL, i, batch);
+    }
+    return atomic_load(&batch->decoded);
+}
+
+int messages_page_decode(MessagesContext *ctx, MessagesPageRow *rows, int count) {
+    if (!ctx || !rows || count < 0) return -1;
+    
+    uint64_t start = messages_metrics_now();
+    DecodeBatch batch = { .rows = rows, .count = count };
+    int decoded = decode_page(ctx, &batch);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_PAGE_DECODE, start);
+    return decoded;
+}
+
+int messages_page_columns_decode(MessagesContext *ctx, MessagesPageColumns *columns) {
+    if (!ctx || !columns) return -1;
+    
+    uint64_t start = messages_metrics_now();
+    DecodeBatch batch = { .columns = columns, .count = columns->count };
+    int decoded = decode_page(ctx, &batch);
+    messages_metrics_record(&ctx->metrics, MESSAGES_OP_PAGE_DECODE, start);
+    return decoded;
+}
+
+void free_messages_page(MessagesPageRow *rows, int count) {
+    if (!rows) return;
+    for (int i = 0; i < count; i++) {
+        free(rows[i].text);
+        free(rows[i].attributed_body);
+        rows[i].text = NULL;
+        rows[i].attributed_body = NULL;
+        rows[i].attributed_body_len = 0;
+    }
+}
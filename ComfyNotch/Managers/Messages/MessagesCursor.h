@@ -0,0 +1,118 @@
+//
+//  MessagesCursor.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/1/25.
+//
+
+#ifndef MessagesCursor_h
+#define MessagesCursor_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "MessagesContext.h"
+
+/// One message of a conversation page.
+/// `text` and `attributed_body` are heap allocated, release them with `free_messages_page`
+typedef struct {
+    int64_t rowid;
+    int64_t date;
+    bool is_from_me;
+    bool is_read;
+    bool has_attachments;
+    char *text;                     // NULL if the text column is empty
+    unsigned char *attributed_body; // raw blob, only filled when text is empty
+    int attributed_body_len;
+} MessagesPageRow;
+
+/// Where a conversation has been read up to, in both directions. Positions are
+/// (date, ROWID) keys rather than offsets, so messages arriving at the head
+/// never shift what the next older page returns. Plain value, copy it freely.
+typedef struct {
+    int64_t handle_id;
+    bool has_rows;              // false until a page returned something
+    int64_t oldest_date;
+    int64_t oldest_rowid;
+    int64_t newest_date;
+    int64_t newest_rowid;
+} MessagesCursor;
+
+MessagesCursor messages_cursor_make(int64_t handle_id);
+
+/// The next `capacity` messages older than anything returned so far, newest
+/// first. On a fresh cursor this is the newest page of the conversation.
+int messages_cursor_older(MessagesContext *ctx, MessagesCursor *cursor,
+                          MessagesPageRow *out, int capacity);
+
+/// Up to `capacity` messages newer than anything returned so far, oldest first
+/// so repeated calls carry on where the last one stopped.
+int messages_cursor_newer(MessagesContext *ctx, MessagesCursor *cursor,
+                          MessagesPageRow *out, int capacity);
+
+/// The newest page of a fresh cursor straight from the conversation cache, no
+/// query at all. Rows carry decoded `text` only. Returns -1 on a miss, then use
+/// `messages_cursor_older`, which fills the cache for next time.
+int messages_cursor_cached(MessagesContext *ctx, MessagesCursor *cursor,
+                           MessagesPageRow *out, int capacity);
+
+/// Decodes every `attributed_body` C can read into `text` and frees the blob,
+/// the rest keep theirs for the caller's own fallback. Spread over the reader
+/// pool if one is attached, so a page costs about one row per core. Returns
+/// how many rows it decoded.
+int messages_page_decode(MessagesContext *ctx, MessagesPageRow *rows, int count);
+
+void free_messages_page(MessagesPageRow *rows, int count);
+
+// MARK: - Columns
+
+/// What a row of `MessagesPageColumns` is, bits of `flags`
+enum {
+    MESSAGES_PAGE_FROM_ME         = 1 << 0,
+    MESSAGES_PAGE_READ            = 1 << 1,
+    MESSAGES_PAGE_HAS_ATTACHMENTS = 1 << 2,
+    /// The body is an undecoded attributedBody blob, not UTF-8 text
+    MESSAGES_PAGE_ATTRIBUTED      = 1 << 3,
+};
+
+/// A page in columns instead of one struct per row. Row `i` is `rowid[i]`,
+/// `date[i]` and so on, its body the `body_length[i]` bytes at
+/// `bodies + body_offset[i]`, always followed by a NUL. A length of 0 is no body.
+///
+/// Two allocations however long the page is, one for the columns and one for
+/// every body, and both are kept for the next page: once a buffer has grown to
+/// the page size, reading a page allocates nothing. Read the fields only, each
+/// page call replaces what was there. Not thread-safe, one per reader.
+typedef struct {
+    int count;
+    int64_t *rowid;
+    int64_t *date;
+    int64_t *handle_id;
+    uint32_t *body_offset;
+    uint32_t *body_length;
+    uint8_t *flags;
+    char *bodies;
+    
+    /// Room in the columns and in `bodies`, grown as needed
+    int row_capacity;
+    size_t bodies_used;
+    size_t bodies_capacity;
+} MessagesPageColumns;
+
+MessagesPageColumns *messages_page_columns_create(void);
+void messages_page_columns_destroy(MessagesPageColumns *columns);
+
+/// `messages_cursor_older`, `_newer` and `_cached` into columns. Same cursor,
+/// same rows in the same order, and the same -1 for a cache miss.
+int messages_cursor_older_columns(MessagesContext *ctx, MessagesCursor *cursor,
+                                  MessagesPageColumns *columns, int capacity);
+int messages_cursor_newer_columns(MessagesContext *ctx, MessagesCursor *cursor,
+                                  MessagesPageColumns *columns, int capacity);
+int messages_cursor_cached_columns(MessagesContext *ctx, MessagesCursor *cursor,
+                                   MessagesPageColumns *columns, int capacity);
+
+/// `messages_page_decode` for columns. The text C finds in a blob always fits
+/// where the blob was, so it is decoded in place and nothing moves.
+int messages_page_columns_decode(MessagesContext *ctx, MessagesPageColumns *columns);
+
+#endif /* MessagesCursor_h */
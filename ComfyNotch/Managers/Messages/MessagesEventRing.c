@@ -0,0 +1,169 @@
+//
+//  MessagesEventRing.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "MessagesEventRing.h"
+
+#define MIN_CAPACITY 16
+#define MAX_CAPACITY (1 << 16)
+/// Keeps each side's counters off the other's cache line
+#define CACHE_LINE 64
+
+struct MessagesEventRing {
+    MessagesEvent *slots;
+    uint64_t mask;
+    int wake_pipe[2];
+
+    /// Producer's line: where it writes next, and the last head it saw so a
+    /// push only reads the consumer's counter when the ring looks full
+    alignas(CACHE_LINE) _Atomic uint64_t tail;
+    uint64_t cached_head;
+
+    /// Consumer's line, it reads tail once per drain
+    alignas(CACHE_LINE) _Atomic uint64_t head;
+
+    /// Set by whoever wrote the byte now sitting in the wake pipe, so a burst
+    /// of pushes costs one write() and not one per event
+    alignas(CACHE_LINE) atomic_bool signalled;
+    atomic_bool overflowed;
+
+    _Atomic uint64_t pushed;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t wakes;
+};
+
+static void signal_consumer(MessagesEventRing *ring) {
+    if (atomic_exchange(&ring->signalled, true)) return;
+
+    char byte = 1;
+    while (write(ring->wake_pipe[1], &byte, 1) < 0 && errno == EINTR) {}
+    atomic_fetch_add_explicit(&ring->wakes, 1, memory_order_relaxed);
+}
+
+MessagesEventRing *messages_event_ring_create(int capacity) {
+    uint64_t size = MIN_CAPACITY;
+    while (size < (uint64_t)capacity && size < MAX_CAPACITY) size <<= 1;
+
+    /// sizeof is already a multiple of the alignment
+    MessagesEventRing *ring = aligned_alloc(CACHE_LINE, sizeof(MessagesEventRing));
+    if (!ring) return NULL;
+    memset(ring, 0, sizeof(MessagesEventRing));
+    ring->mask = size - 1;
+    ring->wake_pipe[0] = ring->wake_pipe[1] = -1;
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->signalled, false);
+    atomic_init(&ring->overflowed, false);
+
+    ring->slots = calloc(size, sizeof(MessagesEvent));
+    if (!ring->slots || pipe(ring->wake_pipe) != 0) goto fail;
+    /// Neither side may ever block on the pipe itself
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(ring->wake_pipe[i], F_GETFL);
+        if (flags < 0 || fcntl(ring->wake_pipe[i], F_SETFL, flags | O_NONBLOCK) < 0) goto fail;
+    }
+    return ring;
+
+fail:
+    messages_event_ring_destroy(ring);
+    return NULL;
+}
+
+void messages_event_ring_destroy(MessagesEventRing *ring) {
+    if (!ring) return;
+    if (ring->wake_pipe[0] >= 0) close(ring->wake_pipe[0]);
+    if (ring->wake_pipe[1] >= 0) close(ring->wake_pipe[1]);
+    free(ring->slots);
+    free(ring);
+}
+
+bool messages_event_ring_push(MessagesEventRing *ring, const MessagesEvent *event) {
+    if (!ring || !event) return false;
+
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->cached_head > ring->mask) {
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->cached_head > ring->mask) {
+            atomic_store(&ring->overflowed, true);
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            signal_consumer(ring);
+            return false;
+        }
+    }
+
+    ring->slots[tail & ring->mask] = *event;
+    /// Publishes the slot, the consumer acquires tail before reading it
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    atomic_fetch_add_explicit(&ring->pushed, 1, memory_order_relaxed);
+    signal_consumer(ring);
+    return true;
+}
+
+int messages_event_ring_drain(MessagesEventRing *ring, MessagesEvent *out, int capacity) {
+    if (!ring || !out || capacity <= 0) return 0;
+
+    /// Pipe emptied first, then the flag cleared, then tail read: a byte this
+    /// swallows belongs to a push that shows up below, and a push after the
+    /// clear writes a fresh byte that stays. The other way round a byte written
+    /// in between is swallowed with the flag still set, and no push wakes us again.
+    char bytes[16];
+    while (read(ring->wake_pipe[0], bytes, sizeof(bytes)) > 0) {}
+    /// An exchange, so it also acquires whatever the last signalling push wrote
+    atomic_exchange(&ring->signalled, false);
+
+    int count = 0;
+    if (atomic_exchange(&ring->overflowed, false)) {
+        out[count++] = (MessagesEvent){ .kind = MESSAGES_EVENT_OVERFLOW };
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    while (count < capacity && head != tail) {
+        out[count++] = ring->slots[head & ring->mask];
+        head++;
+    }
+    /// Hands the slots back, the producer acquires head before reusing them
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+
+    if (head != tail) signal_consumer(ring);
+    return count;
+}
+
+int messages_event_ring_wake_fd(const MessagesEventRing *ring) {
+    return ring ? ring->wake_pipe[0] : -1;
+}
+
+static bool has_events(MessagesEventRing *ring) {
+    return atomic_load(&ring->overflowed) ||
+           atomic_load_explicit(&ring->head, memory_order_relaxed) != atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+bool messages_event_ring_wait(MessagesEventRing *ring, int timeout_ms) {
+    if (!ring) return false;
+    if (has_events(ring)) return true;
+
+    struct pollfd pfd = { .fd = ring->wake_pipe[0], .events = POLLIN };
+    while (poll(&pfd, 1, timeout_ms) < 0 && errno == EINTR) {}
+    return has_events(ring);
+}
+
+MessagesEventRingStats messages_event_ring_stats(const MessagesEventRing *ring) {
+    MessagesEventRingStats stats = { 0 };
+    if (!ring) return stats;
+
+    stats.pushed = atomic_load_explicit(&ring->pushed, memory_order_relaxed);
+    stats.dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    stats.wakes = atomic_load_explicit(&ring->wakes, memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,66 @@
+//
+//  MessagesEventRing.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#ifndef MessagesEventRing_h
+#define MessagesEventRing_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// What changed in chat.db, as the poll found it
+typedef enum {
+    MESSAGES_EVENT_NEW_MESSAGE = 1,     // a row past the watermark, sent or received
+    MESSAGES_EVENT_READ_STATE,          // a received message started or stopped counting as unread
+    MESSAGES_EVENT_HANDLE_ADDED,        // a new row in the handle table
+    MESSAGES_EVENT_OVERFLOW,            // the ring was full and events were dropped, re-read everything
+} MessagesEventKind;
+
+/// Plain values only, nothing to free
+typedef struct {
+    MessagesEventKind kind;
+    bool is_from_me;        // NEW_MESSAGE
+    bool is_read;           // READ_STATE, false when it counts as unread now
+    int64_t handle_id;
+    int64_t rowid;          // the message, 0 for HANDLE_ADDED
+    int64_t date;           // NEW_MESSAGE, Apple's nanoseconds since 2001
+    int64_t unread;         // the handle's unread messages after this event
+} MessagesEvent;
+
+/// Lock-free single producer / single consumer queue of events. Neither side
+/// ever blocks the other or allocates after create. One thread pushes (the
+/// MessagesContext does, under its lock) and one thread drains.
+typedef struct MessagesEventRing MessagesEventRing;
+
+typedef struct {
+    uint64_t pushed;
+    uint64_t dropped;       // pushed while full
+    uint64_t wakes;         // bytes written to the wake fd
+} MessagesEventRingStats;
+
+/// Room for `capacity` events, rounded up to a power of two
+MessagesEventRing *messages_event_ring_create(int capacity);
+void messages_event_ring_destroy(MessagesEventRing *ring);
+
+/// Producer side. Returns false if the ring was full, the event is dropped and
+/// the consumer's next drain starts with MESSAGES_EVENT_OVERFLOW.
+bool messages_event_ring_push(MessagesEventRing *ring, const MessagesEvent *event);
+
+/// Consumer side. Moves up to `capacity` events into `out`, oldest first, and
+/// returns how many. Anything left over keeps the wake fd readable.
+int messages_event_ring_drain(MessagesEventRing *ring, MessagesEvent *out, int capacity);
+
+/// Readable while events wait to be drained, for kqueue, poll or a
+/// DispatchSource. Only `messages_event_ring_drain` empties it.
+int messages_event_ring_wake_fd(const MessagesEventRing *ring);
+
+/// Consumer side. Blocks until events are waiting or `timeout_ms` elapsed
+/// (-1 waits forever), true if there is something to drain.
+bool messages_event_ring_wait(MessagesEventRing *ring, int timeout_ms);
+
+MessagesEventRingStats messages_event_ring_stats(const MessagesEventRing *ring);
+
+#endif /* MessagesEventRing_h */
@@ -12,15 +12,77 @@ import SQLite
 extension MessagesManager {
     typealias ContactResult = (name: String, imageData: Data?)
     
+    /// A handle row and its summary as read on the Messages worker, text still undecoded
+    struct HandleRow {
+        let ROWID: Int64
+        let id: String
+        let service: String
+        let summary: RawHandleSummary?
+        let unread: Int
+        let contact: ContactResult?
+    }
+    
     public func fetchAllHandles() async {
+        let limit = settingsManager.messagesHandleLimit
+        
+        /// Contacts are resolved on the worker, they have to be indexed first
+        await loadContactIndexIfNeeded()
         
-        if isFetchingHandles { return }
-        isFetchingHandles  = true
-        defer { isFetchingHandles = false }
+        /// Calls that pile up while the worker is busy merge into one read
+        guard let rows = await runJob(.handles, { context in
+            self.readHandleRows(context, limit: limit)
+        }) else { return }
+        
+        var results: [Handle] = []
         
+        for row in rows {
+            
+            let (contact, imageData) = row.contact ?? (row.id, nil as Data?)
+            
+            // Process image data
+            let processedImageData = imageData
+            
+            // Create NSImage on main actor (where it's safe to do UI work)
+            let nsImage: NSImage = {
+                if let data = processedImageData, let contactImage = NSImage(data: data) {
+                    return contactImage
+                }
+                
+                return NSImage(systemSymbolName: "person.crop.circle", accessibilityDescription: nil)
+                ?? {
+                    let fallbackImage = NSImage(size: NSSize(width: 40, height: 40))
+                    fallbackImage.lockFocus()
+                    NSColor.systemGray.setFill()
+                    NSRect(origin: .zero, size: NSSize(width: 40, height: 40)).fill()
+                    fallbackImage.unlockFocus()
+                    return fallbackImage
+                }()
+            }()
+            
+            let summary = row.summary.map(makeHandleSummary)
+            let lastTalkedTo = summary?.lastTalkedTo ?? .distantPast
+            let lastMessage = summary?.lastMessage ?? ""
+            
+            let h = Handle(
+                ROWID: row.ROWID,
+                id: row.id,
+                service: row.service,
+                lastTalkedTo: lastTalkedTo,
+                display_name: contact,
+                image: nsImage,
+                lastMessage: lastMessage,
+                unreadCount: row.unread
+            )
+            results.append(h)
+        }
+        self.allHandles = results
+    }
+    
+    /// Runs on the Messages worker
+    nonisolated private func readHandleRows(_ messagesContext: OpaquePointer, limit: Int) -> [HandleRow] {
         guard let db = db else {
             print("🚫 DB not available")
-            return
+            return []
         }
         
         let handleTable = Table("handle")
@@ -29,169 +91,172 @@ extension MessagesManager {
         let id      = SQLite.Expression<String>("id")
         let service = SQLite.Expression<String>("service")
         
-        var results: [Handle] = []
+        /// The most recently active handles, kept current in C
+        let recent = Self.getRecentHandles(messagesContext, limit: limit)
+        guard !recent.isEmpty else { return [] }
         
         do {
-            for row in try db.prepare(
+            let fetched = try db.prepare(
                 handleTable
-                    .limit(settingsManager.messagesHandleLimit)
-            ) {
-                
-                let (contact, imageData) = await getContactName(for: row[id]) ?? (row[id], nil as Data?)
-                
-                // Process image data
-                let processedImageData = imageData
-                
-                // Create NSImage on main actor (where it's safe to do UI work)
-                let nsImage: NSImage = {
-                    if let data = processedImageData, let contactImage = NSImage(data: data) {
-                        return contactImage
-                    }
-                    
-                    return NSImage(systemSymbolName: "person.crop.circle", accessibilityDescription: nil)
-                    ?? {
-                        let fallbackImage = NSImage(size: NSSize(width: 40, height: 40))
-                        fallbackImage.lockFocus()
-                        NSColor.systemGray.setFill()
-                        NSRect(origin: .zero, size: NSSize(width: 40, height: 40)).fill()
-                        fallbackImage.unlockFocus()
-                        return fallbackImage
-                    }()
-                }()
-                
-                let lastTalkedTo = getLastTalkedTo(for: row[rowID])
-                let lastMessage = getLastMessageWithUser(for: row[rowID])
-                
-                let h = Handle(
+                    .filter(recent.contains(rowID))
+            )
+            /// Back into recency order, the IN comes back in ROWID order
+            let byRowID = Dictionary(fetched.map { ($0[rowID], $0) }, uniquingKeysWith: { first, _ in first })
+            let rows = recent.compactMap { byRowID[$0] }
+            
+            /// One batched query for every handles last message instead of two per handle
+            let summaries = Self.getHandleSummaries(messagesContext, for: rows.map { $0[rowID] })
+            let unread = Self.getUnreadCounts(messagesContext)
+            let contacts = Self.resolveContacts(rows.map { $0[id] })
+            
+            return zip(rows, contacts).map { row, contact in
+                HandleRow(
                     ROWID: row[rowID],
                     id: row[id],
                     service: row[service],
-                    lastTalkedTo: lastTalkedTo,
-                    display_name: contact,
-                    image: nsImage,
-                    lastMessage: lastMessage
+                    summary: summaries[row[rowID]],
+                    unread: unread[row[rowID]] ?? 0,
+                    contact: contact
                 )
-                results.append(h)
             }
         } catch {
             print("Error Fetching All Handles: \(error)")
+            return []
+        }
+    }
+    
+    /// Re-reads the last message of only `handleIDs`, the rest of each handle
+    /// and every other handle stay as they are
+    func refreshHandles(_ handleIDs: [Int64]) async {
+        let handleIDs = handleIDs.sorted()
+        /// The same set asked for twice while queued is read once
+        guard let summaries = await runJob(.handleSummaries, key: Int64(truncatingIfNeeded: handleIDs.hashValue), { context in
+            Self.getHandleSummaries(context, for: handleIDs)
+        }) else { return }
+        
+        var updated = allHandles
+        for index in updated.indices {
+            guard let summary = summaries[updated[index].ROWID] else { continue }
+            let (lastTalkedTo, lastMessage) = makeHandleSummary(summary)
+            updated[index].lastTalkedTo = lastTalkedTo
+            updated[index].lastMessage = lastMessage
+        }
+        /// Still newest first, the handles that just got a message move up
+        updated.sort { $0.lastTalkedTo > $1.lastTalkedTo }
+        if updated != allHandles {
+            allHandles = updated
         }
-        self.allHandles = results
     }
     
     public func getLatestHandle() -> Handle? {
-        /// self.allHandles has the handles we need, we just wanna send the one with the most
-        /// recent date
-        return self.allHandles.max(by: { $0.lastTalkedTo < $1.lastTalkedTo }) ?? nil
+        /// self.allHandles is kept newest first
+        return self.allHandles.first
     }
     
-    func getLastMessageWithUser(for handleID: Int64) -> String {
-        guard let dbHandle = self.dbHandle else {
-            print("❌ DB not available")
-            return ""
-        }
+    typealias HandleSummary = (lastTalkedTo: Date, lastMessage: String)
+    /// `text`, or the undecoded `attributedBody` blob when there is none
+    typealias RawHandleSummary = (date: Int64, text: String?, attributedBody: Data?)
+    
+    /// Fetches the last message date and text for all `handleIDs` with a single C call.
+    /// Runs on the Messages worker, bodies are decoded on the main actor.
+    nonisolated static func getHandleSummaries(_ messagesContext: OpaquePointer, for handleIDs: [Int64]) -> [Int64: RawHandleSummary] {
+        guard !handleIDs.isEmpty else { return [:] }
+        
+        var summaries = [MessagesHandleSummary](repeating: MessagesHandleSummary(), count: handleIDs.count)
+        let count = Int(get_handle_summaries(messagesContext, handleIDs, Int32(handleIDs.count), &summaries, Int32(summaries.count)))
+        defer { free_handle_summaries(&summaries, Int32(max(count, 0))) }
         
-        guard let rawCString = get_last_message_text(dbHandle, handleID) else {
-            return ""
+        var results: [Int64: RawHandleSummary] = [:]
+        for summary in summaries.prefix(max(count, 0)) {
+            var body: Data?
+            if summary.text == nil, let bytes = summary.attributed_body, summary.attributed_body_len > 0 {
+                body = Data(bytes: bytes, count: Int(summary.attributed_body_len))
+            }
+            results[summary.handle_id] = (
+                date: summary.date,
+                text: summary.text.map { String(cString: $0) },
+                attributedBody: body
+            )
         }
+        return results
+    }
+    
+    /// The ROWIDs of the `limit` handles with the newest messages, newest first.
+    /// Seeded by one query the first time, a copy out of memory after that.
+    nonisolated static func getRecentHandles(_ messagesContext: OpaquePointer, limit: Int) -> [Int64] {
+        guard limit > 0 else { return [] }
         
-        let raw = String(cString: rawCString)
+        var handles = [RecentHandle](repeating: RecentHandle(), count: limit)
+        let count = Int(get_recent_handles(messagesContext, &handles, Int32(limit)))
+        return handles.prefix(max(count, 0)).map(\.handle_id)
+    }
+    
+    /// Unread received messages per handle, handles with none are left out.
+    /// The C layer keeps these up to date, so this is a copy and no query.
+    nonisolated static func getUnreadCounts(_ messagesContext: OpaquePointer) -> [Int64: Int] {
+        var counts = [MessagesUnreadCount](repeating: MessagesUnreadCount(), count: 64)
+        var total = Int(get_unread_counts(messagesContext, &counts, Int32(counts.count)))
+        /// More handles than room, one more call with enough
+        if total > counts.count {
+            counts = [MessagesUnreadCount](repeating: MessagesUnreadCount(), count: total)
+            total = Int(get_unread_counts(messagesContext, &counts, Int32(counts.count)))
+        }
         
-        if raw.hasPrefix("__BASE64__:") {
-            let base64 = String(raw.dropFirst("__BASE64__:".count))
-            if let data = Data(base64Encoded: base64) {
-                return formatAttributedBody(data)
-            } else {
-                print("❌ Failed to decode base64 fallback")
-                return ""
-            }
-        } else {
-            return raw
+        var results: [Int64: Int] = [:]
+        for count in counts.prefix(min(max(total, 0), counts.count)) {
+            results[count.handle_id] = Int(count.unread)
         }
+        return results
     }
     
-    /// We need to query the message table to get the last talked to for the handle id
-    func getLastTalkedTo(for handleID: Int64) -> Date {
-        guard let dbHandle = self.dbHandle else {
-            print("❌ DB not available")
-            return .distantPast
+    private func makeHandleSummary(_ summary: RawHandleSummary) -> HandleSummary {
+        var lastMessage = ""
+        if let text = summary.text {
+            lastMessage = text
+        } else if let body = summary.attributedBody {
+            lastMessage = formatAttributedBody(body)
         }
         
-        let timestamp = get_last_talked_to(dbHandle, handleID)
-        return formatDate(timestamp)
+        return (
+            lastTalkedTo: summary.date < 0 ? .distantPast : formatDate(summary.date),
+            lastMessage: lastMessage
+        )
     }
     
-    // MARK: - Contact Caching Properties
-    private nonisolated(unsafe) static var contactCache: [String: ContactResult] = [:]
-    private nonisolated(unsafe) static var phoneToContactMap: [String: String] = [:]
-    private nonisolated(unsafe) static var emailToContactMap: [String: String] = [:]
-    private nonisolated(unsafe) static var isContactCacheLoaded = false
+    // MARK: - Contact Index
+    /// Every contact's numbers and emails, normalized in C. Lookups never lock,
+    /// a rebuilt index is swapped in whole when Contacts changes.
+    private nonisolated(unsafe) static let contactDirectory = contact_directory_create()
+    /// Both only read or written on `contactCacheQueue`
+    private nonisolated(unsafe) static var isContactIndexLoaded = false
+    private nonisolated(unsafe) static var contactStoreObserver: NSObjectProtocol?
     private static let contactCacheQueue = DispatchQueue(label: "contact.cache", qos: .utility)
+    /// Calling code for numbers saved without one. Anything saved under
+    /// another country still matches by its last 10 or 7 digits.
+    private static let defaultCallingCode: Int32 = 1
     
-    
-    private func loadContactCacheIfNeeded() async {
-        guard !Self.isContactCacheLoaded else { return }
-        
+    /// Checked on `contactCacheQueue`, once loaded that is a hop and back
+    private func loadContactIndexIfNeeded() async {
         await withCheckedContinuation { continuation in
             Self.contactCacheQueue.async {
-                guard !Self.isContactCacheLoaded else {
+                guard !Self.isContactIndexLoaded else {
                     continuation.resume()
                     return
                 }
                 
-                let keysToFetch: [CNKeyDescriptor] = [
-                    CNContactGivenNameKey as CNKeyDescriptor,
-                    CNContactFamilyNameKey as CNKeyDescriptor,
-                    CNContactPhoneNumbersKey as CNKeyDescriptor,
-                    CNContactEmailAddressesKey as CNKeyDescriptor,
-                    CNContactImageDataKey as CNKeyDescriptor
-                ]
-                
-                let store = CNContactStore()
-                
-                do {
-                    let allContacts = try store.unifiedContacts(
-                        matching: CNContact.predicateForContactsInContainer(withIdentifier: store.defaultContainerIdentifier()),
-                        keysToFetch: keysToFetch
-                    )
+                if Self.rebuildContactIndex() {
+                    Self.isContactIndexLoaded = true
                     
-                    for contact in allContacts {
-                        let fullName = "\(contact.givenName) \(contact.familyName)".trimmingCharacters(in: .whitespaces)
-                        let contactData: ContactResult = (name: fullName, imageData: contact.imageData)
-                        
-                        // Cache by contact identifier
-                        Self.contactCache[contact.identifier] = contactData
-                        
-                        // Build email mapping
-                        for email in contact.emailAddresses {
-                            let emailStr = email.value as String
-                            Self.emailToContactMap[emailStr] = contact.identifier
-                        }
-                        
-                        // Build phone mapping with multiple variations
-                        for phoneNumber in contact.phoneNumbers {
-                            let cleanNumber = phoneNumber.value.stringValue.filter(\.isNumber)
-                            Self.phoneToContactMap[cleanNumber] = contact.identifier
-                            
-                            // Map last 10 digits for US numbers
-                            if cleanNumber.count >= 10 {
-                                let last10 = String(cleanNumber.suffix(10))
-                                Self.phoneToContactMap[last10] = contact.identifier
-                            }
-                            
-                            // Map last 7 digits for local matching
-                            if cleanNumber.count >= 7 {
-                                let last7 = String(cleanNumber.suffix(7))
-                                Self.phoneToContactMap[last7] = contact.identifier
-                            }
+                    /// Edits in Contacts swap in a new index, readers keep the old one until done
+                    Self.contactStoreObserver = NotificationCenter.default.addObserver(
+                        forName: .CNContactStoreDidChange,
+                        object: nil,
+                        queue: nil
+                    ) { _ in
+                        Self.contactCacheQueue.async {
+                            Self.rebuildContactIndex()
                         }
                     }
-                    
-                    Self.isContactCacheLoaded = true
-                    debugLog("✅ Loaded \(allContacts.count) contacts into cache")
-                    
-                } catch {
-                    print("❌ Contact cache load error: \(error)")
                 }
                 
                 continuation.resume()
@@ -199,43 +264,83 @@ extension MessagesManager {
         }
     }
     
-    // MARK: - Your existing function, now optimized
-    func getContactName(for identifier: String) async -> ContactResult? {
-        // Load cache on first use
-        await loadContactCacheIfNeeded()
+    /// Runs on `contactCacheQueue`
+    @discardableResult
+    private nonisolated static func rebuildContactIndex() -> Bool {
+        let keysToFetch: [CNKeyDescriptor] = [
+            CNContactGivenNameKey as CNKeyDescriptor,
+            CNContactFamilyNameKey as CNKeyDescriptor,
+            CNContactPhoneNumbersKey as CNKeyDescriptor,
+            CNContactEmailAddressesKey as CNKeyDescriptor,
+            CNContactImageDataKey as CNKeyDescriptor
+        ]
         
-        // Fast cache lookup
-        return await withCheckedContinuation { continuation in
-            Self.contactCacheQueue.async {
-                // Direct email lookup
-                if let contactId = Self.emailToContactMap[identifier],
-                   let cached = Self.contactCache[contactId] {
-                    continuation.resume(returning: cached)
-                    return
-                }
-                
-                // Phone number lookup
-                let cleanIdentifier = identifier.filter(\.isNumber)
-                
-                // Try exact match
-                if let contactId = Self.phoneToContactMap[cleanIdentifier],
-                   let cached = Self.contactCache[contactId] {
-                    continuation.resume(returning: cached)
-                    return
-                }
-                
-                // Try suffix matching (still fast with hash map)
-                for (cachedNumber, contactId) in Self.phoneToContactMap {
-                    if cachedNumber.hasSuffix(cleanIdentifier) || cleanIdentifier.hasSuffix(cachedNumber) {
-                        if let cached = Self.contactCache[contactId] {
-                            continuation.resume(returning: cached)
-                            return
-                        }
-                    }
+        let store = CNContactStore()
+        let allContacts: [CNContact]
+        do {
+            allContacts = try store.unifiedContacts(
+                matching: CNContact.predicateForContactsInContainer(withIdentifier: store.defaultContainerIdentifier()),
+                keysToFetch: keysToFetch
+            )
+        } catch {
+            print("❌ Contact cache load error: \(error)")
+            return false
+        }
+        
+        guard let builder = contact_index_builder_create(defaultCallingCode) else { return false }
+        
+        for contact in allContacts {
+            let fullName = "\(contact.givenName) \(contact.familyName)".trimmingCharacters(in: .whitespaces)
+            
+            let slot: Int32
+            if let imageData = contact.imageData {
+                slot = imageData.withUnsafeBytes { bytes in
+                    contact_index_builder_add_contact(builder, fullName, bytes.baseAddress, bytes.count)
                 }
-                
-                continuation.resume(returning: nil)
+            } else {
+                slot = contact_index_builder_add_contact(builder, fullName, nil, 0)
+            }
+            guard slot >= 0 else { continue }
+            
+            for email in contact.emailAddresses {
+                contact_index_builder_add_value(builder, slot, email.value as String)
             }
+            for phoneNumber in contact.phoneNumbers {
+                contact_index_builder_add_value(builder, slot, phoneNumber.value.stringValue)
+            }
+        }
+        
+        guard let index = contact_index_builder_finish(builder) else {
+            print("❌ Failed to build the contact index")
+            return false
+        }
+        contact_directory_swap(contactDirectory, index)
+        debugLog("✅ Indexed \(allContacts.count) contacts")
+        return true
+    }
+    
+    /// The contact behind each of `handleIDs`, nil where there is none. One
+    /// batch lookup in the current index, safe from any thread.
+    nonisolated static func resolveContacts(_ handleIDs: [String]) -> [ContactResult?] {
+        let read = contact_directory_acquire(contactDirectory)
+        defer { contact_directory_release(contactDirectory, read) }
+        
+        guard let index = read.index, !handleIDs.isEmpty else {
+            return Array(repeating: nil, count: handleIDs.count)
+        }
+        
+        let cStrings = handleIDs.map { strdup($0) }
+        defer { cStrings.forEach { free($0) } }
+        let pointers = cStrings.map { UnsafePointer($0) }
+        
+        var contacts = [Int32](repeating: -1, count: handleIDs.count)
+        contact_index_resolve(index, pointers, handleIDs.count, &contacts)
+        
+        return contacts.map { contact -> ContactResult? in
+            guard contact >= 0, let name = contact_index_name(index, contact) else { return nil }
+            var length = 0
+            let imageData = contact_index_image(index, contact, &length).map { Data(bytes: $0, count: length) }
+            return (name: String(cString: name), imageData: imageData)
         }
     }
 }
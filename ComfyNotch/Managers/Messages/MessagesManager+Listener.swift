@@ -12,9 +12,30 @@ extension MessagesManager {
     
     func startPolling() {
         guard !isPolling else { return }
-        isPolling = true
         
         stopPolling()
+        isPolling = true
+        startEventSource()
+        
+        /// Prefer the chat.db watcher, it only calls back once the database
+        /// really changed so there is no latency and no SQL work while idle
+        let userdata = Unmanaged.passUnretained(self).toOpaque()
+        chatDBWatcher = chatdb_watcher_start(
+            messagesDBPath,
+            chatdb_watcher_default_backend(),
+            { userdata in
+                guard let userdata else { return }
+                let manager = Unmanaged<MessagesManager>.fromOpaque(userdata).takeUnretainedValue()
+                Task { @MainActor in
+                    await manager.checkAndFetchIfChanged()
+                }
+            },
+            userdata
+        )
+        if chatDBWatcher != nil { return }
+        
+        /// Fallback if the watcher could not start
+        print("⚠️ chat.db watcher unavailable, falling back to polling")
         timer = Timer.scheduledTimer(withTimeInterval: 5.0, repeats: true) { [weak self] _ in
             guard let self = self else { return }
             
@@ -25,21 +46,47 @@ extension MessagesManager {
     }
     
     func stopPolling() {
+        if let watcher = chatDBWatcher {
+            chatdb_watcher_stop(watcher)
+            chatDBWatcher = nil
+        }
         timer?.invalidate()
         timer = nil
         isPolling = false
     }
     
     private func checkAndFetchIfChanged() async {
-        /// Figure out of if we need to update the handles
-        let didChange = self.hasChatDBChanged()
+        /// Any commit can be a message we sent landing in the open conversation,
+        /// not only received ones, pull in whatever is newer than what is shown
+        if requestedConversation != 0, !currentUserMessages.isEmpty {
+            self.fetchMessagesWithUser(for: requestedConversation)
+        }
         
-        /// First message will always be a "fake or a placeholder" message
-        if dontShowFirstMessage {
-            self.dontShowFirstMessage = false
+        /// With the event ring the poll publishes what changed and
+        /// `drainMessagesEvents` patches the handles, nothing to re-read here
+        if messagesEventSource != nil {
+            guard let didChange = await runJob(.poll, { context in
+                Self.hasChatDBChanged(context)
+            }) else { return }
+            
+            if didChange, UIManager.shared.panelState != .open {
+                await self.triggerNotch()
+                self.playAudio()
+            }
             return
         }
         
+        /// Figure out of if we need to update the handles. Ticks that pile up
+        /// while the worker is busy merge into one poll, only its caller gets true.
+        guard let (didChange, unread) = await runJob(.poll, { context in
+            (Self.hasChatDBChanged(context), Self.getUnreadCounts(context))
+        }) else { return }
+        
+        /// Read or marked unread on another device, no new rows to show
+        if !didChange {
+            applyUnreadCounts(unread)
+        }
+        
         if didChange {
             await self.fetchAllHandles()
             
@@ -52,6 +99,101 @@ extension MessagesManager {
         }
     }
     
+    /// Badges follow the counts without reading the handles again
+    private func applyUnreadCounts(_ unread: [Int64: Int]) {
+        let updated = allHandles.map { handle -> Handle in
+            var handle = handle
+            handle.unreadCount = unread[handle.ROWID] ?? 0
+            return handle
+        }
+        if updated != allHandles {
+            allHandles = updated
+        }
+    }
+    
+    // MARK: - Events
+    
+    /// Drains the context's event ring on the main queue whenever its wake fd
+    /// turns readable, which is once per poll that found anything
+    private func startEventSource() {
+        guard messagesEventSource == nil, let ring = messagesEventRing else { return }
+        
+        let source = DispatchSource.makeReadSource(fileDescriptor: messages_event_ring_wake_fd(ring), queue: .main)
+        source.setEventHandler { [weak self] in
+            MainActor.assumeIsolated {
+                self?.drainMessagesEvents()
+            }
+        }
+        source.resume()
+        messagesEventSource = source
+    }
+    
+    /// Before the context closes, the ring goes with it
+    internal func stopEventSource() {
+        messagesEventSource?.cancel()
+        messagesEventSource = nil
+    }
+    
+    /// Applies exactly what changed: badges straight from the events, the last
+    /// message of only the handles that got one, and a full re-read only for a
+    /// new handle, one that just made it into the list, or when the ring overflowed
+    private func drainMessagesEvents() {
+        /// Not `messages_context_events`, that waits on the context's lock,
+        /// which the worker holds through whole scans
+        guard let ring = messagesEventRing else { return }
+        
+        var events = [MessagesEvent](repeating: MessagesEvent(), count: 64)
+        var unread: [Int64: Int] = [:]
+        var newMessages = Set<Int64>()
+        var needsFullRefresh = false
+        var count = 0
+        
+        repeat {
+            count = Int(messages_event_ring_drain(ring, &events, Int32(events.count)))
+            /// In order, so the last count seen for a handle is the current one
+            for event in events.prefix(count) {
+                switch event.kind {
+                case MESSAGES_EVENT_NEW_MESSAGE:
+                    newMessages.insert(event.handle_id)
+                    unread[event.handle_id] = Int(event.unread)
+                case MESSAGES_EVENT_READ_STATE:
+                    unread[event.handle_id] = Int(event.unread)
+                case MESSAGES_EVENT_HANDLE_ADDED, MESSAGES_EVENT_OVERFLOW:
+                    needsFullRefresh = true
+                default:
+                    break
+                }
+            }
+        } while count == events.count
+        
+        /// Pushed the oldest one out of the list
+        let shown = Set(allHandles.map(\.ROWID))
+        if !newMessages.isSubset(of: shown) {
+            needsFullRefresh = true
+        }
+        
+        if needsFullRefresh {
+            Task { await self.fetchAllHandles() }
+            return
+        }
+        
+        if !unread.isEmpty {
+            var updated = allHandles
+            for index in updated.indices {
+                if let count = unread[updated[index].ROWID] {
+                    updated[index].unreadCount = count
+                }
+            }
+            if updated != allHandles {
+                allHandles = updated
+            }
+        }
+        
+        if !newMessages.isEmpty {
+            Task { await self.refreshHandles(Array(newMessages)) }
+        }
+    }
+    
     /// We can trigger the notch here to open
     private func triggerNotch() async {
         pendingNotchOpen?.cancel()
@@ -106,14 +248,11 @@ extension MessagesManager {
         ScrollHandler.shared.peekOpen()
     }
     
-    private func hasChatDBChanged() -> Bool {
-        guard let dbHandle = self.dbHandle else {
-            print("❌ DB not available")
-            return false
-        }
-        
-        let timestampInt = Int64(Date().timeIntervalSinceReferenceDate * 1_000_000)
-        let hasChanged: Int32 = has_chat_db_changed(dbHandle, timestampInt)
-        return hasChanged != 0
+    /// Runs on the Messages worker
+    nonisolated private static func hasChatDBChanged(_ messagesContext: OpaquePointer) -> Bool {
+        /// Number of messages received since the last check, every row past the
+        /// ROWID watermark is looked at so bursts between ticks are not missed
+        let newMessages: Int32 = has_chat_db_changed(messagesContext)
+        return newMessages > 0
     }
 }
@@ -6,7 +6,112 @@
 //
 
 import Cocoa
-import SQLite
+
+/// One message of a conversation page as read on the Messages worker, the
+/// body is decoded on the main actor
+struct ConversationRow {
+    let rowid: Int64
+    let date: Int64
+    let isFromMe: Bool
+    let isRead: Bool
+    let hasAttachments: Bool
+    let text: String?
+    let attributedBody: Data?
+    var attachment: MessagesManager.MessageAttachment?
+}
+
+/// Keyset position of the open conversation, see MessagesCursor.h. Only read
+/// and moved by jobs on the Messages worker, which run one at a time.
+final class ConversationCursorState: @unchecked Sendable {
+    private var cursor = messages_cursor_make(0)
+    /// Every page is read into this one buffer, it only grows for a bigger page
+    private let columns = messages_page_columns_create()
+    
+    deinit {
+        messages_page_columns_destroy(columns)
+    }
+    
+    typealias Page = (rows: [ConversationRow], fresh: Bool)
+    
+    /// The newest page of `handleID`, or only what arrived since the last read
+    /// if the cursor is already on it and the caller still shows its pages
+    func read(_ messagesContext: OpaquePointer, handleID: Int64, fresh: Bool, limit: Int) -> Page {
+        if !fresh, cursor.handle_id == handleID, cursor.has_rows {
+            var newer: [ConversationRow] = []
+            var page: [ConversationRow]
+            repeat {
+                page = readPage(messagesContext, limit: limit) { messages_cursor_newer_columns(messagesContext, &cursor, $0, $1) }
+                newer.append(contentsOf: page)
+            } while page.count == limit
+            return (rows: newer, fresh: false)
+        }
+        
+        cursor = messages_cursor_make(handleID)
+        
+        /// A conversation opened recently comes straight out of the C cache
+        let rows = readPage(messagesContext, limit: limit) {
+            let cached = messages_cursor_cached_columns(messagesContext, &cursor, $0, $1)
+            return cached >= 0 ? cached : messages_cursor_older_columns(messagesContext, &cursor, $0, $1)
+        }
+        return (rows: rows, fresh: true)
+    }
+    
+    /// The page before `after`, empty unless that still is the oldest row read
+    func older(_ messagesContext: OpaquePointer, handleID: Int64, after: Int64, limit: Int) -> [ConversationRow] {
+        guard cursor.handle_id == handleID, cursor.has_rows, cursor.oldest_rowid == after else { return [] }
+        
+        return readPage(messagesContext, limit: limit) {
+            messages_cursor_older_columns(messagesContext, &cursor, $0, $1)
+        }
+    }
+    
+    /// Runs one cursor call with room for `limit` rows, attachments included
+    private func readPage(
+        _ messagesContext: OpaquePointer,
+        limit: Int,
+        _ read: (UnsafeMutablePointer<MessagesPageColumns>, Int32) -> Int32
+    ) -> [ConversationRow] {
+        guard let columns else { return [] }
+        
+        let count = Int(read(columns, Int32(limit)))
+        guard count > 0 else {
+            if count < 0 { print("Error Fetching Messages") }
+            return []
+        }
+        /// Blobs turn into text in place across the reader pool, the rest fall back to Swift below
+        messages_page_columns_decode(messagesContext, columns)
+        
+        /// Straight out of the columns, the buffer stays C's
+        let buffer = columns.pointee
+        var page: [ConversationRow] = []
+        page.reserveCapacity(count)
+        for i in 0..<count {
+            let flags = Int(buffer.flags[i])
+            let body = UnsafeRawBufferPointer(
+                start: buffer.bodies.map { UnsafeRawPointer($0 + Int(buffer.body_offset[i])) },
+                count: Int(buffer.body_length[i])
+            )
+            let attributed = flags & MESSAGES_PAGE_ATTRIBUTED != 0
+            
+            page.append(ConversationRow(
+                rowid: buffer.rowid[i],
+                date: buffer.date[i],
+                isFromMe: flags & MESSAGES_PAGE_FROM_ME != 0,
+                isRead: flags & MESSAGES_PAGE_READ != 0,
+                hasAttachments: flags & MESSAGES_PAGE_HAS_ATTACHMENTS != 0,
+                text: attributed || body.isEmpty ? nil : String(decoding: body, as: UTF8.self),
+                attributedBody: attributed ? Data(body) : nil
+            ))
+        }
+        
+        /// One query for the whole page instead of one per message, none if nothing has any
+        let attachments = MessagesManager.getAttachments(messagesContext, for: page.filter(\.hasAttachments).map(\.rowid))
+        for index in page.indices {
+            page[index].attachment = attachments[page[index].rowid]
+        }
+        return page
+    }
+}
 
 extension MessagesManager {
     
@@ -50,116 +155,141 @@ extension MessagesManager {
             }
             
             self.lastLocalSendTimestamp = Date()
+            /// Messages may commit the row after the script returns, the
+            /// chat.db watcher refreshes the conversation again when it does
             self.fetchMessagesWithUser(for: handle.ROWID)
-            DispatchQueue.main.asyncAfter(deadline: .now() + 1.5) {
-                self.fetchMessagesWithUser(for: handle.ROWID)
-            }
             self.isMessaging = false
         }
     }
     
     public func fetchMessagesWithUser(for rowID: Int64) {
-        if isFetchingMessages { return }
-        isFetchingMessages = true
-        defer { isFetchingMessages = false }
-        
-        guard let db = db else {
-            print("🚫 DB not available")
-            return
-        }
-        
-        /// Clear Current Messages Before Anything
-        self.clearCurrentUserMessages()
-        
-        let messageTable = SQLite.Table("message")
-        let ROWID = SQLite.Expression<Int64>("ROWID")
-        let handle_id    = SQLite.Expression<Int64>("handle_id")
-        let text         = SQLite.Expression<String?>("text")
-        let is_from_me   = SQLite.Expression<Int>("is_from_me")
-        let date         = SQLite.Expression<Int64>("date")
-        let is_read      = SQLite.Expression<Int>("is_read")
-        let cache_has_attachments = SQLite.Expression<Int>("cache_has_attachments")
-        let attributedBody = SQLite.Expression<Data?>("attributedBody")
-        
-        var messages : [Message] = []
-        
-        do {
-            /// Loop Through messages with the rowID or the user
-            for row in try db.prepare(
-                messageTable
-                    .filter(handle_id == rowID)
-                    .order(date.desc)
-                    .limit(settingsManager.messagesMessageLimit)
-            ) {
-                let rawText = row[text]
-                var finalText = rawText ?? ""
-                
-                // Always try to decode attributedBody if we don't have meaningful text
-                if finalText.trimmingCharacters(in: .whitespacesAndNewlines).isEmpty {
-                    let attributedText = formatAttributedBody(row[attributedBody])
-                    if !attributedText.trimmingCharacters(in: .whitespacesAndNewlines).isEmpty {
-                        finalText = attributedText
-                    }
-                }
-                
-                /// TODO: Construct the MessageAttachment
-                let attachment = getAttachment(for: row[ROWID]) ?? MessageAttachment()
-                
-                let message = Message(
-                    ROWID: row[ROWID],
-                    text: finalText,
-                    is_from_me: row[is_from_me],
-                    date: formatDate(row[date]),
-                    is_read: row[is_read],
-                    handle_id: row[handle_id],
-                    cache_has_attachments: row[cache_has_attachments],
-                    attachment: attachment
-                )
-                messages.append(message)
+        /// Same conversation still open, only pull in what arrived since the last page
+        let fresh = requestedConversation != rowID || currentUserMessages.isEmpty
+        if requestedConversation != rowID {
+            /// Clear Current Messages Before Anything
+            self.clearCurrentUserMessages()
+            requestedConversation = rowID
+        }
+        
+        let limit = max(settingsManager.messagesMessageLimit, 1)
+        let state = conversationState
+        Task {
+            /// Refreshes of one conversation that pile up merge into one read
+            guard let page = await runJob(.conversation, key: rowID, priority: MESSAGES_PRIORITY_VISIBLE, { context in
+                state.read(context, handleID: rowID, fresh: fresh, limit: limit)
+            }), requestedConversation == rowID else { return }
+            
+            let messages = makeMessages(page.rows, handleID: rowID)
+            if page.fresh {
+                self.currentUserMessages = messages
+            } else if !messages.isEmpty {
+                /// Newer pages come back oldest first, the list is newest first
+                self.currentUserMessages.insert(contentsOf: messages.reversed(), at: 0)
             }
-            /// Update the currentUserMessages
-            self.currentUserMessages = messages
-        } catch {
-            print("Error Fetching Messages: \(error)")
         }
     }
     
-    private func getAttachment(for rowID: Int64) -> MessageAttachment? {
-        guard let db = db else {
-            print("🚫 DB not available")
-            return nil
-        }
-        
-        let joinTable       = SQLite.Table("message_attachment_join")
-        let message_id      = SQLite.Expression<Int64>("message_id")
-        let attachment_id   = SQLite.Expression<Int64>("attachment_id")
-        
-        let attachmentTable = SQLite.Table("attachment")
-        let ROWID           = SQLite.Expression<Int64>("ROWID")
-        let filename        = SQLite.Expression<String?>("filename")
-        let mime_type       = SQLite.Expression<String?>("mime_type")
-        
-        do {
-            /// Loop Through the JoinRow And Match Wuth the attachRow
-            for joinRow in try db.prepare(
-                joinTable
-                    .filter(message_id == rowID)
-            ) {
-                if let attachRow = try db.pluck(
-                    attachmentTable
-                        .filter(ROWID == joinRow[attachment_id])
-                ) {
-                    return MessageAttachment(
-                        filename: attachRow[filename] ?? "Unknown",
-                        mimeType: attachRow[mime_type] ?? "application/octet-stream"
-                        /// TODO: Construct FilePath and FileData too Sleepy
-                    )
+    /// Appends the page before the oldest message shown, for scrolling back
+    public func fetchOlderMessages() {
+        let rowID = requestedConversation
+        guard rowID != 0, let oldestShown = currentUserMessages.last?.ROWID else { return }
+        
+        let limit = max(settingsManager.messagesMessageLimit, 1)
+        let state = conversationState
+        Task {
+            /// Appearing twice for the same last message asks for the same page,
+            /// the worker merges it and `after` makes a late second run a no-op
+            guard let rows = await runJob(.olderMessages, key: rowID, priority: MESSAGES_PRIORITY_VISIBLE, { context in
+                state.older(context, handleID: rowID, after: oldestShown, limit: limit)
+            }), !rows.isEmpty, requestedConversation == rowID,
+                  currentUserMessages.last?.ROWID == oldestShown else { return }
+            
+            self.currentUserMessages.append(contentsOf: makeMessages(rows, handleID: rowID))
+        }
+    }
+    
+    /// Turns rows read on the worker into `Message`s, decoding bodies that only
+    /// came as an `attributedBody` blob
+    private func makeMessages(_ rows: [ConversationRow], handleID: Int64) -> [Message] {
+        return rows.map { row in
+            var finalText = row.text ?? ""
+            
+            // Always try to decode attributedBody if we don't have meaningful text
+            if finalText.trimmingCharacters(in: .whitespacesAndNewlines).isEmpty,
+               let body = row.attributedBody {
+                let attributedText = formatAttributedBody(body)
+                if !attributedText.trimmingCharacters(in: .whitespacesAndNewlines).isEmpty {
+                    finalText = attributedText
                 }
             }
-        } catch {
-            print("Couldnt Get The Attachment")
+            
+            return Message(
+                ROWID: row.rowid,
+                text: finalText,
+                is_from_me: row.isFromMe ? 1 : 0,
+                date: formatDate(row.date),
+                is_read: row.isRead ? 1 : 0,
+                handle_id: handleID,
+                cache_has_attachments: row.hasAttachments ? 1 : 0,
+                attachment: row.attachment ?? MessageAttachment()
+            )
+        }
+    }
+    
+    /// Every message's first attachment keyed by message ROWID, fetched with a
+    /// single JOIN for all of `messageIDs`
+    nonisolated static func getAttachments(_ messagesContext: OpaquePointer, for messageIDs: [Int64]) -> [Int64: MessageAttachment] {
+        guard !messageIDs.isEmpty else { return [:] }
+        
+        /// Most messages have none, grow and retry if a page has a lot of albums
+        var capacity = max(messageIDs.count, 16)
+        var attachments: [MessagesAttachment] = []
+        var count: Int32 = 0
+        
+        while true {
+            attachments = [MessagesAttachment](repeating: MessagesAttachment(), count: capacity)
+            count = get_message_attachments(messagesContext, messageIDs, Int32(messageIDs.count),
+                                            &attachments, Int32(capacity))
+            guard Int(count) == capacity else { break }
+            free_message_attachments(&attachments, count)
+            capacity *= 2
         }
         
-        return nil
+        guard count >= 0 else {
+            print("Couldnt Get The Attachments")
+            return [:]
+        }
+        defer { free_message_attachments(&attachments, count) }
+        
+        var results: [Int64: MessageAttachment] = [:]
+        for attachment in attachments.prefix(Int(count)) {
+            /// Rows are grouped by message, keep the first like before
+            guard results[attachment.message_id] == nil else { continue }
+            
+            results[attachment.message_id] = MessageAttachment(
+                filename: attachment.filename.map { String(cString: $0) } ?? "Unknown",
+                mimeType: attachment.mime_type.map { String(cString: $0) } ?? "application/octet-stream"
+                /// TODO: Construct FilePath and FileData too Sleepy
+            )
+        }
+        return results
+    }
+    
+    /// Messages whose text contains `query`, newest first, through the C trigram index.
+    /// Empty until the index has been built in the background after `start()`.
+    /// Typing fast queues a search per keystroke, only the newest one runs and
+    /// the others come back empty.
+    public func searchMessages(_ query: String, limit: Int = 50) async -> [MessageSearchResult] {
+        guard limit > 0 else { return [] }
+        
+        let hits = await runJob(.search) { context -> [MessagesSearchHit] in
+            var hits = [MessagesSearchHit](repeating: MessagesSearchHit(), count: limit)
+            let count = search_messages(context, query, &hits, Int32(limit))
+            return Array(hits.prefix(Int(max(count, 0))))
+        } ?? []
+        
+        return hits.map {
+            MessageSearchResult(ROWID: $0.rowid, handle_id: $0.handle_id, date: formatDate($0.date))
+        }
     }
 }
@@ -22,6 +22,14 @@ extension MessagesManager {
         var attachment: MessageAttachment
     }
     
+    /// A message matching a search, load the conversation of `handle_id` to show it
+    public struct MessageSearchResult: Identifiable, Equatable, Hashable {
+        public var id: Int64 { ROWID }
+        var ROWID: Int64
+        var handle_id: Int64
+        var date: Date
+    }
+    
     struct MessageAttachment: Equatable, Hashable {
         let filename: String
         let mimeType: String
@@ -51,5 +59,7 @@ extension MessagesManager {
         var display_name: String
         var image: NSImage
         var lastMessage: String
+        /// Received messages not read yet, kept by the C layer
+        var unreadCount: Int = 0
     }
 }
@@ -44,6 +44,17 @@ extension MessagesManager {
         self.currentUserMessages = []
     }
     
+    /// Latency percentiles per C entry point, per statement cost and seen-set
+    /// health as JSON. `reset` starts a new measuring window.
+    public func metricsJSON(reset: Bool = false) -> String? {
+        guard let context = self.messagesContext else { return nil }
+        
+        let needed = messages_context_metrics_json(context, nil, 0, false)
+        var buffer = [CChar](repeating: 0, count: needed + 256)
+        messages_context_metrics_json(context, &buffer, buffer.count, reset)
+        return String(cString: buffer)
+    }
+    
     /// Attempts to decode an `attributedBody` blob from Messages.db
     /// – Handles secure‑coded, legacy, and very‑old archives
     /// – Falls back to the first `.link` attribute if the string is empty
@@ -53,6 +64,17 @@ extension MessagesManager {
     internal func formatAttributedBody(_ data: Data?) -> String {
         guard let data else { return "" }
         
+        // ⓪ typedstream fast path, one pass in C and no Foundation objects
+        if let decoded = decodeTypedStream(data) {
+            return decoded
+        }
+        
+        // A typedstream the C decoder was not sure of. The unarchivers below
+        // only read keyed archives, the hex scan is what reads these.
+        if isTypedStream(data) {
+            return extractTextFromHex(data) ?? ""
+        }
+        
         var attributed: NSAttributedString?
         
         // ① secure‑coding path  (modern archives)
@@ -137,6 +159,35 @@ extension MessagesManager {
         return result
     }
     
+    /// Decodes the `streamtyped` archives Messages writes with the C decoder,
+    /// nil if the blob is some other format or one the decoder would not vouch
+    /// for, so the slower paths get a go
+    private func decodeTypedStream(_ data: Data) -> String? {
+        return data.withUnsafeBytes { raw -> String? in
+            guard let base = raw.baseAddress else { return nil }
+            
+            var decoded = AttributedBodyText()
+            guard attributed_body_decode(base, raw.count, &decoded) else { return nil }
+            
+            let bytes = raw.bindMemory(to: UInt8.self)
+            let text = String(decoding: bytes[decoded.text_offset..<decoded.text_offset + decoded.text_length],
+                              as: UTF8.self)
+            
+            // Same rule as below, a link only stands in for an empty string
+            if text.trimmingCharacters(in: .whitespacesAndNewlines).isEmpty, decoded.has_link {
+                return String(decoding: bytes[decoded.link_offset..<decoded.link_offset + decoded.link_length],
+                              as: UTF8.self)
+            }
+            return text
+        }
+    }
+    
+    /// A version byte, then "streamtyped" with its length in front
+    private func isTypedStream(_ data: Data) -> Bool {
+        let header = data.dropFirst().prefix(12)
+        return header.count == 12 && header.elementsEqual([0x0b] + Array("streamtyped".utf8))
+    }
+    
     /// Fallback method to extract text directly from hex when NSKeyedUnarchiver fails
     private func extractTextFromHex(_ data: Data) -> String? {
         let hex = data.map { String(format: "%02x", $0) }.joined()
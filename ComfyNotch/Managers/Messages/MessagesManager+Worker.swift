@@ -0,0 +1,121 @@
+//
+//  MessagesManager+Worker.swift
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+import Foundation
+
+/// What the Messages worker gets asked to do. Jobs of the same kind and key
+/// that are still queued are merged into one run, see MessagesWorker.h
+enum MessagesJobKind: UInt32 {
+    case restoreSeen = 1
+    case poll
+    case handles
+    case conversation
+    case olderMessages
+    case search
+    case handleSummaries
+    case buildIndex
+    case buildSearch
+    case attach
+    case saveSeen
+}
+
+/// Holds a Swift job while the C worker has it, retained until `complete`
+private final class MessagesJobBox {
+    let work: (OpaquePointer) -> Void
+    let done: () -> Void
+    
+    init(work: @escaping (OpaquePointer) -> Void, done: @escaping () -> Void) {
+        self.work = work
+        self.done = done
+    }
+}
+
+/// Written on the worker thread, read once the continuation resumed
+private final class MessagesJobResult<T>: @unchecked Sendable {
+    var value: T?
+}
+
+extension MessagesManager {
+
+    internal func startWorker() {
+        guard messagesWorker == nil, let context = messagesContext else { return }
+        messagesWorker = messages_worker_start(context)
+        if messagesWorker == nil {
+            print("❌ Failed to start the Messages worker")
+        }
+    }
+    
+    /// Finishes the job in flight, anything still queued completes without running
+    internal func stopWorker() {
+        guard let worker = messagesWorker else { return }
+        let stats = messages_worker_stats(worker)
+        debugLog("📊 Messages worker: \(stats.submitted) jobs, \(stats.merged) merged, \(stats.runs) runs")
+        messages_worker_stop(worker)
+        messagesWorker = nil
+    }
+    
+    /// Queues `work` on the Messages worker, the only thread that queries
+    /// chat.db. `done` is called on the worker thread once the job ran, or was
+    /// answered by a newer one of the same kind and key, or dropped on stop.
+    /// Returns false if there is no worker, `done` is not called then.
+    @discardableResult
+    internal func submitJob(
+        _ kind: MessagesJobKind,
+        key: Int64 = 0,
+        priority: MessagesJobPriority = MESSAGES_PRIORITY_NORMAL,
+        work: @escaping @Sendable (OpaquePointer) -> Void,
+        done: @escaping () -> Void = {}
+    ) -> Bool {
+        guard let worker = messagesWorker else { return false }
+        
+        let box = Unmanaged.passRetained(MessagesJobBox(work: work, done: done))
+        var job = MessagesJob(
+            kind: kind.rawValue,
+            key: key,
+            priority: priority,
+            run: { context, userdata in
+                guard let context, let userdata else { return }
+                Unmanaged<MessagesJobBox>.fromOpaque(userdata).takeUnretainedValue().work(context)
+            },
+            complete: { userdata in
+                guard let userdata else { return }
+                Unmanaged<MessagesJobBox>.fromOpaque(userdata).takeRetainedValue().done()
+            },
+            userdata: box.toOpaque()
+        )
+        
+        guard messages_worker_submit(worker, &job) else {
+            box.release()
+            return false
+        }
+        return true
+    }
+    
+    /// Runs `work` on the Messages worker and hands back what it returned.
+    /// nil if a newer request of the same kind and key answered this one
+    /// instead, or the worker is gone, the caller that ran gets the result.
+    internal func runJob<T>(
+        _ kind: MessagesJobKind,
+        key: Int64 = 0,
+        priority: MessagesJobPriority = MESSAGES_PRIORITY_NORMAL,
+        _ work: @escaping @Sendable (OpaquePointer) -> T
+    ) async -> T? {
+        let result = MessagesJobResult<T>()
+        
+        await withCheckedContinuation { (continuation: CheckedContinuation<Void, Never>) in
+            let submitted = submitJob(
+                kind,
+                key: key,
+                priority: priority,
+                work: { context in result.value = work(context) },
+                done: { continuation.resume() }
+            )
+            if !submitted { continuation.resume() }
+        }
+        return result.value
+    }
+}
@@ -11,16 +11,36 @@ import Contacts
 
 // MARK: - DB Internals
 extension MessagesManager {
-    internal var messagesDBPath: String {
+    nonisolated internal var messagesDBPath: String {
         FileManager.default
             .homeDirectoryForCurrentUser
             .appendingPathComponent("Library/Messages/chat.db")
             .path
     }
     
-    internal var db: Connection? {
+    /// Only opened from jobs on the Messages worker
+    nonisolated internal var db: Connection? {
         try? Connection(messagesDBPath, readonly: true)
     }
+    
+    /// chat.db is read only, our (handle_id, date) index lives in our caches folder
+    internal var messagesIndexPath: String? {
+        guard let caches = FileManager.default.urls(for: .cachesDirectory, in: .userDomainMask).first else {
+            return nil
+        }
+        let folder = caches.appendingPathComponent(Bundle.main.bundleIdentifier ?? "ComfyNotch")
+        try? FileManager.default.createDirectory(at: folder, withIntermediateDirectories: true)
+        return folder.appendingPathComponent("chat-handle-date.idx").path
+    }
+    
+    internal var messagesSearchIndexPath: String? {
+        messagesIndexPath.map { ($0 as NSString).deletingLastPathComponent + "/chat-search.idx" }
+    }
+    
+    /// Seen GUIDs and the ROWID watermark, written on stop and read back on start
+    internal var messagesSeenSnapshotPath: String? {
+        messagesIndexPath.map { ($0 as NSString).deletingLastPathComponent + "/chat-seen.snapshot" }
+    }
 }
 
 
@@ -50,13 +70,18 @@ final class MessagesManager: ObservableObject {
     ///     multiple operations are not being
     ///     executed at the same time, them being
     ///     triggered will be invalidated by
-    ///     these flags
-    internal var isFetchingHandles  = false
-    internal var isFetchingMessages = false
+    ///     these flags. Reads don't need one,
+    ///     the Messages worker merges them
     internal var isMessaging        = false
     internal var isPlayingAudio     = false
     
     internal var timer: Timer?
+    internal var chatDBWatcher: OpaquePointer?
+    /// Fires on the main queue while the context's event ring has something to drain
+    internal var messagesEventSource: DispatchSourceRead?
+    /// The ring `messagesEventSource` drains, from the worker's first job until
+    /// the context is closed. Kept here so draining never waits on the context's lock
+    internal var messagesEventRing: OpaquePointer?
     internal var lastKnownModificationDate: Date?
     internal var lastLocalSendTimestamp: Date?
     
@@ -64,48 +89,141 @@ final class MessagesManager: ObservableObject {
     internal var pendingNotchOpen: DispatchWorkItem?
     internal var messageCloseWorkItem: DispatchWorkItem?
     
-    internal var dontShowFirstMessage: Bool = true
-    internal var dbHandle: OpaquePointer?
-    
+    /// Owns the chat.db connection and its cached prepared statements (see MessagesContext.h)
+    internal var messagesContext: OpaquePointer?
+    /// The only thread that queries `messagesContext`, see MessagesWorker.h
+    internal var messagesWorker: OpaquePointer?
+    /// Keyset position of the open conversation, only moved by worker jobs
+    internal let conversationState = ConversationCursorState()
+    /// Conversation the user last opened, pages for any other are dropped
+    internal var requestedConversation: Int64 = 0
     internal var isPolling = false
     
     public func start() {
         if SettingsModel.shared.enableMessagesNotifications {
             Task {
                 /// Open the SQLite database connection
-                if sqlite3_open_v2(
-                    messagesDBPath,
-                    &self.dbHandle,
-                    SQLITE_OPEN_READONLY | SQLITE_OPEN_FULLMUTEX | SQLITE_OPEN_SHAREDCACHE,
-                    nil
-                ) == SQLITE_OK {
+                if let context = messages_context_open(messagesDBPath) {
+                    self.messagesContext = context
+                    /// Room for a full page per conversation or every reopen misses
+                    messages_context_set_cache_budget(
+                        context,
+                        8 << 20,
+                        Int32(max(settingsManager.messagesMessageLimit, Int(CONVERSATION_CACHE_DEFAULT_PER_HANDLE)))
+                    )
                     print("✅ SQLite DB opened and cached")
+                    self.startWorker()
+                    
+                    /// The worker's first job, the readers open chat.db and attaching the ring reads it.
+                    /// The ring is kept so the main actor never asks the context for it.
+                    self.messagesEventRing = await self.runJob(.attach, { context -> OpaquePointer? in
+                        /// Read-only connections for refreshing every handle or decoding a page across cores
+                        if !messages_context_attach_pool(context, 0) {
+                            print("❌ Failed to open the Messages reader pool")
+                        }
+                        /// Polls say what changed instead of only that something did
+                        guard messages_context_attach_events(context, 1024) else {
+                            print("❌ Failed to attach the Messages event ring")
+                            return nil
+                        }
+                        return messages_context_events(context)
+                    }) ?? nil
+                    
+                    /// Carry on from the last run, otherwise the first poll starts at the newest row.
+                    /// Queued ahead of the first poll, which lines up behind it.
+                    if let seenPath = self.messagesSeenSnapshotPath {
+                        self.submitJob(.restoreSeen, work: { context in
+                            if messages_context_restore_seen(context, seenPath) {
+                                debugLog("📊 Restored seen messages up to ROWID \(get_messages_watermark(context))")
+                            }
+                        })
+                    }
                 } else {
                     print("❌ Failed to open SQLite DB")
-                    self.dbHandle = nil
+                    self.messagesContext = nil
                 }
                 
                 /// Check At start so no weird UI bug
                 self.checkFullDiskAccess()
                 self.checkContactAccess()
                 await self.fetchAllHandles()
+                self.attachIndexes()
                 self.startPolling()
             }
         }
     }
     
+    /// The first builds read every message, so they run as background worker
+    /// jobs of one batch each, queued behind the first handle list. Every job
+    /// queues the next until its build is done, a poll or a visible page never
+    /// waits for more than the batch in flight. `stopWorker()` drops the rest.
+    /// Lookups use plain SQL until the index is attached, search answers nothing
+    /// until its index is.
+    private func attachIndexes() {
+        guard let indexPath = self.messagesIndexPath,
+              let searchPath = self.messagesSearchIndexPath else { return }
+        
+        self.buildIndex(.buildIndex, "sidecar message index", {
+            messages_context_attach_index_step($0, indexPath, 10_000)
+        }, then: {
+            self.buildIndex(.buildSearch, "message search index", {
+                messages_context_attach_search_step($0, searchPath, 10_000)
+            })
+        })
+    }
+    
+    /// Runs `step` as one job after the other until it is done, then `next`
+    private func buildIndex(
+        _ kind: MessagesJobKind,
+        _ name: String,
+        _ step: @escaping @Sendable (OpaquePointer) -> MessagesBuildStatus,
+        then next: (() -> Void)? = nil
+    ) {
+        Task {
+            switch await self.runJob(kind, priority: MESSAGES_PRIORITY_BACKGROUND, step) {
+            case .some(MESSAGES_BUILD_MORE):
+                self.buildIndex(kind, name, step, then: next)
+            case .some(MESSAGES_BUILD_FAILED):
+                print("❌ Failed to build the \(name)")
+                next?()
+            case .some(MESSAGES_BUILD_DONE):
+                next?()
+            default:
+                /// The worker stopped
+                break
+            }
+        }
+    }
+    
     func stop() {
-        self.timer?.invalidate()
-        self.timer = nil
-        self.isPolling = false
+        self.stopPolling()
+        self.stopEventSource()
+        self.messagesEventRing = nil
         
-        if let handle = self.dbHandle {
-            sqlite3_close(handle)
-            print("✅ SQLite DB closed")
-            self.dbHandle = nil
+        /// The worker's last job, `stopWorker()` drops anything still queued
+        if let worker = self.messagesWorker, let seenPath = self.messagesSeenSnapshotPath {
+            self.submitJob(.saveSeen, work: { context in
+                if !messages_context_save_seen(context, seenPath) {
+                    print("❌ Failed to save seen messages")
+                }
+            })
+            messages_worker_drain(worker, MESSAGES_PRIORITY_NORMAL)
         }
+        /// Nothing else uses the context once the worker is gone
+        self.stopWorker()
         
-        hashmap_free()
+        if let context = self.messagesContext {
+            let stats = messages_context_stats(context)
+            debugLog("📊 Prepared \(stats.prepares) statements, avoided \(stats.prepares_avoided) re-prepares")
+            let cacheStats = messages_context_cache_stats(context)
+            debugLog("📊 Conversation cache: \(cacheStats.hits) hits, \(cacheStats.misses) misses, \(cacheStats.pushes) deltas applied")
+            if let metrics = self.metricsJSON() {
+                debugLog("📊 Messages metrics: \(metrics)")
+            }
+            messages_context_close(context)
+            print("✅ SQLite DB closed")
+            self.messagesContext = nil
+        }
     }
     
     func checkContactAccess() {
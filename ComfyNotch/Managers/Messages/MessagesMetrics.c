@@ -0,0 +1,228 @@
+//
+//  MessagesMetrics.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/5/25.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "MessagesContextInternal.h"
+
+static const char *operation_names[MESSAGES_OP_COUNT] = {
+    [MESSAGES_OP_HAS_CHANGED] = "has_chat_db_changed",
+    [MESSAGES_OP_NEW_MESSAGES] = "get_new_messages",
+    [MESSAGES_OP_LAST_TALKED_TO] = "get_last_talked_to",
+    [MESSAGES_OP_LAST_MESSAGE_BODY] = "visit_last_message_body",
+    [MESSAGES_OP_HANDLE_SUMMARIES] = "get_handle_summaries",
+    [MESSAGES_OP_ATTACHMENTS] = "get_message_attachments",
+    [MESSAGES_OP_CURSOR_OLDER] = "messages_cursor_older",
+    [MESSAGES_OP_CURSOR_NEWER] = "messages_cursor_newer",
+    [MESSAGES_OP_CURSOR_CACHED] = "messages_cursor_cached",
+    [MESSAGES_OP_SEARCH] = "search_messages",
+    [MESSAGES_OP_UNREAD_COUNTS] = "get_unread_counts",
+    [MESSAGES_OP_PAGE_DECODE] = "messages_page_decode",
+    [MESSAGES_OP_RECENT_HANDLES] = "get_recent_handles",
+};
+
+const char *messages_operation_name(MessagesOperation op) {
+    return op >= 0 && op < MESSAGES_OP_COUNT ? operation_names[op] : NULL;
+}
+
+uint64_t messages_metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// MARK: - Recording
+
+/// Values below 8 get a bucket each, above that every power of two is split
+/// into 8 buckets by the 3 bits under the leading one
+static inline int bucket_of(uint64_t value) {
+    if (value < (1u << MESSAGES_HISTOGRAM_SUB_BITS)) return (int)value;
+    int exponent = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (exponent - MESSAGES_HISTOGRAM_SUB_BITS)) & ((1 << MESSAGES_HISTOGRAM_SUB_BITS) - 1);
+    return ((exponent - MESSAGES_HISTOGRAM_SUB_BITS + 1) << MESSAGES_HISTOGRAM_SUB_BITS) + sub;
+}
+
+/// Largest value that lands in `bucket`
+static uint64_t bucket_limit(int bucket) {
+    if (bucket < (1 << MESSAGES_HISTOGRAM_SUB_BITS)) return (uint64_t)bucket;
+    int exponent = (bucket >> MESSAGES_HISTOGRAM_SUB_BITS) + MESSAGES_HISTOGRAM_SUB_BITS - 1;
+    int sub = bucket & ((1 << MESSAGES_HISTOGRAM_SUB_BITS) - 1);
+    int shift = exponent - MESSAGES_HISTOGRAM_SUB_BITS;
+    uint64_t low = (uint64_t)((1 << MESSAGES_HISTOGRAM_SUB_BITS) + sub) << shift;
+    return low + ((1ull << shift) - 1);
+}
+
+static inline void store_max(_Atomic uint64_t *max, uint64_t value) {
+    uint64_t seen = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > seen &&
+           !atomic_compare_exchange_weak_explicit(max, &seen, value,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static inline void add(_Atomic uint64_t *counter, uint64_t value) {
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+void messages_metrics_record(MessagesMetrics *metrics, MessagesOperation op, uint64_t start_ns) {
+    uint64_t elapsed = messages_metrics_now() - start_ns;
+    MessagesHistogram *histogram = &metrics->operations[op];
+
+    add(&histogram->buckets[bucket_of(elapsed)], 1);
+    add(&histogram->total_ns, elapsed);
+    store_max(&histogram->max_ns, elapsed);
+}
+
+void messages_metrics_record_statement(MessagesMetrics *metrics, MessagesStatementID id,
+                                       sqlite3_stmt *stmt, uint64_t ns) {
+    MessagesStatementCounters *counters = &metrics->statements[id];
+
+    add(&counters->executions, 1);
+    add(&counters->total_ns, ns);
+    store_max(&counters->max_ns, ns);
+    /// Read and reset so every execution only reports its own work
+    add(&counters->vm_steps, (uint64_t)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1));
+    add(&counters->fullscan_steps, (uint64_t)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1));
+    add(&counters->sorts, (uint64_t)sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1));
+}
+
+// MARK: - Snapshots
+
+/// Swapping each counter for 0 means a call recorded mid-snapshot lands in
+/// one window or the next, never in neither
+static inline uint64_t take(_Atomic uint64_t *counter, bool reset) {
+    return reset
+        ? atomic_exchange_explicit(counter, 0, memory_order_relaxed)
+        : atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void summarize(MessagesHistogram *histogram, MessagesLatencySummary *out, bool reset) {
+    uint64_t buckets[MESSAGES_HISTOGRAM_BUCKETS];
+
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < MESSAGES_HISTOGRAM_BUCKETS; i++) {
+        buckets[i] = take(&histogram->buckets[i], reset);
+        out->count += buckets[i];
+    }
+    out->total_ns = take(&histogram->total_ns, reset);
+    out->max_ns = take(&histogram->max_ns, reset);
+    if (out->count == 0) return;
+
+    /// Rank of each percentile, rounded up, then the bucket it falls in
+    uint64_t p50 = (out->count * 50 + 99) / 100;
+    uint64_t p90 = (out->count * 90 + 99) / 100;
+    uint64_t p99 = (out->count * 99 + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < MESSAGES_HISTOGRAM_BUCKETS && seen < p99; i++) {
+        if (!buckets[i]) continue;
+        seen += buckets[i];
+        uint64_t limit = bucket_limit(i);
+        if (limit > out->max_ns) limit = out->max_ns;
+        if (!out->p50_ns && seen >= p50) out->p50_ns = limit;
+        if (!out->p90_ns && seen >= p90) out->p90_ns = limit;
+        if (seen >= p99) out->p99_ns = limit;
+    }
+}
+
+bool messages_context_metrics(MessagesContext *ctx, MessagesMetricsSnapshot *out, bool reset) {
+    if (!ctx || !out) return false;
+    memset(out, 0, sizeof(*out));
+
+    for (int op = 0; op < MESSAGES_OP_COUNT; op++) {
+        summarize(&ctx->metrics.operations[op], &out->operations[op], reset);
+    }
+
+    for (int id = 0; id < MESSAGES_STMT_COUNT; id++) {
+        MessagesStatementCounters *counters = &ctx->metrics.statements[id];
+        out->statements[id] = (MessagesStatementMetrics){
+            .executions = take(&counters->executions, reset),
+            .total_ns = take(&counters->total_ns, reset),
+            .max_ns = take(&counters->max_ns, reset),
+            .vm_steps = take(&counters->vm_steps, reset),
+            .fullscan_steps = take(&counters->fullscan_steps, reset),
+            .sorts = take(&counters->sorts, reset),
+        };
+    }
+
+    /// Gauges, nothing to reset
+    out->seen = message_seen_set_stats(&ctx->seen);
+    out->seen_expired = message_seen_set_expired(&ctx->seen);
+    messages_context_lock(ctx);
+    out->conversation_cache_bytes = conversation_cache_stats(ctx->conversations).bytes;
+    out->sidecar_index_entries = ctx->index ? sidecar_index_count(ctx->index) : 0;
+    out->search_documents = ctx->search ? message_search_doc_count(ctx->search) : 0;
+    out->unread_messages = unread_counters_total(ctx->unread);
+    messages_context_unlock(ctx);
+    return true;
+}
+
+// MARK: - JSON
+
+typedef struct {
+    char *buffer;
+    size_t capacity;
+    size_t length;      // what the whole document needs, may run past `capacity`
+} JSONWriter;
+
+static void emit(JSONWriter *writer, const char *format, ...) {
+    char *at = writer->length < writer->capacity ? writer->buffer + writer->length : NULL;
+    size_t room = at ? writer->capacity - writer->length : 0;
+
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(at, room, format, args);
+    va_end(args);
+    if (written > 0) writer->length += (size_t)written;
+}
+
+size_t messages_context_metrics_json(MessagesContext *ctx, char *buffer, size_t capacity, bool reset) {
+    JSONWriter writer = { .buffer = capacity ? buffer : NULL, .capacity = buffer ? capacity : 0 };
+    if (writer.capacity) buffer[0] = '\0';
+
+    MessagesMetricsSnapshot snapshot;
+    if (!messages_context_metrics(ctx, &snapshot, reset)) return 0;
+
+    emit(&writer, "{\"operations\":{");
+    bool first = true;
+    for (int op = 0; op < MESSAGES_OP_COUNT; op++) {
+        const MessagesLatencySummary *s = &snapshot.operations[op];
+        if (!s->count) continue;
+        emit(&writer, "%s\"%s\":{\"count\":%llu,\"mean_ns\":%llu,\"p50_ns\":%llu,"
+             "\"p90_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}",
+             first ? "" : ",", operation_names[op],
+             (unsigned long long)s->count, (unsigned long long)(s->total_ns / s->count),
+             (unsigned long long)s->p50_ns, (unsigned long long)s->p90_ns,
+             (unsigned long long)s->p99_ns, (unsigned long long)s->max_ns);
+        first = false;
+    }
+
+    emit(&writer, "},\"statements\":{");
+    first = true;
+    for (int id = 0; id < MESSAGES_STMT_COUNT; id++) {
+        const MessagesStatementMetrics *s = &snapshot.statements[id];
+        if (!s->executions) continue;
+        emit(&writer, "%s\"%s\":{\"executions\":%llu,\"total_ns\":%llu,\"max_ns\":%llu,"
+             "\"vm_steps\":%llu,\"fullscan_steps\":%llu,\"sorts\":%llu}",
+             first ? "" : ",", messages_context_statement_name(id),
+             (unsigned long long)s->executions, (unsigned long long)s->total_ns,
+             (unsigned long long)s->max_ns, (unsigned long long)s->vm_steps,
+             (unsigned long long)s->fullscan_steps, (unsigned long long)s->sorts);
+        first = false;
+    }
+
+    emit(&writer, "},\"seen\":{\"count\":%zu,\"capacity\":%zu,\"mean_probe\":%.3f,"
+         "\"max_probe\":%zu,\"bytes\":%zu,\"expired\":%llu},",
+         snapshot.seen.count, snapshot.seen.capacity, snapshot.seen.mean_probe,
+         snapshot.seen.max_probe, snapshot.seen.bytes, (unsigned long long)snapshot.seen_expired);
+    emit(&writer, "\"conversation_cache_bytes\":%zu,\"sidecar_index_entries\":%zu,"
+         "\"search_documents\":%zu,\"unread_messages\":%zu}",
+         snapshot.conversation_cache_bytes, snapshot.sidecar_index_entries,
+         snapshot.search_documents, snapshot.unread_messages);
+    return writer.length;
+}
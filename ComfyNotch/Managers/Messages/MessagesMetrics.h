@@ -0,0 +1,73 @@
+//
+//  MessagesMetrics.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/5/25.
+//
+
+#ifndef MessagesMetrics_h
+#define MessagesMetrics_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "MessageHashMap.h"
+
+/// Entry points of the Messages C layer that record their latency
+typedef enum {
+    MESSAGES_OP_HAS_CHANGED = 0,
+    MESSAGES_OP_NEW_MESSAGES,
+    MESSAGES_OP_LAST_TALKED_TO,
+    MESSAGES_OP_LAST_MESSAGE_BODY,
+    MESSAGES_OP_HANDLE_SUMMARIES,
+    MESSAGES_OP_ATTACHMENTS,
+    MESSAGES_OP_CURSOR_OLDER,
+    MESSAGES_OP_CURSOR_NEWER,
+    MESSAGES_OP_CURSOR_CACHED,
+    MESSAGES_OP_SEARCH,
+    MESSAGES_OP_UNREAD_COUNTS,
+    MESSAGES_OP_PAGE_DECODE,
+    MESSAGES_OP_RECENT_HANDLES,
+    MESSAGES_OP_COUNT
+} MessagesOperation;
+
+/// Room for every prepared statement of a context, indexed like the statement cache
+#define MESSAGES_METRICS_MAX_STATEMENTS 24
+
+/// Log-linear buckets: 8 per power of two, so any value is within 12.5%
+#define MESSAGES_HISTOGRAM_SUB_BITS 3
+#define MESSAGES_HISTOGRAM_BUCKETS  ((64 - MESSAGES_HISTOGRAM_SUB_BITS + 1) << MESSAGES_HISTOGRAM_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+} MessagesLatencySummary;
+
+/// From SQLite's profile hook, one execution is prepare/bind to reset
+typedef struct {
+    uint64_t executions;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t vm_steps;          // bytecode steps, a rough cost of the work done
+    uint64_t fullscan_steps;    // rows walked by full table scans, should stay 0
+    uint64_t sorts;
+} MessagesStatementMetrics;
+
+typedef struct {
+    MessagesLatencySummary operations[MESSAGES_OP_COUNT];
+    MessagesStatementMetrics statements[MESSAGES_METRICS_MAX_STATEMENTS];
+    MessageHashMapStats seen;
+    uint64_t seen_expired;
+    size_t conversation_cache_bytes;
+    size_t sidecar_index_entries;
+    size_t search_documents;
+    size_t unread_messages;
+} MessagesMetricsSnapshot;
+
+const char *messages_operation_name(MessagesOperation op);
+
+#endif /* MessagesMetrics_h */
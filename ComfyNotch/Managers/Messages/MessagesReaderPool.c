@@ -0,0 +1,203 @@
+//
+//  MessagesReaderPool.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "MessagesReaderPool.h"
+
+/// More readers than this only adds connections that wait on the disk
+#define MAX_READERS 8
+
+/// Every reader connection gets these. mmap reads pages straight out of the
+/// page cache instead of copying them, and the bigger cache keeps the handle
+/// and message indexes warm between batches.
+static const char *reader_pragmas =
+    "PRAGMA query_only = 1;"
+    "PRAGMA mmap_size = 268435456;"     // 256 MB of address space, not memory
+    "PRAGMA cache_size = -16384;";      // 16 MB
+
+struct MessagesReader {
+    MessagesReaderPool *pool;
+    sqlite3 *db;
+    sqlite3_stmt *statements[MESSAGES_STMT_COUNT];
+    pthread_t thread;
+    bool started;
+};
+
+struct MessagesReaderPool {
+    MessagesReader readers[MAX_READERS];
+    int size;
+    MessagesMetrics *metrics;
+
+    /// One batch at a time
+    pthread_mutex_t run_lock;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // a new batch, or stopping
+    pthread_cond_t done;        // the last reader finished its share
+    uint64_t batch;             // bumped for every batch
+    int busy;                   // readers still working on it
+    bool stopping;
+
+    /// The batch being run
+    MessagesReaderTask task;
+    void *userdata;
+    size_t count;
+    _Atomic size_t next;
+};
+
+static int profile_reader_statement(unsigned type, void *userdata, void *p, void *x) {
+    MessagesReader *reader = userdata;
+    if (type != SQLITE_TRACE_PROFILE || !reader->pool->metrics) return 0;
+
+    for (int id = 0; id < MESSAGES_STMT_COUNT; id++) {
+        if (reader->statements[id] == p) {
+            messages_metrics_record_statement(reader->pool->metrics, id, p, (uint64_t)*(sqlite3_int64 *)x);
+            break;
+        }
+    }
+    return 0;
+}
+
+static void *reader_main(void *arg) {
+    MessagesReader *reader = arg;
+    MessagesReaderPool *pool = reader->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stopping && pool->batch == seen) pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->stopping) break;
+        seen = pool->batch;
+        pthread_mutex_unlock(&pool->lock);
+
+        /// Claim indexes one at a time, a slow one never holds up the rest
+        size_t index;
+        while ((index = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+            pool->task(reader, index, pool->userdata);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static bool open_reader(MessagesReader *reader, const char *db_path) {
+    /// A private cache and no mutex, the connection only ever sees one thread
+    int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_PRIVATECACHE;
+    if (sqlite3_open_v2(db_path, &reader->db, flags, NULL) != SQLITE_OK ||
+        sqlite3_exec(reader->db, reader_pragmas, NULL, NULL, NULL) != SQLITE_OK) {
+        sqlite3_close(reader->db);
+        reader->db = NULL;
+        return false;
+    }
+    sqlite3_trace_v2(reader->db, SQLITE_TRACE_PROFILE, profile_reader_statement, reader);
+    return true;
+}
+
+MessagesReaderPool *messages_reader_pool_open(const char *db_path, int readers, MessagesMetrics *metrics) {
+    if (!db_path) return NULL;
+
+    if (readers <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        readers = cores > 0 ? (int)cores : 1;
+    }
+    if (readers > MAX_READERS) readers = MAX_READERS;
+
+    MessagesReaderPool *pool = calloc(1, sizeof(MessagesReaderPool));
+    if (!pool) return NULL;
+    pool->metrics = metrics;
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    atomic_init(&pool->next, 0);
+
+    for (int i = 0; i < readers; i++) {
+        MessagesReader *reader = &pool->readers[i];
+        reader->pool = pool;
+        if (!open_reader(reader, db_path)) {
+            messages_reader_pool_close(pool);
+            return NULL;
+        }
+        pool->size++;
+        if (pthread_create(&reader->thread, NULL, reader_main, reader) != 0) {
+            messages_reader_pool_close(pool);
+            return NULL;
+        }
+        reader->started = true;
+    }
+    return pool;
+}
+
+void messages_reader_pool_close(MessagesReaderPool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->size; i++) {
+        MessagesReader *reader = &pool->readers[i];
+        if (reader->started) pthread_join(reader->thread, NULL);
+        for (int id = 0; id < MESSAGES_STMT_COUNT; id++) sqlite3_finalize(reader->statements[id]);
+        sqlite3_close(reader->db);
+    }
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run_lock);
+    free(pool);
+}
+
+int messages_reader_pool_size(const MessagesReaderPool *pool) {
+    return pool ? pool->size : 0;
+}
+
+void messages_reader_pool_run(MessagesReaderPool *pool, size_t count, MessagesReaderTask task, void *userdata) {
+    if (!pool || !task || count == 0) return;
+
+    pthread_mutex_lock(&pool->run_lock);
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->userdata = userdata;
+    pool->count = count;
+    atomic_store(&pool->next, 0);
+    pool->busy = pool->size;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->wake);
+
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run_lock);
+}
+
+sqlite3_stmt *messages_reader_statement(MessagesReader *reader, MessagesStatementID id) {
+    if (!reader || id < 0 || id >= MESSAGES_STMT_COUNT) return NULL;
+
+    sqlite3_stmt *stmt = reader->statements[id];
+    if (stmt) return stmt;
+
+    if (sqlite3_prepare_v3(reader->db, messages_context_statement_sql(id), -1,
+                           SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK) {
+        return NULL;
+    }
+    reader->statements[id] = stmt;
+    return stmt;
+}
+
+void messages_reader_release(MessagesReader *reader, sqlite3_stmt *stmt) {
+    (void)reader;
+    if (!stmt) return;
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
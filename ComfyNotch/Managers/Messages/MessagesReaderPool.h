@@ -0,0 +1,45 @@
+//
+//  MessagesReaderPool.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+//  Only included by the C files in this folder, like MessagesContextInternal.h
+//
+
+#ifndef MessagesReaderPool_h
+#define MessagesReaderPool_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "MessagesContextInternal.h"
+
+/// Read-only chat.db connections, each owned by one thread, for batches that
+/// split into independent pieces. chat.db is in WAL mode, so the readers never
+/// wait on each other or on Messages writing. Every piece sees a consistent
+/// snapshot on its own, pieces of one batch may see different ones.
+typedef struct MessagesReaderPool MessagesReaderPool;
+/// One connection with its own cached statements, only valid inside a task
+typedef struct MessagesReader MessagesReader;
+
+/// `readers` connections and threads, 0 for one per core. Statement costs are
+/// recorded into `metrics` like the context's own.
+MessagesReaderPool *messages_reader_pool_open(const char *db_path, int readers, MessagesMetrics *metrics);
+void messages_reader_pool_close(MessagesReaderPool *pool);
+
+int messages_reader_pool_size(const MessagesReaderPool *pool);
+
+typedef void (*MessagesReaderTask)(MessagesReader *reader, size_t index, void *userdata);
+
+/// Calls `task` once for every index in [0, count), spread over the pool, and
+/// returns once all of them ran. Tasks write their results by index, so they
+/// come out in order however the threads interleave. One batch at a time,
+/// callers queue up.
+void messages_reader_pool_run(MessagesReaderPool *pool, size_t count, MessagesReaderTask task, void *userdata);
+
+/// Same contract as `messages_context_statement`, minus the lock: the reader
+/// belongs to the task's thread. Pair with `messages_reader_release`.
+sqlite3_stmt *messages_reader_statement(MessagesReader *reader, MessagesStatementID id);
+void messages_reader_release(MessagesReader *reader, sqlite3_stmt *stmt);
+
+#endif /* MessagesReaderPool_h */
@@ -0,0 +1,275 @@
+//
+//  MessagesWorker.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MessagesWorker.h"
+
+/// A submit that was merged into a queued job, completed after that job ran
+typedef struct {
+    MessagesJobComplete complete;
+    void *userdata;
+} JobWaiter;
+
+typedef struct JobNode {
+    MessagesJob job;
+    JobWaiter *waiters;
+    int waiter_count;
+    int waiter_capacity;
+    struct JobNode *next;
+} JobNode;
+
+typedef struct {
+    JobNode *head;
+    JobNode *tail;
+} JobQueue;
+
+struct MessagesWorker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    MessagesContext *ctx;
+    JobQueue queues[MESSAGES_PRIORITY_COUNT];
+    bool stopping;
+
+    _Atomic uint64_t submitted;
+    _Atomic uint64_t merged;
+    _Atomic uint64_t runs;
+    _Atomic uint64_t pending;
+};
+
+static void queue_push(JobQueue *queue, JobNode *node) {
+    node->next = NULL;
+    if (queue->tail) queue->tail->next = node;
+    else queue->head = node;
+    queue->tail = node;
+}
+
+static JobNode *queue_pop(JobQueue *queue) {
+    JobNode *node = queue->head;
+    if (!node) return NULL;
+    queue->head = node->next;
+    if (!queue->head) queue->tail = NULL;
+    node->next = NULL;
+    return node;
+}
+
+static void queue_unlink(JobQueue *queue, JobNode *node, JobNode *previous) {
+    if (previous) previous->next = node->next;
+    else queue->head = node->next;
+    if (queue->tail == node) queue->tail = previous;
+    node->next = NULL;
+}
+
+/// Completes the job that ran, then everything merged into it in submit order
+static void complete_node(JobNode *node) {
+    if (node->job.complete) node->job.complete(node->job.userdata);
+    for (int i = 0; i < node->waiter_count; i++) {
+        if (node->waiters[i].complete) node->waiters[i].complete(node->waiters[i].userdata);
+    }
+    free(node->waiters);
+    free(node);
+}
+
+/// Caller holds the lock. Queues stay a handful of jobs long because of
+/// merging, so a scan is cheaper than keeping a table in sync.
+static bool merge_into_pending(MessagesWorker *worker, const MessagesJob *job) {
+    if (job->kind == 0) return false;
+
+    for (int level = 0; level < MESSAGES_PRIORITY_COUNT; level++) {
+        JobQueue *queue = &worker->queues[level];
+        JobNode *previous = NULL;
+        for (JobNode *node = queue->head; node; previous = node, node = node->next) {
+            if (node->job.kind != job->kind || node->job.key != job->key) continue;
+
+            if (node->waiter_count == node->waiter_capacity) {
+                int capacity = node->waiter_capacity ? node->waiter_capacity * 2 : 4;
+                JobWaiter *waiters = realloc(node->waiters, (size_t)capacity * sizeof(JobWaiter));
+                if (!waiters) return false;
+                node->waiters = waiters;
+                node->waiter_capacity = capacity;
+            }
+            node->waiters[node->waiter_count++] = (JobWaiter){ node->job.complete, node->job.userdata };
+
+            MessagesJobPriority priority = job->priority > node->job.priority ? job->priority : node->job.priority;
+            node->job = *job;
+            node->job.priority = priority;
+            if ((int)priority != level) {
+                queue_unlink(queue, node, previous);
+                queue_push(&worker->queues[priority], node);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+static JobNode *next_job(MessagesWorker *worker) {
+    for (int level = MESSAGES_PRIORITY_COUNT - 1; level >= 0; level--) {
+        JobNode *node = queue_pop(&worker->queues[level]);
+        if (node) return node;
+    }
+    return NULL;
+}
+
+static void *worker_thread(void *arg) {
+    MessagesWorker *worker = arg;
+
+    pthread_mutex_lock(&worker->lock);
+    for (;;) {
+        JobNode *node = next_job(worker);
+        if (!node) {
+            if (worker->stopping) break;
+            pthread_cond_wait(&worker->wake, &worker->lock);
+            continue;
+        }
+        atomic_fetch_sub_explicit(&worker->pending, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&worker->lock);
+
+        /// Taken off the queue before running, so a submit for the same job
+        /// from here on queues a fresh run instead of merging into this one
+        if (node->job.run) node->job.run(worker->ctx, node->job.userdata);
+        atomic_fetch_add_explicit(&worker->runs, 1, memory_order_relaxed);
+        complete_node(node);
+
+        pthread_mutex_lock(&worker->lock);
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+MessagesWorker *messages_worker_start(MessagesContext *ctx) {
+    if (!ctx) return NULL;
+
+    MessagesWorker *worker = calloc(1, sizeof(MessagesWorker));
+    if (!worker) return NULL;
+    worker->ctx = ctx;
+
+    if (pthread_mutex_init(&worker->lock, NULL) != 0) goto fail;
+    if (pthread_cond_init(&worker->wake, NULL) != 0) {
+        pthread_mutex_destroy(&worker->lock);
+        goto fail;
+    }
+    if (pthread_create(&worker->thread, NULL, worker_thread, worker) != 0) {
+        pthread_cond_destroy(&worker->wake);
+        pthread_mutex_destroy(&worker->lock);
+        goto fail;
+    }
+    return worker;
+
+fail:
+    free(worker);
+    return NULL;
+}
+
+void messages_worker_stop(MessagesWorker *worker) {
+    if (!worker) return;
+
+    /// Take the queued jobs first so the thread only finishes what it is running
+    pthread_mutex_lock(&worker->lock);
+    JobNode *dropped = NULL, **tail = &dropped;
+    for (int level = MESSAGES_PRIORITY_COUNT - 1; level >= 0; level--) {
+        JobNode *node;
+        while ((node = queue_pop(&worker->queues[level]))) {
+            *tail = node;
+            tail = &node->next;
+        }
+    }
+    atomic_store_explicit(&worker->pending, 0, memory_order_relaxed);
+    worker->stopping = true;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_join(worker->thread, NULL);
+
+    while (dropped) {
+        JobNode *next = dropped->next;
+        complete_node(dropped);
+        dropped = next;
+    }
+
+    pthread_cond_destroy(&worker->wake);
+    pthread_mutex_destroy(&worker->lock);
+    free(worker);
+}
+
+bool messages_worker_submit(MessagesWorker *worker, const MessagesJob *job) {
+    if (!worker || !job || (int)job->priority < 0 || job->priority >= MESSAGES_PRIORITY_COUNT) return false;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->stopping) {
+        pthread_mutex_unlock(&worker->lock);
+        return false;
+    }
+
+    bool taken = true;
+    if (merge_into_pending(worker, job)) {
+        atomic_fetch_add_explicit(&worker->merged, 1, memory_order_relaxed);
+    } else {
+        JobNode *node = calloc(1, sizeof(JobNode));
+        if (node) {
+            node->job = *job;
+            queue_push(&worker->queues[job->priority], node);
+            atomic_fetch_add_explicit(&worker->pending, 1, memory_order_relaxed);
+            pthread_cond_signal(&worker->wake);
+        }
+        taken = node != NULL;
+    }
+    if (taken) atomic_fetch_add_explicit(&worker->submitted, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&worker->lock);
+    return taken;
+}
+
+// MARK: - Drain
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
+    bool done;
+} DrainBarrier;
+
+static void barrier_complete(void *userdata) {
+    DrainBarrier *barrier = userdata;
+    pthread_mutex_lock(&barrier->lock);
+    barrier->done = true;
+    pthread_cond_signal(&barrier->done_cond);
+    pthread_mutex_unlock(&barrier->lock);
+}
+
+/// A job that never merges lines up behind everything at or above its
+/// priority, once it completes they all have
+void messages_worker_drain(MessagesWorker *worker, MessagesJobPriority priority) {
+    if (!worker) return;
+
+    DrainBarrier barrier = { .done = false };
+    pthread_mutex_init(&barrier.lock, NULL);
+    pthread_cond_init(&barrier.done_cond, NULL);
+
+    MessagesJob job = { .kind = 0, .priority = priority, .complete = barrier_complete, .userdata = &barrier };
+    if (messages_worker_submit(worker, &job)) {
+        pthread_mutex_lock(&barrier.lock);
+        while (!barrier.done) pthread_cond_wait(&barrier.done_cond, &barrier.lock);
+        pthread_mutex_unlock(&barrier.lock);
+    }
+
+    pthread_cond_destroy(&barrier.done_cond);
+    pthread_mutex_destroy(&barrier.lock);
+}
+
+MessagesWorkerStats messages_worker_stats(MessagesWorker *worker) {
+    MessagesWorkerStats stats = { 0 };
+    if (!worker) return stats;
+
+    stats.submitted = atomic_load_explicit(&worker->submitted, memory_order_relaxed);
+    stats.merged = atomic_load_explicit(&worker->merged, memory_order_relaxed);
+    stats.runs = atomic_load_explicit(&worker->runs, memory_order_relaxed);
+    stats.pending = atomic_load_explicit(&worker->pending, memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,69 @@
+//
+//  MessagesWorker.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#ifndef MessagesWorker_h
+#define MessagesWorker_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "MessagesContext.h"
+
+/// One thread that runs every query against a MessagesContext, so callers
+/// only ever queue work and get called back. Requests for the same thing that
+/// are still waiting are merged into one run, and higher priorities go first.
+typedef struct MessagesWorker MessagesWorker;
+
+/// Highest runs first, in submit order within a level
+typedef enum {
+    MESSAGES_PRIORITY_BACKGROUND = 0,   // nobody is looking, e.g. warming caches
+    MESSAGES_PRIORITY_NORMAL,           // polls, the handle list
+    MESSAGES_PRIORITY_VISIBLE,          // the conversation on screen
+    MESSAGES_PRIORITY_COUNT
+} MessagesJobPriority;
+
+/// Both are called on the worker thread, hop to your own queue before touching UI state
+typedef void (*MessagesJobRun)(MessagesContext *ctx, void *userdata);
+typedef void (*MessagesJobComplete)(void *userdata);
+
+/// Submitting a job whose `kind` and `key` match one still queued merges the
+/// two: the newer `run` and `userdata` replace the older ones and the job
+/// keeps its place in line, unless the new priority is higher, then it moves
+/// to the back of that line. A match that is already running does not merge,
+/// the new job runs again after it so nothing that changed meanwhile is missed.
+typedef struct {
+    uint32_t kind;                  // 0 never merges
+    int64_t key;
+    MessagesJobPriority priority;
+    MessagesJobRun run;
+    /// Called exactly once for every submitted job after the run that answered
+    /// it, merged away or not, and also for jobs dropped by stop. May be NULL.
+    MessagesJobComplete complete;
+    void *userdata;
+} MessagesJob;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t merged;            // submits answered by a job already queued
+    uint64_t runs;
+    uint64_t pending;           // queued right now
+} MessagesWorkerStats;
+
+/// The context still has to be closed by the caller, after the worker stopped
+MessagesWorker *messages_worker_start(MessagesContext *ctx);
+/// Finishes the job that is running, completes the queued ones without
+/// running them, then joins the thread
+void messages_worker_stop(MessagesWorker *worker);
+
+/// Returns false if the job was not taken, its `complete` is not called then
+bool messages_worker_submit(MessagesWorker *worker, const MessagesJob *job);
+/// Blocks until everything queued at or above `priority` when called has
+/// completed. Not from the worker thread.
+void messages_worker_drain(MessagesWorker *worker, MessagesJobPriority priority);
+
+MessagesWorkerStats messages_worker_stats(MessagesWorker *worker);
+
+#endif /* MessagesWorker_h */
@@ -0,0 +1,163 @@
+//
+//  RecentHandles.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "Int64Table.h"
+#include "RecentHandles.h"
+
+#define MAX_CAPACITY (1 << 20)
+
+struct RecentHandles {
+    /// heap[0] is the oldest handle kept, the one a newer handle pushes out
+    RecentHandle *heap;
+    int count;
+    int capacity;
+
+    /// handle_id -> where it sits in the heap, at least twice the capacity so
+    /// inserting never needs to grow it
+    Int64Table positions;
+
+    RecentHandle newest;
+};
+
+// MARK: - Heap
+
+/// Ties on date go by handle_id so the order never depends on arrival
+static inline bool older(RecentHandle a, RecentHandle b) {
+    return a.date < b.date || (a.date == b.date && a.handle_id < b.handle_id);
+}
+
+static void place(RecentHandles *recent, int index, RecentHandle entry) {
+    recent->heap[index] = entry;
+    int64_table_find(&recent->positions, entry.handle_id)->value = index;
+}
+
+static void sift_up(RecentHandles *recent, int index) {
+    RecentHandle entry = recent->heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!older(entry, recent->heap[parent])) break;
+        place(recent, index, recent->heap[parent]);
+        index = parent;
+    }
+    place(recent, index, entry);
+}
+
+static void sift_down(RecentHandles *recent, int index) {
+    RecentHandle entry = recent->heap[index];
+    for (;;) {
+        int child = index * 2 + 1;
+        if (child >= recent->count) break;
+        if (child + 1 < recent->count && older(recent->heap[child + 1], recent->heap[child])) child++;
+        if (!older(recent->heap[child], entry)) break;
+        place(recent, index, recent->heap[child]);
+        index = child;
+    }
+    place(recent, index, entry);
+}
+
+// MARK: - Recent Handles
+
+RecentHandles *recent_handles_create(int capacity) {
+    if (capacity <= 0 || capacity > MAX_CAPACITY) return NULL;
+
+    RecentHandles *recent = calloc(1, sizeof(RecentHandles));
+    if (!recent) return NULL;
+
+    recent->heap = malloc((size_t)capacity * sizeof(RecentHandle));
+    if (!recent->heap || !int64_table_init(&recent->positions, (size_t)capacity * 2)) {
+        recent_handles_destroy(recent);
+        return NULL;
+    }
+    recent->capacity = capacity;
+    return recent;
+}
+
+void recent_handles_destroy(RecentHandles *recent) {
+    if (!recent) return;
+    free(recent->heap);
+    int64_table_free(&recent->positions);
+    free(recent);
+}
+
+int recent_handles_capacity(const RecentHandles *recent) {
+    return recent ? recent->capacity : 0;
+}
+
+int recent_handles_count(const RecentHandles *recent) {
+    return recent ? recent->count : 0;
+}
+
+bool recent_handles_update(RecentHandles *recent, int64_t handle_id, int64_t date) {
+    if (!recent || handle_id == INT64_TABLE_EMPTY) return false;
+
+    RecentHandle entry = { .handle_id = handle_id, .date = date };
+    Int64TableSlot *slot = int64_table_find(&recent->positions, handle_id);
+    if (slot) {
+        /// Newer only ever moves it away from the root
+        int index = (int)slot->value;
+        if (date <= recent->heap[index].date) return false;
+        recent->heap[index].date = date;
+        sift_down(recent, index);
+    } else if (recent->count < recent->capacity) {
+        int index = recent->count++;
+        recent->heap[index] = entry;
+        int64_table_insert(&recent->positions, handle_id, NULL);
+        sift_up(recent, index);
+    } else {
+        if (!older(recent->heap[0], entry)) return false;
+        int64_table_remove(&recent->positions, int64_table_find(&recent->positions, recent->heap[0].handle_id));
+        recent->heap[0] = entry;
+        int64_table_insert(&recent->positions, handle_id, NULL);
+        sift_down(recent, 0);
+    }
+
+    /// The newest is never the one pushed out, unless it is replaced by a newer one
+    if (recent->count == 1 || older(recent->newest, entry)) recent->newest = entry;
+    return true;
+}
+
+bool recent_handles_get(const RecentHandles *recent, int64_t handle_id, int64_t *date) {
+    if (!recent) return false;
+
+    const Int64TableSlot *slot = int64_table_find(&recent->positions, handle_id);
+    if (!slot) return false;
+    if (date) *date = recent->heap[slot->value].date;
+    return true;
+}
+
+bool recent_handles_newest(const RecentHandles *recent, RecentHandle *out) {
+    if (!recent || !out || recent->count == 0) return false;
+    *out = recent->newest;
+    return true;
+}
+
+static int compare_newest_first(const void *a, const void *b) {
+    RecentHandle x = *(const RecentHandle *)a, y = *(const RecentHandle *)b;
+    return older(y, x) ? -1 : older(x, y);
+}
+
+int recent_handles_copy(const RecentHandles *recent, RecentHandle *out, int capacity) {
+    if (!recent || !out || capacity <= 0) return 0;
+
+    /// Sorted in `out` when it holds them all, only a short `out` needs a scratch copy
+    RecentHandle *sorted = out;
+    if (capacity < recent->count) {
+        sorted = malloc((size_t)recent->count * sizeof(RecentHandle));
+        if (!sorted) return 0;
+    }
+    memcpy(sorted, recent->heap, (size_t)recent->count * sizeof(RecentHandle));
+    qsort(sorted, (size_t)recent->count, sizeof(RecentHandle), compare_newest_first);
+
+    int count = recent->count < capacity ? recent->count : capacity;
+    if (sorted != out) {
+        memcpy(out, sorted, (size_t)count * sizeof(RecentHandle));
+        free(sorted);
+    }
+    return count;
+}
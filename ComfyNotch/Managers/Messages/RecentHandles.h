@@ -0,0 +1,51 @@
+//
+//  RecentHandles.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#ifndef RecentHandles_h
+#define RecentHandles_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// A handle and the date of its newest message
+typedef struct {
+    int64_t handle_id;
+    int64_t date;       // Apple's nanoseconds since 2001
+} RecentHandle;
+
+/// The K handles whose last message is the most recent. A min-heap of K
+/// entries on (date, handle_id) plus a handle -> heap slot table: a message
+/// for a handle that is already in moves it in O(log K), one for a handle that
+/// is not only costs a comparison with the oldest entry, which it replaces.
+///
+/// Dates only move forward, a handle that dropped out comes back with a newer
+/// message, but a deleted message never takes its date back.
+///
+/// Not thread-safe, a MessagesContext keeps one under its lock.
+typedef struct RecentHandles RecentHandles;
+
+/// Keeps `capacity` handles at most
+RecentHandles *recent_handles_create(int capacity);
+void recent_handles_destroy(RecentHandles *recent);
+
+int recent_handles_capacity(const RecentHandles *recent);
+int recent_handles_count(const RecentHandles *recent);
+
+/// `handle_id` has a message at `date`. Returns true if that changed the
+/// K: the handle came in, or its date moved.
+bool recent_handles_update(RecentHandles *recent, int64_t handle_id, int64_t date);
+
+/// False if `handle_id` is not one of the K, `date` may be NULL
+bool recent_handles_get(const RecentHandles *recent, int64_t handle_id, int64_t *date);
+
+/// The handle with the newest message, false while empty
+bool recent_handles_newest(const RecentHandles *recent, RecentHandle *out);
+
+/// The newest `capacity` of them, newest first, returns how many were written
+int recent_handles_copy(const RecentHandles *recent, RecentHandle *out, int capacity);
+
+#endif /* RecentHandles_h */
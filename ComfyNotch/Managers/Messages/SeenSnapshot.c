@@ -0,0 +1,326 @@
+//
+//  SeenSnapshot.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SeenSnapshot.h"
+#include "MessageHashMap.h"
+
+#define SNAPSHOT_MAGIC      "CNSEEN01"
+#define SNAPSHOT_VERSION    2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t db_identity;
+    int64_t watermark;
+    int64_t newest_date;
+    uint64_t capacity;      // slots, a power of two
+    uint64_t count;
+    uint64_t keys_size;
+    uint64_t checksum;      // of every field above
+} SnapshotHeader;
+
+/// `hash == 0` marks an empty slot, keys are offsets into the blob after the slots
+typedef struct {
+    uint64_t hash;
+    uint32_t key_offset;
+    uint32_t key_len;
+    int64_t date;
+    uint32_t is_from_me;
+    uint32_t reserved;
+} SnapshotSlot;
+
+struct SeenSnapshot {
+    void *map;
+    size_t map_size;
+    const SnapshotSlot *slots;
+    const char *keys;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t keys_size;
+    int64_t watermark;
+    int64_t newest_date;
+};
+
+struct SeenSnapshotWriter {
+    SnapshotSlot *slots;
+    uint64_t capacity;
+    uint64_t count;
+    char *keys;
+    size_t keys_size;
+    size_t keys_capacity;
+    int64_t newest_date;
+};
+
+static uint64_t header_checksum(const SnapshotHeader *header) {
+    /// FNV-1a, only guards against a torn or foreign file
+    const unsigned char *bytes = (const unsigned char *)header;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < offsetof(SnapshotHeader, checksum); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// MARK: - Reading
+
+SeenSnapshot *seen_snapshot_open(const char *path, uint64_t db_identity) {
+    if (!path) return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    SnapshotHeader header;
+    bool valid = fstat(fd, &st) == 0 &&
+                 (size_t)st.st_size >= sizeof(header) &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 memcmp(header.magic, SNAPSHOT_MAGIC, 8) == 0 &&
+                 header.version == SNAPSHOT_VERSION &&
+                 header.slot_size == sizeof(SnapshotSlot) &&
+                 header.checksum == header_checksum(&header) &&
+                 header.db_identity == db_identity &&
+                 header.capacity > 0 && (header.capacity & (header.capacity - 1)) == 0 &&
+                 header.count < header.capacity &&
+                 header.keys_size <= UINT32_MAX &&
+                 (uint64_t)st.st_size == sizeof(header) + header.capacity * sizeof(SnapshotSlot) + header.keys_size;
+    if (!valid) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    SeenSnapshot *snapshot = calloc(1, sizeof(SeenSnapshot));
+    if (!snapshot) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    snapshot->map = map;
+    snapshot->map_size = (size_t)st.st_size;
+    snapshot->slots = (const SnapshotSlot *)((const char *)map + sizeof(header));
+    snapshot->keys = (const char *)(snapshot->slots + header.capacity);
+    snapshot->capacity = header.capacity;
+    snapshot->count = header.count;
+    snapshot->keys_size = header.keys_size;
+    snapshot->watermark = header.watermark;
+    snapshot->newest_date = header.newest_date;
+    return snapshot;
+}
+
+void seen_snapshot_close(SeenSnapshot *snapshot) {
+    if (!snapshot) return;
+    munmap(snapshot->map, snapshot->map_size);
+    free(snapshot);
+}
+
+int64_t seen_snapshot_watermark(const SeenSnapshot *snapshot) {
+    return snapshot ? snapshot->watermark : 0;
+}
+
+size_t seen_snapshot_count(const SeenSnapshot *snapshot) {
+    return snapshot ? (size_t)snapshot->count : 0;
+}
+
+int64_t seen_snapshot_newest_date(const SeenSnapshot *snapshot) {
+    return snapshot ? snapshot->newest_date : 0;
+}
+
+/// Only the header is checked on open, so every slot is bounds checked as it
+/// is used. A damaged slot can make a GUID look new again, never the reverse.
+static bool slot_key(const SeenSnapshot *snapshot, const SnapshotSlot *slot,
+                     const char **key, size_t *length) {
+    if ((uint64_t)slot->key_offset + slot->key_len > snapshot->keys_size) return false;
+    *key = snapshot->keys + slot->key_offset;
+    *length = slot->key_len;
+    return true;
+}
+
+bool seen_snapshot_get(const SeenSnapshot *snapshot, const char *key, MessageMeta *out) {
+    if (!snapshot || !key) return false;
+
+    size_t len = strlen(key);
+    uint64_t hash = message_hashmap_hash(key, len);
+    uint64_t mask = snapshot->capacity - 1;
+    uint64_t index = hash & mask;
+
+    for (uint64_t probes = 0; probes < snapshot->capacity; probes++) {
+        const SnapshotSlot *slot = &snapshot->slots[index];
+        if (slot->hash == 0) return false;
+
+        const char *slot_key_bytes;
+        size_t slot_len;
+        if (slot->hash == hash && slot_key(snapshot, slot, &slot_key_bytes, &slot_len) &&
+            slot_len == len && memcmp(slot_key_bytes, key, len) == 0) {
+            if (out) *out = (MessageMeta){ .isFromMe = slot->is_from_me != 0, .date = slot->date };
+            return true;
+        }
+        index = (index + 1) & mask;
+    }
+    return false;
+}
+
+void seen_snapshot_each(const SeenSnapshot *snapshot, SeenSnapshotVisitor visit, void *userdata) {
+    if (!snapshot || !visit) return;
+
+    for (uint64_t i = 0; i < snapshot->capacity; i++) {
+        const SnapshotSlot *slot = &snapshot->slots[i];
+        const char *key;
+        size_t length;
+        if (slot->hash == 0 || !slot_key(snapshot, slot, &key, &length)) continue;
+        visit(key, length, (MessageMeta){ .isFromMe = slot->is_from_me != 0, .date = slot->date }, userdata);
+    }
+}
+
+// MARK: - Writing
+
+/// Kept at most half full, probe runs in the file stay short
+static uint64_t capacity_for(size_t count) {
+    uint64_t capacity = 16;
+    while (capacity < (uint64_t)count * 2) capacity <<= 1;
+    return capacity;
+}
+
+static SnapshotSlot *find_slot(SnapshotSlot *slots, uint64_t capacity, const char *keys,
+                               uint64_t hash, const char *key, size_t len) {
+    uint64_t mask = capacity - 1;
+    uint64_t index = hash & mask;
+    for (;;) {
+        SnapshotSlot *slot = &slots[index];
+        if (slot->hash == 0) return slot;
+        if (slot->hash == hash && slot->key_len == len &&
+            memcmp(keys + slot->key_offset, key, len) == 0) {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static bool grow(SeenSnapshotWriter *writer) {
+    uint64_t capacity = writer->capacity * 2;
+    SnapshotSlot *slots = calloc(capacity, sizeof(SnapshotSlot));
+    if (!slots) return false;
+
+    for (uint64_t i = 0; i < writer->capacity; i++) {
+        SnapshotSlot *old = &writer->slots[i];
+        if (old->hash == 0) continue;
+        *find_slot(slots, capacity, writer->keys, old->hash, writer->keys + old->key_offset, old->key_len) = *old;
+    }
+
+    free(writer->slots);
+    writer->slots = slots;
+    writer->capacity = capacity;
+    return true;
+}
+
+SeenSnapshotWriter *seen_snapshot_writer_create(size_t expected_count) {
+    SeenSnapshotWriter *writer = calloc(1, sizeof(SeenSnapshotWriter));
+    if (!writer) return NULL;
+
+    writer->capacity = capacity_for(expected_count);
+    writer->slots = calloc(writer->capacity, sizeof(SnapshotSlot));
+    /// GUIDs are 36 bytes, or 40 with a "p:0/" prefix
+    writer->keys_capacity = (expected_count ? expected_count : 16) * 40;
+    writer->keys = malloc(writer->keys_capacity);
+    writer->newest_date = INT64_MIN;
+    if (!writer->slots || !writer->keys) {
+        free(writer->slots);
+        free(writer->keys);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+bool seen_snapshot_writer_add(SeenSnapshotWriter *writer, const char *key, size_t length, MessageMeta value) {
+    if (!writer || !key) return false;
+    if ((writer->count + 1) * 2 > writer->capacity && !grow(writer)) return false;
+
+    uint64_t hash = message_hashmap_hash(key, length);
+    SnapshotSlot *slot = find_slot(writer->slots, writer->capacity, writer->keys, hash, key, length);
+    if (slot->hash != 0) return true;
+
+    if (writer->keys_size + length > UINT32_MAX) return false;
+    if (writer->keys_size + length > writer->keys_capacity) {
+        size_t capacity = writer->keys_capacity * 2 + length;
+        char *keys = realloc(writer->keys, capacity);
+        if (!keys) return false;
+        writer->keys = keys;
+        writer->keys_capacity = capacity;
+    }
+    memcpy(writer->keys + writer->keys_size, key, length);
+
+    *slot = (SnapshotSlot){
+        .hash = hash,
+        .key_offset = (uint32_t)writer->keys_size,
+        .key_len = (uint32_t)length,
+        .date = value.date,
+        .is_from_me = value.isFromMe,
+    };
+    writer->keys_size += length;
+    writer->count++;
+    if (value.date > writer->newest_date) writer->newest_date = value.date;
+    return true;
+}
+
+static void writer_free(SeenSnapshotWriter *writer) {
+    if (!writer) return;
+    free(writer->slots);
+    free(writer->keys);
+    free(writer);
+}
+
+bool seen_snapshot_writer_finish(SeenSnapshotWriter *writer, const char *path,
+                                 uint64_t db_identity, int64_t watermark) {
+    if (!writer || !path) {
+        writer_free(writer);
+        return false;
+    }
+
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        writer_free(writer);
+        return false;
+    }
+
+    SnapshotHeader header = { 0 };
+    memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.version = SNAPSHOT_VERSION;
+    header.slot_size = sizeof(SnapshotSlot);
+    header.db_identity = db_identity;
+    header.watermark = watermark;
+    header.newest_date = writer->count ? writer->newest_date : 0;
+    header.capacity = writer->capacity;
+    header.count = writer->count;
+    header.keys_size = writer->keys_size;
+    header.checksum = header_checksum(&header);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(writer->slots, sizeof(SnapshotSlot), writer->capacity, file) == writer->capacity &&
+              (writer->keys_size == 0 || fwrite(writer->keys, writer->keys_size, 1, file) == 1);
+    ok = fclose(file) == 0 && ok;
+    writer_free(writer);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
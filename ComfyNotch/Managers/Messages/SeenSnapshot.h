@@ -0,0 +1,52 @@
+//
+//  SeenSnapshot.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#ifndef SeenSnapshot_h
+#define SeenSnapshot_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "MessageMeta.h"
+
+/// The seen-GUID set and ROWID watermark as they were when the app last
+/// stopped, so the next launch carries on from there instead of starting
+/// blind. The file already is an open addressing table (same hash as
+/// MessageHashMap) plus a key blob, so opening it is a header check and an
+/// mmap no matter how many GUIDs it holds, and lookups probe the mapping.
+///
+/// Read only once open, safe to share between threads.
+typedef struct SeenSnapshot SeenSnapshot;
+
+/// Maps `path` if it is a snapshot of the database identified by
+/// `db_identity`. Returns NULL if it is missing, torn or for another file.
+SeenSnapshot *seen_snapshot_open(const char *path, uint64_t db_identity);
+void seen_snapshot_close(SeenSnapshot *snapshot);
+
+/// Highest message ROWID already handed out when the snapshot was written
+int64_t seen_snapshot_watermark(const SeenSnapshot *snapshot);
+size_t seen_snapshot_count(const SeenSnapshot *snapshot);
+/// Newest message date among its GUIDs, once that falls out of the seen
+/// window the whole snapshot can go
+int64_t seen_snapshot_newest_date(const SeenSnapshot *snapshot);
+
+bool seen_snapshot_get(const SeenSnapshot *snapshot, const char *key, MessageMeta *out);
+
+typedef void (*SeenSnapshotVisitor)(const char *key, size_t length, MessageMeta value, void *userdata);
+void seen_snapshot_each(const SeenSnapshot *snapshot, SeenSnapshotVisitor visit, void *userdata);
+
+/// Builds the table for a new snapshot in memory, then writes it out in one go
+typedef struct SeenSnapshotWriter SeenSnapshotWriter;
+
+SeenSnapshotWriter *seen_snapshot_writer_create(size_t expected_count);
+/// Keeps the first value added for a key
+bool seen_snapshot_writer_add(SeenSnapshotWriter *writer, const char *key, size_t length, MessageMeta value);
+/// Writes a temp file and renames it over `path`, then frees the writer either way
+bool seen_snapshot_writer_finish(SeenSnapshotWriter *writer, const char *path,
+                                 uint64_t db_identity, int64_t watermark);
+
+#endif /* SeenSnapshot_h */
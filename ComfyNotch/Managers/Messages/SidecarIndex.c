@@ -0,0 +1,262 @@
+//
+//  SidecarIndex.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/3/25.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SidecarIndex.h"
+
+#define SIDECAR_MAGIC       "CNSIDX01"
+#define SIDECAR_VERSION     1
+
+/// Rows kept in memory before the file is rewritten with them merged in
+#define SIDECAR_TAIL_MAX    1024
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t db_identity;
+    int64_t watermark;
+    uint64_t count;
+    uint64_t checksum;      // of every field above
+} SidecarHeader;
+
+struct SidecarIndex {
+    char *path;
+    uint64_t db_identity;
+
+    /// The file, NULL while it has no entries
+    void *map;
+    size_t map_size;
+    const SidecarIndexEntry *entries;
+    size_t count;
+
+    /// Newer rows not in the file yet, same order
+    SidecarIndexEntry tail[SIDECAR_TAIL_MAX];
+    size_t tail_count;
+
+    int64_t file_watermark;
+    int64_t watermark;
+};
+
+static uint64_t header_checksum(const SidecarHeader *header) {
+    /// FNV-1a, only guards against a torn or foreign file
+    const unsigned char *bytes = (const unsigned char *)header;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < offsetof(SidecarHeader, checksum); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int compare_entries(const SidecarIndexEntry *a, const SidecarIndexEntry *b) {
+    if (a->handle_id != b->handle_id) return a->handle_id < b->handle_id ? -1 : 1;
+    if (a->date != b->date) return a->date < b->date ? -1 : 1;
+    if (a->rowid != b->rowid) return a->rowid < b->rowid ? -1 : 1;
+    return 0;
+}
+
+static int compare_entries_qsort(const void *a, const void *b) {
+    return compare_entries(a, b);
+}
+
+/// First position whose entry is >= `key`
+static size_t lower_bound(const SidecarIndexEntry *entries, size_t count, const SidecarIndexEntry *key) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (compare_entries(&entries[mid], key) < 0) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+static void unmap(SidecarIndex *index) {
+    if (index->map) munmap(index->map, index->map_size);
+    index->map = NULL;
+    index->map_size = 0;
+    index->entries = NULL;
+    index->count = 0;
+}
+
+/// Maps the file at `index->path` if it is a valid index of our database
+static bool map_file(SidecarIndex *index) {
+    int fd = open(index->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    SidecarHeader header;
+    bool valid = fstat(fd, &st) == 0 &&
+                 (size_t)st.st_size >= sizeof(header) &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 memcmp(header.magic, SIDECAR_MAGIC, 8) == 0 &&
+                 header.version == SIDECAR_VERSION &&
+                 header.entry_size == sizeof(SidecarIndexEntry) &&
+                 header.checksum == header_checksum(&header) &&
+                 header.db_identity == index->db_identity &&
+                 (uint64_t)st.st_size == sizeof(header) + header.count * sizeof(SidecarIndexEntry);
+    if (!valid) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    unmap(index);
+    index->map = map;
+    index->map_size = (size_t)st.st_size;
+    index->entries = (const SidecarIndexEntry *)((const char *)map + sizeof(header));
+    index->count = header.count;
+    index->file_watermark = header.watermark;
+    index->watermark = header.watermark;
+    return true;
+}
+
+/// Writes `a` and `b` merged into a temp file and renames it over the index, so
+/// a reader never maps a half written file
+static bool write_merged(SidecarIndex *index,
+                         const SidecarIndexEntry *a, size_t a_count,
+                         const SidecarIndexEntry *b, size_t b_count,
+                         int64_t watermark) {
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index->path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) return false;
+
+    SidecarHeader header = { 0 };
+    memcpy(header.magic, SIDECAR_MAGIC, 8);
+    header.version = SIDECAR_VERSION;
+    header.entry_size = sizeof(SidecarIndexEntry);
+    header.db_identity = index->db_identity;
+    header.watermark = watermark;
+    header.count = a_count + b_count;
+    header.checksum = header_checksum(&header);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    size_t i = 0, j = 0;
+    while (ok && (i < a_count || j < b_count)) {
+        const SidecarIndexEntry *next =
+            j >= b_count || (i < a_count && compare_entries(&a[i], &b[j]) <= 0) ? &a[i++] : &b[j++];
+        ok = fwrite(next, sizeof(*next), 1, file) == 1;
+    }
+
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp_path, index->path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    return map_file(index);
+}
+
+SidecarIndex *sidecar_index_open(const char *path, uint64_t db_identity) {
+    if (!path) return NULL;
+
+    SidecarIndex *index = calloc(1, sizeof(SidecarIndex));
+    if (!index) return NULL;
+
+    index->path = strdup(path);
+    if (!index->path) {
+        free(index);
+        return NULL;
+    }
+    index->db_identity = db_identity;
+
+    /// A missing or stale file just means an empty index that needs building
+    map_file(index);
+    return index;
+}
+
+void sidecar_index_close(SidecarIndex *index) {
+    if (!index) return;
+
+    sidecar_index_flush(index);
+    unmap(index);
+    free(index->path);
+    free(index);
+}
+
+int64_t sidecar_index_watermark(SidecarIndex *index) {
+    return index ? index->watermark : 0;
+}
+
+size_t sidecar_index_count(SidecarIndex *index) {
+    return index ? index->count + index->tail_count : 0;
+}
+
+bool sidecar_index_rebuild(SidecarIndex *index, SidecarIndexEntry *entries, size_t count,
+                           int64_t watermark) {
+    if (!index || (count > 0 && !entries)) return false;
+
+    qsort(entries, count, sizeof(SidecarIndexEntry), compare_entries_qsort);
+
+    index->tail_count = 0;
+    unmap(index);
+    index->file_watermark = index->watermark = 0;
+    return write_merged(index, entries, count, NULL, 0, watermark);
+}
+
+bool sidecar_index_flush(SidecarIndex *index) {
+    if (!index) return false;
+    if (index->tail_count == 0 && index->watermark == index->file_watermark) return true;
+
+    if (!write_merged(index, index->entries, index->count, index->tail, index->tail_count,
+                      index->watermark)) {
+        return false;
+    }
+    index->tail_count = 0;
+    return true;
+}
+
+bool sidecar_index_add(SidecarIndex *index, const SidecarIndexEntry *entry) {
+    if (!index || !entry) return false;
+    if (entry->rowid <= index->watermark) return true;
+
+    if (index->tail_count == SIDECAR_TAIL_MAX && !sidecar_index_flush(index)) return false;
+
+    /// Rows mostly arrive with the newest date of their handle, so this is a short move
+    size_t at = lower_bound(index->tail, index->tail_count, entry);
+    memmove(&index->tail[at + 1], &index->tail[at], (index->tail_count - at) * sizeof(SidecarIndexEntry));
+    index->tail[at] = *entry;
+    index->tail_count++;
+    index->watermark = entry->rowid;
+    return true;
+}
+
+/// The entry of `key.handle_id` right before `key` in one sorted run
+static const SidecarIndexEntry *before_in(const SidecarIndexEntry *entries, size_t count,
+                                          const SidecarIndexEntry *key) {
+    size_t at = lower_bound(entries, count, key);
+    if (at == 0 || entries[at - 1].handle_id != key->handle_id) return NULL;
+    return &entries[at - 1];
+}
+
+bool sidecar_index_before(SidecarIndex *index, int64_t handle_id, int64_t date, int64_t rowid,
+                          SidecarIndexEntry *out) {
+    if (!index || !out) return false;
+
+    SidecarIndexEntry key = { .handle_id = handle_id, .date = date, .rowid = rowid };
+    const SidecarIndexEntry *file = before_in(index->entries, index->count, &key);
+    const SidecarIndexEntry *tail = before_in(index->tail, index->tail_count, &key);
+
+    const SidecarIndexEntry *best = file;
+    if (tail && (!best || compare_entries(tail, best) > 0)) best = tail;
+    if (!best) return false;
+
+    *out = *best;
+    return true;
+}
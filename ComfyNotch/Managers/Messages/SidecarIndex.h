@@ -0,0 +1,57 @@
+//
+//  SidecarIndex.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/3/25.
+//
+
+#ifndef SidecarIndex_h
+#define SidecarIndex_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// chat.db is read only to us, so the (handle_id, date) index every "latest
+/// message" lookup needs lives in our own cache folder instead: a file of
+/// entries sorted by (handle_id, date, rowid), memory mapped, plus a small
+/// sorted in-memory tail of newer rows that gets merged into the file when it
+/// fills up. Lookups are a binary search in each, whatever Apple's schema has.
+///
+/// Not thread-safe, the MessagesContext that owns one only touches it locked.
+typedef struct {
+    int64_t handle_id;
+    int64_t date;
+    int64_t rowid;
+} SidecarIndexEntry;
+
+typedef struct SidecarIndex SidecarIndex;
+
+/// Maps `path` if it holds an index of the database identified by
+/// `db_identity`, otherwise starts empty (watermark 0) and the caller builds it.
+SidecarIndex *sidecar_index_open(const char *path, uint64_t db_identity);
+
+/// Merges anything pending into the file and unmaps it
+void sidecar_index_close(SidecarIndex *index);
+
+/// Highest message ROWID the index has seen
+int64_t sidecar_index_watermark(SidecarIndex *index);
+size_t sidecar_index_count(SidecarIndex *index);
+
+/// Replaces the whole index with `entries` (sorted here, in place) and writes it out
+bool sidecar_index_rebuild(SidecarIndex *index, SidecarIndexEntry *entries, size_t count,
+                           int64_t watermark);
+
+/// Adds a row newer than the watermark, anything older is already in and ignored.
+/// The file is rewritten once the in-memory tail fills up.
+bool sidecar_index_add(SidecarIndex *index, const SidecarIndexEntry *entry);
+
+/// Writes the in-memory tail into the file now
+bool sidecar_index_flush(SidecarIndex *index);
+
+/// The newest entry of `handle_id` strictly before (date, rowid).
+/// Pass INT64_MAX for both to get the newest entry of the handle.
+bool sidecar_index_before(SidecarIndex *index, int64_t handle_id, int64_t date, int64_t rowid,
+                          SidecarIndexEntry *out);
+
+#endif /* SidecarIndex_h */
@@ -0,0 +1,149 @@
+//
+//  UnreadCounters.c
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#include <stdlib.h>
+#include "Int64Table.h"
+#include "UnreadCounters.h"
+
+struct UnreadCounters {
+    /// ROWID -> handle_id, `stamp` is the sweep that last added it
+    Int64Table messages;
+    /// handle_id -> unread, only handles above 0
+    Int64Table handles;
+    uint32_t sweep;
+    UnreadCountersObserver observer;
+    void *observer_userdata;
+};
+
+// MARK: - Counters
+
+UnreadCounters *unread_counters_create(void) {
+    UnreadCounters *counters = calloc(1, sizeof(UnreadCounters));
+    if (!counters) return NULL;
+
+    if (!int64_table_init(&counters->messages, 64) || !int64_table_init(&counters->handles, 16)) {
+        int64_table_free(&counters->messages);
+        free(counters);
+        return NULL;
+    }
+    return counters;
+}
+
+void unread_counters_destroy(UnreadCounters *counters) {
+    if (!counters) return;
+    int64_table_free(&counters->messages);
+    int64_table_free(&counters->handles);
+    free(counters);
+}
+
+static bool increment_handle(UnreadCounters *counters, int64_t handle_id) {
+    Int64TableSlot *slot = int64_table_insert(&counters->handles, handle_id, NULL);
+    if (!slot) return false;
+    slot->value++;
+    return true;
+}
+
+/// Only looks the handle up, an insert may grow the table first and fail.
+/// Every counted message keeps its handle above 0, so it is always there.
+static void decrement_handle(UnreadCounters *counters, int64_t handle_id) {
+    Int64TableSlot *slot = int64_table_find(&counters->handles, handle_id);
+    if (slot && --slot->value <= 0) int64_table_remove(&counters->handles, slot);
+}
+
+static void notify(const UnreadCounters *counters, int64_t rowid, int64_t handle_id, bool unread) {
+    if (!counters->observer) return;
+    counters->observer(rowid, handle_id, unread, unread_counters_get(counters, handle_id),
+                       counters->observer_userdata);
+}
+
+bool unread_counters_add(UnreadCounters *counters, int64_t rowid, int64_t handle_id) {
+    if (!counters || rowid == INT64_TABLE_EMPTY || handle_id == INT64_TABLE_EMPTY) return false;
+
+    bool inserted;
+    Int64TableSlot *slot = int64_table_insert(&counters->messages, rowid, &inserted);
+    if (!slot) return false;
+    slot->stamp = counters->sweep;
+    if (!inserted) return true;
+    slot->value = handle_id;
+
+    if (!increment_handle(counters, handle_id)) {
+        int64_table_remove(&counters->messages, slot);
+        return false;
+    }
+    notify(counters, rowid, handle_id, true);
+    return true;
+}
+
+bool unread_counters_remove(UnreadCounters *counters, int64_t rowid) {
+    if (!counters) return false;
+
+    Int64TableSlot *slot = int64_table_find(&counters->messages, rowid);
+    if (!slot) return false;
+
+    int64_t handle_id = slot->value;
+    decrement_handle(counters, handle_id);
+    int64_table_remove(&counters->messages, slot);
+    notify(counters, rowid, handle_id, false);
+    return true;
+}
+
+int64_t unread_counters_get(const UnreadCounters *counters, int64_t handle_id) {
+    if (!counters) return 0;
+    Int64TableSlot *slot = int64_table_find(&counters->handles, handle_id);
+    return slot ? slot->value : 0;
+}
+
+size_t unread_counters_total(const UnreadCounters *counters) {
+    return counters ? counters->messages.count : 0;
+}
+
+size_t unread_counters_handles(const UnreadCounters *counters) {
+    return counters ? counters->handles.count : 0;
+}
+
+void unread_counters_each(const UnreadCounters *counters, UnreadCountersVisitor visit, void *userdata) {
+    if (!counters || !visit) return;
+
+    for (size_t i = 0; i < counters->handles.capacity; i++) {
+        const Int64TableSlot *slot = &counters->handles.slots[i];
+        if (slot->key != INT64_TABLE_EMPTY) visit(slot->key, slot->value, userdata);
+    }
+}
+
+void unread_counters_observe(UnreadCounters *counters, UnreadCountersObserver observer, void *userdata) {
+    if (!counters) return;
+    counters->observer = observer;
+    counters->observer_userdata = userdata;
+}
+
+// MARK: - Sweeps
+
+void unread_counters_begin_sweep(UnreadCounters *counters) {
+    if (counters) counters->sweep++;
+}
+
+size_t unread_counters_end_sweep(UnreadCounters *counters) {
+    if (!counters) return 0;
+
+    /// Removing shifts later slots back, so a slot is only passed once it holds
+    /// a message this sweep did see
+    size_t removed = 0;
+    Int64Table *messages = &counters->messages;
+    for (size_t i = 0; i < messages->capacity; ) {
+        Int64TableSlot *slot = &messages->slots[i];
+        if (slot->key != INT64_TABLE_EMPTY && slot->stamp != counters->sweep) {
+            int64_t rowid = slot->key, handle_id = slot->value;
+            decrement_handle(counters, handle_id);
+            int64_table_remove(messages, slot);
+            notify(counters, rowid, handle_id, false);
+            removed++;
+            continue;
+        }
+        i++;
+    }
+    return removed;
+}
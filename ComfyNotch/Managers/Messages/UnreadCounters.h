@@ -0,0 +1,53 @@
+//
+//  UnreadCounters.h
+//  ComfyNotch
+//
+//  Created by Aryan Rogye on 8/6/25.
+//
+
+#ifndef UnreadCounters_h
+#define UnreadCounters_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Unread received messages per handle, plus which ROWIDs make up each count
+/// so a message being read (or deleted) takes exactly itself off. Reading a
+/// count is a hash lookup, reading all of them is a walk over the handles.
+///
+/// Not thread-safe, a MessagesContext keeps one under its lock.
+typedef struct UnreadCounters UnreadCounters;
+
+UnreadCounters *unread_counters_create(void);
+void unread_counters_destroy(UnreadCounters *counters);
+
+/// Counts `rowid` against `handle_id`, a ROWID that is already counted stays
+/// where it is. Also marks it as still unread in a running sweep.
+bool unread_counters_add(UnreadCounters *counters, int64_t rowid, int64_t handle_id);
+/// Takes `rowid` off its handle, false if it was not counted
+bool unread_counters_remove(UnreadCounters *counters, int64_t rowid);
+
+int64_t unread_counters_get(const UnreadCounters *counters, int64_t handle_id);
+/// Unread messages over all handles
+size_t unread_counters_total(const UnreadCounters *counters);
+/// Handles with at least one unread message
+size_t unread_counters_handles(const UnreadCounters *counters);
+
+typedef void (*UnreadCountersVisitor)(int64_t handle_id, int64_t unread, void *userdata);
+/// Every handle with unread messages, in no particular order
+void unread_counters_each(const UnreadCounters *counters, UnreadCountersVisitor visit, void *userdata);
+
+/// Called for every ROWID that starts or stops counting, however it happened,
+/// with its handle's count after the change. NULL stops calling.
+typedef void (*UnreadCountersObserver)(int64_t rowid, int64_t handle_id, bool unread,
+                                       int64_t handle_unread, void *userdata);
+void unread_counters_observe(UnreadCounters *counters, UnreadCountersObserver observer, void *userdata);
+
+/// A sweep re-reads what is unread right now: `unread_counters_add` every
+/// unread ROWID between begin and end, then end takes off everything that was
+/// not added again and returns how many that was.
+void unread_counters_begin_sweep(UnreadCounters *counters);
+size_t unread_counters_end_sweep(UnreadCounters *counters);
+
+#endif /* UnreadCounters_h */
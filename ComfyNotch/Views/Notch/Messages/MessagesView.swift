@@ -179,6 +179,12 @@ struct MessagesView: View {
                         } // HStack
                         .id(message.id)
                         .scaleEffect(y: -1)
+                        .onAppear {
+                            /// Reached the oldest loaded message, page in the ones before it
+                            if message.id == messagesManager.currentUserMessages.last?.id {
+                                messagesManager.fetchOlderMessages()
+                            }
+                        }
                     } /// ForEach
                 } /// VSTack
                 .padding()
@@ -256,6 +262,15 @@ struct MessagesView: View {
             Text(formatDate(handle.lastTalkedTo))
                 .font(.caption)
                 .foregroundStyle(.secondary)
+            /// Unread Badge
+            if handle.unreadCount > 0 {
+                Text("\(handle.unreadCount)")
+                    .font(.caption2.bold())
+                    .foregroundColor(.white)
+                    .padding(.horizontal, 6)
+                    .padding(.vertical, 1)
+                    .background(Capsule().fill(Color.blue))
+            }
         }
     }
     
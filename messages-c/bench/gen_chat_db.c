@@ -0,0 +1,55 @@
+//
+//  gen_chat_db.c
+//  ComfyNotch
+//
+//  Writes a synthetic chat.db to poke at by hand or point the app at.
+//
+//  Usage: gen_chat_db OUT.db [--handles N] [--per-handle N]
+//                            [--attributed FRACTION] [--attachments FRACTION] [--seed N]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "synthetic_chat_db.h"
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: gen_chat_db OUT.db [--handles N] [--per-handle N]\n"
+            "                          [--attributed FRACTION] [--attachments FRACTION] [--seed N]\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return 2;
+    }
+
+    SyntheticChatDBConfig config = synthetic_chat_db_defaults();
+    for (int i = 2; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[i], "--handles") == 0) config.handles = atoi(value);
+        else if (strcmp(argv[i], "--per-handle") == 0) config.messages_per_handle = atoi(value);
+        else if (strcmp(argv[i], "--attributed") == 0) config.attributed_fraction = atof(value);
+        else if (strcmp(argv[i], "--attachments") == 0) config.attachment_fraction = atof(value);
+        else if (strcmp(argv[i], "--seed") == 0) config.seed = strtoull(value, NULL, 10);
+        else {
+            usage();
+            return 2;
+        }
+        i++;
+    }
+
+    sqlite3 *db = synthetic_chat_db_generate(argv[1], &config);
+    if (!db) return 1;
+    sqlite3_close(db);
+
+    printf("%s: %d handles x %d messages, %.0f%% attributedBody only, %.0f%% with attachments\n",
+           argv[1], config.handles, config.messages_per_handle,
+           config.attributed_fraction * 100, config.attachment_fraction * 100);
+    return 0;
+}
@@ -0,0 +1,133 @@
+//
+//  hashmap_bench.c
+//  ComfyNotch
+//
+//  Compares the open addressing MessageHashMap against the original chained
+//  table at 10k, 100k and 1M GUIDs.
+//
+//  Usage: hashmap_bench [max_entries]
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "MessageHashMap.h"
+#include "legacy_hashmap.h"
+
+#define GUID_LEN 37
+#define LOOKUP_SAMPLE 200000
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/// Fills `out` with `count` upper case UUID strings like chat.db guids
+static void make_guids(char (*out)[GUID_LEN], size_t count, uint64_t seed) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < count; i++) {
+        uint64_t hi = splitmix64(&seed), lo = splitmix64(&seed);
+        char *g = out[i];
+        int pos = 0;
+        for (int nibble = 0; nibble < 32; nibble++) {
+            if (nibble == 8 || nibble == 12 || nibble == 16 || nibble == 20) g[pos++] = '-';
+            uint64_t word = nibble < 16 ? hi : lo;
+            g[pos++] = hex[(word >> ((nibble % 16) * 4)) & 0xF];
+        }
+        g[pos] = '\0';
+    }
+}
+
+typedef struct {
+    double insert_ns;
+    double hit_ns;
+    double miss_ns;
+} BenchResult;
+
+static BenchResult bench_new(char (*keys)[GUID_LEN], char (*misses)[GUID_LEN], size_t n, size_t sample) {
+    BenchResult r;
+    MessageHashMap map;
+    message_hashmap_init(&map, HASHMAP_SIZE);
+    
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        MessageMeta meta = { .isFromMe = i & 1, .date = (int64_t)i };
+        message_hashmap_put(&map, keys[i], meta);
+    }
+    r.insert_ns = (double)(now_ns() - start) / n;
+    
+    size_t found = 0;
+    start = now_ns();
+    for (size_t i = 0; i < sample; i++) found += message_hashmap_get(&map, keys[(i * 7919) % n]) != NULL;
+    r.hit_ns = (double)(now_ns() - start) / sample;
+    
+    start = now_ns();
+    for (size_t i = 0; i < sample; i++) found += message_hashmap_get(&map, misses[i]) != NULL;
+    r.miss_ns = (double)(now_ns() - start) / sample;
+    
+    if (found != sample) fprintf(stderr, "new map returned %zu hits, expected %zu\n", found, sample);
+    message_hashmap_free(&map);
+    return r;
+}
+
+static BenchResult bench_legacy(char (*keys)[GUID_LEN], char (*misses)[GUID_LEN], size_t n, size_t sample) {
+    BenchResult r;
+    
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        MessageMeta meta = { .isFromMe = i & 1, .date = (int64_t)i };
+        legacy_hashmap_put(keys[i], meta);
+    }
+    r.insert_ns = (double)(now_ns() - start) / n;
+    
+    size_t found = 0;
+    start = now_ns();
+    for (size_t i = 0; i < sample; i++) found += legacy_hashmap_get(keys[(i * 7919) % n]) != NULL;
+    r.hit_ns = (double)(now_ns() - start) / sample;
+    
+    start = now_ns();
+    for (size_t i = 0; i < sample; i++) found += legacy_hashmap_get(misses[i]) != NULL;
+    r.miss_ns = (double)(now_ns() - start) / sample;
+    
+    if (found != sample) fprintf(stderr, "legacy map returned %zu hits, expected %zu\n", found, sample);
+    legacy_hashmap_free();
+    return r;
+}
+
+int main(int argc, char **argv) {
+    size_t max_entries = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    const size_t sizes[] = { 10000, 100000, 1000000 };
+    
+    char (*keys)[GUID_LEN] = malloc(max_entries * GUID_LEN);
+    char (*misses)[GUID_LEN] = malloc(LOOKUP_SAMPLE * GUID_LEN);
+    if (!keys || !misses) return 1;
+    
+    make_guids(keys, max_entries, 1);
+    make_guids(misses, LOOKUP_SAMPLE, 2);
+    
+    printf("%-10s %-8s %12s %12s %12s\n", "entries", "map", "insert ns", "hit ns", "miss ns");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        if (n > max_entries) break;
+        size_t sample = n < LOOKUP_SAMPLE ? n : LOOKUP_SAMPLE;
+        
+        BenchResult legacy = bench_legacy(keys, misses, n, sample);
+        BenchResult fresh = bench_new(keys, misses, n, sample);
+        
+        printf("%-10zu %-8s %12.1f %12.1f %12.1f\n", n, "legacy", legacy.insert_ns, legacy.hit_ns, legacy.miss_ns);
+        printf("%-10zu %-8s %12.1f %12.1f %12.1f\n", n, "open", fresh.insert_ns, fresh.hit_ns, fresh.miss_ns);
+    }
+    
+    free(keys);
+    free(misses);
+    return 0;
+}
@@ -0,0 +1,637 @@
+//
+//  latency_replay.c
+//  ComfyNotch
+//
+//  End to end detection latency: replays a message arrival trace into a
+//  scratch chat.db, one WAL commit per write like Messages does, while a
+//  detection strategy (the chat.db watcher on either backend, or a plain
+//  timer) drives the real poll path: a MessagesWorker job running
+//  has_chat_db_changed and draining the context's event ring. Every strategy
+//  gets the same trace and the same starting database.
+//
+//  Per strategy it reports the commit -> detection latency distribution,
+//  messages never detected, and false positives (rows reported twice, rows
+//  that are not in the trace, or a received count the events do not back up).
+//  Exits 1 if any strategy missed a message or reported a false positive, or
+//  with --budget, if a p99 went over it. A watcher strategy also fails if it
+//  asked for more polls than the trace has commits to explain.
+//
+//  Traces are text, one write per line, times in ms from the start:
+//
+//      # ms      op        handle  rows
+//      0         received  3       1
+//      12.5      received  3       4       <- one commit of 4 rows
+//      300       sent      1       1
+//      450       read      3       0       <- marks handle 3 read
+//      460       edit      0       0       <- rewrites the newest row
+//      900       checkpoint 0      0
+//
+//  Usage: latency_replay [--quick] [--messages N] [--gap MS] [--seed N]
+//                        [--speed X] [--trace FILE] [--record FILE]
+//                        [--only NAME] [--budget MS]
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ChatDBWatcher.h"
+#include "Messages.h"
+#include "MessagesWorker.h"
+#include "synthetic_chat_db.h"
+#include "test_chat_db.h"
+
+#define REPLAY_HANDLES      40
+#define REPLAY_HISTORY      20      // messages per handle already in the database
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= deadline_ns) return;
+        uint64_t wait = deadline_ns - now;
+        struct timespec ts = { .tv_sec = (time_t)(wait / 1000000000ull), .tv_nsec = (long)(wait % 1000000000ull) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static double random_unit(uint64_t *state) {
+    return (double)(splitmix64(state) >> 11) / (double)(1ull << 53);
+}
+
+// MARK: - Traces
+
+typedef enum {
+    TRACE_RECEIVED,
+    TRACE_SENT,
+    TRACE_READ,
+    TRACE_EDIT,
+    TRACE_CHECKPOINT,
+    TRACE_OP_COUNT
+} TraceOpKind;
+
+static const char *trace_op_names[TRACE_OP_COUNT] = {
+    [TRACE_RECEIVED] = "received",
+    [TRACE_SENT] = "sent",
+    [TRACE_READ] = "read",
+    [TRACE_EDIT] = "edit",
+    [TRACE_CHECKPOINT] = "checkpoint",
+};
+
+typedef struct {
+    uint64_t offset_us;
+    TraceOpKind kind;
+    int64_t handle_id;
+    int rows;               // messages written in this one commit
+} TraceOp;
+
+typedef struct {
+    TraceOp *ops;
+    size_t count;
+    size_t capacity;
+    size_t messages;
+} Trace;
+
+static void trace_add(Trace *trace, TraceOp op) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 256;
+        trace->ops = realloc(trace->ops, trace->capacity * sizeof(TraceOp));
+        if (!trace->ops) {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+    trace->ops[trace->count++] = op;
+    if (op.kind == TRACE_RECEIVED || op.kind == TRACE_SENT) trace->messages += (size_t)op.rows;
+}
+
+/// Conversations the way they arrive: quiet gaps, bursts of replies a few ms
+/// apart (each its own commit), the odd commit of several rows at once, and
+/// writes that are not new messages: reads, edits, WAL checkpoints.
+static Trace trace_generate(size_t messages, double mean_gap_ms, uint64_t seed) {
+    Trace trace = { 0 };
+    uint64_t rng = seed;
+    double t_ms = 0;
+
+    while (trace.messages < messages) {
+        t_ms += -log(1.0 - random_unit(&rng)) * mean_gap_ms;
+        int64_t handle = 1 + (int64_t)(splitmix64(&rng) % REPLAY_HANDLES);
+        double roll = random_unit(&rng);
+
+        if (roll < 0.08) {
+            trace_add(&trace, (TraceOp){ (uint64_t)(t_ms * 1000), TRACE_READ, handle, 0 });
+        } else if (roll < 0.12) {
+            trace_add(&trace, (TraceOp){ (uint64_t)(t_ms * 1000), TRACE_EDIT, 0, 0 });
+        } else if (roll < 0.14) {
+            trace_add(&trace, (TraceOp){ (uint64_t)(t_ms * 1000), TRACE_CHECKPOINT, 0, 0 });
+        } else if (roll < 0.29) {
+            /// A burst from one person
+            int burst = 2 + (int)(random_unit(&rng) * 5);
+            for (int i = 0; i < burst && trace.messages < messages; i++) {
+                trace_add(&trace, (TraceOp){ (uint64_t)(t_ms * 1000), TRACE_RECEIVED, handle, 1 });
+                t_ms += 5 + random_unit(&rng) * 35;
+            }
+        } else {
+            TraceOpKind kind = random_unit(&rng) < 0.25 ? TRACE_SENT : TRACE_RECEIVED;
+            int rows = random_unit(&rng) < 0.05 ? 2 + (int)(random_unit(&rng) * 3) : 1;
+            if ((size_t)rows > messages - trace.messages) rows = (int)(messages - trace.messages);
+            trace_add(&trace, (TraceOp){ (uint64_t)(t_ms * 1000), kind, handle, rows });
+        }
+    }
+    return trace;
+}
+
+static bool trace_load(const char *path, Trace *trace) {
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+
+    memset(trace, 0, sizeof(*trace));
+    char line[256], op[32];
+    int number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        number++;
+        char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0') continue;
+
+        double ms;
+        long long handle;
+        int rows;
+        if (sscanf(start, "%lf %31s %lld %d", &ms, op, &handle, &rows) != 4 || ms < 0) {
+            fprintf(stderr, "%s:%d: expected \"ms op handle rows\"\n", path, number);
+            fclose(file);
+            return false;
+        }
+        int kind = 0;
+        while (kind < TRACE_OP_COUNT && strcmp(op, trace_op_names[kind]) != 0) kind++;
+        if (kind == TRACE_OP_COUNT ||
+            ((kind == TRACE_RECEIVED || kind == TRACE_SENT) && (rows < 1 || handle < 1 || handle > REPLAY_HANDLES))) {
+            fprintf(stderr, "%s:%d: bad op \"%s\"\n", path, number, op);
+            fclose(file);
+            return false;
+        }
+        trace_add(trace, (TraceOp){ (uint64_t)(ms * 1000), (TraceOpKind)kind, handle, rows });
+    }
+    fclose(file);
+    return trace->messages > 0;
+}
+
+static bool trace_save(const char *path, const Trace *trace) {
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+
+    fprintf(file, "# ms op handle rows\n");
+    for (size_t i = 0; i < trace->count; i++) {
+        const TraceOp *op = &trace->ops[i];
+        fprintf(file, "%.3f %s %lld %d\n", op->offset_us / 1000.0, trace_op_names[op->kind],
+                (long long)op->handle_id, op->rows);
+    }
+    return fclose(file) == 0;
+}
+
+// MARK: - Replay
+
+typedef struct {
+    const char *name;
+    /// The watcher backend, NULL polls on a timer every `interval_ms`
+    const ChatDBWatcherBackend *(*backend)(void);
+    int interval_ms;
+} Strategy;
+
+typedef struct {
+    const Trace *trace;
+    int64_t first_rowid;            // the trace's messages are the ROWIDs after this
+    uint64_t *landed_ns;            // per trace message, once its COMMIT returned
+    _Atomic uint64_t *detected_ns;  // per trace message, first time it was reported
+
+    MessagesContext *ctx;
+    MessagesEventRing *ring;
+    MessagesWorker *worker;
+
+    /// Timer strategy
+    pthread_t timer;
+    pthread_mutex_t lock;
+    pthread_cond_t stop;
+    bool stopping;
+    int interval_ms;
+
+    /// Polls asked for, by the watcher or the timer thread
+    _Atomic uint64_t requests;
+
+    /// Only written by the worker
+    uint64_t runs;
+    uint64_t unknown;               // NEW_MESSAGE for a row that is not in the trace
+    uint64_t duplicates;            // the same row reported twice
+    uint64_t overflows;
+    int64_t received_reported;      // what has_chat_db_changed returned
+    int64_t received_events;        // received NEW_MESSAGEs behind it
+} Replay;
+
+/// The poll the app runs on its worker, events drained right after
+static void run_detection(MessagesContext *ctx, void *userdata) {
+    Replay *replay = userdata;
+    int received = has_chat_db_changed(ctx);
+    uint64_t now = now_ns();
+
+    MessagesEvent events[64];
+    int count;
+    while ((count = messages_event_ring_drain(replay->ring, events, 64)) > 0) {
+        for (int i = 0; i < count; i++) {
+            if (events[i].kind == MESSAGES_EVENT_OVERFLOW) replay->overflows++;
+            if (events[i].kind != MESSAGES_EVENT_NEW_MESSAGE) continue;
+
+            if (!events[i].is_from_me) replay->received_events++;
+            int64_t index = events[i].rowid - replay->first_rowid - 1;
+            if (index < 0 || (size_t)index >= replay->trace->messages) {
+                replay->unknown++;
+                continue;
+            }
+            uint64_t expected = 0;
+            if (!atomic_compare_exchange_strong(&replay->detected_ns[index], &expected, now)) {
+                replay->duplicates++;
+            }
+        }
+    }
+    replay->received_reported += received;
+    replay->runs++;
+}
+
+/// Polls that pile up while one runs merge, like the app's .poll jobs
+static void request_detection(void *userdata) {
+    Replay *replay = userdata;
+    atomic_fetch_add(&replay->requests, 1);
+    MessagesJob job = {
+        .kind = 1,
+        .priority = MESSAGES_PRIORITY_NORMAL,
+        .run = run_detection,
+        .userdata = replay,
+    };
+    messages_worker_submit(replay->worker, &job);
+}
+
+static void *timer_main(void *arg) {
+    Replay *replay = arg;
+    pthread_mutex_lock(&replay->lock);
+    while (!replay->stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = (uint64_t)deadline.tv_nsec + (uint64_t)replay->interval_ms * 1000000ull;
+        deadline.tv_sec += (time_t)(ns / 1000000000ull);
+        deadline.tv_nsec = (long)(ns % 1000000000ull);
+        if (pthread_cond_timedwait(&replay->stop, &replay->lock, &deadline) != 0 && !replay->stopping) {
+            request_detection(replay);
+        }
+    }
+    pthread_mutex_unlock(&replay->lock);
+    return NULL;
+}
+
+static bool exec(sqlite3 *db, const char *sql) {
+    char *error = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &error) == SQLITE_OK) return true;
+    fprintf(stderr, "%s: %s\n", sql, error ? error : "?");
+    sqlite3_free(error);
+    return false;
+}
+
+/// One trace op, as its own transaction
+static bool apply_op(sqlite3 *db, sqlite3_stmt *insert, const TraceOp *op,
+                     Replay *replay, size_t *message, int64_t *date) {
+    char sql[160];
+    switch (op->kind) {
+    case TRACE_READ:
+        snprintf(sql, sizeof(sql),
+                 "UPDATE message SET is_read = 1, date_read = %lld "
+                 "WHERE handle_id = %lld AND is_read = 0 AND is_from_me = 0;",
+                 (long long)*date, (long long)op->handle_id);
+        return exec(db, sql);
+    case TRACE_EDIT:
+        return exec(db, "UPDATE message SET is_finished = 1 WHERE ROWID = (SELECT MAX(ROWID) FROM message);");
+    case TRACE_CHECKPOINT:
+        return exec(db, "PRAGMA wal_checkpoint(PASSIVE);");
+    case TRACE_RECEIVED:
+    case TRACE_SENT:
+        break;
+    default:
+        return false;
+    }
+
+    bool from_me = op->kind == TRACE_SENT;
+    if (op->rows > 1 && !exec(db, "BEGIN;")) return false;
+    for (int i = 0; i < op->rows; i++) {
+        char guid[48];
+        snprintf(guid, sizeof(guid), "REPLAY-%08zu", *message + (size_t)i);
+        *date += 1000000000LL;
+
+        sqlite3_reset(insert);
+        sqlite3_bind_text(insert, 1, guid, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(insert, 2, op->handle_id);
+        sqlite3_bind_int64(insert, 3, *date);
+        sqlite3_bind_int(insert, 4, from_me);
+        if (sqlite3_step(insert) != SQLITE_DONE) return false;
+        /// One writer and no deletes, so trace messages get consecutive ROWIDs
+        if (sqlite3_last_insert_rowid(db) != replay->first_rowid + (int64_t)(*message + (size_t)i) + 1) {
+            fprintf(stderr, "ROWIDs are not consecutive, is something else writing?\n");
+            return false;
+        }
+    }
+    if (op->rows > 1 && !exec(db, "COMMIT;")) return false;
+
+    uint64_t landed = now_ns();
+    for (int i = 0; i < op->rows; i++) replay->landed_ns[(*message)++] = landed;
+    return true;
+}
+
+/// Most times data_version can move during the replay: once per commit, and
+/// once more for the first write after a checkpoint, which restarts the WAL
+/// and so shows readers a new header a moment before it commits
+static uint64_t data_version_moves(const Trace *trace) {
+    uint64_t moves = 0;
+    bool checkpointed = false;
+    for (size_t i = 0; i < trace->count; i++) {
+        if (trace->ops[i].kind == TRACE_CHECKPOINT) {
+            checkpointed = true;
+            continue;
+        }
+        moves += checkpointed ? 2 : 1;
+        checkpointed = false;
+    }
+    return moves;
+}
+
+typedef struct {
+    size_t messages;
+    size_t detected;
+    size_t missed;
+    uint64_t false_positives;
+    double p50_ms, p90_ms, p99_ms, max_ms;
+    uint64_t runs, idle_runs, overflows;   // idle: polls asked for that no commit explains
+    uint64_t file_events;
+} ReplayResult;
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(const uint64_t *sorted, size_t count, size_t percent) {
+    if (count == 0) return 0;
+    size_t index = (count * percent) / 100;
+    return sorted[index < count ? index : count - 1] / 1e6;
+}
+
+static bool replay_strategy(const char *path, const Trace *trace, const Strategy *strategy,
+                            double speed, int grace_ms, ReplayResult *result) {
+    SyntheticChatDBConfig config = synthetic_chat_db_defaults();
+    config.handles = REPLAY_HANDLES;
+    config.messages_per_handle = REPLAY_HISTORY;
+    sqlite3 *writer = synthetic_chat_db_generate(path, &config);
+    if (!writer) return false;
+
+    Replay replay = { .trace = trace, .interval_ms = strategy->interval_ms };
+    replay.landed_ns = calloc(trace->messages, sizeof(uint64_t));
+    replay.detected_ns = calloc(trace->messages, sizeof(_Atomic uint64_t));
+    pthread_mutex_init(&replay.lock, NULL);
+    pthread_cond_init(&replay.stop, NULL);
+
+    sqlite3_stmt *insert = NULL;
+    int64_t date = 0;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(writer, "SELECT MAX(ROWID), MAX(date) FROM message;", -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        replay.first_rowid = sqlite3_column_int64(stmt, 0);
+        date = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_prepare_v2(writer,
+                       "INSERT INTO message (guid, text, handle_id, service, date, is_from_me, is_read, is_finished) "
+                       "VALUES (?1, 'replayed', ?2, 'iMessage', ?3, ?4, ?4, 0);",
+                       -1, &insert, NULL);
+
+    /// Seeded before anything is replayed, so only trace rows are new
+    replay.ctx = messages_context_open(path);
+    bool ok = insert && replay.landed_ns && replay.detected_ns && replay.ctx &&
+              messages_context_attach_events(replay.ctx, 4096);
+    if (ok) {
+        replay.ring = messages_context_events(replay.ctx);
+        has_chat_db_changed(replay.ctx);
+        replay.worker = messages_worker_start(replay.ctx);
+        ok = replay.worker != NULL;
+    }
+
+    ChatDBWatcher *watcher = NULL;
+    bool timer = false;
+    if (ok && strategy->backend) {
+        watcher = chatdb_watcher_start(path, strategy->backend(), request_detection, &replay);
+        ok = watcher != NULL;
+    } else if (ok) {
+        timer = ok = pthread_create(&replay.timer, NULL, timer_main, &replay) == 0;
+    }
+
+    size_t message = 0;
+    uint64_t start = now_ns();
+    for (size_t i = 0; ok && i < trace->count; i++) {
+        sleep_until(start + (uint64_t)(trace->ops[i].offset_us * 1000.0 / speed));
+        ok = apply_op(writer, insert, &trace->ops[i], &replay, &message, &date);
+    }
+    /// Long enough for the slowest strategy to come round once more
+    sleep_until(now_ns() + (uint64_t)grace_ms * 1000000ull);
+
+    if (watcher) {
+        result->file_events = chatdb_watcher_stats(watcher).file_events;
+        chatdb_watcher_stop(watcher);
+    }
+    if (timer) {
+        pthread_mutex_lock(&replay.lock);
+        replay.stopping = true;
+        pthread_cond_signal(&replay.stop);
+        pthread_mutex_unlock(&replay.lock);
+        pthread_join(replay.timer, NULL);
+    }
+    if (replay.worker) {
+        messages_worker_drain(replay.worker, MESSAGES_PRIORITY_BACKGROUND);
+        messages_worker_stop(replay.worker);
+    }
+
+    if (ok) {
+        uint64_t *latencies = malloc(trace->messages * sizeof(uint64_t));
+        size_t detected = 0;
+        for (size_t i = 0; latencies && i < trace->messages; i++) {
+            uint64_t at = atomic_load(&replay.detected_ns[i]);
+            if (!at) continue;
+            /// The poll can see a row a hair before the writer read its clock
+            latencies[detected++] = at > replay.landed_ns[i] ? at - replay.landed_ns[i] : 0;
+        }
+        if (latencies) qsort(latencies, detected, sizeof(uint64_t), compare_u64);
+
+        int64_t unbacked = replay.received_reported - replay.received_events;
+        uint64_t requests = atomic_load(&replay.requests), moves = data_version_moves(trace);
+        *result = (ReplayResult){
+            .messages = trace->messages,
+            .detected = detected,
+            .missed = trace->messages - detected,
+            .false_positives = replay.unknown + replay.duplicates + (unbacked > 0 ? (uint64_t)unbacked : 0),
+            .p50_ms = percentile_ms(latencies, detected, 50),
+            .p90_ms = percentile_ms(latencies, detected, 90),
+            .p99_ms = percentile_ms(latencies, detected, 99),
+            .max_ms = detected ? latencies[detected - 1] / 1e6 : 0,
+            .runs = replay.runs,
+            .idle_runs = requests > moves ? requests - moves : 0,
+            .overflows = replay.overflows,
+            .file_events = result->file_events,
+        };
+        ok = latencies != NULL;
+        free(latencies);
+    }
+
+    messages_context_close(replay.ctx);
+    sqlite3_finalize(insert);
+    sqlite3_close(writer);
+    pthread_cond_destroy(&replay.stop);
+    pthread_mutex_destroy(&replay.lock);
+    free(replay.landed_ns);
+    free((void *)replay.detected_ns);
+    return ok;
+}
+
+// MARK: - Main
+
+static const Strategy strategies[] = {
+    { "watcher (default backend)", chatdb_watcher_default_backend, 0 },
+    { "watcher (stat polling)", chatdb_watcher_poll_backend, 50 },
+    { "timer 250ms", NULL, 250 },
+    { "timer 1000ms", NULL, 1000 },
+    { "timer 5000ms (app fallback)", NULL, 5000 },
+};
+#define STRATEGY_COUNT (sizeof(strategies) / sizeof(strategies[0]))
+
+/// Enough to tell a regression from noise in a few seconds
+static const Strategy quick_strategies[] = {
+    { "watcher (default backend)", chatdb_watcher_default_backend, 0 },
+    { "watcher (stat polling)", chatdb_watcher_poll_backend, 50 },
+    { "timer 100ms", NULL, 100 },
+};
+#define QUICK_STRATEGY_COUNT (sizeof(quick_strategies) / sizeof(quick_strategies[0]))
+
+int main(int argc, char **argv) {
+    bool quick = false;
+    size_t messages = 300;
+    double gap_ms = 50;
+    uint64_t seed = 1;
+    double speed = 1;
+    double budget_ms = 0;
+    const char *trace_path = NULL, *record_path = NULL, *only = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) quick = true;
+        else if (strcmp(argv[i], "--messages") == 0 && i + 1 < argc) messages = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--gap") == 0 && i + 1 < argc) gap_ms = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) speed = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) trace_path = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) record_path = argv[++i];
+        else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) only = argv[++i];
+        else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) budget_ms = strtod(argv[++i], NULL);
+        else {
+            fprintf(stderr, "usage: latency_replay [--quick] [--messages N] [--gap MS] [--seed N] [--speed X]\n"
+                            "                      [--trace FILE] [--record FILE] [--only NAME] [--budget MS]\n");
+            return 2;
+        }
+    }
+    if (quick) {
+        messages = 30;
+        gap_ms = 20;
+    }
+    if (messages == 0 || gap_ms <= 0 || speed <= 0) {
+        fprintf(stderr, "--messages, --gap and --speed must be positive\n");
+        return 2;
+    }
+
+    Trace trace;
+    if (trace_path) {
+        if (!trace_load(trace_path, &trace)) {
+            fprintf(stderr, "could not read a trace with messages from %s\n", trace_path);
+            return 2;
+        }
+    } else {
+        trace = trace_generate(messages, gap_ms, seed);
+    }
+    if (record_path && !trace_save(record_path, &trace)) {
+        fprintf(stderr, "could not write %s\n", record_path);
+        return 2;
+    }
+    double seconds = trace.count ? trace.ops[trace.count - 1].offset_us / 1e6 / speed : 0;
+    fprintf(stderr, "replaying %zu messages in %zu commits over %.1fs\n", trace.messages, trace.count, seconds);
+
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "replay.db");
+
+    const Strategy *list = quick ? quick_strategies : strategies;
+    size_t count = quick ? QUICK_STRATEGY_COUNT : STRATEGY_COUNT;
+    int failures = 0;
+
+    printf("%-30s %9s %9s %9s %9s %9s %7s %7s %7s %7s\n", "strategy", "detected", "p50 ms", "p90 ms",
+           "p99 ms", "max ms", "missed", "false+", "runs", "idle");
+    for (size_t i = 0; i < count; i++) {
+        if (only && !strstr(list[i].name, only)) continue;
+
+        int grace_ms = list[i].interval_ms * 2 + 500;
+        ReplayResult result = { 0 };
+        if (!replay_strategy(path, &trace, &list[i], speed, grace_ms, &result)) {
+            printf("FAIL %s could not replay the trace\n", list[i].name);
+            failures++;
+            continue;
+        }
+
+        char detected[32], idle[32] = "-";
+        snprintf(detected, sizeof(detected), "%zu/%zu", result.detected, result.messages);
+        if (list[i].backend) snprintf(idle, sizeof(idle), "%llu", (unsigned long long)result.idle_runs);
+        printf("%-30s %9s %9.2f %9.2f %9.2f %9.2f %7zu %7llu %7llu %7s\n", list[i].name, detected,
+               result.p50_ms, result.p90_ms, result.p99_ms, result.max_ms, result.missed,
+               (unsigned long long)result.false_positives, (unsigned long long)result.runs, idle);
+
+        if (result.overflows) {
+            printf("  event ring overflowed %llu times\n", (unsigned long long)result.overflows);
+        }
+        if (result.missed || result.false_positives) {
+            printf("FAIL %s missed %zu, %llu false positives\n", list[i].name, result.missed,
+                   (unsigned long long)result.false_positives);
+            failures++;
+        }
+        /// A watcher only calls back when data_version moved, a timer has no such bound
+        if (list[i].backend && result.idle_runs) {
+            printf("FAIL %s asked for %llu polls no commit explains\n", list[i].name,
+                   (unsigned long long)result.idle_runs);
+            failures++;
+        }
+        if (budget_ms > 0 && result.p99_ms > budget_ms) {
+            printf("FAIL %s p99 %.2fms is over the %.2fms budget\n", list[i].name, result.p99_ms, budget_ms);
+            failures++;
+        }
+    }
+
+    char side[600];
+    unlink(path);
+    snprintf(side, sizeof(side), "%s-wal", path);
+    unlink(side);
+    snprintf(side, sizeof(side), "%s-shm", path);
+    unlink(side);
+    free(trace.ops);
+    return failures ? 1 : 0;
+}
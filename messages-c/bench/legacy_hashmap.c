@@ -0,0 +1,77 @@
+//
+//  legacy_hashmap.c
+//  ComfyNotch
+//
+//  Copy of MessageHashMap.c before it moved to open addressing.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "legacy_hashmap.h"
+
+typedef struct LegacyHashNode {
+    char *key;
+    MessageMeta value;
+    struct LegacyHashNode *next;
+} LegacyHashNode;
+
+static LegacyHashNode *buckets[LEGACY_HASHMAP_SIZE] = { 0 };
+
+static int getHashIndex(const char *key) {
+    unsigned long hash = 5381;
+    int c;
+    
+    while ((c = *key++)) {
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    }
+    
+    return hash % LEGACY_HASHMAP_SIZE;
+}
+
+void legacy_hashmap_put(const char *key, MessageMeta value) {
+    int index = getHashIndex(key);
+    
+    LegacyHashNode *node = buckets[index];
+    while (node != NULL) {
+        if (strcmp(node->key, key) == 0) {
+            if (node->value.date != value.date) {
+                node->value = value;
+            }
+            return;
+        }
+        node = node->next;
+    }
+    
+    LegacyHashNode *newNode = malloc(sizeof(LegacyHashNode));
+    newNode->key = strdup(key);
+    newNode->value = value;
+    newNode->next = buckets[index];
+    buckets[index] = newNode;
+}
+
+MessageMeta *legacy_hashmap_get(const char *key) {
+    int index = getHashIndex(key);
+    
+    LegacyHashNode *node = buckets[index];
+    while (node != NULL) {
+        if (strcmp(node->key, key) == 0) {
+            return &node->value;
+        }
+        node = node->next;
+    }
+    return NULL;
+}
+
+void legacy_hashmap_free(void) {
+    for (int i = 0; i < LEGACY_HASHMAP_SIZE; i++) {
+        LegacyHashNode *node = buckets[i];
+        while (node != NULL) {
+            LegacyHashNode *next = node->next;
+            free(node->key);
+            free(node);
+            node = next;
+        }
+        buckets[i] = NULL;
+    }
+}
@@ -0,0 +1,20 @@
+//
+//  legacy_hashmap.h
+//  ComfyNotch
+//
+//  The original fixed 1024 bucket chained MessageHashMap, kept only so the
+//  benchmark has something to compare the open addressing map against.
+//
+
+#ifndef legacy_hashmap_h
+#define legacy_hashmap_h
+
+#include "MessageMeta.h"
+
+#define LEGACY_HASHMAP_SIZE 1024
+
+void legacy_hashmap_put(const char *key, MessageMeta value);
+MessageMeta *legacy_hashmap_get(const char *key);
+void legacy_hashmap_free(void);
+
+#endif
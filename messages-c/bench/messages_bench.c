@@ -0,0 +1,435 @@
+//
+//  messages_bench.c
+//  ComfyNotch
+//
+//  Latency of the Messages C entry points against synthetic chat.db files of
+//  10k messages up to --max (10M takes a few GB of disk and a while to
+//  generate), and of the seen-GUID hashmap at the same sizes. Every
+//  statement's EXPLAIN QUERY PLAN is checked first, a full scan of a
+//  message table fails the run.
+//
+//  Usage: messages_bench [--max N] [--iterations N] [--plans-only]
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "AttributedBodyDecoder.h"
+#include "Messages.h"
+#include "MessageHashMap.h"
+#include "MessagesCursor.h"
+#include "MessagesContextInternal.h"
+#include "synthetic_chat_db.h"
+#include "test_chat_db.h"
+
+#define BENCH_HANDLES   200
+/// What the notch lists by default
+#define BENCH_RECENT_HANDLES 30
+#define BENCH_PAGE      50
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// MARK: - Samples
+
+typedef struct {
+    uint64_t *ns;
+    size_t count;
+    size_t capacity;
+} Samples;
+
+static Samples samples_make(size_t capacity) {
+    return (Samples){ .ns = malloc(capacity * sizeof(uint64_t)), .capacity = capacity };
+}
+
+static void samples_add(Samples *s, uint64_t ns) {
+    if (s->count < s->capacity) s->ns[s->count++] = ns;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/// Prints p50 / p99 / max and empties the samples for the next run
+static void report(const char *name, size_t messages, Samples *s) {
+    if (s->count == 0) return;
+    qsort(s->ns, s->count, sizeof(uint64_t), compare_u64);
+    double p50 = s->ns[s->count / 2] / 1000.0;
+    double p99 = s->ns[(s->count * 99) / 100 < s->count ? (s->count * 99) / 100 : s->count - 1] / 1000.0;
+    double max = s->ns[s->count - 1] / 1000.0;
+    printf("%-44s %10zu %12.2f %12.2f %12.2f %8zu\n", name, messages, p50, p99, max, s->count);
+    s->count = 0;
+}
+
+static void report_header(void) {
+    printf("%-44s %10s %12s %12s %12s %8s\n", "benchmark", "messages", "p50 us", "p99 us", "max us", "samples");
+}
+
+// MARK: - Query plans
+
+/// A SCAN of one of these (under its name or the alias our SQL gives it) reads the whole table
+static const char *scanned_tables[] = {
+    "message", "m", "attachment", "a", "message_attachment_join", "j",
+};
+
+static bool is_full_scan(const char *detail) {
+    if (strncmp(detail, "SCAN ", 5) != 0) return false;
+    for (size_t i = 0; i < sizeof(scanned_tables) / sizeof(scanned_tables[0]); i++) {
+        size_t n = strlen(scanned_tables[i]);
+        if (strncmp(detail + 5, scanned_tables[i], n) == 0 && (detail[5 + n] == '\0' || detail[5 + n] == ' ')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Prints every statement's plan, returns how many regressed
+static int check_query_plans(const char *db_path) {
+    sqlite3 *db;
+    if (sqlite3_open_v2(db_path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) return 1;
+
+    int failures = 0;
+    for (int id = 0; id < MESSAGES_STMT_COUNT; id++) {
+        const char *name = messages_context_statement_name(id);
+        char *sql = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", messages_context_statement_sql(id));
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+            printf("FAIL %s: %s\n", name, sqlite3_errmsg(db));
+            sqlite3_free(sql);
+            failures++;
+            continue;
+        }
+        sqlite3_free(sql);
+
+        bool ok = true;
+        printf("%s\n", name);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+            /// Attachments are sorted back into id order, a page's worth of rows at most
+            bool bad = is_full_scan(detail) ||
+                       (strstr(detail, "TEMP B-TREE") && id != MESSAGES_STMT_ATTACHMENTS);
+            printf("  %s %s\n", bad ? "!!" : "  ", detail);
+            ok = ok && !bad;
+        }
+        sqlite3_finalize(stmt);
+        if (!ok) {
+            printf("FAIL %s regressed to a full scan or sort\n", name);
+            failures++;
+        }
+    }
+
+    sqlite3_close(db);
+    return failures;
+}
+
+// MARK: - Messages entry points
+
+typedef struct {
+    size_t iterations;
+    uint64_t rng;
+} BenchOptions;
+
+static int64_t random_handle(BenchOptions *options) {
+    return 1 + (int64_t)(splitmix64(&options->rng) % BENCH_HANDLES);
+}
+
+/// Refreshing every handle at once, what the handle list does on launch
+static void bench_summaries(MessagesContext *ctx, size_t messages, BenchOptions *options,
+                            Samples *s, const char *suffix) {
+    char name[64];
+    MessagesHandleSummary summaries[BENCH_HANDLES];
+    size_t rounds = options->iterations / 20 + 1;
+    for (size_t i = 0; i < rounds; i++) {
+        uint64_t start = now_ns();
+        int count = get_handle_summaries(ctx, NULL, 0, summaries, BENCH_HANDLES);
+        samples_add(s, now_ns() - start);
+        free_handle_summaries(summaries, count);
+    }
+    snprintf(name, sizeof(name), "get_handle_summaries (all)%s", suffix);
+    report(name, messages, s);
+}
+
+/// The per-handle "latest message" lookups, on random handles
+static void bench_latest(MessagesContext *ctx, size_t messages, BenchOptions *options,
+                         Samples *s, const char *suffix) {
+    char name[64];
+    char buffer[4096];
+
+    for (size_t i = 0; i < options->iterations; i++) {
+        int64_t handle = random_handle(options);
+        uint64_t start = now_ns();
+        get_last_talked_to(ctx, handle);
+        samples_add(s, now_ns() - start);
+    }
+    snprintf(name, sizeof(name), "get_last_talked_to%s", suffix);
+    report(name, messages, s);
+
+    for (size_t i = 0; i < options->iterations; i++) {
+        int64_t handle = random_handle(options);
+        MessagesBody body;
+        uint64_t start = now_ns();
+        get_last_message_body(ctx, handle, buffer, sizeof(buffer), &body);
+        samples_add(s, now_ns() - start);
+    }
+    snprintf(name, sizeof(name), "get_last_message_body%s", suffix);
+    report(name, messages, s);
+
+    bench_summaries(ctx, messages, options, s, suffix);
+}
+
+/// A conversation's newest page as Swift reads it, one struct and two heap
+/// strings per row against one reused columnar buffer
+static void bench_pages(MessagesContext *ctx, size_t messages, BenchOptions *options, Samples *s) {
+    MessagesPageRow rows[BENCH_PAGE];
+    size_t rounds = options->iterations / 10 + 1;
+    for (size_t i = 0; i < rounds; i++) {
+        MessagesCursor cursor = messages_cursor_make(random_handle(options));
+        uint64_t start = now_ns();
+        int count = messages_cursor_older(ctx, &cursor, rows, BENCH_PAGE);
+        messages_page_decode(ctx, rows, count);
+        free_messages_page(rows, count);
+        samples_add(s, now_ns() - start);
+    }
+    report("page of 50 (rows, decode, free)", messages, s);
+
+    MessagesPageColumns *columns = messages_page_columns_create();
+    for (size_t i = 0; columns && i < rounds; i++) {
+        MessagesCursor cursor = messages_cursor_make(random_handle(options));
+        uint64_t start = now_ns();
+        messages_cursor_older_columns(ctx, &cursor, columns, BENCH_PAGE);
+        messages_page_columns_decode(ctx, columns);
+        samples_add(s, now_ns() - start);
+    }
+    report("page of 50 (columns, decode)", messages, s);
+    messages_page_columns_destroy(columns);
+}
+
+static void bench_database(const char *path, size_t messages, BenchOptions *options) {
+    SyntheticChatDBConfig config = synthetic_chat_db_defaults();
+    config.handles = BENCH_HANDLES;
+    config.messages_per_handle = (int)(messages / BENCH_HANDLES);
+
+    uint64_t start = now_ns();
+    sqlite3 *writer = synthetic_chat_db_generate(path, &config);
+    if (!writer) {
+        fprintf(stderr, "could not generate %zu messages\n", messages);
+        return;
+    }
+    fprintf(stderr, "generated %zu messages in %.1fs\n", messages, (now_ns() - start) / 1e9);
+
+    Samples s = samples_make(options->iterations > 64 ? options->iterations : 64);
+
+    /// What replaced preload_hashmap: open and seed the ROWID watermark
+    for (int i = 0; i < 20; i++) {
+        start = now_ns();
+        MessagesContext *cold = messages_context_open(path);
+        get_messages_watermark(cold);
+        samples_add(&s, now_ns() - start);
+        messages_context_close(cold);
+    }
+    report("open + seed watermark (cold)", messages, &s);
+
+    MessagesContext *ctx = messages_context_open(path);
+    has_chat_db_changed(ctx);
+
+    for (size_t i = 0; i < options->iterations; i++) {
+        start = now_ns();
+        has_chat_db_changed(ctx);
+        samples_add(&s, now_ns() - start);
+    }
+    report("has_chat_db_changed (idle)", messages, &s);
+
+    size_t arrivals = options->iterations / 10 + 1;
+    for (size_t i = 0; i < arrivals; i++) {
+        synthetic_chat_db_append(writer, &config, 1);
+        start = now_ns();
+        has_chat_db_changed(ctx);
+        samples_add(&s, now_ns() - start);
+    }
+    report("has_chat_db_changed (1 new row)", messages, &s);
+
+    bench_latest(ctx, messages, options, &s, "");
+
+    bench_pages(ctx, messages, options, &s);
+
+    /// The handle list: seeded by one query, then kept current by the delta scan
+    RecentHandle recent[BENCH_RECENT_HANDLES];
+    for (int i = 0; i < 20; i++) {
+        MessagesContext *cold = messages_context_open(path);
+        start = now_ns();
+        get_recent_handles(cold, recent, BENCH_RECENT_HANDLES);
+        samples_add(&s, now_ns() - start);
+        messages_context_close(cold);
+    }
+    report("get_recent_handles (seed)", messages, &s);
+
+    get_recent_handles(ctx, recent, BENCH_RECENT_HANDLES);
+    for (size_t i = 0; i < arrivals; i++) {
+        synthetic_chat_db_append(writer, &config, 1);
+        has_chat_db_changed(ctx);
+        start = now_ns();
+        get_recent_handles(ctx, recent, BENCH_RECENT_HANDLES);
+        samples_add(&s, now_ns() - start);
+    }
+    report("get_recent_handles (after a new row)", messages, &s);
+
+    /// The same refresh split over a reader per core
+    MessagesContext *pooled = messages_context_open(path);
+    bool pool = messages_context_attach_pool(pooled, 0);
+    if (pool) bench_summaries(pooled, messages, options, &s, " [pool]");
+
+    char index_path[600], pooled_index_path[620];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    snprintf(pooled_index_path, sizeof(pooled_index_path), "%s.pool", index_path);
+    unlink(index_path);
+    unlink(pooled_index_path);
+    start = now_ns();
+    bool indexed = messages_context_attach_index(ctx, index_path);
+    samples_add(&s, now_ns() - start);
+    report("sidecar index build", messages, &s);
+    if (indexed) bench_latest(ctx, messages, options, &s, " [sidecar]");
+    if (pool && messages_context_attach_index(pooled, pooled_index_path)) {
+        bench_summaries(pooled, messages, options, &s, " [sidecar, pool]");
+    }
+
+    messages_context_close(pooled);
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(index_path);
+    unlink(pooled_index_path);
+    free(s.ns);
+}
+
+// MARK: - Hashmap
+
+static void make_guid(uint64_t seed, char *out) {
+    static const char hex[] = "0123456789ABCDEF";
+    uint64_t hi = splitmix64(&seed), lo = splitmix64(&seed);
+    int pos = 0;
+    for (int nibble = 0; nibble < 32; nibble++) {
+        if (nibble == 8 || nibble == 12 || nibble == 16 || nibble == 20) out[pos++] = '-';
+        uint64_t word = nibble < 16 ? hi : lo;
+        out[pos++] = hex[(word >> ((nibble % 16) * 4)) & 0xF];
+    }
+    out[pos] = '\0';
+}
+
+/// Every put timed on its own so the resizes show up in the tail
+static void bench_hashmap(size_t entries, BenchOptions *options) {
+    char guid[40];
+    Samples s = samples_make(entries);
+    MessageHashMap map;
+    message_hashmap_init(&map, HASHMAP_SIZE);
+
+    for (size_t i = 0; i < entries; i++) {
+        make_guid(i, guid);
+        MessageMeta meta = { .date = (int64_t)i, .isFromMe = i & 1 };
+        uint64_t start = now_ns();
+        message_hashmap_put(&map, guid, meta);
+        samples_add(&s, now_ns() - start);
+    }
+    report("hashmap put", entries, &s);
+
+    size_t lookups = options->iterations * 100 < entries ? options->iterations * 100 : entries;
+    size_t found = 0;
+    for (size_t i = 0; i < lookups; i++) {
+        make_guid(splitmix64(&options->rng) % entries, guid);
+        uint64_t start = now_ns();
+        found += message_hashmap_get(&map, guid) != NULL;
+        samples_add(&s, now_ns() - start);
+    }
+    report("hashmap get (hit)", entries, &s);
+
+    for (size_t i = 0; i < lookups; i++) {
+        make_guid(entries + (splitmix64(&options->rng) % entries), guid);
+        uint64_t start = now_ns();
+        found -= message_hashmap_get(&map, guid) != NULL;
+        samples_add(&s, now_ns() - start);
+    }
+    report("hashmap get (miss)", entries, &s);
+
+    if (found != lookups) fprintf(stderr, "hashmap lookups were wrong (%zu of %zu)\n", found, lookups);
+    message_hashmap_free(&map);
+    free(s.ns);
+}
+
+/// Synthetic blobs have to take the same decode path real ones do or the numbers mean nothing
+static bool check_synthetic_blobs(void) {
+    static const char *texts[] = {
+        "ok",
+        "see you at the airport \xF0\x9F\x98\x82",
+        "long message long message long message long message long message long message "
+        "long message long message long message long message long message long message",
+    };
+    uint8_t blob[1024];
+    for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        size_t length = strlen(texts[i]);
+        size_t blob_length = synthetic_attributed_body(texts[i], length, blob, sizeof(blob));
+        AttributedBodyText decoded;
+        if (blob_length > sizeof(blob) || !attributed_body_decode(blob, blob_length, &decoded) ||
+            decoded.text_length != length || memcmp(blob + decoded.text_offset, texts[i], length) != 0) {
+            fprintf(stderr, "synthetic attributedBody %zu does not decode\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    size_t max_messages = 1000000;
+    bool plans_only = false;
+    BenchOptions options = { .iterations = 2000, .rng = 42 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) max_messages = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) options.iterations = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--plans-only") == 0) plans_only = true;
+        else {
+            fprintf(stderr, "usage: messages_bench [--max N] [--iterations N] [--plans-only]\n");
+            return 2;
+        }
+    }
+    if (options.iterations == 0) options.iterations = 1;
+    if (!check_synthetic_blobs()) return 1;
+
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "bench.db");
+
+    /// Plans depend on the statistics SQLite sees, so check them against real looking data
+    SyntheticChatDBConfig config = synthetic_chat_db_defaults();
+    sqlite3 *db = synthetic_chat_db_generate(path, &config);
+    if (!db) return 1;
+    sqlite3_close(db);
+    int failures = check_query_plans(path);
+    if (failures || plans_only) {
+        unlink(path);
+        return failures ? 1 : 0;
+    }
+
+    const size_t sizes[] = { 10000, 100000, 1000000, 10000000 };
+    printf("\n");
+    report_header();
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && sizes[i] <= max_messages; i++) {
+        bench_database(path, sizes[i], &options);
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && sizes[i] <= max_messages; i++) {
+        bench_hashmap(sizes[i], &options);
+    }
+
+    unlink(path);
+    return 0;
+}
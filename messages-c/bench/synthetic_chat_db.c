@@ -0,0 +1,292 @@
+//
+//  synthetic_chat_db.c
+//  ComfyNotch
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "synthetic_chat_db.h"
+#include "test_chat_db.h"
+
+/// 2023-01-01 in Apple's nanoseconds since 2001
+#define SYNTHETIC_START_DATE    (694224000LL * 1000000000LL)
+
+static const char *vocabulary[] = {
+    "ok", "lol", "yeah", "omw", "sure", "thanks", "see", "you", "soon", "tonight",
+    "dinner", "at", "the", "new", "place", "are", "we", "still", "on", "for",
+    "tomorrow", "meeting", "moved", "to", "3pm", "can", "pick", "me", "up", "from",
+    "airport", "running", "late", "coffee", "?", "!", "haha", "call", "later", "love",
+    "happy", "birthday", "did", "get", "my", "message", "sounds", "good", "\xF0\x9F\x98\x82", "\xE2\x9D\xA4\xEF\xB8\x8F",
+};
+#define VOCABULARY_COUNT (sizeof(vocabulary) / sizeof(vocabulary[0]))
+
+/// Everything of a one run NSAttributedString blob around the string bytes and
+/// the run length, copied from the layout Messages writes (see tests/fixtures)
+static const uint8_t attributed_prefix[] = {
+    0x04, 0x0b, 's', 't', 'r', 'e', 'a', 'm', 't', 'y', 'p', 'e', 'd', 0x81, 0xe8, 0x03,
+    0x84, 0x01, 0x40, 0x84, 0x84, 0x84, 0x12, 'N', 'S', 'A', 't', 't', 'r', 'i', 'b', 'u',
+    't', 'e', 'd', 'S', 't', 'r', 'i', 'n', 'g', 0x00, 0x84, 0x84, 0x08, 'N', 'S', 'O',
+    'b', 'j', 'e', 'c', 't', 0x00, 0x85, 0x92, 0x84, 0x84, 0x84, 0x08, 'N', 'S', 'S', 't',
+    'r', 'i', 'n', 'g', 0x01, 0x94, 0x84, 0x01, 0x2b,
+};
+static const uint8_t attributed_run[] = { 0x86, 0x84, 0x02, 0x69, 0x49, 0x01 };
+static const uint8_t attributed_suffix[] = {
+    0x92, 0x84, 0x84, 0x84, 0x0c, 'N', 'S', 'D', 'i', 'c', 't', 'i', 'o', 'n', 'a', 'r',
+    'y', 0x00, 0x94, 0x84, 0x01, 0x69, 0x01, 0x92, 0x84, 0x96, 0x96, 0x1d, '_', '_', 'k', 'I',
+    'M', 'M', 'e', 's', 's', 'a', 'g', 'e', 'P', 'a', 'r', 't', 'A', 't', 't', 'r', 'i', 'b',
+    'u', 't', 'e', 'N', 'a', 'm', 'e', 0x86, 0x92, 0x84, 0x84, 0x84, 0x08, 'N', 'S', 'N', 'u',
+    'm', 'b', 'e', 'r', 0x00, 0x84, 0x84, 0x07, 'N', 'S', 'V', 'a', 'l', 'u', 'e', 0x00, 0x94,
+    0x84, 0x01, 0x2a, 0x84, 0x99, 0x99, 0x00, 0x86, 0x86, 0x86,
+};
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static double random_unit(uint64_t *state) {
+    return (double)(splitmix64(state) >> 11) / (double)(1ull << 53);
+}
+
+/// typedstream integers: one byte, or 0x81 and two little endian bytes
+static size_t put_ts_int(uint8_t *out, uint32_t value) {
+    if (value < 0x80) {
+        out[0] = (uint8_t)value;
+        return 1;
+    }
+    out[0] = 0x81;
+    out[1] = (uint8_t)value;
+    out[2] = (uint8_t)(value >> 8);
+    return 3;
+}
+
+/// NSString lengths count UTF-16 units, 4 byte sequences are surrogate pairs
+static uint32_t utf16_length(const char *text, size_t length) {
+    uint32_t units = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if ((c & 0xC0) != 0x80) units += c >= 0xF0 ? 2 : 1;
+    }
+    return units;
+}
+
+size_t synthetic_attributed_body(const char *text, size_t length, uint8_t *out, size_t capacity) {
+    uint8_t number[3];
+    size_t needed = sizeof(attributed_prefix) + put_ts_int(number, (uint32_t)length) + length +
+                    sizeof(attributed_run) + put_ts_int(number, utf16_length(text, length)) +
+                    sizeof(attributed_suffix);
+    if (needed > capacity || length > 0x7FFF) return needed;
+
+    size_t pos = 0;
+    memcpy(out + pos, attributed_prefix, sizeof(attributed_prefix));
+    pos += sizeof(attributed_prefix);
+    pos += put_ts_int(out + pos, (uint32_t)length);
+    memcpy(out + pos, text, length);
+    pos += length;
+    memcpy(out + pos, attributed_run, sizeof(attributed_run));
+    pos += sizeof(attributed_run);
+    pos += put_ts_int(out + pos, utf16_length(text, length));
+    memcpy(out + pos, attributed_suffix, sizeof(attributed_suffix));
+    return pos + sizeof(attributed_suffix);
+}
+
+SyntheticChatDBConfig synthetic_chat_db_defaults(void) {
+    return (SyntheticChatDBConfig){
+        .handles = 50,
+        .messages_per_handle = 200,
+        .attributed_fraction = 0.7,
+        .attachment_fraction = 0.05,
+        .from_me_fraction = 0.4,
+        .seed = 1,
+    };
+}
+
+/// Where generation left off, so appends continue the same timeline
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *message;
+    sqlite3_stmt *attachment;
+    sqlite3_stmt *join;
+    const SyntheticChatDBConfig *config;
+    uint64_t rng;
+    int64_t date;
+    int64_t last_rowid;
+} Generator;
+
+static bool generator_open(Generator *g, sqlite3 *db, const SyntheticChatDBConfig *config) {
+    memset(g, 0, sizeof(*g));
+    g->db = db;
+    g->config = config;
+
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "SELECT IFNULL(MAX(ROWID), 0), IFNULL(MAX(date), 0) FROM message;",
+                           -1, &stmt, NULL) != SQLITE_OK) {
+        return false;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        g->last_rowid = sqlite3_column_int64(stmt, 0);
+        g->date = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+    if (g->date < SYNTHETIC_START_DATE) g->date = SYNTHETIC_START_DATE;
+    g->rng = config->seed ^ (uint64_t)g->last_rowid * 0x9e3779b97f4a7c15ull;
+
+    return sqlite3_prepare_v2(db,
+                              "INSERT INTO message (guid, text, handle_id, service, date, date_read, "
+                              "is_from_me, is_read, is_finished, cache_has_attachments, attributedBody) "
+                              "VALUES (?1, ?2, ?3, 'iMessage', ?4, ?5, ?6, ?7, 1, ?8, ?9);",
+                              -1, &g->message, NULL) == SQLITE_OK &&
+           sqlite3_prepare_v2(db,
+                              "INSERT INTO attachment (guid, filename, mime_type, transfer_name, total_bytes) "
+                              "VALUES (?1, ?2, 'image/jpeg', ?3, ?4);",
+                              -1, &g->attachment, NULL) == SQLITE_OK &&
+           sqlite3_prepare_v2(db,
+                              "INSERT INTO message_attachment_join (message_id, attachment_id) VALUES (?1, ?2);",
+                              -1, &g->join, NULL) == SQLITE_OK;
+}
+
+static void generator_close(Generator *g) {
+    sqlite3_finalize(g->message);
+    sqlite3_finalize(g->attachment);
+    sqlite3_finalize(g->join);
+}
+
+static void make_guid(Generator *g, char *out, size_t capacity) {
+    uint64_t hi = splitmix64(&g->rng), lo = splitmix64(&g->rng);
+    snprintf(out, capacity, "%08X-%04X-%04X-%04X-%012llX",
+             (unsigned)(hi >> 32), (unsigned)(hi >> 16) & 0xFFFF, (unsigned)hi & 0xFFFF,
+             (unsigned)(lo >> 48), (unsigned long long)(lo & 0xFFFFFFFFFFFFull));
+}
+
+/// Mostly short messages with the odd long one, like real threads
+static size_t make_text(Generator *g, char *out, size_t capacity) {
+    double roll = random_unit(&g->rng);
+    int words = roll < 0.6 ? 1 + (int)(random_unit(&g->rng) * 6)
+              : roll < 0.95 ? 6 + (int)(random_unit(&g->rng) * 20)
+              : 30 + (int)(random_unit(&g->rng) * 60);
+
+    size_t length = 0;
+    for (int w = 0; w < words; w++) {
+        const char *word = vocabulary[splitmix64(&g->rng) % VOCABULARY_COUNT];
+        int n = snprintf(out + length, capacity - length, w ? " %s" : "%s", word);
+        if (n < 0 || (size_t)n >= capacity - length) break;
+        length += (size_t)n;
+    }
+    return length;
+}
+
+static bool insert_message(Generator *g, int64_t handle_id, bool read) {
+    char guid[48];
+    char text[1024];
+    uint8_t blob[1400];
+
+    make_guid(g, guid, sizeof(guid));
+    size_t length = make_text(g, text, sizeof(text));
+    bool attributed = random_unit(&g->rng) < g->config->attributed_fraction;
+    bool attachment = random_unit(&g->rng) < g->config->attachment_fraction;
+    bool from_me = random_unit(&g->rng) < g->config->from_me_fraction;
+
+    /// Bursts of replies seconds apart, then quiet stretches of hours
+    int64_t gap_seconds = random_unit(&g->rng) < 0.8 ? 1 + (int64_t)(random_unit(&g->rng) * 90)
+                                                     : 600 + (int64_t)(random_unit(&g->rng) * 20000);
+    g->date += gap_seconds * 1000000000LL + (int64_t)(splitmix64(&g->rng) % 1000000000ull);
+
+    sqlite3_stmt *stmt = g->message;
+    sqlite3_reset(stmt);
+    sqlite3_bind_text(stmt, 1, guid, -1, SQLITE_TRANSIENT);
+    if (attributed) {
+        size_t blob_length = synthetic_attributed_body(text, length, blob, sizeof(blob));
+        if (blob_length > sizeof(blob)) return false;
+        sqlite3_bind_null(stmt, 2);
+        sqlite3_bind_blob(stmt, 9, blob, (int)blob_length, SQLITE_TRANSIENT);
+    } else {
+        sqlite3_bind_text(stmt, 2, text, (int)length, SQLITE_TRANSIENT);
+        sqlite3_bind_null(stmt, 9);
+    }
+    sqlite3_bind_int64(stmt, 3, handle_id);
+    sqlite3_bind_int64(stmt, 4, g->date);
+    sqlite3_bind_int64(stmt, 5, read || from_me ? g->date : 0);
+    sqlite3_bind_int(stmt, 6, from_me);
+    sqlite3_bind_int(stmt, 7, read || from_me);
+    sqlite3_bind_int(stmt, 8, attachment);
+    if (sqlite3_step(stmt) != SQLITE_DONE) return false;
+    int64_t message_id = g->last_rowid = sqlite3_last_insert_rowid(g->db);
+    if (!attachment) return true;
+
+    char filename[128];
+    snprintf(filename, sizeof(filename), "~/Library/Messages/Attachments/%02x/IMG_%04lld.jpeg",
+             (unsigned)(message_id & 0xFF), (long long)(message_id % 10000));
+
+    make_guid(g, guid, sizeof(guid));
+    stmt = g->attachment;
+    sqlite3_reset(stmt);
+    sqlite3_bind_text(stmt, 1, guid, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, strrchr(filename, '/') + 1, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 4, 50000 + (int64_t)(splitmix64(&g->rng) % 4000000));
+    if (sqlite3_step(stmt) != SQLITE_DONE) return false;
+
+    stmt = g->join;
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, message_id);
+    sqlite3_bind_int64(stmt, 2, sqlite3_last_insert_rowid(g->db));
+    return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+sqlite3 *synthetic_chat_db_generate(const char *path, const SyntheticChatDBConfig *config) {
+    if (!path || !config || config->handles <= 0 || config->messages_per_handle < 0) return NULL;
+
+    sqlite3 *db = test_chat_db_create(path);
+    if (!db) return NULL;
+    sqlite3_exec(db, "PRAGMA synchronous=OFF; BEGIN;", NULL, NULL, NULL);
+
+    bool ok = true;
+    for (int h = 0; ok && h < config->handles; h++) {
+        char id[32];
+        if (h % 5 == 4) snprintf(id, sizeof(id), "friend%d@icloud.com", h);
+        else snprintf(id, sizeof(id), "+1555%07d", h);
+        ok = test_chat_db_add_handle(db, id, "iMessage") > 0;
+    }
+
+    /// Every handle gets its quota, shuffled onto one timeline so conversations interleave
+    size_t total = (size_t)config->handles * (size_t)config->messages_per_handle;
+    int32_t *timeline = total ? malloc(total * sizeof(int32_t)) : NULL;
+    ok = ok && (total == 0 || timeline);
+    for (size_t i = 0; ok && i < total; i++) timeline[i] = (int32_t)(i % (size_t)config->handles) + 1;
+
+    Generator g = { 0 };
+    ok = ok && generator_open(&g, db, config);
+    for (size_t i = total; ok && i > 1; i--) {
+        size_t j = splitmix64(&g.rng) % i;
+        int32_t swap = timeline[i - 1];
+        timeline[i - 1] = timeline[j];
+        timeline[j] = swap;
+    }
+
+    /// Everything but the last few messages has been read
+    for (size_t i = 0; ok && i < total; i++) ok = insert_message(&g, timeline[i], i + 20 < total);
+    generator_close(&g);
+    free(timeline);
+
+    ok = ok && sqlite3_exec(db, "COMMIT; PRAGMA synchronous=NORMAL;", NULL, NULL, NULL) == SQLITE_OK;
+    if (!ok) {
+        fprintf(stderr, "synthetic chat.db: %s\n", sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return NULL;
+    }
+    return db;
+}
+
+int64_t synthetic_chat_db_append(sqlite3 *db, const SyntheticChatDBConfig *config, int count) {
+    Generator g = { 0 };
+    bool ok = generator_open(&g, db, config);
+    for (int i = 0; ok && i < count; i++) {
+        int64_t handle_id = 1 + (int64_t)(splitmix64(&g.rng) % (uint64_t)config->handles);
+        ok = insert_message(&g, handle_id, false);
+    }
+    generator_close(&g);
+    return ok ? g.last_rowid : -1;
+}
@@ -0,0 +1,43 @@
+//
+//  synthetic_chat_db.h
+//  ComfyNotch
+//
+//  Realistic chat.db files for benchmarks: conversations interleaved on one
+//  timeline, Apple's nanosecond dates, modern attributedBody-only rows and
+//  attachments. Built on the schema from tests/test_chat_db.h and fully
+//  determined by the seed.
+//
+
+#ifndef synthetic_chat_db_h
+#define synthetic_chat_db_h
+
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    int handles;
+    int messages_per_handle;
+    double attributed_fraction;     // rows with only an attributedBody blob, like macOS 13+
+    double attachment_fraction;     // rows with one attachment
+    double from_me_fraction;
+    uint64_t seed;
+} SyntheticChatDBConfig;
+
+/// 50 handles x 200 messages, 70% attributedBody-only, 5% attachments
+SyntheticChatDBConfig synthetic_chat_db_defaults(void);
+
+/// Creates the database at `path` (replacing it) and fills it in one transaction.
+/// Returns a writable connection for appending more, the caller closes it.
+sqlite3 *synthetic_chat_db_generate(const char *path, const SyntheticChatDBConfig *config);
+
+/// Appends `count` new messages after everything already there, each its own
+/// commit like Messages.app does. Returns the last ROWID written or -1.
+int64_t synthetic_chat_db_append(sqlite3 *db, const SyntheticChatDBConfig *config, int count);
+
+/// Encodes `text` the way Messages writes a one run attributedBody.
+/// Returns the blob length, larger than `capacity` if it did not fit.
+size_t synthetic_attributed_body(const char *text, size_t length, uint8_t *out, size_t capacity);
+
+#endif /* synthetic_chat_db_h */
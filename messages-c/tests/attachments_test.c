@@ -0,0 +1,79 @@
+//
+//  attachments_test.c
+//  ComfyNotch
+//
+//  Checks a whole page of messages gets its attachments from one call,
+//  grouped by message in the order the ids were passed.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "test_chat_db.h"
+
+int main(void) {
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "attachments.db");
+    
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t handle = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    
+    int64_t plain = test_chat_db_add_message(writer, "M-1", handle, "no attachment", 1, false);
+    int64_t photo = test_chat_db_add_message(writer, "M-2", handle, "\xef\xbf\xbc", 2, false);
+    int64_t album = test_chat_db_add_message(writer, "M-3", handle, "\xef\xbf\xbc\xef\xbf\xbc", 3, true);
+    
+    int64_t photo_a = test_chat_db_add_attachment(writer, photo, "A-1", "~/Library/Messages/Attachments/a/IMG_0001.HEIC",
+                                                  "image/heic", "IMG_0001.HEIC", 2048);
+    int64_t album_a = test_chat_db_add_attachment(writer, album, "A-2", "~/Library/Messages/Attachments/b/IMG_0002.jpeg",
+                                                  "image/jpeg", "IMG_0002.jpeg", 4096);
+    int64_t album_b = test_chat_db_add_attachment(writer, album, "A-3", NULL, NULL, "voice.caf", 0);
+    assert(photo_a > 0 && album_a > 0 && album_b > 0);
+    
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    
+    /// Newest first like a conversation page, the output follows that order
+    int64_t page[] = { album, photo, plain, 9999 };
+    MessagesAttachment attachments[8];
+    int count = get_message_attachments(ctx, page, 4, attachments, 8);
+    assert(count == 3);
+    
+    assert(attachments[0].message_id == album && attachments[0].attachment_id == album_a);
+    assert(strcmp(attachments[0].mime_type, "image/jpeg") == 0);
+    assert(strcmp(attachments[0].transfer_name, "IMG_0002.jpeg") == 0);
+    assert(attachments[0].total_bytes == 4096);
+    
+    assert(attachments[1].message_id == album && attachments[1].attachment_id == album_b);
+    assert(attachments[1].filename == NULL && attachments[1].mime_type == NULL);
+    assert(strcmp(attachments[1].transfer_name, "voice.caf") == 0);
+    
+    assert(attachments[2].message_id == photo && attachments[2].attachment_id == photo_a);
+    assert(strcmp(attachments[2].filename, "~/Library/Messages/Attachments/a/IMG_0001.HEIC") == 0);
+    assert(attachments[2].total_bytes == 2048);
+    free_message_attachments(attachments, count);
+    
+    /// A full buffer stops early instead of overrunning
+    count = get_message_attachments(ctx, page, 4, attachments, 2);
+    assert(count == 2);
+    free_message_attachments(attachments, count);
+    
+    /// Nothing asked, nothing returned
+    assert(get_message_attachments(ctx, NULL, 0, attachments, 8) == 0);
+    assert(get_message_attachments(ctx, &plain, 1, attachments, 8) == 0);
+    
+    /// The statement is prepared once and reused
+    MessagesContextStats before = messages_context_stats(ctx);
+    count = get_message_attachments(ctx, page, 4, attachments, 8);
+    free_message_attachments(attachments, count);
+    MessagesContextStats after = messages_context_stats(ctx);
+    assert(after.prepares == before.prepares);
+    
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+    printf("attachments_test passed\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+//
+//  attributed_body_test.c
+//  ComfyNotch
+//
+//  Runs the typedstream decoder over every blob in fixtures/attributed_body
+//  and compares the text / link slices with the expected files next to it.
+//
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "AttributedBodyDecoder.h"
+
+#ifndef FIXTURE_DIR
+#error "FIXTURE_DIR must point at tests/fixtures/attributed_body"
+#endif
+
+/// Reads a whole file, returns NULL if it does not exist
+static char *read_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    char *data = malloc(size + 1);
+    assert(data);
+    *length = fread(data, 1, size, file);
+    data[*length] = '\0';
+    fclose(file);
+    return data;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/// Hex digits to bytes, skipping whitespace and `#` comments
+static unsigned char *parse_hex(const char *hex, size_t *length) {
+    unsigned char *bytes = malloc(strlen(hex) / 2 + 1);
+    assert(bytes);
+    
+    size_t count = 0;
+    int high = -1;
+    for (const char *p = hex; *p; p++) {
+        if (*p == '#') {
+            while (*p && *p != '\n') p++;
+            if (!*p) break;
+            continue;
+        }
+        int value = hex_value(*p);
+        if (value < 0) continue;
+        if (high < 0) {
+            high = value;
+        } else {
+            bytes[count++] = (unsigned char)(high << 4 | value);
+            high = -1;
+        }
+    }
+    assert(high < 0);
+    *length = count;
+    return bytes;
+}
+
+static void check_slice(const char *name, const char *what, const unsigned char *blob,
+                        bool has, size_t offset, size_t length, const char *expected,
+                        size_t expected_length) {
+    if (!expected) {
+        if (has) fprintf(stderr, "%s: unexpected %s\n", name, what);
+        assert(!has);
+        return;
+    }
+    if (!has || length != expected_length || memcmp(blob + offset, expected, length) != 0) {
+        fprintf(stderr, "%s: %s mismatch, got '%.*s'\n", name, what,
+                has ? (int)length : 0, has ? (const char *)blob + offset : "");
+        assert(false);
+    }
+}
+
+static void run_fixture(const char *name) {
+    char path[1024];
+    size_t hex_length, blob_length, text_length = 0, link_length = 0;
+    
+    snprintf(path, sizeof(path), "%s/%s.hex", FIXTURE_DIR, name);
+    char *hex = read_file(path, &hex_length);
+    assert(hex);
+    unsigned char *blob = parse_hex(hex, &blob_length);
+    
+    snprintf(path, sizeof(path), "%s/%s.txt", FIXTURE_DIR, name);
+    char *text = read_file(path, &text_length);
+    snprintf(path, sizeof(path), "%s/%s.link", FIXTURE_DIR, name);
+    char *link = read_file(path, &link_length);
+    
+    AttributedBodyText decoded;
+    bool ok = attributed_body_decode(blob, blob_length, &decoded);
+    assert(ok == (text != NULL));
+    
+    if (ok) {
+        check_slice(name, "text", blob, decoded.has_text, decoded.text_offset,
+                    decoded.text_length, text, text_length);
+        check_slice(name, "link", blob, decoded.has_link, decoded.link_offset,
+                    decoded.link_length, link, link_length);
+    }
+    
+    /// Every shorter prefix has to fail cleanly or still point inside the blob
+    for (size_t cut = 0; cut < blob_length; cut++) {
+        AttributedBodyText partial;
+        if (attributed_body_decode(blob, cut, &partial)) {
+            assert(partial.text_offset + partial.text_length <= cut);
+        }
+    }
+    
+    free(hex);
+    free(blob);
+    free(text);
+    free(link);
+}
+
+int main(void) {
+    DIR *dir = opendir(FIXTURE_DIR);
+    assert(dir);
+    
+    int fixtures = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        size_t length = strlen(entry->d_name);
+        if (length < 5 || strcmp(entry->d_name + length - 4, ".hex") != 0) continue;
+        
+        char name[256];
+        snprintf(name, sizeof(name), "%.*s", (int)(length - 4), entry->d_name);
+        run_fixture(name);
+        fixtures++;
+    }
+    closedir(dir);
+    assert(fixtures > 0);
+    
+    /// Garbage in, nothing out
+    AttributedBodyText decoded;
+    assert(!attributed_body_decode(NULL, 0, &decoded));
+    assert(!attributed_body_decode("streamtyped", 11, &decoded));
+    
+    printf("attributed_body_test passed (%d fixtures)\n", fixtures);
+    return 0;
+}
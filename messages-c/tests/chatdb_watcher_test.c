@@ -0,0 +1,246 @@
+//
+//  chatdb_watcher_test.c
+//  ComfyNotch
+//
+//  Checks the chat.db watcher calls back once per real commit and never for
+//  a -wal write that commits nothing, looks again on its settle backoff when
+//  a file event beats the commit, runs no SQL while idle, and that the stat
+//  polling fallback sees commits too.
+//
+
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ChatDBWatcher.h"
+
+static _Atomic int callbacks;
+
+static void count_callback(void *userdata) {
+    (void)userdata;
+    atomic_fetch_add(&callbacks, 1);
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+/// Gives the watcher thread up to two seconds to get there
+static bool wait_for_callbacks(int expected) {
+    for (int i = 0; i < 2000 && atomic_load(&callbacks) < expected; i++) sleep_ms(1);
+    return atomic_load(&callbacks) == expected;
+}
+
+static void exec(sqlite3 *db, const char *sql) {
+    char *error = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &error) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, error ? error : "?");
+        assert(false);
+    }
+}
+
+static void remove_db(const char *path) {
+    char side[1100];
+    unlink(path);
+    snprintf(side, sizeof(side), "%s-wal", path);
+    unlink(side);
+    snprintf(side, sizeof(side), "%s-shm", path);
+    unlink(side);
+}
+
+/// A WAL mode database with one row, and the writer that keeps the -wal alive
+static sqlite3 *create_db(char *path, size_t capacity, const char *name) {
+    const char *tmp = getenv("TMPDIR");
+    snprintf(path, capacity, "%s/comfy-%d-%s", tmp && *tmp ? tmp : "/tmp", (int)getpid(), name);
+    remove_db(path);
+
+    sqlite3 *db = NULL;
+    assert(sqlite3_open(path, &db) == SQLITE_OK);
+    exec(db, "PRAGMA journal_mode = WAL;");
+    exec(db, "CREATE TABLE message (ROWID INTEGER PRIMARY KEY, text TEXT);");
+    exec(db, "INSERT INTO message (text) VALUES ('first');");
+    return db;
+}
+
+/// Bytes past the last frame SQLite published are never read, zeros are no valid frame either
+static void append_to_wal(const char *path, size_t length) {
+    char wal[1100];
+    snprintf(wal, sizeof(wal), "%s-wal", path);
+    FILE *file = fopen(wal, "ab");
+    assert(file);
+    for (size_t i = 0; i < length; i++) fputc(0, file);
+    assert(fclose(file) == 0);
+}
+
+// MARK: - Scripted Backend
+
+/// Stands in for the kernel: the test says when a file changed, and every
+/// timeout the watcher asked for is written down
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t waiting;
+    int control[2];
+    int timeouts[64];
+    int waits;
+} ScriptedBackend;
+
+static ScriptedBackend scripted = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .waiting = PTHREAD_COND_INITIALIZER,
+};
+
+static void *scripted_open(const char *db_path) {
+    (void)db_path;
+    if (pipe(scripted.control) != 0) return NULL;
+    scripted.waits = 0;
+    return &scripted;
+}
+
+static ChatDBWaitResult scripted_wait(void *state, int wake_fd, int timeout_ms) {
+    ScriptedBackend *backend = state;
+    pthread_mutex_lock(&backend->lock);
+    if (backend->waits < 64) backend->timeouts[backend->waits] = timeout_ms;
+    backend->waits++;
+    pthread_cond_broadcast(&backend->waiting);
+    pthread_mutex_unlock(&backend->lock);
+
+    struct pollfd pfds[2] = {
+        { .fd = wake_fd,             .events = POLLIN },
+        { .fd = backend->control[0], .events = POLLIN },
+    };
+    int rc = poll(pfds, 2, timeout_ms);
+    if (rc < 0) return CHATDB_WAIT_ERROR;
+    if (rc == 0) return CHATDB_WAIT_TIMEOUT;
+    if (pfds[0].revents & POLLIN) return CHATDB_WAIT_WOKEN;
+
+    char byte;
+    assert(read(backend->control[0], &byte, 1) == 1);
+    return CHATDB_WAIT_CHANGED;
+}
+
+static void scripted_close(void *state) {
+    ScriptedBackend *backend = state;
+    close(backend->control[0]);
+    close(backend->control[1]);
+}
+
+static const ChatDBWatcherBackend scripted_backend = {
+    .name  = "scripted",
+    .open  = scripted_open,
+    .wait  = scripted_wait,
+    .close = scripted_close,
+};
+
+static void report_file_event(void) {
+    char byte = 1;
+    assert(write(scripted.control[1], &byte, 1) == 1);
+}
+
+/// Blocks until a wait after the `after`th one is a wait forever, returns its number
+static int wait_until_asleep(int after) {
+    pthread_mutex_lock(&scripted.lock);
+    while (scripted.waits <= after || scripted.timeouts[scripted.waits - 1] != -1) {
+        pthread_cond_wait(&scripted.waiting, &scripted.lock);
+    }
+    int waits = scripted.waits;
+    pthread_mutex_unlock(&scripted.lock);
+    return waits;
+}
+
+static void check_settle(void) {
+    char path[1024];
+    sqlite3 *writer = create_db(path, sizeof(path), "watcher-settle.db");
+    atomic_store(&callbacks, 0);
+
+    ChatDBWatcher *watcher = chatdb_watcher_start(path, &scripted_backend, count_callback, NULL);
+    assert(watcher);
+    assert(wait_until_asleep(0) == 1);
+
+    /// Nothing committed behind the event: one look, then the whole backoff, then sleep
+    report_file_event();
+    assert(wait_until_asleep(1) == 7);
+    const int expected[] = { -1, 2, 5, 10, 25, 50, -1 };
+    for (int i = 0; i < 7; i++) assert(scripted.timeouts[i] == expected[i]);
+
+    ChatDBWatcherStats stats = chatdb_watcher_stats(watcher);
+    assert(stats.file_events == 1 && stats.version_checks == 6 && stats.callbacks == 0);
+    assert(atomic_load(&callbacks) == 0);
+
+    /// Idle means no SQL at all
+    sleep_ms(200);
+    stats = chatdb_watcher_stats(watcher);
+    assert(stats.version_checks == 6);
+    pthread_mutex_lock(&scripted.lock);
+    assert(scripted.waits == 7);
+    pthread_mutex_unlock(&scripted.lock);
+
+    /// The commit lands only after the event and its first look, a retry has to catch it
+    report_file_event();
+    pthread_mutex_lock(&scripted.lock);
+    while (scripted.waits < 9) pthread_cond_wait(&scripted.waiting, &scripted.lock);
+    pthread_mutex_unlock(&scripted.lock);
+    exec(writer, "INSERT INTO message (text) VALUES ('late');");
+    assert(wait_for_callbacks(1));
+    wait_until_asleep(9);
+
+    stats = chatdb_watcher_stats(watcher);
+    assert(stats.file_events == 2 && stats.callbacks == 1);
+
+    chatdb_watcher_stop(watcher);
+    sqlite3_close(writer);
+    remove_db(path);
+}
+
+// MARK: - Real Backends
+
+static void check_backend(const ChatDBWatcherBackend *backend) {
+    char path[1024], name[64];
+    snprintf(name, sizeof(name), "watcher-%s.db", backend->name);
+    sqlite3 *writer = create_db(path, sizeof(path), name);
+    atomic_store(&callbacks, 0);
+
+    ChatDBWatcher *watcher = chatdb_watcher_start(path, backend, count_callback, NULL);
+    assert(watcher);
+
+    exec(writer, "INSERT INTO message (text) VALUES ('one');");
+    assert(wait_for_callbacks(1));
+
+    /// A checkpoint writes chat.db, and frames appended past the last commit
+    /// are what a writer leaves before it publishes the header in -shm
+    sleep_ms(100);
+    uint64_t events = chatdb_watcher_stats(watcher).file_events;
+    exec(writer, "PRAGMA wal_checkpoint(PASSIVE);");
+    append_to_wal(path, 4096);
+    sleep_ms(300);
+    ChatDBWatcherStats stats = chatdb_watcher_stats(watcher);
+    assert(stats.file_events > events);
+    assert(atomic_load(&callbacks) == 1 && stats.callbacks == 1);
+
+    /// Once the backoff ran out, nothing runs until the files change again
+    uint64_t checks = stats.version_checks;
+    sleep_ms(300);
+    assert(chatdb_watcher_stats(watcher).version_checks == checks);
+
+    exec(writer, "INSERT INTO message (text) VALUES ('two');");
+    assert(wait_for_callbacks(2));
+
+    chatdb_watcher_stop(watcher);
+    sqlite3_close(writer);
+    remove_db(path);
+}
+
+int main(void) {
+    check_settle();
+    check_backend(chatdb_watcher_default_backend());
+    check_backend(chatdb_watcher_poll_backend());
+    printf("chatdb_watcher_test passed\n");
+    return 0;
+}
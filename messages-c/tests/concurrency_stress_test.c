@@ -0,0 +1,145 @@
+//
+//  concurrency_stress_test.c
+//  ComfyNotch
+//
+//  Hammers one MessagesContext from several threads while another connection
+//  keeps committing messages. Build with -DMESSAGES_SANITIZE_THREAD=ON to run
+//  it under ThreadSanitizer.
+//
+//  Every received message has to be reported by has_chat_db_changed exactly
+//  once, no matter which thread happened to see it.
+//
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "test_chat_db.h"
+
+#define HANDLES         40
+#define SEED_MESSAGES   1000
+#define NEW_MESSAGES    400
+#define READERS         6
+#define DETECTORS       3
+#define LONG_TEXT       10000
+
+static MessagesContext *ctx;
+static atomic_bool writer_done = false;
+static atomic_int received_total = 0;
+static int64_t handle_ids[HANDLES];
+
+static void *writer_thread(void *arg) {
+    sqlite3 *db = arg;
+    char guid[64];
+    char *long_text = malloc(LONG_TEXT + 1);
+    memset(long_text, 'x', LONG_TEXT);
+    long_text[LONG_TEXT] = '\0';
+    
+    for (int i = 0; i < NEW_MESSAGES; i++) {
+        snprintf(guid, sizeof(guid), "NEW-%d", i);
+        const char *text = i % 50 == 0 ? long_text : "hello";
+        test_chat_db_add_message(db, guid, handle_ids[i % HANDLES], text, 1000000 + i, i % 4 == 0);
+        if (i % 20 == 0) usleep(1000);
+    }
+    
+    free(long_text);
+    atomic_store(&writer_done, true);
+    return NULL;
+}
+
+static void *reader_thread(void *arg) {
+    (void)arg;
+    char small[16];
+    MessagesHandleSummary summaries[HANDLES];
+    
+    while (!atomic_load(&writer_done)) {
+        for (int h = 0; h < HANDLES; h++) {
+            assert(get_last_talked_to(ctx, handle_ids[h]) > 0);
+            
+            /// Small buffer on purpose, the call must report the full length
+            MessagesBody body;
+            int64_t length = get_last_message_body(ctx, handle_ids[h], small, sizeof(small), &body);
+            assert(length >= 0);
+            assert(body.kind == MESSAGES_BODY_TEXT);
+            if (length > (int64_t)sizeof(small)) {
+                assert(body.data == NULL);
+                /// The newest message may have changed in between, a retry
+                /// either fits or reports the new length again
+                char *full = malloc(length);
+                int64_t again = get_last_message_body(ctx, handle_ids[h], full, length, &body);
+                assert(again >= 0);
+                assert(body.data == (again <= length ? full : NULL));
+                assert((int64_t)body.length == again);
+                free(full);
+            } else {
+                assert(body.data == small);
+            }
+        }
+        
+        int count = get_handle_summaries(ctx, handle_ids, HANDLES, summaries, HANDLES);
+        assert(count == HANDLES);
+        free_handle_summaries(summaries, count);
+    }
+    return NULL;
+}
+
+static void *detector_thread(void *arg) {
+    (void)arg;
+    while (!atomic_load(&writer_done)) {
+        atomic_fetch_add(&received_total, has_chat_db_changed(ctx));
+        usleep(200);
+    }
+    return NULL;
+}
+
+int main(void) {
+    char path[512], id[32], guid[64];
+    test_chat_db_path(path, sizeof(path), "stress-chat.db");
+    
+    sqlite3 *db = test_chat_db_create(path);
+    assert(db);
+    
+    for (int h = 0; h < HANDLES; h++) {
+        snprintf(id, sizeof(id), "+1555000%04d", h);
+        handle_ids[h] = test_chat_db_add_handle(db, id, "iMessage");
+    }
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    for (int i = 0; i < SEED_MESSAGES; i++) {
+        snprintf(guid, sizeof(guid), "SEED-%d", i);
+        test_chat_db_add_message(db, guid, handle_ids[i % HANDLES], "seed", 1 + i, i % 2);
+    }
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    
+    ctx = messages_context_open(path);
+    assert(ctx);
+    
+    /// Seeds the watermark so the seed rows are not counted
+    assert(has_chat_db_changed(ctx) == 0);
+    
+    pthread_t writer, readers[READERS], detectors[DETECTORS];
+    pthread_create(&writer, NULL, writer_thread, db);
+    for (int i = 0; i < READERS; i++) pthread_create(&readers[i], NULL, reader_thread, NULL);
+    for (int i = 0; i < DETECTORS; i++) pthread_create(&detectors[i], NULL, detector_thread, NULL);
+    
+    pthread_join(writer, NULL);
+    for (int i = 0; i < READERS; i++) pthread_join(readers[i], NULL);
+    for (int i = 0; i < DETECTORS; i++) pthread_join(detectors[i], NULL);
+    
+    atomic_fetch_add(&received_total, has_chat_db_changed(ctx));
+    
+    int expected = NEW_MESSAGES - NEW_MESSAGES / 4;
+    if (atomic_load(&received_total) != expected) {
+        fprintf(stderr, "received %d, expected %d\n", atomic_load(&received_total), expected);
+        return 1;
+    }
+    
+    messages_context_close(ctx);
+    sqlite3_close(db);
+    unlink(path);
+    printf("concurrency_stress_test passed\n");
+    return 0;
+}
@@ -0,0 +1,221 @@
+//
+//  contact_index_test.c
+//  ComfyNotch
+//
+//  Checks phone and email normalization, lookups by exact and suffix keys
+//  (ambiguous suffixes match nothing), batch resolves, and that readers keep
+//  a usable index while other threads swap new ones in.
+//
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "ContactIndex.h"
+
+static void check_phone(const char *value, int country, const char *expected) {
+    char out[CONTACT_KEY_MAX];
+    size_t length = contact_normalize_phone(value, country, out, sizeof(out));
+    if (!expected) {
+        assert(length == 0);
+        return;
+    }
+    if (length != strlen(expected) || strcmp(out, expected) != 0) {
+        fprintf(stderr, "%s -> %s, expected %s\n", value, length ? out : "(nothing)", expected);
+        assert(0);
+    }
+}
+
+static void check_email(const char *value, const char *expected) {
+    char out[CONTACT_KEY_MAX];
+    size_t length = contact_normalize_email(value, out, sizeof(out));
+    if (!expected) {
+        assert(length == 0);
+        return;
+    }
+    if (length != strlen(expected) || strcmp(out, expected) != 0) {
+        fprintf(stderr, "%s -> %s, expected %s\n", value, length ? out : "(nothing)", expected);
+        assert(0);
+    }
+}
+
+static void check_normalize(void) {
+    check_phone("+1 (555) 123-4567", 1, "+15551234567");
+    check_phone("(555) 123-4567", 1, "+15551234567");
+    check_phone("1-555-123-4567", 1, "+15551234567");
+    check_phone("555.123.4567", 0, "5551234567");
+    check_phone("07911 123456", 44, "+447911123456");
+    check_phone("0044 7911 123456", 1, "+447911123456");
+    check_phone("+44 7911 123456", 1, "+447911123456");
+    check_phone("447911123456", 44, "+447911123456");
+    check_phone("12345", 1, "12345");
+    check_phone("call me", 1, NULL);
+    check_phone("", 1, NULL);
+
+    check_email("  John.Appleseed@iCloud.COM ", "john.appleseed@icloud.com");
+    check_email("mailto:Someone@Example.org", "someone@example.org");
+    check_email("user@bücher.example", "user@xn--bcher-kva.example");
+    check_email("a@münchen.de", "a@xn--mnchen-3ya.de");
+    check_email("x@例え.テスト", "x@xn--r8jz45g.xn--zckzah");
+    check_email("no-at-sign", NULL);
+    check_email("@example.com", NULL);
+    check_email("two@@example.com", NULL);
+    check_email("bad@\xff\xfe.com", NULL);
+
+    char out[CONTACT_KEY_MAX];
+    ContactKeyKind kind;
+    assert(contact_normalize("Ann@Example.com", 1, out, sizeof(out), &kind) && kind == CONTACT_KEY_EMAIL);
+    assert(contact_normalize("555 123 4567", 1, out, sizeof(out), &kind) && kind == CONTACT_KEY_PHONE);
+    assert(!contact_normalize("urn:biz:abc", 1, out, sizeof(out), &kind) && kind == CONTACT_KEY_NONE);
+    /// Too small for the key
+    assert(contact_normalize_phone("+15551234567", 1, out, 5) == 0);
+}
+
+static ContactIndex *build_index(void) {
+    ContactIndexBuilder *builder = contact_index_builder_create(1);
+    assert(builder);
+
+    static const unsigned char photo[] = { 0x89, 'P', 'N', 'G' };
+    int32_t ann = contact_index_builder_add_contact(builder, "Ann Lee", photo, sizeof(photo));
+    int32_t bob = contact_index_builder_add_contact(builder, "Bob Ray", NULL, 0);
+    int32_t cat = contact_index_builder_add_contact(builder, "Cat Kim", NULL, 0);
+    int32_t dan = contact_index_builder_add_contact(builder, "Dan Fox", NULL, 0);
+    assert(ann == 0 && bob == 1 && cat == 2 && dan == 3);
+
+    assert(contact_index_builder_add_value(builder, ann, "(555) 123-4567"));
+    assert(contact_index_builder_add_value(builder, ann, "Ann.Lee@Example.com"));
+    assert(contact_index_builder_add_value(builder, bob, "07911 123456"));
+    assert(contact_index_builder_add_value(builder, bob, "bob@bücher.example"));
+    /// Same last 7 digits as Ann, in another area code
+    assert(contact_index_builder_add_value(builder, cat, "+1 212 123 4567"));
+    /// The same number twice, the first contact keeps it
+    assert(contact_index_builder_add_value(builder, dan, "555 123 4567"));
+    assert(!contact_index_builder_add_value(builder, dan, "no number here"));
+    assert(!contact_index_builder_add_value(builder, 9, "555 000 0000"));
+
+    ContactIndex *index = contact_index_builder_finish(builder);
+    assert(index);
+    assert(contact_index_contacts(index) == 4);
+    return index;
+}
+
+static void check_lookups(void) {
+    ContactIndex *index = build_index();
+
+    assert(contact_index_lookup(index, "+15551234567") == 0);
+    assert(contact_index_lookup(index, "ann.lee@example.com") == 0);
+    assert(contact_index_lookup(index, "ANN.LEE@EXAMPLE.COM") == 0);
+    assert(contact_index_lookup(index, "+12121234567") == 2);
+    assert(contact_index_lookup(index, "bob@xn--bcher-kva.example") == 1);
+
+    /// Saved as a national number under the wrong country, found by its last 10 digits
+    assert(contact_index_lookup(index, "+447911123456") == 1);
+    /// Last 7 digits are Ann's and Cat's, so they match neither
+    assert(contact_index_lookup(index, "123-4567") == -1);
+    assert(contact_index_lookup(index, "+19991234567") == -1);
+    assert(contact_index_lookup(index, "stranger@example.com") == -1);
+    assert(contact_index_lookup(index, "") == -1);
+
+    assert(strcmp(contact_index_name(index, 0), "Ann Lee") == 0);
+    assert(strcmp(contact_index_name(index, 3), "Dan Fox") == 0);
+    assert(contact_index_name(index, 4) == NULL && contact_index_name(index, -1) == NULL);
+    size_t length;
+    const unsigned char *image = contact_index_image(index, 0, &length);
+    assert(image && length == 4 && image[1] == 'P');
+    assert(contact_index_image(index, 1, &length) == NULL && length == 0);
+
+    const char *handles[] = { "+15551234567", "nobody@example.com", "+447911123456", "+12121234567" };
+    int32_t out[4];
+    assert(contact_index_resolve(index, handles, 4, out) == 3);
+    assert(out[0] == 0 && out[1] == -1 && out[2] == 1 && out[3] == 2);
+
+    contact_index_free(index);
+
+    /// An empty index looks up nothing
+    ContactIndex *empty = contact_index_builder_finish(contact_index_builder_create(1));
+    assert(empty && contact_index_keys(empty) == 0);
+    assert(contact_index_lookup(empty, "+15551234567") == -1);
+    contact_index_free(empty);
+}
+
+/// Each index generation names its one contact after the generation number
+static ContactIndex *generation_index(int generation) {
+    ContactIndexBuilder *builder = contact_index_builder_create(1);
+    char name[32];
+    snprintf(name, sizeof(name), "gen %d", generation);
+    int32_t contact = contact_index_builder_add_contact(builder, name, NULL, 0);
+    assert(contact_index_builder_add_value(builder, contact, "+15550000000"));
+    return contact_index_builder_finish(builder);
+}
+
+static atomic_bool stop_readers;
+static atomic_long lookups;
+/// Readers that finished a lookup, the swaps only start once all have
+static atomic_int ready_readers;
+
+static void *read_directory(void *arg) {
+    ContactDirectory *directory = arg;
+    int last = -1;
+    bool ready = false;
+    while (!atomic_load(&stop_readers)) {
+        ContactDirectoryRead read = contact_directory_acquire(directory);
+        const char *handles[] = { "+15550000000", "555-000-0000" };
+        int32_t out[2];
+        assert(contact_index_resolve(read.index, handles, 2, out) == 2);
+        int generation;
+        assert(sscanf(contact_index_name(read.index, out[0]), "gen %d", &generation) == 1);
+        /// Swaps only ever move forward
+        assert(generation >= last);
+        last = generation;
+        contact_directory_release(directory, read);
+        atomic_fetch_add(&lookups, 1);
+        if (!ready) {
+            ready = true;
+            atomic_fetch_add(&ready_readers, 1);
+        }
+    }
+    return NULL;
+}
+
+static void check_directory(void) {
+    ContactDirectory *directory = contact_directory_create();
+    assert(directory);
+
+    ContactDirectoryRead read = contact_directory_acquire(directory);
+    assert(read.index == NULL);
+    contact_directory_release(directory, read);
+
+    contact_directory_swap(directory, generation_index(0));
+
+    pthread_t readers[3];
+    for (int i = 0; i < 3; i++) assert(pthread_create(&readers[i], NULL, read_directory, directory) == 0);
+    while (atomic_load(&ready_readers) < 3) sched_yield();
+
+    /// Every tenth swap waits for a lookup, so they overlap even on one core
+    long before = atomic_load(&lookups);
+    for (int generation = 1; generation <= 100; generation++) {
+        contact_directory_swap(directory, generation_index(generation));
+        if (generation % 10 == 0) {
+            long seen = atomic_load(&lookups);
+            while (atomic_load(&lookups) == seen) sched_yield();
+        }
+    }
+    atomic_store(&stop_readers, true);
+    for (int i = 0; i < 3; i++) pthread_join(readers[i], NULL);
+    assert(atomic_load(&lookups) - before >= 10);
+
+    read = contact_directory_acquire(directory);
+    assert(strcmp(contact_index_name(read.index, 0), "gen 100") == 0);
+    contact_directory_release(directory, read);
+    contact_directory_destroy(directory);
+}
+
+int main(void) {
+    check_normalize();
+    check_lookups();
+    check_directory();
+    printf("contact_index_test passed\n");
+    return 0;
+}
@@ -0,0 +1,208 @@
+//
+//  conversation_cache_test.c
+//  ComfyNotch
+//
+//  Checks the per handle rings, LRU eviction under the byte budget, and that
+//  a MessagesContext keeps a cached conversation current from the delta scan
+//  so reopening it runs no statements.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ConversationCache.h"
+#include "Messages.h"
+#include "MessagesCursor.h"
+#include "test_chat_db.h"
+
+/// The plain_hello fixture, the smallest typedstream body Messages writes
+static const unsigned char hello_blob[] = {
+    0x04, 0x0b, 0x73, 0x74, 0x72, 0x65, 0x61, 0x6d, 0x74, 0x79, 0x70, 0x65, 0x64, 0x81, 0xe8, 0x03,
+    0x84, 0x01, 0x40, 0x84, 0x84, 0x84, 0x12, 0x4e, 0x53, 0x41, 0x74, 0x74, 0x72, 0x69, 0x62, 0x75,
+    0x74, 0x65, 0x64, 0x53, 0x74, 0x72, 0x69, 0x6e, 0x67, 0x00, 0x84, 0x84, 0x08, 0x4e, 0x53, 0x4f,
+    0x62, 0x6a, 0x65, 0x63, 0x74, 0x00, 0x85, 0x92, 0x84, 0x84, 0x84, 0x08, 0x4e, 0x53, 0x53, 0x74,
+    0x72, 0x69, 0x6e, 0x67, 0x01, 0x94, 0x84, 0x01, 0x2b, 0x05, 0x68, 0x65, 0x6c, 0x6c, 0x6f, 0x86,
+    0x84, 0x02, 0x69, 0x49, 0x01, 0x05, 0x92, 0x84, 0x84, 0x84, 0x0c, 0x4e, 0x53, 0x44, 0x69, 0x63,
+    0x74, 0x69, 0x6f, 0x6e, 0x61, 0x72, 0x79, 0x00, 0x94, 0x84, 0x01, 0x69, 0x01, 0x92, 0x84, 0x96,
+    0x96, 0x1d, 0x5f, 0x5f, 0x6b, 0x49, 0x4d, 0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x50, 0x61,
+    0x72, 0x74, 0x41, 0x74, 0x74, 0x72, 0x69, 0x62, 0x75, 0x74, 0x65, 0x4e, 0x61, 0x6d, 0x65, 0x86,
+    0x92, 0x84, 0x84, 0x84, 0x08, 0x4e, 0x53, 0x4e, 0x75, 0x6d, 0x62, 0x65, 0x72, 0x00, 0x84, 0x84,
+    0x07, 0x4e, 0x53, 0x56, 0x61, 0x6c, 0x75, 0x65, 0x00, 0x94, 0x84, 0x01, 0x2a, 0x84, 0x99, 0x99,
+    0x00, 0x86, 0x86, 0x86,
+};
+
+typedef struct {
+    int64_t rowids[256];
+    char texts[256][32];
+    int count;
+} Visited;
+
+static void remember(const ConversationCacheMessage *message, void *userdata) {
+    Visited *visited = userdata;
+    visited->rowids[visited->count] = message->rowid;
+    snprintf(visited->texts[visited->count], 32, "%s", message->text);
+    visited->count++;
+}
+
+static ConversationCacheMessage message_at(int64_t rowid, const char *text) {
+    return (ConversationCacheMessage){
+        .rowid = rowid, .date = rowid * 10, .text = text, .text_length = strlen(text)
+    };
+}
+
+static void test_ring(void) {
+    ConversationCache *cache = conversation_cache_create(1 << 20, 8);
+    ConversationCacheMessage page[5];
+    for (int i = 0; i < 5; i++) page[i] = message_at(50 - i, "page");
+    
+    assert(conversation_cache_fill(cache, 7, page, 5, true));
+    
+    Visited visited = { .count = 0 };
+    assert(conversation_cache_visit(cache, 7, 20, remember, &visited) == 5);
+    assert(visited.rowids[0] == 50 && visited.rowids[4] == 46);
+    
+    /// New rows go on the head, past the ring size the oldest fall off
+    for (int64_t rowid = 51; rowid <= 60; rowid++) {
+        assert(conversation_cache_push(cache, 7, &(ConversationCacheMessage){
+            .rowid = rowid, .date = rowid * 10, .text = "pushed", .text_length = 6 }));
+    }
+    visited.count = 0;
+    assert(conversation_cache_visit(cache, 7, 8, remember, &visited) == 8);
+    for (int i = 0; i < 8; i++) assert(visited.rowids[i] == 60 - i);
+    assert(strcmp(visited.texts[0], "pushed") == 0);
+    
+    /// It no longer holds the whole conversation, asking for more is a miss
+    assert(conversation_cache_visit(cache, 7, 9, remember, &visited) == -1);
+    
+    /// A row it already has is fine, an out of order one it can't place drops it
+    ConversationCacheMessage again = message_at(58, "pushed");
+    assert(conversation_cache_push(cache, 7, &again));
+    ConversationCacheMessage late = message_at(40, "late");
+    late.date = 555;
+    assert(!conversation_cache_push(cache, 7, &late));
+    assert(!conversation_cache_contains(cache, 7));
+    
+    /// Uncached handles are left alone
+    assert(!conversation_cache_push(cache, 8, &again));
+    assert(!conversation_cache_contains(cache, 8));
+    
+    ConversationCacheStats stats = conversation_cache_stats(cache);
+    assert(stats.pushes == 10 && stats.invalidations == 1);
+    assert(stats.conversations == 0 && stats.bytes == 0);
+    conversation_cache_destroy(cache);
+}
+
+static void test_lru_budget(void) {
+    /// Room for about three conversations of four short messages
+    ConversationCache *probe = conversation_cache_create(SIZE_MAX, 4);
+    ConversationCacheMessage page[4];
+    for (int i = 0; i < 4; i++) page[i] = message_at(4 - i, "0123456789");
+    conversation_cache_fill(probe, 1, page, 4, true);
+    size_t one = conversation_cache_stats(probe).bytes;
+    conversation_cache_destroy(probe);
+    
+    ConversationCache *cache = conversation_cache_create(one * 3 + one / 2, 4);
+    for (int64_t handle = 1; handle <= 3; handle++) {
+        assert(conversation_cache_fill(cache, handle, page, 4, true));
+    }
+    
+    /// Touch 1 so 2 is the least recently used, then make room for 4
+    Visited visited = { .count = 0 };
+    assert(conversation_cache_visit(cache, 1, 4, remember, &visited) == 4);
+    assert(conversation_cache_fill(cache, 4, page, 4, true));
+    
+    assert(conversation_cache_contains(cache, 1));
+    assert(!conversation_cache_contains(cache, 2));
+    assert(conversation_cache_contains(cache, 3));
+    assert(conversation_cache_contains(cache, 4));
+    
+    ConversationCacheStats stats = conversation_cache_stats(cache);
+    assert(stats.evictions == 1 && stats.conversations == 3);
+    assert(stats.bytes <= one * 3 + one / 2);
+    conversation_cache_destroy(cache);
+    
+    /// Plenty of handles, so the table grows and deletes shift entries back
+    cache = conversation_cache_create(SIZE_MAX, 2);
+    for (int64_t handle = 0; handle < 2000; handle++) {
+        assert(conversation_cache_fill(cache, handle, page, 2, false));
+    }
+    for (int64_t handle = 0; handle < 2000; handle += 2) conversation_cache_invalidate(cache, handle);
+    for (int64_t handle = 0; handle < 2000; handle++) {
+        assert(conversation_cache_contains(cache, handle) == (handle % 2 == 1));
+    }
+    assert(conversation_cache_stats(cache).conversations == 1000);
+    conversation_cache_destroy(cache);
+}
+
+static void test_context(void) {
+    char path[512];
+    char guid[32];
+    test_chat_db_path(path, sizeof(path), "conversation-cache.db");
+    
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t handle = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    for (int i = 0; i < 30; i++) {
+        snprintf(guid, sizeof(guid), "H-%d", i);
+        test_chat_db_add_message(writer, guid, handle, "history", 100 + i, i % 2);
+    }
+    
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    assert(has_chat_db_changed(ctx) == 0);
+    
+    MessagesPageRow page[20];
+    MessagesCursor cursor = messages_cursor_make(handle);
+    assert(messages_cursor_cached(ctx, &cursor, page, 20) == -1);
+    
+    /// The first open reads SQLite and seeds the cache
+    int count = messages_cursor_older(ctx, &cursor, page, 20);
+    assert(count == 20);
+    free_messages_page(page, count);
+    
+    /// A new message lands in the cache through the delta scan, body decoded in C
+    int64_t rowid = test_chat_db_add_message(writer, "N-1", handle, NULL, 500, false);
+    assert(test_chat_db_set_attributed_body(writer, rowid, hello_blob, sizeof(hello_blob)));
+    assert(has_chat_db_changed(ctx) == 1);
+    
+    /// Reopening runs no statements at all
+    MessagesContextStats before = messages_context_stats(ctx);
+    cursor = messages_cursor_make(handle);
+    count = messages_cursor_cached(ctx, &cursor, page, 20);
+    MessagesContextStats after = messages_context_stats(ctx);
+    assert(count == 20);
+    assert(after.prepares == before.prepares && after.prepares_avoided == before.prepares_avoided);
+    
+    assert(page[0].rowid == rowid && strcmp(page[0].text, "hello") == 0);
+    assert(page[1].date == 129 && strcmp(page[1].text, "history") == 0);
+    assert(cursor.has_rows && cursor.newest_rowid == rowid);
+    free_messages_page(page, count);
+    
+    /// The cursor carries on from the cached page with SQLite
+    count = messages_cursor_older(ctx, &cursor, page, 20);
+    assert(count == 11);
+    assert(page[0].date == 110 && page[10].date == 100);
+    free_messages_page(page, count);
+    
+    ConversationCacheStats stats = messages_context_cache_stats(ctx);
+    assert(stats.hits == 1 && stats.misses == 1 && stats.pushes == 1);
+    
+    /// Resizing starts over empty
+    assert(messages_context_set_cache_budget(ctx, 1 << 16, 32));
+    cursor = messages_cursor_make(handle);
+    assert(messages_cursor_cached(ctx, &cursor, page, 20) == -1);
+    
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+}
+
+int main(void) {
+    test_ring();
+    test_lru_budget();
+    test_context();
+    printf("conversation_cache_test passed\n");
+    return 0;
+}
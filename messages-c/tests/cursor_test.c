@@ -0,0 +1,110 @@
+//
+//  cursor_test.c
+//  ComfyNotch
+//
+//  Pages a conversation both ways with the keyset cursor and checks every
+//  message comes back exactly once, in order, while new ones keep arriving.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesCursor.h"
+#include "test_chat_db.h"
+
+#define HISTORY 1000
+#define PAGE    37
+
+/// (date, ROWID) strictly descending
+static bool is_older(const MessagesPageRow *a, const MessagesPageRow *b) {
+    return b->date < a->date || (b->date == a->date && b->rowid < a->rowid);
+}
+
+int main(void) {
+    char path[512];
+    char guid[64];
+    test_chat_db_path(path, sizeof(path), "cursor.db");
+    
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t handle = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    int64_t other = test_chat_db_add_handle(writer, "+15550000002", "iMessage");
+    
+    /// Every fourth date repeats so ties on date have to be broken by ROWID
+    for (int i = 0; i < HISTORY; i++) {
+        snprintf(guid, sizeof(guid), "H-%d", i);
+        test_chat_db_add_message(writer, guid, handle, "history", 1000 + i - (i % 4 == 1), i % 2);
+        snprintf(guid, sizeof(guid), "O-%d", i);
+        test_chat_db_add_message(writer, guid, other, "someone else", 1000 + i, false);
+    }
+    
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    
+    MessagesCursor cursor = messages_cursor_make(handle);
+    MessagesPageRow page[PAGE];
+    MessagesPageRow last = { .date = INT64_MAX, .rowid = INT64_MAX };
+    int seen = 0;
+    int arrived = 0;
+    
+    for (;;) {
+        int count = messages_cursor_older(ctx, &cursor, page, PAGE);
+        assert(count >= 0);
+        if (count == 0) break;
+        
+        for (int i = 0; i < count; i++) {
+            assert(strcmp(page[i].text, "history") == 0);
+            assert(is_older(&last, &page[i]));
+            last = page[i];
+        }
+        seen += count;
+        free_messages_page(page, count);
+        
+        /// New messages landing at the head must not shift the older pages
+        if (seen < HISTORY && arrived < 5) {
+            snprintf(guid, sizeof(guid), "N-%d", arrived++);
+            test_chat_db_add_message(writer, guid, handle, "new", 5000 + arrived, false);
+        }
+    }
+    assert(seen == HISTORY);
+    assert(messages_cursor_older(ctx, &cursor, page, PAGE) == 0);
+    
+    /// The head picks up everything that arrived, oldest first, and then stops
+    int count = messages_cursor_newer(ctx, &cursor, page, PAGE);
+    assert(count == arrived);
+    for (int i = 0; i < count; i++) {
+        assert(strcmp(page[i].text, "new") == 0);
+        assert(page[i].date == 5000 + i + 1);
+    }
+    free_messages_page(page, count);
+    assert(messages_cursor_newer(ctx, &cursor, page, PAGE) == 0);
+    
+    test_chat_db_add_message(writer, "N-late", handle, "late", 9000, true);
+    count = messages_cursor_newer(ctx, &cursor, page, PAGE);
+    assert(count == 1 && page[0].is_from_me && page[0].date == 9000);
+    free_messages_page(page, count);
+    
+    /// A conversation with nothing in it yet fills from the start once it does
+    int64_t quiet = test_chat_db_add_handle(writer, "+15550000003", "iMessage");
+    MessagesCursor empty = messages_cursor_make(quiet);
+    assert(messages_cursor_older(ctx, &empty, page, PAGE) == 0);
+    assert(messages_cursor_newer(ctx, &empty, page, PAGE) == 0);
+    test_chat_db_add_message(writer, "Q-1", quiet, "first", 1, false);
+    test_chat_db_add_message(writer, "Q-2", quiet, "second", 2, false);
+    count = messages_cursor_newer(ctx, &empty, page, PAGE);
+    assert(count == 2 && strcmp(page[0].text, "first") == 0);
+    free_messages_page(page, count);
+    assert(messages_cursor_older(ctx, &empty, page, PAGE) == 0);
+    
+    /// Both directions reuse their cached statements
+    MessagesContextStats stats = messages_context_stats(ctx);
+    assert(stats.prepares == 2);
+    
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+    printf("cursor_test passed\n");
+    return 0;
+}
@@ -0,0 +1,233 @@
+//
+//  event_ring_test.c
+//  ComfyNotch
+//
+//  Checks the event ring keeps order across a producer and consumer thread,
+//  reports overflow instead of blocking, keeps its wake fd readable exactly
+//  while events wait, never loses a wake-up to a consumer that only drains
+//  when the fd says so, and that a context's polls publish new handles, new
+//  messages and read state changes as they happen.
+//
+
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesEventRing.h"
+#include "test_chat_db.h"
+
+#define STRESS_EVENTS 200000
+
+static bool wake_fd_readable(const MessagesEventRing *ring) {
+    struct pollfd pfd = { .fd = messages_event_ring_wake_fd(ring), .events = POLLIN };
+    return poll(&pfd, 1, 0) == 1;
+}
+
+static MessagesEvent message_event(int64_t rowid) {
+    return (MessagesEvent){ .kind = MESSAGES_EVENT_NEW_MESSAGE, .rowid = rowid, .handle_id = rowid % 7 };
+}
+
+static void check_ring(void) {
+    MessagesEventRing *ring = messages_event_ring_create(5);
+    assert(ring);
+    MessagesEvent out[32];
+
+    assert(!wake_fd_readable(ring));
+    assert(!messages_event_ring_wait(ring, 0));
+    assert(messages_event_ring_drain(ring, out, 32) == 0);
+
+    /// Rounded up to 16
+    for (int64_t i = 1; i <= 16; i++) {
+        MessagesEvent event = message_event(i);
+        assert(messages_event_ring_push(ring, &event));
+    }
+    MessagesEvent extra = message_event(17);
+    assert(!messages_event_ring_push(ring, &extra));
+    assert(wake_fd_readable(ring) && messages_event_ring_wait(ring, 0));
+
+    /// The drop comes first, then everything that fit
+    assert(messages_event_ring_drain(ring, out, 5) == 5);
+    assert(out[0].kind == MESSAGES_EVENT_OVERFLOW);
+    for (int i = 1; i < 5; i++) assert(out[i].rowid == i);
+    /// Left over, so still readable
+    assert(wake_fd_readable(ring));
+    assert(messages_event_ring_drain(ring, out, 32) == 12);
+    assert(out[0].rowid == 5 && out[11].rowid == 16);
+    assert(!wake_fd_readable(ring));
+
+    MessagesEventRingStats stats = messages_event_ring_stats(ring);
+    assert(stats.pushed == 16 && stats.dropped == 1);
+    /// One write for the burst, one for the leftovers
+    assert(stats.wakes == 2);
+    messages_event_ring_destroy(ring);
+}
+
+static void *produce(void *arg) {
+    MessagesEventRing *ring = arg;
+    for (int64_t i = 1; i <= STRESS_EVENTS; i++) {
+        MessagesEvent event = message_event(i);
+        messages_event_ring_push(ring, &event);
+        if (i % 1000 == 0) usleep(50);
+    }
+    return NULL;
+}
+
+/// Whatever is not dropped arrives once, in order
+static void check_threads(void) {
+    MessagesEventRing *ring = messages_event_ring_create(256);
+    assert(ring);
+    pthread_t producer;
+    assert(pthread_create(&producer, NULL, produce, ring) == 0);
+
+    MessagesEvent out[64];
+    int64_t last = 0, received = 0;
+    int overflows = 0;
+    while (received + (int64_t)messages_event_ring_stats(ring).dropped < STRESS_EVENTS) {
+        if (!messages_event_ring_wait(ring, 1000)) continue;
+        int count = messages_event_ring_drain(ring, out, 64);
+        for (int i = 0; i < count; i++) {
+            if (out[i].kind == MESSAGES_EVENT_OVERFLOW) {
+                overflows++;
+                continue;
+            }
+            assert(out[i].rowid > last && out[i].handle_id == out[i].rowid % 7);
+            last = out[i].rowid;
+            received++;
+        }
+    }
+    pthread_join(producer, NULL);
+
+    MessagesEventRingStats stats = messages_event_ring_stats(ring);
+    assert(received + (int64_t)stats.dropped == STRESS_EVENTS);
+    assert((stats.dropped == 0) == (overflows == 0));
+    assert(received > 0);
+    messages_event_ring_destroy(ring);
+}
+
+static void *produce_burst(void *arg) {
+    MessagesEventRing *ring = arg;
+    for (int64_t i = 1; i <= STRESS_EVENTS; i++) {
+        MessagesEvent event = message_event(i);
+        messages_event_ring_push(ring, &event);
+    }
+    return NULL;
+}
+
+/// Like the app's DispatchSource: only drains once the wake fd is readable,
+/// so a swallowed wake-up leaves events behind and the poll times out
+static void check_wakes(void) {
+    for (int round = 0; round < 20; round++) {
+        MessagesEventRing *ring = messages_event_ring_create(64);
+        assert(ring);
+        pthread_t producer;
+        assert(pthread_create(&producer, NULL, produce_burst, ring) == 0);
+
+        MessagesEvent out[8];
+        int64_t last = 0, received = 0;
+        while (received + (int64_t)messages_event_ring_stats(ring).dropped < STRESS_EVENTS) {
+            struct pollfd pfd = { .fd = messages_event_ring_wake_fd(ring), .events = POLLIN };
+            int ready = poll(&pfd, 1, 2000);
+            assert(ready == 1);
+            int count = messages_event_ring_drain(ring, out, 8);
+            for (int i = 0; i < count; i++) {
+                if (out[i].kind == MESSAGES_EVENT_OVERFLOW) continue;
+                assert(out[i].rowid > last);
+                last = out[i].rowid;
+                received++;
+            }
+        }
+        pthread_join(producer, NULL);
+
+        /// Everything drained, and the fd says so
+        assert(messages_event_ring_drain(ring, out, 8) == 0);
+        assert(!wake_fd_readable(ring));
+        messages_event_ring_destroy(ring);
+    }
+}
+
+static int drain(MessagesContext *ctx, MessagesEvent *out, int capacity) {
+    return messages_event_ring_drain(messages_context_events(ctx), out, capacity);
+}
+
+static void exec(sqlite3 *db, const char *sql) {
+    assert(sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK);
+}
+
+static void check_context(void) {
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "events.db");
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+
+    int64_t alice = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    int64_t a1 = test_chat_db_add_message(writer, "A-1", alice, "hi", 1, false);
+
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    assert(messages_context_events(ctx) == NULL);
+    assert(messages_context_attach_events(ctx, 64));
+    MessagesEventRing *ring = messages_context_events(ctx);
+    assert(messages_context_attach_events(ctx, 64) && messages_context_events(ctx) == ring);
+
+    /// What was there before the first poll is not news
+    MessagesEvent out[16];
+    assert(has_chat_db_changed(ctx) == 0);
+    assert(drain(ctx, out, 16) == 0);
+
+    /// A new contact writes its handle and first message together
+    int64_t bob = test_chat_db_add_handle(writer, "+15550000002", "iMessage");
+    int64_t b1 = test_chat_db_add_message(writer, "B-1", bob, "new number, it's bob", 2, false);
+    int64_t a2 = test_chat_db_add_message(writer, "A-2", alice, "sent from my phone", 3, true);
+    assert(has_chat_db_changed(ctx) == 1);
+    assert(wake_fd_readable(ring));
+
+    int count = drain(ctx, out, 16);
+    assert(count == 4);
+    assert(out[0].kind == MESSAGES_EVENT_HANDLE_ADDED && out[0].handle_id == bob);
+    /// The unread row is counted by the scan, then reported
+    assert(out[1].kind == MESSAGES_EVENT_READ_STATE && out[1].rowid == b1 && !out[1].is_read);
+    assert(out[1].handle_id == bob && out[1].unread == 1);
+    assert(out[2].kind == MESSAGES_EVENT_NEW_MESSAGE && out[2].rowid == b1);
+    assert(out[2].handle_id == bob && !out[2].is_from_me && out[2].date == 2 && out[2].unread == 1);
+    assert(out[3].kind == MESSAGES_EVENT_NEW_MESSAGE && out[3].rowid == a2 && out[3].is_from_me);
+    assert(out[3].unread == 1);
+    assert(!wake_fd_readable(ring));
+
+    /// Read on another device, no new row
+    char sql[128];
+    snprintf(sql, sizeof(sql), "UPDATE message SET is_read = 1 WHERE ROWID = %lld;", (long long)a1);
+    exec(writer, sql);
+    assert(has_chat_db_changed(ctx) == 0);
+    assert(drain(ctx, out, 16) == 1);
+    assert(out[0].kind == MESSAGES_EVENT_READ_STATE && out[0].rowid == a1 && out[0].is_read);
+    assert(out[0].handle_id == alice && out[0].unread == 0);
+
+    /// Marked unread again
+    snprintf(sql, sizeof(sql), "UPDATE message SET is_read = 0 WHERE ROWID = %lld;", (long long)a1);
+    exec(writer, sql);
+    has_chat_db_changed(ctx);
+    assert(drain(ctx, out, 16) == 1);
+    assert(out[0].kind == MESSAGES_EVENT_READ_STATE && out[0].rowid == a1 && !out[0].is_read);
+    assert(out[0].unread == 1);
+
+    /// Nothing happened, nothing published
+    has_chat_db_changed(ctx);
+    assert(drain(ctx, out, 16) == 0);
+    assert(!wake_fd_readable(ring));
+
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+}
+
+int main(void) {
+    check_ring();
+    check_threads();
+    check_wakes();
+    check_context();
+    printf("event_ring_test passed\n");
+    return 0;
+}
@@ -0,0 +1,133 @@
+//
+//  hashmap_test.c
+//  ComfyNotch
+//
+//  Checks the seen-message map keeps its put / get / free behaviour across
+//  resizes, and that the seen set only reports a GUID once.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "MessageHashMap.h"
+
+static void format_key(char *key, size_t size, int i) {
+    snprintf(key, size, "GUID-%08d-%s", i, i % 3 ? "short" : "a-much-longer-suffix-to-cross-16");
+}
+
+static void test_map(void) {
+    MessageHashMap map;
+    char key[64];
+    message_hashmap_init(&map, HASHMAP_SIZE);
+    
+    /// Enough keys to force several doublings from HASHMAP_SIZE
+    for (int i = 0; i < 20000; i++) {
+        format_key(key, sizeof(key), i);
+        MessageMeta meta = { .isFromMe = i % 2, .date = i };
+        assert(message_hashmap_put(&map, key, meta));
+    }
+    assert(map.count == 20000);
+    
+    for (int i = 0; i < 20000; i++) {
+        format_key(key, sizeof(key), i);
+        MessageMeta *meta = message_hashmap_get(&map, key);
+        assert(meta != NULL);
+        assert(meta->date == i);
+        assert(meta->isFromMe == (i % 2));
+    }
+    assert(message_hashmap_get(&map, "GUID-not-there") == NULL);
+    assert(message_hashmap_get(&map, "") == NULL);
+    
+    /// An existing key with a new date is updated in place, not duplicated
+    MessageMeta updated = { .isFromMe = true, .date = 123456 };
+    message_hashmap_put(&map, "GUID-00000004-short", updated);
+    assert(map.count == 20000);
+    assert(message_hashmap_get(&map, "GUID-00000004-short")->date == 123456);
+    
+    message_hashmap_free(&map);
+    assert(map.count == 0);
+    assert(message_hashmap_get(&map, "GUID-00000004-short") == NULL);
+    
+    /// Usable again after a free, a NULL key is refused
+    assert(message_hashmap_put(&map, "again", updated));
+    assert(message_hashmap_get(&map, "again") != NULL);
+    assert(!message_hashmap_put(&map, NULL, updated));
+    assert(map.count == 1);
+    message_hashmap_free(&map);
+}
+
+static void test_seen_set(void) {
+    MessageSeenSet set;
+    MessageMeta meta = { .isFromMe = false, .date = 42 };
+    MessageMeta out = { 0 };
+    message_seen_set_init(&set);
+    
+    assert(message_seen_set_insert(&set, "A", meta));
+    assert(!message_seen_set_insert(&set, "A", meta));
+    assert(message_seen_set_get(&set, "A", &out) && out.date == 42);
+    assert(!message_seen_set_get(&set, "B", NULL));
+    assert(message_seen_set_count(&set) == 1);
+    
+    message_seen_set_destroy(&set);
+}
+
+/// A month of traffic through a one hour window stays at about two hours of GUIDs
+static void test_seen_set_expiry(void) {
+    const int64_t second = 1000000000LL;       // chat.db dates are nanoseconds
+    const int64_t start = 700000000LL * second;
+    const int per_minute = 20;
+    MessageSeenSet set;
+    message_seen_set_init(&set);
+    message_seen_set_set_window(&set, 60 * 60);
+    assert(message_seen_set_cutoff(&set) == INT64_MIN);
+    
+    char guid[48];
+    size_t peak = 0;
+    int minutes = 30 * 24 * 60;
+    for (int minute = 0; minute < minutes; minute++) {
+        for (int i = 0; i < per_minute; i++) {
+            snprintf(guid, sizeof(guid), "G-%d-%d", minute, i);
+            MessageMeta meta = { .isFromMe = false, .date = start + (int64_t)minute * 60 * second + i };
+            assert(message_seen_set_insert(&set, guid, meta));
+        }
+        size_t count = message_seen_set_count(&set);
+        if (count > peak) peak = count;
+    }
+    assert(peak <= (size_t)(2 * 60 + 1) * per_minute);
+    assert(message_seen_set_expired(&set) + message_seen_set_count(&set) == (uint64_t)minutes * per_minute);
+    
+    /// Everything inside the window is still deduped, the oldest is gone
+    int64_t cutoff = message_seen_set_cutoff(&set);
+    assert(cutoff == start + (int64_t)(minutes - 1) * 60 * second + per_minute - 1 - 3600 * second);
+    for (int minute = minutes - 60; minute < minutes; minute++) {
+        snprintf(guid, sizeof(guid), "G-%d-%d", minute, 0);
+        assert(message_seen_set_get(&set, guid, NULL));
+    }
+    assert(!message_seen_set_get(&set, "G-0-0", NULL));
+    
+    /// Quiet for longer than two windows, both generations go
+    MessageMeta later = { .date = start + (int64_t)(minutes + 3 * 60) * 60 * second };
+    assert(message_seen_set_insert(&set, "late", later));
+    assert(message_seen_set_count(&set) == 1);
+    message_seen_set_destroy(&set);
+    
+    /// Window 0 never forgets, old seconds-based dates scale the window too
+    message_seen_set_init(&set);
+    message_seen_set_set_window(&set, 0);
+    for (int i = 0; i < 1000; i++) {
+        snprintf(guid, sizeof(guid), "S-%d", i);
+        assert(message_seen_set_insert(&set, guid, (MessageMeta){ .date = (int64_t)i * 86400 }));
+    }
+    assert(message_seen_set_count(&set) == 1000 && message_seen_set_cutoff(&set) == INT64_MIN);
+    message_seen_set_set_window(&set, 86400);
+    assert(message_seen_set_cutoff(&set) == 999 * 86400 - 86400);
+    message_seen_set_destroy(&set);
+}
+
+int main(void) {
+    test_map();
+    test_seen_set();
+    test_seen_set_expiry();
+    printf("hashmap_test passed\n");
+    return 0;
+}
@@ -0,0 +1,106 @@
+//
+//  int64_table_test.c
+//  ComfyNotch
+//
+//  Checks the shared int64 table against a plain array through random
+//  inserts and removes on clustered keys, so backward shift deletion is
+//  exercised across wrapped probe runs and resizes.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Int64Table.h"
+
+#define KEYS 4096
+
+/// -1 when the key is not in
+static int64_t reference[KEYS];
+
+/// Every slot sits in the probe run of its home, nothing is lost or doubled
+static void check_against_reference(const Int64Table *table) {
+    size_t count = 0;
+    for (int64_t key = 0; key < KEYS; key++) {
+        Int64TableSlot *slot = int64_table_find(table, key);
+        if (reference[key] < 0) {
+            assert(slot == NULL);
+            continue;
+        }
+        assert(slot && slot->key == key && slot->value == reference[key]);
+        count++;
+    }
+    assert(table->count == count);
+    assert(table->count * 2 <= table->capacity);
+}
+
+static void check_randomized(void) {
+    Int64Table table;
+    assert(int64_table_init(&table, 0) && table.capacity == 16);
+    for (int i = 0; i < KEYS; i++) reference[i] = -1;
+
+    srand(7);
+    for (int round = 0; round < 300; round++) {
+        for (int op = 0; op < 100; op++) {
+            /// A narrow range early on keeps runs long and wrapping
+            int64_t key = rand() % (round < 100 ? 64 : KEYS);
+            if (rand() % 3) {
+                bool inserted;
+                Int64TableSlot *slot = int64_table_insert(&table, key, &inserted);
+                assert(slot && slot->key == key);
+                assert(inserted == (reference[key] < 0));
+                if (inserted) assert(slot->value == 0 && slot->stamp == 0);
+                slot->value = reference[key] = rand();
+            } else {
+                Int64TableSlot *slot = int64_table_find(&table, key);
+                assert((slot != NULL) == (reference[key] >= 0));
+                if (slot) int64_table_remove(&table, slot);
+                reference[key] = -1;
+            }
+        }
+        check_against_reference(&table);
+    }
+
+    /// Empty it again
+    for (int64_t key = 0; key < KEYS; key++) {
+        Int64TableSlot *slot = int64_table_find(&table, key);
+        if (slot) int64_table_remove(&table, slot);
+        reference[key] = -1;
+    }
+    check_against_reference(&table);
+    assert(table.count == 0);
+    int64_table_free(&table);
+}
+
+static void check_edges(void) {
+    Int64Table table;
+    assert(int64_table_init(&table, 100) && table.capacity == 128);
+    assert(int64_table_insert(&table, INT64_TABLE_EMPTY, NULL) == NULL);
+    assert(int64_table_find(&table, INT64_TABLE_EMPTY) == NULL);
+
+    /// Sized for it, filling to half never moves the slots
+    Int64TableSlot *slots = table.slots;
+    for (int64_t key = 0; key < 64; key++) assert(int64_table_insert(&table, key * 1000 - 5000, NULL));
+    assert(table.slots == slots && table.count == 64);
+    assert(int64_table_insert(&table, INT64_MAX, NULL) && table.capacity == 256);
+    assert(int64_table_find(&table, -5000) && int64_table_find(&table, INT64_MAX));
+
+    /// Pointers and stamps move with their slot
+    int marker = 0;
+    Int64TableSlot *slot = int64_table_find(&table, 0);
+    slot->pointer = &marker;
+    slot->stamp = 9;
+    int64_table_remove(&table, int64_table_find(&table, -5000));
+    slot = int64_table_find(&table, 0);
+    assert(slot->pointer == &marker && slot->stamp == 9);
+
+    int64_table_free(&table);
+    assert(table.slots == NULL && table.count == 0);
+    int64_table_free(NULL);
+}
+
+int main(void) {
+    check_randomized();
+    check_edges();
+    printf("int64_table_test passed\n");
+    return 0;
+}
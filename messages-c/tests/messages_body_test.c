@@ -0,0 +1,120 @@
+//
+//  messages_body_test.c
+//  ComfyNotch
+//
+//  Checks the last message body comes back tagged and byte for byte, text as
+//  UTF-8 and attributedBody as the raw blob, through both the copying and the
+//  zero copy entry points.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "test_chat_db.h"
+
+/// Has NUL bytes and high bytes on purpose, neither may be mangled on the way out
+static const unsigned char blob[] = {
+    0x04, 0x0b, 's', 't', 'r', 'e', 'a', 'm', 't', 'y', 'p', 'e', 'd', 0x81, 0xe8, 0x03,
+    0x84, 0x01, 0x40, 0x84, 0x84, 0x84, 0x00, 0xff, 0x00, 0x2b, 0x05, 'h', 'e', 'l', 'l', 'o',
+};
+
+typedef struct {
+    int calls;
+    MessagesBodyKind kind;
+    unsigned char bytes[64];
+    size_t length;
+} VisitResult;
+
+static void remember_body(const MessagesBody *body, void *userdata) {
+    VisitResult *result = userdata;
+    result->calls++;
+    result->kind = body->kind;
+    result->length = body->length;
+    assert(body->length <= sizeof(result->bytes));
+    memcpy(result->bytes, body->data, body->length);
+}
+
+int main(void) {
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "body.db");
+    
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t text_handle = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    int64_t blob_handle = test_chat_db_add_handle(writer, "+15550000002", "iMessage");
+    int64_t empty_handle = test_chat_db_add_handle(writer, "+15550000003", "iMessage");
+    
+    test_chat_db_add_message(writer, "T-1", text_handle, "older", 1, false);
+    test_chat_db_add_message(writer, "T-2", text_handle, "héllo wörld", 2, true);
+    int64_t rowid = test_chat_db_add_message(writer, "B-1", blob_handle, "placeholder", 3, false);
+    assert(test_chat_db_set_attributed_body(writer, rowid, blob, sizeof(blob)));
+    
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    
+    /// Text is copied without a terminator and reports its byte length
+    const char *expected = "héllo wörld";
+    char buffer[64];
+    MessagesBody body;
+    int64_t length = get_last_message_body(ctx, text_handle, buffer, sizeof(buffer), &body);
+    assert(length == (int64_t)strlen(expected));
+    assert(body.kind == MESSAGES_BODY_TEXT);
+    assert(body.data == buffer && body.length == (size_t)length);
+    assert(memcmp(buffer, expected, length) == 0);
+    
+    /// The blob arrives untouched, no base64 or string conversion in between
+    length = get_last_message_body(ctx, blob_handle, buffer, sizeof(buffer), &body);
+    assert(length == (int64_t)sizeof(blob));
+    assert(body.kind == MESSAGES_BODY_ATTRIBUTED);
+    assert(memcmp(buffer, blob, sizeof(blob)) == 0);
+    
+    /// Too small: nothing copied, the full length is reported for the retry
+    length = get_last_message_body(ctx, blob_handle, buffer, 4, &body);
+    assert(length == (int64_t)sizeof(blob));
+    assert(body.kind == MESSAGES_BODY_ATTRIBUTED && body.data == NULL);
+    
+    /// A NULL buffer is a size query
+    assert(get_last_message_body(ctx, text_handle, NULL, 0, NULL) == (int64_t)strlen(expected));
+    
+    /// No message at all
+    length = get_last_message_body(ctx, empty_handle, buffer, sizeof(buffer), &body);
+    assert(length == -1);
+    assert(body.kind == MESSAGES_BODY_NONE);
+    
+    /// The visitor sees the same bytes straight from SQLite
+    VisitResult visited = { 0 };
+    assert(visit_last_message_body(ctx, blob_handle, remember_body, &visited));
+    assert(visited.calls == 1);
+    assert(visited.kind == MESSAGES_BODY_ATTRIBUTED);
+    assert(visited.length == sizeof(blob));
+    assert(memcmp(visited.bytes, blob, sizeof(blob)) == 0);
+    
+    memset(&visited, 0, sizeof(visited));
+    assert(!visit_last_message_body(ctx, empty_handle, remember_body, &visited));
+    assert(visited.calls == 0);
+    
+    /// Summaries go through the same column reader
+    int64_t ids[] = { text_handle, blob_handle };
+    MessagesHandleSummary summaries[2];
+    assert(get_handle_summaries(ctx, ids, 2, summaries, 2) == 2);
+    for (int i = 0; i < 2; i++) {
+        if (summaries[i].handle_id == text_handle) {
+            assert(summaries[i].text && strcmp(summaries[i].text, expected) == 0);
+            assert(!summaries[i].attributed_body);
+        } else {
+            assert(!summaries[i].text);
+            assert(summaries[i].attributed_body_len == (int)sizeof(blob));
+            assert(memcmp(summaries[i].attributed_body, blob, sizeof(blob)) == 0);
+        }
+    }
+    free_handle_summaries(summaries, 2);
+    
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+    printf("messages_body_test passed\n");
+    return 0;
+}
@@ -0,0 +1,215 @@
+//
+//  messages_worker_test.c
+//  ComfyNotch
+//
+//  Checks the worker runs the highest priority first, merges repeated
+//  requests that are still queued into one run while completing every one of
+//  them, never merges into a run in progress, and completes dropped jobs on
+//  stop.
+//
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesWorker.h"
+#include "test_chat_db.h"
+
+#define MAX_EVENTS 64
+
+/// What ran, in order, as the `tag` of each job
+static int ran[MAX_EVENTS];
+static atomic_int ran_count = 0;
+static atomic_int completed = 0;
+
+typedef struct {
+    int tag;
+    int completions;
+} TestJob;
+
+static void record_run(MessagesContext *ctx, void *userdata) {
+    (void)ctx;
+    ran[atomic_fetch_add(&ran_count, 1)] = ((TestJob *)userdata)->tag;
+}
+
+static void record_complete(void *userdata) {
+    ((TestJob *)userdata)->completions++;
+    atomic_fetch_add(&completed, 1);
+}
+
+static void submit(MessagesWorker *worker, uint32_t kind, int64_t key,
+                   MessagesJobPriority priority, TestJob *job) {
+    MessagesJob request = {
+        .kind = kind, .key = key, .priority = priority,
+        .run = record_run, .complete = record_complete, .userdata = job,
+    };
+    assert(messages_worker_submit(worker, &request));
+}
+
+/// Holds the worker thread inside a job until released, so jobs pile up behind it
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static bool gate_entered, gate_open;
+
+static void gate_run(MessagesContext *ctx, void *userdata) {
+    (void)ctx;
+    (void)userdata;
+    pthread_mutex_lock(&gate_lock);
+    gate_entered = true;
+    pthread_cond_broadcast(&gate_cond);
+    while (!gate_open) pthread_cond_wait(&gate_cond, &gate_lock);
+    pthread_mutex_unlock(&gate_lock);
+}
+
+static void close_gate(MessagesWorker *worker, uint32_t kind, int64_t key) {
+    gate_entered = gate_open = false;
+    MessagesJob job = { .kind = kind, .key = key, .priority = MESSAGES_PRIORITY_NORMAL, .run = gate_run };
+    assert(messages_worker_submit(worker, &job));
+
+    pthread_mutex_lock(&gate_lock);
+    while (!gate_entered) pthread_cond_wait(&gate_cond, &gate_lock);
+    pthread_mutex_unlock(&gate_lock);
+}
+
+static void open_gate(void) {
+    pthread_mutex_lock(&gate_lock);
+    gate_open = true;
+    pthread_cond_broadcast(&gate_cond);
+    pthread_mutex_unlock(&gate_lock);
+}
+
+static void *stop_worker(void *worker) {
+    messages_worker_stop(worker);
+    return NULL;
+}
+
+static void reset_events(void) {
+    atomic_store(&ran_count, 0);
+    atomic_store(&completed, 0);
+}
+
+/// Runs on the worker thread against the real context
+typedef struct {
+    int64_t handle;
+    int64_t last_talked_to;
+    int changed;
+} QueryJob;
+
+static void query_run(MessagesContext *ctx, void *userdata) {
+    QueryJob *job = userdata;
+    job->last_talked_to = get_last_talked_to(ctx, job->handle);
+    job->changed = has_chat_db_changed(ctx);
+}
+
+int main(void) {
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "messages_worker.db");
+
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t handle = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    test_chat_db_add_message(writer, "W-1", handle, "hello", 10, false);
+
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    MessagesWorker *worker = messages_worker_start(ctx);
+    assert(worker);
+
+    /// Priorities: visible, then normal, then background, FIFO within a level
+    TestJob background = { .tag = 1 }, normal_a = { .tag = 2 }, normal_b = { .tag = 3 }, visible = { .tag = 4 };
+    close_gate(worker, 0, 0);
+    submit(worker, 0, 0, MESSAGES_PRIORITY_BACKGROUND, &background);
+    submit(worker, 0, 0, MESSAGES_PRIORITY_NORMAL, &normal_a);
+    submit(worker, 0, 0, MESSAGES_PRIORITY_NORMAL, &normal_b);
+    submit(worker, 0, 0, MESSAGES_PRIORITY_VISIBLE, &visible);
+    assert(messages_worker_stats(worker).pending == 4);
+    open_gate();
+    messages_worker_drain(worker, MESSAGES_PRIORITY_BACKGROUND);
+    assert(atomic_load(&ran_count) == 4);
+    assert(ran[0] == 4 && ran[1] == 2 && ran[2] == 3 && ran[3] == 1);
+    reset_events();
+
+    /// Five refreshes of one handle while the worker is busy: one run, with the
+    /// newest request, and every one of them completed
+    TestJob refreshes[5];
+    close_gate(worker, 0, 0);
+    MessagesWorkerStats before = messages_worker_stats(worker);
+    for (int i = 0; i < 5; i++) {
+        refreshes[i] = (TestJob){ .tag = 10 + i };
+        submit(worker, 7, handle, MESSAGES_PRIORITY_NORMAL, &refreshes[i]);
+    }
+    /// Same kind for another key is its own job
+    TestJob other_handle = { .tag = 20 };
+    submit(worker, 7, handle + 1, MESSAGES_PRIORITY_NORMAL, &other_handle);
+    open_gate();
+    messages_worker_drain(worker, MESSAGES_PRIORITY_BACKGROUND);
+
+    MessagesWorkerStats after = messages_worker_stats(worker);
+    assert(after.merged - before.merged == 4);
+    assert(atomic_load(&ran_count) == 2);
+    assert(ran[0] == 14 && ran[1] == 20);
+    for (int i = 0; i < 5; i++) assert(refreshes[i].completions == 1);
+    assert(atomic_load(&completed) == 6);
+    reset_events();
+
+    /// A merge that asks for more moves the job ahead of lower ones
+    TestJob slow = { .tag = 30 }, poll = { .tag = 31 }, opened = { .tag = 32 };
+    close_gate(worker, 0, 0);
+    submit(worker, 3, handle, MESSAGES_PRIORITY_BACKGROUND, &slow);
+    submit(worker, 0, 0, MESSAGES_PRIORITY_NORMAL, &poll);
+    submit(worker, 3, handle, MESSAGES_PRIORITY_VISIBLE, &opened);
+    open_gate();
+    messages_worker_drain(worker, MESSAGES_PRIORITY_BACKGROUND);
+    assert(atomic_load(&ran_count) == 2);
+    assert(ran[0] == 32 && ran[1] == 31);
+    assert(slow.completions == 1 && opened.completions == 1);
+    reset_events();
+
+    /// A request for the job that is running queues another run, the running
+    /// one may already have read past what the caller wants to see
+    close_gate(worker, 9, handle);
+    TestJob again = { .tag = 40 };
+    submit(worker, 9, handle, MESSAGES_PRIORITY_NORMAL, &again);
+    open_gate();
+    messages_worker_drain(worker, MESSAGES_PRIORITY_BACKGROUND);
+    assert(atomic_load(&ran_count) == 1 && ran[0] == 40);
+    reset_events();
+
+    /// Jobs get the worker's context, and see commits made since the last one
+    QueryJob query = { .handle = handle };
+    MessagesJob request = { .kind = 1, .key = handle, .priority = MESSAGES_PRIORITY_VISIBLE,
+                            .run = query_run, .userdata = &query };
+    assert(messages_worker_submit(worker, &request));
+    messages_worker_drain(worker, MESSAGES_PRIORITY_BACKGROUND);
+    assert(query.last_talked_to == 10 && query.changed == 0);
+
+    test_chat_db_add_message(writer, "W-2", handle, "still there?", 20, false);
+    assert(messages_worker_submit(worker, &request));
+    messages_worker_drain(worker, MESSAGES_PRIORITY_BACKGROUND);
+    assert(query.last_talked_to == 20 && query.changed == 1);
+
+    /// Stop finishes the running job and completes the queued ones unrun
+    TestJob dropped[3];
+    close_gate(worker, 0, 0);
+    for (int i = 0; i < 3; i++) {
+        dropped[i] = (TestJob){ .tag = 50 + i };
+        submit(worker, 0, 0, MESSAGES_PRIORITY_NORMAL, &dropped[i]);
+    }
+    /// Stop from another thread and let the gate go once it has taken the queue
+    pthread_t stopper;
+    assert(pthread_create(&stopper, NULL, stop_worker, worker) == 0);
+    while (messages_worker_stats(worker).pending != 0) usleep(100);
+    open_gate();
+    pthread_join(stopper, NULL);
+    assert(atomic_load(&ran_count) == 0);
+    for (int i = 0; i < 3; i++) assert(dropped[i].completions == 1);
+
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+    printf("messages_worker_test passed\n");
+    return 0;
+}
@@ -0,0 +1,108 @@
+//
+//  metrics_test.c
+//  ComfyNotch
+//
+//  Checks every entry point lands in its latency histogram, statements report
+//  what SQLite did for them, and a reset starts a clean window.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesContext.h"
+#include "MessagesContextInternal.h"
+#include "MessagesCursor.h"
+#include "test_chat_db.h"
+
+int main(void) {
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "metrics.db");
+
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t handle = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    for (int i = 0; i < 20; i++) {
+        char guid[32];
+        snprintf(guid, sizeof(guid), "M-%d", i);
+        assert(test_chat_db_add_message(writer, guid, handle, "hello", i + 1, i % 2) > 0);
+    }
+
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+
+    for (int i = 0; i < 100; i++) assert(get_last_talked_to(ctx, handle) == 20);
+    assert(has_chat_db_changed(ctx) == 0);
+
+    MessagesCursor cursor = messages_cursor_make(handle);
+    MessagesPageRow rows[8];
+    int count = messages_cursor_older(ctx, &cursor, rows, 8);
+    assert(count == 8);
+    free_messages_page(rows, count);
+
+    MessagesMetricsSnapshot snapshot;
+    assert(messages_context_metrics(ctx, &snapshot, false));
+
+    const MessagesLatencySummary *talked = &snapshot.operations[MESSAGES_OP_LAST_TALKED_TO];
+    assert(talked->count == 100);
+    assert(talked->p50_ns > 0 && talked->p50_ns <= talked->p90_ns);
+    assert(talked->p90_ns <= talked->p99_ns && talked->p99_ns <= talked->max_ns);
+    assert(talked->total_ns >= talked->max_ns);
+
+    /// has_chat_db_changed is timed on its own and through get_new_messages
+    assert(snapshot.operations[MESSAGES_OP_HAS_CHANGED].count == 1);
+    assert(snapshot.operations[MESSAGES_OP_NEW_MESSAGES].count == 1);
+    assert(snapshot.operations[MESSAGES_OP_CURSOR_OLDER].count == 1);
+    assert(snapshot.operations[MESSAGES_OP_SEARCH].count == 0);
+
+    const MessagesStatementMetrics *lookup = &snapshot.statements[MESSAGES_STMT_LAST_TALKED_TO];
+    assert(lookup->executions == 100);
+    assert(lookup->vm_steps > 0);
+    assert(lookup->fullscan_steps == 0);
+    assert(snapshot.statements[MESSAGES_STMT_PAGE_OLDER].executions == 1);
+
+    /// Nothing new in chat.db, so the seen set is still empty but allocated
+    assert(snapshot.seen.count == 0 && snapshot.seen.capacity > 0 && snapshot.seen.bytes > 0);
+
+    /// A snapshot with reset hands over the window, the next one starts empty
+    size_t needed = messages_context_metrics_json(ctx, NULL, 0, false);
+    assert(needed > 0);
+    char *json = malloc(needed + 1);
+    assert(messages_context_metrics_json(ctx, json, needed + 1, true) == needed);
+    assert(strlen(json) == needed);
+    assert(json[0] == '{' && json[needed - 1] == '}');
+    assert(strstr(json, "\"get_last_talked_to\":{\"count\":100,"));
+    assert(strstr(json, "\"LAST_TALKED_TO\":{\"executions\":100,"));
+    assert(!strstr(json, "search_messages"));
+
+    /// A short buffer is truncated but still terminated
+    char small[16];
+    assert(messages_context_metrics_json(ctx, small, sizeof(small), false) > sizeof(small));
+    assert(strlen(small) == sizeof(small) - 1);
+    free(json);
+
+    assert(messages_context_metrics(ctx, &snapshot, false));
+    for (int op = 0; op < MESSAGES_OP_COUNT; op++) {
+        assert(snapshot.operations[op].count == 0 && snapshot.operations[op].max_ns == 0);
+    }
+    assert(snapshot.statements[MESSAGES_STMT_LAST_TALKED_TO].executions == 0);
+
+    /// New GUIDs show up in the seen set's numbers
+    for (int i = 0; i < 50; i++) {
+        char guid[32];
+        snprintf(guid, sizeof(guid), "N-%d", i);
+        test_chat_db_add_message(writer, guid, handle, "new", 100 + i, false);
+    }
+    assert(has_chat_db_changed(ctx) == 50);
+    assert(messages_context_metrics(ctx, &snapshot, false));
+    assert(snapshot.seen.count == 50);
+    assert(snapshot.seen.mean_probe >= 1.0 && snapshot.seen.max_probe >= 1);
+
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+    printf("metrics_test passed\n");
+    return 0;
+}
@@ -0,0 +1,187 @@
+//
+//  page_columns_test.c
+//  ComfyNotch
+//
+//  Checks pages read into columns hold exactly what the row API returns,
+//  through older, newer and cached pages and after decoding, that the cursor
+//  moves the same either way, and that a buffer stops allocating once it has
+//  grown to the page size.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesCursor.h"
+#include "synthetic_chat_db.h"
+#include "test_chat_db.h"
+
+#define HANDLE  3
+#define PAGE    48
+
+static void assert_same_page(const MessagesPageRow *rows, const MessagesPageColumns *columns, int count) {
+    assert(columns->count == count);
+    for (int i = 0; i < count; i++) {
+        const MessagesPageRow *row = &rows[i];
+        uint8_t flags = columns->flags[i];
+        assert(columns->rowid[i] == row->rowid && columns->date[i] == row->date);
+        assert(columns->handle_id[i] == HANDLE);
+        assert(!!(flags & MESSAGES_PAGE_FROM_ME) == row->is_from_me);
+        assert(!!(flags & MESSAGES_PAGE_READ) == row->is_read);
+        assert(!!(flags & MESSAGES_PAGE_HAS_ATTACHMENTS) == row->has_attachments);
+
+        const char *body = columns->bodies + columns->body_offset[i];
+        size_t length = columns->body_length[i];
+        assert(body[length] == '\0');
+        if (row->text) {
+            assert(!(flags & MESSAGES_PAGE_ATTRIBUTED));
+            assert(length == strlen(row->text) && memcmp(body, row->text, length) == 0);
+        } else if (row->attributed_body) {
+            assert(flags & MESSAGES_PAGE_ATTRIBUTED);
+            assert(length == (size_t)row->attributed_body_len && memcmp(body, row->attributed_body, length) == 0);
+        } else {
+            assert(length == 0);
+        }
+    }
+}
+
+static void assert_same_cursor(const MessagesCursor *a, const MessagesCursor *b) {
+    assert(a->has_rows == b->has_rows);
+    assert(a->oldest_date == b->oldest_date && a->oldest_rowid == b->oldest_rowid);
+    assert(a->newest_date == b->newest_date && a->newest_rowid == b->newest_rowid);
+}
+
+/// Pages back through the whole conversation both ways, decoding as the app does
+static void check_older(MessagesContext *ctx, MessagesPageColumns *columns) {
+    MessagesCursor by_rows = messages_cursor_make(HANDLE), by_columns = messages_cursor_make(HANDLE);
+    MessagesPageRow rows[PAGE];
+    int pages = 0, blobs = 0, undecoded = 0;
+
+    for (;;) {
+        int count = messages_cursor_older(ctx, &by_rows, rows, PAGE);
+        assert(messages_cursor_older_columns(ctx, &by_columns, columns, PAGE) == count);
+        assert_same_cursor(&by_rows, &by_columns);
+        assert_same_page(rows, columns, count);
+        if (count == 0) break;
+
+        for (int i = 0; i < count; i++) blobs += rows[i].attributed_body != NULL;
+        int decoded = messages_page_decode(ctx, rows, count);
+        assert(messages_page_columns_decode(ctx, columns) == decoded);
+        assert_same_page(rows, columns, count);
+        for (int i = 0; i < count; i++) undecoded += rows[i].attributed_body != NULL;
+
+        free_messages_page(rows, count);
+        pages++;
+    }
+    assert(pages > 3 && blobs > 0);
+    /// Everything synthetic decodes in C
+    assert(undecoded == 0);
+}
+
+static void check_newer(MessagesContext *ctx, sqlite3 *writer, MessagesPageColumns *columns) {
+    MessagesCursor by_rows = messages_cursor_make(HANDLE), by_columns = messages_cursor_make(HANDLE);
+    MessagesPageRow rows[PAGE];
+
+    int count = messages_cursor_older(ctx, &by_rows, rows, 5);
+    free_messages_page(rows, count);
+    assert(messages_cursor_older_columns(ctx, &by_columns, columns, 5) == count);
+
+    /// Nothing new yet
+    assert(messages_cursor_newer(ctx, &by_rows, rows, PAGE) == 0);
+    assert(messages_cursor_newer_columns(ctx, &by_columns, columns, PAGE) == 0);
+    assert(columns->count == 0);
+
+    test_chat_db_add_message(writer, "NEWER-1", HANDLE, "first new", by_rows.newest_date + 1, false);
+    test_chat_db_add_message(writer, "NEWER-2", HANDLE, "", by_rows.newest_date + 2, true);
+    test_chat_db_add_message(writer, "NEWER-3", HANDLE, "third", by_rows.newest_date + 3, true);
+
+    count = messages_cursor_newer(ctx, &by_rows, rows, PAGE);
+    assert(count == 3);
+    assert(messages_cursor_newer_columns(ctx, &by_columns, columns, PAGE) == 3);
+    assert_same_cursor(&by_rows, &by_columns);
+    assert_same_page(rows, columns, count);
+    /// An empty text column is no body at all
+    assert(columns->body_length[1] == 0 && !(columns->flags[1] & MESSAGES_PAGE_ATTRIBUTED));
+    assert(strcmp(columns->bodies + columns->body_offset[2], "third") == 0);
+    free_messages_page(rows, count);
+}
+
+static void check_cached(MessagesContext *ctx, MessagesPageColumns *columns) {
+    MessagesCursor by_rows = messages_cursor_make(HANDLE), by_columns = messages_cursor_make(HANDLE);
+    MessagesPageRow rows[PAGE];
+
+    /// check_older read the newest page, which filled the cache
+    int count = messages_cursor_cached(ctx, &by_rows, rows, 20);
+    assert(count == 20);
+    assert(messages_cursor_cached_columns(ctx, &by_columns, columns, 20) == count);
+    assert_same_cursor(&by_rows, &by_columns);
+    assert_same_page(rows, columns, count);
+    free_messages_page(rows, count);
+
+    /// Only for a fresh cursor, and a miss is a miss either way
+    assert(messages_cursor_cached_columns(ctx, &by_columns, columns, 20) == -1);
+    MessagesCursor other = messages_cursor_make(HANDLE + 1);
+    assert(messages_cursor_cached_columns(ctx, &other, columns, 20) == -1);
+}
+
+/// Grows to the largest page, then every page reuses the same memory
+static void check_reuse(MessagesContext *ctx) {
+    MessagesPageColumns *columns = messages_page_columns_create();
+    assert(columns && columns->count == 0 && columns->row_capacity == 0);
+
+    MessagesCursor cursor = messages_cursor_make(HANDLE);
+    assert(messages_cursor_older_columns(ctx, &cursor, columns, 100) == 100);
+    assert(columns->row_capacity >= 100);
+
+    int64_t *block = columns->rowid;
+    char *bodies = columns->bodies;
+    int row_capacity = columns->row_capacity;
+    size_t bodies_capacity = columns->bodies_capacity;
+
+    cursor = messages_cursor_make(HANDLE);
+    for (int page = 0; page < 3; page++) {
+        assert(messages_cursor_older_columns(ctx, &cursor, columns, 30) == 30);
+        assert(columns->rowid == block && columns->bodies == bodies);
+        assert(columns->row_capacity == row_capacity && columns->bodies_capacity == bodies_capacity);
+    }
+
+    assert(messages_cursor_older_columns(NULL, &cursor, columns, 30) == -1);
+    assert(messages_cursor_older_columns(ctx, &cursor, columns, 0) == -1);
+    assert(messages_cursor_older_columns(ctx, &cursor, NULL, 30) == -1);
+    messages_page_columns_destroy(columns);
+    messages_page_columns_destroy(NULL);
+}
+
+int main(void) {
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "page_columns.db");
+
+    SyntheticChatDBConfig config = synthetic_chat_db_defaults();
+    config.handles = 8;
+    config.messages_per_handle = 300;
+    sqlite3 *writer = synthetic_chat_db_generate(path, &config);
+    assert(writer);
+
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    MessagesPageColumns *columns = messages_page_columns_create();
+    assert(columns);
+
+    check_older(ctx, columns);
+    check_cached(ctx, columns);
+    check_newer(ctx, writer, columns);
+    check_reuse(ctx);
+
+    /// The same, with decoding spread over a pool
+    assert(messages_context_attach_pool(ctx, 3));
+    check_older(ctx, columns);
+
+    messages_page_columns_destroy(columns);
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+    printf("page_columns_test passed\n");
+    return 0;
+}
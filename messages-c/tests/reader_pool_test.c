@@ -0,0 +1,181 @@
+//
+//  reader_pool_test.c
+//  ComfyNotch
+//
+//  Checks the reader pool runs every task exactly once, and that handle
+//  summaries and page decoding split over it come out the same, and in the
+//  same order, as on the context's own connection, with and without the
+//  sidecar index.
+//
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesCursor.h"
+#include "MessagesReaderPool.h"
+#include "synthetic_chat_db.h"
+#include "test_chat_db.h"
+
+#define HANDLES 120
+#define TASKS   1000
+
+static _Atomic int runs[TASKS];
+static size_t results[TASKS];
+
+static void record_task(MessagesReader *reader, size_t index, void *userdata) {
+    assert(reader);
+    atomic_fetch_add(&runs[index], 1);
+    results[index] = index * (size_t)userdata;
+}
+
+/// Each task reads the row count on its own reader connection
+static void count_messages(MessagesReader *reader, size_t index, void *userdata) {
+    int64_t *counts = userdata;
+    sqlite3_stmt *stmt = messages_reader_statement(reader, MESSAGES_STMT_MAX_ROWID);
+    assert(stmt && sqlite3_step(stmt) == SQLITE_ROW);
+    counts[index] = sqlite3_column_int64(stmt, 0);
+    messages_reader_release(reader, stmt);
+}
+
+static void check_pool(const char *path, int64_t max_rowid) {
+    MessagesReaderPool *pool = messages_reader_pool_open(path, 3, NULL);
+    assert(pool && messages_reader_pool_size(pool) == 3);
+
+    for (int round = 1; round <= 3; round++) {
+        messages_reader_pool_run(pool, TASKS, record_task, (void *)(size_t)round);
+        for (size_t i = 0; i < TASKS; i++) {
+            assert(atomic_load(&runs[i]) == round);
+            assert(results[i] == i * (size_t)round);
+        }
+    }
+
+    int64_t counts[32];
+    messages_reader_pool_run(pool, 32, count_messages, counts);
+    for (int i = 0; i < 32; i++) assert(counts[i] == max_rowid);
+
+    /// Nothing to do returns straight away
+    messages_reader_pool_run(pool, 0, record_task, NULL);
+    messages_reader_pool_close(pool);
+
+    assert(messages_reader_pool_open("/nonexistent/chat.db", 2, NULL) == NULL);
+}
+
+static void assert_same_summaries(const MessagesHandleSummary *a, const MessagesHandleSummary *b, int count) {
+    for (int i = 0; i < count; i++) {
+        assert(a[i].handle_id == b[i].handle_id);
+        assert(a[i].date == b[i].date);
+        assert(a[i].is_from_me == b[i].is_from_me);
+        assert((a[i].text == NULL) == (b[i].text == NULL));
+        if (a[i].text) assert(strcmp(a[i].text, b[i].text) == 0);
+        assert(a[i].attributed_body_len == b[i].attributed_body_len);
+        if (a[i].attributed_body_len) {
+            assert(memcmp(a[i].attributed_body, b[i].attributed_body, (size_t)a[i].attributed_body_len) == 0);
+        }
+    }
+}
+
+static void check_summaries(MessagesContext *serial, MessagesContext *pooled) {
+    MessagesHandleSummary a[HANDLES + 8], b[HANDLES + 8];
+
+    /// Every handle
+    int count = get_handle_summaries(serial, NULL, 0, a, HANDLES + 8);
+    assert(count == HANDLES);
+    assert(get_handle_summaries(pooled, NULL, 0, b, HANDLES + 8) == count);
+    assert_same_summaries(a, b, count);
+    free_handle_summaries(a, count);
+    free_handle_summaries(b, count);
+
+    /// Given ids come back in the order given, unknown ones without a message
+    int64_t ids[HANDLES + 1];
+    for (int i = 0; i < HANDLES; i++) ids[i] = HANDLES - i;
+    ids[HANDLES] = 999999;
+    count = get_handle_summaries(serial, ids, HANDLES + 1, a, HANDLES + 8);
+    assert(count == HANDLES + 1);
+    assert(get_handle_summaries(pooled, ids, HANDLES + 1, b, HANDLES + 8) == count);
+    assert_same_summaries(a, b, count);
+    for (int i = 0; i < count; i++) assert(b[i].handle_id == ids[i]);
+    assert(b[HANDLES].date == -1);
+    free_handle_summaries(a, count);
+    free_handle_summaries(b, count);
+
+    /// A short `out` takes the first ids
+    assert(get_handle_summaries(pooled, ids, HANDLES + 1, b, 40) == 40);
+    assert(b[39].handle_id == ids[39]);
+    free_handle_summaries(b, 40);
+}
+
+static void check_page_decode(MessagesContext *serial, MessagesContext *pooled) {
+    MessagesPageRow a[64], b[64];
+    MessagesCursor cursor_a = messages_cursor_make(7), cursor_b = messages_cursor_make(7);
+    int count = messages_cursor_older(serial, &cursor_a, a, 64);
+    assert(count > 16);
+    assert(messages_cursor_older(pooled, &cursor_b, b, 64) == count);
+
+    int blobs = 0;
+    for (int i = 0; i < count; i++) blobs += a[i].attributed_body != NULL;
+    assert(blobs > 0);
+
+    assert(messages_page_decode(serial, a, count) == blobs);
+    assert(messages_page_decode(pooled, b, count) == blobs);
+    for (int i = 0; i < count; i++) {
+        assert(a[i].rowid == b[i].rowid);
+        assert(a[i].text && b[i].text && strcmp(a[i].text, b[i].text) == 0);
+        assert(!a[i].attributed_body && !b[i].attributed_body);
+    }
+    /// Already decoded rows are left alone
+    assert(messages_page_decode(pooled, b, count) == 0);
+
+    free_messages_page(a, count);
+    free_messages_page(b, count);
+}
+
+int main(void) {
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "reader_pool.db");
+
+    SyntheticChatDBConfig config = synthetic_chat_db_defaults();
+    config.handles = HANDLES;
+    config.messages_per_handle = 40;
+    sqlite3 *writer = synthetic_chat_db_generate(path, &config);
+    assert(writer);
+
+    check_pool(path, (int64_t)HANDLES * 40);
+
+    MessagesContext *serial = messages_context_open(path);
+    MessagesContext *pooled = messages_context_open(path);
+    assert(serial && pooled);
+    assert(messages_context_attach_pool(pooled, 4));
+    assert(messages_context_attach_pool(pooled, 4));
+
+    check_summaries(serial, pooled);
+    check_page_decode(serial, pooled);
+
+    /// Through the sidecar index the readers only fetch rows by ROWID
+    char serial_index[600], pooled_index[600];
+    snprintf(serial_index, sizeof(serial_index), "%s.serial.idx", path);
+    snprintf(pooled_index, sizeof(pooled_index), "%s.pooled.idx", path);
+    assert(messages_context_attach_index(serial, serial_index));
+    assert(messages_context_attach_index(pooled, pooled_index));
+    synthetic_chat_db_append(writer, &config, 50);
+    check_summaries(serial, pooled);
+
+    /// Pool statements show up in the metrics like the context's own
+    MessagesMetricsSnapshot snapshot;
+    assert(messages_context_metrics(pooled, &snapshot, false));
+    assert(snapshot.statements[MESSAGES_STMT_HANDLE_SUMMARIES].executions > 0);
+    assert(snapshot.statements[MESSAGES_STMT_MESSAGE_BY_ROWID].executions >= HANDLES);
+    assert(snapshot.operations[MESSAGES_OP_PAGE_DECODE].count == 2);
+
+    messages_context_close(serial);
+    messages_context_close(pooled);
+    sqlite3_close(writer);
+    unlink(serial_index);
+    unlink(pooled_index);
+    unlink(path);
+    printf("reader_pool_test passed\n");
+    return 0;
+}
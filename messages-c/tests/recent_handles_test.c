@@ -0,0 +1,165 @@
+//
+//  recent_handles_test.c
+//  ComfyNotch
+//
+//  Checks the top K against sorting every handle's last date through random
+//  updates, then that a context's recent handles are the right ones from its
+//  first query and follow new messages, including handles coming in from
+//  outside the K and a larger K reading them again.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesContextInternal.h"
+#include "RecentHandles.h"
+#include "test_chat_db.h"
+
+#define HANDLES 300
+#define K       25
+
+static int64_t last_date[HANDLES];
+
+static int compare_reference(const void *a, const void *b) {
+    const RecentHandle *x = a, *y = b;
+    if (x->date != y->date) return x->date > y->date ? -1 : 1;
+    return x->handle_id > y->handle_id ? -1 : x->handle_id < y->handle_id;
+}
+
+/// Every handle with a message, newest first
+static int reference(RecentHandle *out) {
+    int count = 0;
+    for (int h = 0; h < HANDLES; h++) {
+        if (last_date[h] >= 0) out[count++] = (RecentHandle){ .handle_id = h, .date = last_date[h] };
+    }
+    qsort(out, (size_t)count, sizeof(RecentHandle), compare_reference);
+    return count;
+}
+
+static void check_against_reference(const RecentHandles *recent) {
+    RecentHandle expected[HANDLES], got[K + 4];
+    int total = reference(expected);
+    int count = recent_handles_copy(recent, got, K + 4);
+    assert(count == (total < K ? total : K));
+    assert(recent_handles_count(recent) == count);
+    for (int i = 0; i < count; i++) {
+        assert(got[i].handle_id == expected[i].handle_id && got[i].date == expected[i].date);
+        int64_t date;
+        assert(recent_handles_get(recent, got[i].handle_id, &date) && date == got[i].date);
+    }
+    if (count < total) assert(!recent_handles_get(recent, expected[count].handle_id, NULL));
+
+    RecentHandle newest;
+    assert(recent_handles_newest(recent, &newest) == (count > 0));
+    if (count) assert(newest.handle_id == expected[0].handle_id && newest.date == expected[0].date);
+
+    /// A short `out` gets the newest ones
+    if (count >= 3) {
+        assert(recent_handles_copy(recent, got, 3) == 3);
+        for (int i = 0; i < 3; i++) assert(got[i].handle_id == expected[i].handle_id);
+    }
+}
+
+static void check_randomized(void) {
+    assert(recent_handles_create(0) == NULL);
+    RecentHandles *recent = recent_handles_create(K);
+    assert(recent && recent_handles_capacity(recent) == K);
+    for (int h = 0; h < HANDLES; h++) last_date[h] = -1;
+    check_against_reference(recent);
+
+    srand(11);
+    int64_t clock = 1000;
+    for (int round = 0; round < 200; round++) {
+        for (int op = 0; op < 200; op++) {
+            int h = rand() % 10 ? rand() % 40 : rand() % HANDLES;
+            /// Mostly new messages, sometimes one dated before the last, sometimes a tie
+            int64_t date = rand() % 8 ? (clock += 1 + rand() % 5) : clock - rand() % 200;
+            bool moves = date > last_date[h];
+            if (moves) last_date[h] = date;
+            bool changed = recent_handles_update(recent, h, date);
+            if (!moves) assert(!changed);
+        }
+        check_against_reference(recent);
+    }
+    recent_handles_destroy(recent);
+}
+
+static void check_context(void) {
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "recent.db");
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+
+    /// Oldest handle first in ROWID order, so the first rows are the least recent
+    int64_t handles[40];
+    for (int i = 0; i < 40; i++) {
+        char id[32];
+        snprintf(id, sizeof(id), "+1555%07d", i);
+        handles[i] = test_chat_db_add_handle(writer, id, "iMessage");
+        char guid[32];
+        snprintf(guid, sizeof(guid), "SEED-%d", i);
+        test_chat_db_add_message(writer, guid, handles[i], "hi", 100 + i * 10, i % 2);
+    }
+    /// One handle without messages, and a message to a group with no handle
+    int64_t silent = test_chat_db_add_handle(writer, "silent@example.com", "iMessage");
+    test_chat_db_add_message(writer, "GROUP-1", 0, "to the group", 5000, true);
+
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    RecentHandle out[64];
+    assert(get_recent_handles(ctx, out, 0) == -1);
+
+    int count = get_recent_handles(ctx, out, 5);
+    assert(count == 5);
+    for (int i = 0; i < 5; i++) {
+        assert(out[i].handle_id == handles[39 - i] && out[i].date == 100 + (39 - i) * 10);
+    }
+
+    /// The oldest handle gets a message and goes to the front
+    test_chat_db_add_message(writer, "NEW-1", handles[0], "back again", 1000, false);
+    has_chat_db_changed(ctx);
+    assert(get_recent_handles(ctx, out, 5) == 5);
+    assert(out[0].handle_id == handles[0] && out[0].date == 1000);
+    assert(out[1].handle_id == handles[39] && out[4].handle_id == handles[36]);
+
+    /// Fewer than kept is the newest of them
+    assert(get_recent_handles(ctx, out, 2) == 2);
+    assert(out[0].handle_id == handles[0] && out[1].handle_id == handles[39]);
+
+    /// Sent counts the same as received, and nothing was queried for it
+    MessagesMetricsSnapshot before, after;
+    assert(messages_context_metrics(ctx, &before, false));
+    test_chat_db_add_message(writer, "NEW-2", handles[20], "replying", 1100, true);
+    has_chat_db_changed(ctx);
+    assert(get_recent_handles(ctx, out, 5) == 5);
+    assert(out[0].handle_id == handles[20] && out[1].handle_id == handles[0]);
+    assert(messages_context_metrics(ctx, &after, false));
+    assert(after.statements[MESSAGES_STMT_RECENT_HANDLES].executions ==
+           before.statements[MESSAGES_STMT_RECENT_HANDLES].executions);
+
+    /// Asking for more reads them again, the handle without messages and the
+    /// group message's handle_id 0 are not in
+    count = get_recent_handles(ctx, out, 64);
+    assert(count == 40);
+    for (int i = 0; i < count; i++) assert(out[i].handle_id != silent && out[i].handle_id != 0);
+    assert(out[0].handle_id == handles[20] && out[1].handle_id == handles[0] && out[2].handle_id == handles[39]);
+    for (int i = 1; i < count; i++) assert(out[i - 1].date >= out[i].date);
+    assert(messages_context_metrics(ctx, &after, false));
+    assert(after.statements[MESSAGES_STMT_RECENT_HANDLES].executions ==
+           before.statements[MESSAGES_STMT_RECENT_HANDLES].executions + 1);
+    assert(after.operations[MESSAGES_OP_RECENT_HANDLES].count == 5);
+
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+}
+
+int main(void) {
+    check_randomized();
+    check_context();
+    printf("recent_handles_test passed\n");
+    return 0;
+}
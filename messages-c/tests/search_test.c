@@ -0,0 +1,179 @@
+//
+//  search_test.c
+//  ComfyNotch
+//
+//  Checks search_messages against a LIKE scan (also ASCII case-insensitive)
+//  while the index is built, extended past its in-memory tail, reopened from
+//  disk, and rows are deleted or only carry an attributedBody.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessageSearch.h"
+#include "test_chat_db.h"
+
+#define HISTORY 6000
+#define HITS    256
+
+static const char *words[] = {
+    "Dinner", "tonight", "pizza", "Meeting", "moved", "tomorrow", "lol", "ok",
+    "airport", "pickup", "birthday", "Party", "running", "late", "coffee", "?",
+};
+
+/// Every ROWID whose text holds `query`, newest first, the way SQL sees it
+static int expected_hits(sqlite3 *db, const char *query, int64_t *out, int capacity) {
+    sqlite3_stmt *stmt;
+    assert(sqlite3_prepare_v2(db,
+                              "SELECT ROWID FROM message WHERE text LIKE '%' || ?1 || '%' "
+                              "ORDER BY date DESC, ROWID DESC LIMIT ?2;",
+                              -1, &stmt, NULL) == SQLITE_OK);
+    sqlite3_bind_text(stmt, 1, query, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, capacity);
+    int count = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) out[count++] = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+static void check_query(MessagesContext *ctx, sqlite3 *writer, const char *query) {
+    MessagesSearchHit hits[HITS];
+    int64_t expected[HITS];
+    int count = search_messages(ctx, query, hits, HITS);
+    int want = expected_hits(writer, query, expected, HITS);
+    assert(count == want);
+    for (int i = 0; i < count; i++) assert(hits[i].rowid == expected[i]);
+}
+
+static void check_all(MessagesContext *ctx, sqlite3 *writer) {
+    check_query(ctx, writer, "pizza");
+    check_query(ctx, writer, "PIZZA TONIGHT");
+    check_query(ctx, writer, "party lol");
+    check_query(ctx, writer, "irpo");
+    check_query(ctx, writer, "zebra");
+    check_query(ctx, writer, "unique-7");
+}
+
+static void add_messages(sqlite3 *writer, int64_t handle, int from, int to) {
+    char guid[64];
+    char text[256];
+    for (int i = from; i < to; i++) {
+        size_t len = (size_t)snprintf(text, sizeof(text), "unique-%d", i);
+        for (int w = 0; w < 1 + i % 6; w++) {
+            len += (size_t)snprintf(text + len, sizeof(text) - len, " %s", words[(i * 7 + w * 3) % 16]);
+        }
+        snprintf(guid, sizeof(guid), "G-%d", i);
+        test_chat_db_add_message(writer, guid, handle + i % 3, text, 1000 + i, i % 2);
+    }
+}
+
+int main(void) {
+    char path[512];
+    char index_path[600];
+    test_chat_db_path(path, sizeof(path), "search.db");
+    snprintf(index_path, sizeof(index_path), "%s.search", path);
+    unlink(index_path);
+
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t handle = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    test_chat_db_add_handle(writer, "+15550000002", "iMessage");
+    test_chat_db_add_handle(writer, "+15550000003", "iMessage");
+    add_messages(writer, handle, 0, HISTORY);
+
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+
+    MessagesSearchHit hits[HITS];
+    assert(search_messages(ctx, "pizza", hits, HITS) == -1);
+
+    assert(messages_context_attach_search(ctx, index_path));
+    check_all(ctx, writer);
+
+    /// Too short for a trigram
+    assert(search_messages(ctx, "ok", hits, HITS) == 0);
+
+    /// Arrivals after the build are found on the next query
+    add_messages(writer, handle, HISTORY, HISTORY + 500);
+    check_all(ctx, writer);
+
+    /// A hit that was deleted disappears, the capacity cuts the newest first
+    assert(sqlite3_exec(writer, "DELETE FROM message WHERE ROWID IN "
+                                "(SELECT ROWID FROM message WHERE text LIKE '%pizza%' LIMIT 40);",
+                        NULL, NULL, NULL) == SQLITE_OK);
+    check_all(ctx, writer);
+    int count = search_messages(ctx, "coffee", hits, 5);
+    assert(count == 5);
+    for (int i = 1; i < count; i++) assert(hits[i - 1].date > hits[i].date);
+
+    messages_context_close(ctx);
+
+    /// Reopening picks up from the file's watermark
+    add_messages(writer, handle, HISTORY + 500, HISTORY + 600);
+    ctx = messages_context_open(path);
+    assert(ctx);
+    assert(messages_context_attach_search(ctx, index_path));
+    check_all(ctx, writer);
+    messages_context_close(ctx);
+
+    /// Built a batch at a time. Closing halfway keeps what was indexed, the
+    /// next build only reads the rest.
+    unlink(index_path);
+    ctx = messages_context_open(path);
+    assert(ctx);
+    assert(messages_context_attach_search_step(ctx, index_path, 300) == MESSAGES_BUILD_MORE);
+    assert(messages_context_attach_search_step(ctx, index_path, 300) == MESSAGES_BUILD_MORE);
+    assert(search_messages(ctx, "pizza", hits, HITS) == -1);
+    messages_context_close(ctx);
+
+    ctx = messages_context_open(path);
+    assert(ctx);
+    int steps = 0;
+    MessagesBuildStatus status;
+    while ((status = messages_context_attach_search_step(ctx, index_path, 300)) == MESSAGES_BUILD_MORE) steps++;
+    assert(status == MESSAGES_BUILD_DONE);
+    sqlite3_stmt *rows;
+    assert(sqlite3_prepare_v2(writer, "SELECT COUNT(*) FROM message;", -1, &rows, NULL) == SQLITE_OK);
+    assert(sqlite3_step(rows) == SQLITE_ROW);
+    assert(steps == (sqlite3_column_int(rows, 0) - 600) / 300 && steps > 1);
+    sqlite3_finalize(rows);
+    check_all(ctx, writer);
+    messages_context_close(ctx);
+
+    /// The in-memory tail and the file agree, whatever side of a flush a row is on
+    char small_path[600];
+    snprintf(small_path, sizeof(small_path), "%s.small", path);
+    unlink(small_path);
+    MessageSearch *search = message_search_open(small_path, 42);
+    MessageSearchDoc doc = { .rowid = 1, .handle_id = 7, .date = 10 };
+    assert(message_search_add(search, &doc, "Hello World", 11));
+    assert(message_search_flush(search));
+    doc.rowid = 2;
+    assert(message_search_add(search, &doc, "hello there", 11));
+    doc.rowid = 2;
+    assert(message_search_add(search, &doc, "ignored, not above the watermark", 32));
+    doc.rowid = 3;
+    assert(message_search_add(search, &doc, "hi", 2));
+    assert(message_search_doc_count(search) == 2 && message_search_watermark(search) == 3);
+    message_search_close(search);
+
+    search = message_search_open(small_path, 42);
+    assert(message_search_doc_count(search) == 2 && message_search_watermark(search) == 3);
+    assert(message_search_matches("Say HELLO", 9, "hello", 5));
+    assert(!message_search_matches("hell", 4, "hello", 5));
+    message_search_close(search);
+
+    search = message_search_open(small_path, 43);
+    assert(message_search_doc_count(search) == 0 && message_search_watermark(search) == 0);
+    message_search_close(search);
+
+    sqlite3_close(writer);
+    unlink(small_path);
+    unlink(index_path);
+    unlink(path);
+    printf("search_test passed\n");
+    return 0;
+}
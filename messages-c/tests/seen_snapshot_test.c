@@ -0,0 +1,138 @@
+//
+//  seen_snapshot_test.c
+//  ComfyNotch
+//
+//  Checks a restart carries on from the saved seen set and watermark: what
+//  arrived while closed is reported once, nothing from before fires again,
+//  and a torn or foreign snapshot is ignored.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesContextInternal.h"
+#include "SeenSnapshot.h"
+#include "test_chat_db.h"
+
+static void check_large_snapshot(const char *path) {
+    SeenSnapshotWriter *writer = seen_snapshot_writer_create(100);
+    assert(writer);
+
+    /// Far past the size hint, the writer grows
+    char guid[64];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(guid, sizeof(guid), "p:0/%08X-0000-4000-8000-%012d", i, i);
+        assert(seen_snapshot_writer_add(writer, guid, strlen(guid), (MessageMeta){ .isFromMe = i % 3 == 0, .date = i }));
+    }
+    /// Adding a key again keeps the first value
+    snprintf(guid, sizeof(guid), "p:0/%08X-0000-4000-8000-%012d", 7, 7);
+    assert(seen_snapshot_writer_add(writer, guid, strlen(guid), (MessageMeta){ .date = -1 }));
+    assert(seen_snapshot_writer_finish(writer, path, 42, 12345));
+
+    assert(seen_snapshot_open(path, 43) == NULL);
+    SeenSnapshot *snapshot = seen_snapshot_open(path, 42);
+    assert(snapshot);
+    assert(seen_snapshot_count(snapshot) == 20000);
+    assert(seen_snapshot_watermark(snapshot) == 12345);
+    for (int i = 0; i < 20000; i++) {
+        snprintf(guid, sizeof(guid), "p:0/%08X-0000-4000-8000-%012d", i, i);
+        MessageMeta meta;
+        assert(seen_snapshot_get(snapshot, guid, &meta));
+        assert(meta.date == i && meta.isFromMe == (i % 3 == 0));
+    }
+    assert(!seen_snapshot_get(snapshot, "not-a-guid", NULL));
+    seen_snapshot_close(snapshot);
+
+    /// A flipped header byte and a truncated file are both refused
+    FILE *file = fopen(path, "r+b");
+    assert(file);
+    fseek(file, 24, SEEK_SET);
+    fputc(0x7f, file);
+    fclose(file);
+    assert(seen_snapshot_open(path, 42) == NULL);
+
+    assert(truncate(path, 64) == 0);
+    assert(seen_snapshot_open(path, 42) == NULL);
+    unlink(path);
+}
+
+int main(void) {
+    char path[512], snapshot_path[512];
+    test_chat_db_path(path, sizeof(path), "seen_snapshot.db");
+    test_chat_db_path(snapshot_path, sizeof(snapshot_path), "seen.snapshot");
+    unlink(snapshot_path);
+
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t handle = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    test_chat_db_add_message(writer, "OLD-1", handle, "from before the first launch", 1, false);
+
+    /// First launch: nothing to restore, existing history is not news
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    assert(!messages_context_restore_seen(ctx, snapshot_path));
+    assert(has_chat_db_changed(ctx) == 0);
+    int64_t first_watermark = get_messages_watermark(ctx);
+
+    test_chat_db_add_message(writer, "A-1", handle, "hi", 2, false);
+    test_chat_db_add_message(writer, "A-2", handle, "hey", 3, true);
+    test_chat_db_add_message(writer, "A-3", handle, "you there?", 4, false);
+    assert(has_chat_db_changed(ctx) == 2);
+    assert(messages_context_save_seen(ctx, snapshot_path));
+    messages_context_close(ctx);
+
+    /// While the app is closed
+    test_chat_db_add_message(writer, "B-1", handle, "missed this", 5, false);
+    test_chat_db_add_message(writer, "B-2", handle, "replied from the phone", 6, true);
+
+    ctx = messages_context_open(path);
+    assert(ctx);
+    assert(messages_context_restore_seen(ctx, snapshot_path));
+    assert(has_chat_db_changed(ctx) == 1);
+    assert(has_chat_db_changed(ctx) == 0);
+
+    /// Rows the last run already reported that are handed out again are still not news
+    set_messages_watermark(ctx, first_watermark);
+    assert(has_chat_db_changed(ctx) == 0);
+
+    /// Saving again keeps the restored GUIDs alongside the new ones
+    assert(messages_context_save_seen(ctx, snapshot_path));
+    SeenSnapshot *snapshot = seen_snapshot_open(snapshot_path, ctx->db_identity);
+    assert(snapshot);
+    assert(seen_snapshot_get(snapshot, "A-1", NULL) && seen_snapshot_get(snapshot, "B-2", NULL));
+    assert(seen_snapshot_watermark(snapshot) == get_messages_watermark(ctx));
+    seen_snapshot_close(snapshot);
+
+    /// A snapshot claiming rows chat.db doesn't have is from a replaced database
+    SeenSnapshotWriter *future = seen_snapshot_writer_create(0);
+    assert(seen_snapshot_writer_finish(future, snapshot_path, ctx->db_identity, 1000000));
+    int64_t before = get_messages_watermark(ctx);
+    assert(!messages_context_restore_seen(ctx, snapshot_path));
+    assert(get_messages_watermark(ctx) == before);
+    messages_context_close(ctx);
+
+    /// GUIDs that fell out of the seen window are not written
+    ctx = messages_context_open(path);
+    assert(ctx);
+    messages_context_set_seen_window(ctx, 60);
+    assert(has_chat_db_changed(ctx) == 0);
+    test_chat_db_add_message(writer, "E-1", handle, "an hour ago", 100, false);
+    test_chat_db_add_message(writer, "E-2", handle, "now", 100 + 3600, false);
+    assert(has_chat_db_changed(ctx) == 2);
+    assert(messages_context_save_seen(ctx, snapshot_path));
+    snapshot = seen_snapshot_open(snapshot_path, ctx->db_identity);
+    assert(snapshot);
+    assert(seen_snapshot_get(snapshot, "E-2", NULL) && !seen_snapshot_get(snapshot, "E-1", NULL));
+    assert(seen_snapshot_newest_date(snapshot) == 100 + 3600);
+    seen_snapshot_close(snapshot);
+    messages_context_close(ctx);
+
+    check_large_snapshot(snapshot_path);
+
+    sqlite3_close(writer);
+    unlink(path);
+    printf("seen_snapshot_test passed\n");
+    return 0;
+}
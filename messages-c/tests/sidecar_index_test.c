@@ -0,0 +1,179 @@
+//
+//  sidecar_index_test.c
+//  ComfyNotch
+//
+//  Checks every "latest message of a handle" lookup answers the same through
+//  the sidecar index as through SQL, while rows arrive, get deleted and the
+//  index is reopened from disk.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "SidecarIndex.h"
+#include "test_chat_db.h"
+
+#define HANDLES 4
+#define HISTORY 3000
+
+static int64_t expected_last_date(sqlite3 *db, int64_t handle_id) {
+    sqlite3_stmt *stmt;
+    assert(sqlite3_prepare_v2(db, "SELECT MAX(date) FROM message WHERE handle_id = ?;",
+                              -1, &stmt, NULL) == SQLITE_OK);
+    sqlite3_bind_int64(stmt, 1, handle_id);
+    assert(sqlite3_step(stmt) == SQLITE_ROW);
+    int64_t date = sqlite3_column_type(stmt, 0) == SQLITE_NULL ? -1 : sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return date;
+}
+
+static void check_handles(MessagesContext *ctx, sqlite3 *writer, const int64_t *handles, int count) {
+    MessagesHandleSummary summaries[HANDLES + 1];
+    assert(get_handle_summaries(ctx, handles, count, summaries, count) == count);
+
+    for (int i = 0; i < count; i++) {
+        int64_t expected = expected_last_date(writer, handles[i]);
+        assert(get_last_talked_to(ctx, handles[i]) == expected);
+        assert(summaries[i].handle_id == handles[i]);
+        assert(summaries[i].date == expected);
+        if (expected >= 0) assert(summaries[i].text && strncmp(summaries[i].text, "latest", 6) == 0);
+    }
+    free_handle_summaries(summaries, count);
+}
+
+static void add_message(sqlite3 *writer, int64_t handle, int64_t date, bool latest) {
+    static int serial;
+    char guid[64];
+    snprintf(guid, sizeof(guid), "S-%d", serial++);
+    test_chat_db_add_message(writer, guid, handle, latest ? "latest" : "older", date, false);
+}
+
+int main(void) {
+    char path[512];
+    char index_path[600];
+    test_chat_db_path(path, sizeof(path), "sidecar.db");
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    unlink(index_path);
+
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t handles[HANDLES + 1];
+    for (int i = 0; i < HANDLES; i++) {
+        char id[32];
+        snprintf(id, sizeof(id), "+1555000000%d", i);
+        handles[i] = test_chat_db_add_handle(writer, id, "iMessage");
+    }
+
+    /// Dates run backwards for part of the history so the newest ROWID of a
+    /// handle is not its newest date
+    for (int i = 0; i < HISTORY; i++) {
+        add_message(writer, handles[i % (HANDLES - 1)], i < HISTORY / 2 ? 100000 - i : i, false);
+    }
+    for (int i = 0; i < HANDLES - 1; i++) add_message(writer, handles[i], 200000 + i, true);
+    for (int i = 0; i < HANDLES - 1; i++) add_message(writer, handles[i], 150000, false);
+
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+    check_handles(ctx, writer, handles, HANDLES);
+
+    /// Built on attach, then the same answers come from the index
+    assert(messages_context_attach_index(ctx, index_path));
+    assert(access(index_path, F_OK) == 0);
+    check_handles(ctx, writer, handles, HANDLES);
+
+    /// More rows than the in-memory tail holds, so it gets merged into the file
+    for (int i = 0; i < 1500; i++) add_message(writer, handles[i % HANDLES], 300000 + i, i >= 1500 - HANDLES);
+    check_handles(ctx, writer, handles, HANDLES);
+
+    /// A handle the index has never seen, and one added after the build
+    handles[HANDLES] = test_chat_db_add_handle(writer, "+15559999999", "iMessage");
+    check_handles(ctx, writer, handles, HANDLES + 1);
+    add_message(writer, handles[HANDLES], 5, true);
+    check_handles(ctx, writer, handles, HANDLES + 1);
+
+    /// A deleted newest row falls back to the one before it
+    int64_t deleted = get_last_talked_to(ctx, handles[0]);
+    char sql[256];
+    snprintf(sql, sizeof(sql),
+             "DELETE FROM message WHERE handle_id = %lld AND date = %lld;"
+             "UPDATE message SET text = 'latest' WHERE ROWID = (SELECT ROWID FROM message "
+             "WHERE handle_id = %lld ORDER BY date DESC LIMIT 1);",
+             (long long)handles[0], (long long)deleted, (long long)handles[0]);
+    assert(sqlite3_exec(writer, sql, NULL, NULL, NULL) == SQLITE_OK);
+    check_handles(ctx, writer, handles, HANDLES + 1);
+    assert(get_last_talked_to(ctx, handles[0]) < deleted);
+
+    /// Every handle summarised through the handle table takes the same path
+    MessagesHandleSummary all[HANDLES + 1];
+    assert(get_handle_summaries(ctx, NULL, 0, all, HANDLES + 1) == HANDLES + 1);
+    for (int i = 0; i < HANDLES + 1; i++) {
+        assert(all[i].handle_id == handles[i]);
+        assert(all[i].date == expected_last_date(writer, handles[i]));
+    }
+    free_handle_summaries(all, HANDLES + 1);
+    messages_context_close(ctx);
+
+    /// Reopening maps the file as written and catches up from its watermark
+    ctx = messages_context_open(path);
+    assert(ctx);
+    assert(messages_context_attach_index(ctx, index_path));
+    check_handles(ctx, writer, handles, HANDLES);
+    messages_context_close(ctx);
+
+    /// Built a batch at a time, a row that lands between two steps is in too
+    unlink(index_path);
+    ctx = messages_context_open(path);
+    assert(ctx);
+    int steps = 0;
+    MessagesBuildStatus status;
+    while ((status = messages_context_attach_index_step(ctx, index_path, 1000)) == MESSAGES_BUILD_MORE) {
+        if (++steps == 2) add_message(writer, handles[1], 400000, true);
+    }
+    assert(status == MESSAGES_BUILD_DONE);
+    sqlite3_stmt *count;
+    assert(sqlite3_prepare_v2(writer, "SELECT COUNT(*) FROM message;", -1, &count, NULL) == SQLITE_OK);
+    assert(sqlite3_step(count) == SQLITE_ROW);
+    assert(steps == sqlite3_column_int(count, 0) / 1000 && steps > 1);
+    sqlite3_finalize(count);
+    check_handles(ctx, writer, handles, HANDLES + 1);
+    messages_context_close(ctx);
+
+    /// The file belongs to one chat.db, anything else starts empty
+    SidecarIndex *foreign = sidecar_index_open(index_path, 12345);
+    assert(foreign && sidecar_index_watermark(foreign) == 0 && sidecar_index_count(foreign) == 0);
+    sidecar_index_close(foreign);
+
+    /// Rows at or below the watermark are ignored, lookups stop at the handle boundary
+    SidecarIndex *index = sidecar_index_open(index_path, 777);
+    SidecarIndexEntry entries[] = {
+        { .handle_id = 2, .date = 10, .rowid = 3 },
+        { .handle_id = 1, .date = 20, .rowid = 1 },
+        { .handle_id = 1, .date = 20, .rowid = 2 },
+    };
+    assert(sidecar_index_rebuild(index, entries, 3, 3));
+    SidecarIndexEntry stale = { .handle_id = 3, .date = 1, .rowid = 3 };
+    assert(sidecar_index_add(index, &stale) && sidecar_index_count(index) == 3);
+
+    SidecarIndexEntry found;
+    assert(sidecar_index_before(index, 1, INT64_MAX, INT64_MAX, &found) && found.rowid == 2);
+    assert(sidecar_index_before(index, 1, 20, 2, &found) && found.rowid == 1);
+    assert(!sidecar_index_before(index, 1, 20, 1, &found));
+    assert(!sidecar_index_before(index, 3, INT64_MAX, INT64_MAX, &found));
+
+    SidecarIndexEntry fresh = { .handle_id = 1, .date = 30, .rowid = 4 };
+    assert(sidecar_index_add(index, &fresh) && sidecar_index_watermark(index) == 4);
+    assert(sidecar_index_before(index, 1, INT64_MAX, INT64_MAX, &found) && found.rowid == 4);
+    sidecar_index_close(index);
+
+    index = sidecar_index_open(index_path, 777);
+    assert(sidecar_index_count(index) == 4 && sidecar_index_watermark(index) == 4);
+    sidecar_index_close(index);
+
+    sqlite3_close(writer);
+    unlink(index_path);
+    unlink(path);
+    printf("sidecar_index_test passed\n");
+    return 0;
+}
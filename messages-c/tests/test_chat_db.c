@@ -0,0 +1,122 @@
+//
+//  test_chat_db.c
+//  ComfyNotch
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_chat_db.h"
+
+static const char *schema =
+"PRAGMA journal_mode=WAL;"
+"CREATE TABLE handle (ROWID INTEGER PRIMARY KEY AUTOINCREMENT UNIQUE, id TEXT NOT NULL, "
+"  country TEXT, service TEXT NOT NULL, uncanonicalized_id TEXT, person_centric_id TEXT, "
+"  UNIQUE (id, service));"
+"CREATE TABLE message (ROWID INTEGER PRIMARY KEY AUTOINCREMENT, guid TEXT UNIQUE NOT NULL, "
+"  text TEXT, handle_id INTEGER DEFAULT 0, service TEXT, date INTEGER, date_read INTEGER, "
+"  is_from_me INTEGER DEFAULT 0, is_read INTEGER DEFAULT 0, is_finished INTEGER DEFAULT 0, "
+"  cache_has_attachments INTEGER DEFAULT 0, attributedBody BLOB);"
+"CREATE TABLE attachment (ROWID INTEGER PRIMARY KEY AUTOINCREMENT, guid TEXT UNIQUE NOT NULL, "
+"  filename TEXT, mime_type TEXT, transfer_name TEXT, total_bytes INTEGER DEFAULT 0);"
+"CREATE TABLE message_attachment_join (message_id INTEGER REFERENCES message (ROWID) ON DELETE CASCADE, "
+"  attachment_id INTEGER REFERENCES attachment (ROWID) ON DELETE CASCADE, "
+"  UNIQUE(message_id, attachment_id));"
+"CREATE INDEX message_idx_handle ON message(handle_id, date);"
+"CREATE INDEX message_idx_is_read ON message(is_read, is_from_me, is_finished);"
+"CREATE INDEX message_attachment_join_idx_message_id ON message_attachment_join(message_id);";
+
+void test_chat_db_path(char *out, size_t capacity, const char *name) {
+    const char *tmp = getenv("TMPDIR");
+    snprintf(out, capacity, "%s/comfy-%d-%s", tmp && *tmp ? tmp : "/tmp", (int)getpid(), name);
+}
+
+sqlite3 *test_chat_db_create(const char *path) {
+    char side[1100];
+    unlink(path);
+    snprintf(side, sizeof(side), "%s-wal", path);
+    unlink(side);
+    snprintf(side, sizeof(side), "%s-shm", path);
+    unlink(side);
+    
+    sqlite3 *db = NULL;
+    if (sqlite3_open(path, &db) != SQLITE_OK) {
+        sqlite3_close(db);
+        return NULL;
+    }
+    
+    char *error = NULL;
+    if (sqlite3_exec(db, schema, NULL, NULL, &error) != SQLITE_OK) {
+        fprintf(stderr, "schema: %s\n", error);
+        sqlite3_free(error);
+        sqlite3_close(db);
+        return NULL;
+    }
+    return db;
+}
+
+int64_t test_chat_db_add_handle(sqlite3 *db, const char *id, const char *service) {
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, "INSERT INTO handle (id, service) VALUES (?, ?);", -1, &stmt, NULL);
+    sqlite3_bind_text(stmt, 1, id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, service, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? sqlite3_last_insert_rowid(db) : -1;
+}
+
+int64_t test_chat_db_add_message(sqlite3 *db, const char *guid, int64_t handle_id,
+                                 const char *text, int64_t date, bool is_from_me) {
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db,
+                       "INSERT INTO message (guid, text, handle_id, date, is_from_me, is_read) "
+                       "VALUES (?, ?, ?, ?, ?, ?);", -1, &stmt, NULL);
+    sqlite3_bind_text(stmt, 1, guid, -1, SQLITE_STATIC);
+    if (text) sqlite3_bind_text(stmt, 2, text, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, handle_id);
+    sqlite3_bind_int64(stmt, 4, date);
+    sqlite3_bind_int(stmt, 5, is_from_me);
+    sqlite3_bind_int(stmt, 6, is_from_me);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? sqlite3_last_insert_rowid(db) : -1;
+}
+
+bool test_chat_db_set_attributed_body(sqlite3 *db, int64_t rowid, const void *blob, int length) {
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db, "UPDATE message SET text = NULL, attributedBody = ? WHERE ROWID = ?;",
+                       -1, &stmt, NULL);
+    sqlite3_bind_blob(stmt, 1, blob, length, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, rowid);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE && sqlite3_changes(db) == 1;
+}
+
+int64_t test_chat_db_add_attachment(sqlite3 *db, int64_t message_id, const char *guid,
+                                    const char *filename, const char *mime_type,
+                                    const char *transfer_name, int64_t total_bytes) {
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(db,
+                       "INSERT INTO attachment (guid, filename, mime_type, transfer_name, total_bytes) "
+                       "VALUES (?, ?, ?, ?, ?);", -1, &stmt, NULL);
+    sqlite3_bind_text(stmt, 1, guid, -1, SQLITE_STATIC);
+    if (filename) sqlite3_bind_text(stmt, 2, filename, -1, SQLITE_STATIC);
+    if (mime_type) sqlite3_bind_text(stmt, 3, mime_type, -1, SQLITE_STATIC);
+    if (transfer_name) sqlite3_bind_text(stmt, 4, transfer_name, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 5, total_bytes);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) return -1;
+    
+    int64_t attachment_id = sqlite3_last_insert_rowid(db);
+    sqlite3_prepare_v2(db,
+                       "INSERT INTO message_attachment_join (message_id, attachment_id) VALUES (?, ?);",
+                       -1, &stmt, NULL);
+    sqlite3_bind_int64(stmt, 1, message_id);
+    sqlite3_bind_int64(stmt, 2, attachment_id);
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? attachment_id : -1;
+}
@@ -0,0 +1,36 @@
+//
+//  test_chat_db.h
+//  ComfyNotch
+//
+//  Scratch chat.db files for the Messages C tests. Only the tables and
+//  indexes the Messages layer reads are created, with the same names and
+//  column order Apple uses.
+//
+
+#ifndef test_chat_db_h
+#define test_chat_db_h
+
+#include <sqlite3.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Creates an empty WAL mode chat.db at `path` (removing any old one) and
+/// returns a writable connection to it, the caller closes it
+sqlite3 *test_chat_db_create(const char *path);
+
+int64_t test_chat_db_add_handle(sqlite3 *db, const char *id, const char *service);
+int64_t test_chat_db_add_message(sqlite3 *db, const char *guid, int64_t handle_id,
+                                 const char *text, int64_t date, bool is_from_me);
+
+/// Turns a message into the modern shape: no `text`, only an attributedBody blob
+bool test_chat_db_set_attributed_body(sqlite3 *db, int64_t rowid, const void *blob, int length);
+
+/// Adds an attachment row and joins it to `message_id`, returns the attachment ROWID
+int64_t test_chat_db_add_attachment(sqlite3 *db, int64_t message_id, const char *guid,
+                                    const char *filename, const char *mime_type,
+                                    const char *transfer_name, int64_t total_bytes);
+
+/// Fills `out` with a unique per-process scratch path ending in `name`
+void test_chat_db_path(char *out, size_t capacity, const char *name);
+
+#endif
@@ -0,0 +1,171 @@
+//
+//  unread_counters_test.c
+//  ComfyNotch
+//
+//  Checks the counters against a plain array through random adds, removes and
+//  sweeps, then that a context's counts follow new rows, messages being read,
+//  marked unread again and deleted, without a COUNT(*) anywhere.
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Messages.h"
+#include "MessagesContextInternal.h"
+#include "UnreadCounters.h"
+#include "test_chat_db.h"
+
+#define ROWIDS  4096
+#define HANDLES 37
+
+/// Which handle each ROWID is counted against, -1 when it is not
+static int64_t expected_handle[ROWIDS];
+
+static int64_t expected_count(int64_t handle_id) {
+    int64_t count = 0;
+    for (int i = 0; i < ROWIDS; i++) count += expected_handle[i] == handle_id;
+    return count;
+}
+
+static void check_against_reference(const UnreadCounters *counters) {
+    size_t total = 0, handles = 0;
+    for (int64_t h = 0; h < HANDLES; h++) {
+        int64_t count = expected_count(h);
+        assert(unread_counters_get(counters, h) == count);
+        total += (size_t)count;
+        handles += count > 0;
+    }
+    assert(unread_counters_total(counters) == total);
+    assert(unread_counters_handles(counters) == handles);
+}
+
+static void sum_visit(int64_t handle_id, int64_t unread, void *userdata) {
+    assert(unread > 0 && unread == expected_count(handle_id));
+    *(int64_t *)userdata += unread;
+}
+
+static void check_randomized(void) {
+    UnreadCounters *counters = unread_counters_create();
+    assert(counters);
+    for (int i = 0; i < ROWIDS; i++) expected_handle[i] = -1;
+
+    srand(7);
+    for (int round = 0; round < 40; round++) {
+        for (int op = 0; op < 2000; op++) {
+            int rowid = rand() % ROWIDS;
+            if (rand() % 3) {
+                int64_t handle = rand() % HANDLES;
+                assert(unread_counters_add(counters, rowid, handle));
+                /// Counted once, against the handle it was first added for
+                if (expected_handle[rowid] < 0) expected_handle[rowid] = handle;
+            } else {
+                assert(unread_counters_remove(counters, rowid) == (expected_handle[rowid] >= 0));
+                expected_handle[rowid] = -1;
+            }
+        }
+        check_against_reference(counters);
+
+        /// A sweep that sees every other counted ROWID drops the rest
+        unread_counters_begin_sweep(counters);
+        size_t dropped = 0;
+        for (int i = 0; i < ROWIDS; i++) {
+            if (expected_handle[i] < 0) continue;
+            if (i % 2 == round % 2) {
+                assert(unread_counters_add(counters, i, expected_handle[i]));
+            } else {
+                expected_handle[i] = -1;
+                dropped++;
+            }
+        }
+        assert(unread_counters_end_sweep(counters) == dropped);
+        check_against_reference(counters);
+    }
+
+    int64_t sum = 0;
+    unread_counters_each(counters, sum_visit, &sum);
+    assert((size_t)sum == unread_counters_total(counters));
+    unread_counters_destroy(counters);
+}
+
+static int64_t find_count(const MessagesUnreadCount *counts, int count, int64_t handle_id) {
+    for (int i = 0; i < count; i++) {
+        if (counts[i].handle_id == handle_id) return counts[i].unread;
+    }
+    return 0;
+}
+
+static void exec(sqlite3 *db, const char *sql) {
+    assert(sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK);
+}
+
+int main(void) {
+    check_randomized();
+
+    char path[512];
+    test_chat_db_path(path, sizeof(path), "unread.db");
+
+    sqlite3 *writer = test_chat_db_create(path);
+    assert(writer);
+    int64_t alice = test_chat_db_add_handle(writer, "+15550000001", "iMessage");
+    int64_t bob = test_chat_db_add_handle(writer, "+15550000002", "iMessage");
+    int64_t a1 = test_chat_db_add_message(writer, "A-1", alice, "hi", 1, false);
+    test_chat_db_add_message(writer, "A-2", alice, "you there?", 2, false);
+    test_chat_db_add_message(writer, "A-3", alice, "mine, never unread", 3, true);
+    test_chat_db_add_message(writer, "B-1", bob, "yo", 4, false);
+    exec(writer, "UPDATE message SET is_read = 1 WHERE guid = 'B-1';");
+
+    MessagesContext *ctx = messages_context_open(path);
+    assert(ctx);
+
+    /// Seeded by the first call
+    MessagesUnreadCount counts[8];
+    assert(get_unread_counts(ctx, counts, 8) == 1);
+    assert(find_count(counts, 1, alice) == 2);
+    assert(get_unread_count(ctx, bob) == 0);
+    assert(get_unread_counts(ctx, NULL, 0) == 1);
+
+    /// New rows are counted by the delta scan
+    test_chat_db_add_message(writer, "B-2", bob, "lunch?", 5, false);
+    test_chat_db_add_message(writer, "B-3", bob, "sent from my phone", 6, true);
+    assert(has_chat_db_changed(ctx) == 1);
+    assert(get_unread_count(ctx, bob) == 1);
+
+    /// Reading a conversation elsewhere only flips is_read
+    char sql[128];
+    snprintf(sql, sizeof(sql), "UPDATE message SET is_read = 1 WHERE handle_id = %lld;", (long long)alice);
+    exec(writer, sql);
+    assert(has_chat_db_changed(ctx) == 0);
+    assert(get_unread_count(ctx, alice) == 0);
+    assert(get_unread_counts(ctx, counts, 8) == 1 && counts[0].handle_id == bob);
+
+    /// Marked unread again, and a deleted unread message
+    snprintf(sql, sizeof(sql), "UPDATE message SET is_read = 0 WHERE ROWID = %lld;", (long long)a1);
+    exec(writer, sql);
+    exec(writer, "DELETE FROM message WHERE guid = 'B-2';");
+    assert(has_chat_db_changed(ctx) == 0);
+    assert(get_unread_count(ctx, alice) == 1);
+    assert(get_unread_count(ctx, bob) == 0);
+
+    /// Nothing committed since, the sweep is skipped
+    MessagesMetricsSnapshot snapshot;
+    assert(messages_context_metrics(ctx, &snapshot, true));
+    assert(has_chat_db_changed(ctx) == 0);
+    assert(messages_context_metrics(ctx, &snapshot, false));
+    assert(snapshot.statements[MESSAGES_STMT_UNREAD].executions == 0);
+    assert(snapshot.statements[MESSAGES_STMT_DATA_VERSION].executions == 1);
+    assert(snapshot.unread_messages == 1);
+
+    /// Reading the counts never goes back to SQLite
+    for (int i = 0; i < 100; i++) assert(get_unread_counts(ctx, counts, 8) == 1);
+    assert(messages_context_metrics(ctx, &snapshot, false));
+    assert(snapshot.operations[MESSAGES_OP_UNREAD_COUNTS].count == 100);
+    assert(snapshot.statements[MESSAGES_STMT_DATA_VERSION].executions == 1);
+
+    messages_context_close(ctx);
+    sqlite3_close(writer);
+    unlink(path);
+    printf("unread_counters_test passed\n");
+    return 0;
+}